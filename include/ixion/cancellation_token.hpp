@@ -0,0 +1,79 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_CANCELLATION_TOKEN_HPP
+#define INCLUDED_IXION_CANCELLATION_TOKEN_HPP
+
+#include "env.hpp"
+
+#include <chrono>
+#include <memory>
+
+namespace ixion {
+
+/**
+ * Token used to interrupt a running calculation, either on request or once
+ * a deadline passes.  The calculation checks the token between formula
+ * cells, so a cell that has already started its interpretation always runs
+ * to completion.
+ *
+ * All methods of this class are safe to call concurrently, which means
+ * that a calculation running on one thread can be cancelled from another.
+ */
+class IXION_DLLPUBLIC cancellation_token
+{
+    struct impl;
+    std::unique_ptr<impl> mp_impl;
+
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    cancellation_token();
+    cancellation_token(const cancellation_token&) = delete;
+    cancellation_token& operator= (const cancellation_token&) = delete;
+    ~cancellation_token();
+
+    /**
+     * Request cancellation of the calculation that uses this token.
+     */
+    void cancel();
+
+    /**
+     * Set a point in time past which the calculation that uses this token
+     * is to be considered cancelled.
+     *
+     * @param deadline deadline of the calculation.
+     */
+    void set_deadline(clock_type::time_point deadline);
+
+    /**
+     * Set a deadline relative to the current time.
+     *
+     * @param timeout maximum duration of the calculation from now.
+     */
+    void set_timeout(clock_type::duration timeout);
+
+    /**
+     * Check whether the cancellation has been requested, or the deadline
+     * has passed.
+     *
+     * @return true if the calculation should stop, false otherwise.
+     */
+    bool is_cancelled() const;
+
+    /**
+     * Clear the cancellation request and the deadline, so that the token
+     * can be used for another calculation.
+     */
+    void reset();
+};
+
+}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
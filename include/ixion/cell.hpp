@@ -60,11 +60,29 @@ public:
      */
     void check_circular(const model_context& cxt, const abs_address_t& pos);
 
+    /**
+     * Set the outcome of a circular reference check performed externally.
+     * When the cell is not circular-safe, i.e. it is either on a circular
+     * reference path or depends on a cell that is, it gets an error result
+     * assigned prior to its interpretation.
+     *
+     * @param safe true if the cell has no circular dependency, false
+     *             otherwise.
+     */
+    void set_circular_safe(bool safe);
+
     /**
      * Reset cell's internal state.
      */
     void reset();
 
+    /**
+     * Mark the cell as left uncalculated by a cancelled calculation, unless
+     * its result is already available.  The cell stays without a result,
+     * and any threads waiting for its result get woken up.
+     */
+    void cancel_calc();
+
     /**
      * Get a series of all reference tokens included in the formula
      * expression stored in this cell.
@@ -110,6 +128,16 @@ public:
      */
     void set_result_cache(formula_result result);
 
+    /**
+     * Set a cached result without pre-processing.  For a grouped formula
+     * cell, the result is expected to store the results of all cells in the
+     * group.  Unlike set_result_cache(), the new result replaces any
+     * existing result as a whole.
+     *
+     * @param result cached result.
+     */
+    void set_raw_result_cache(formula_result result);
+
     formula_group_t get_group_properties() const;
 
     /**
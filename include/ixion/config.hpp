@@ -39,6 +39,31 @@ struct IXION_DLLPUBLIC config
      */
     int8_t output_precision;
 
+    /**
+     * Maximum number of iterations to perform when calculating the formula
+     * cells on circular reference paths.  A value of 0 disables iterative
+     * calculation, in which case those cells get a reference error instead.
+     * By default it's 0.
+     */
+    uint16_t max_iterations;
+
+    /**
+     * Maximum change in the numeric result of any cell between two
+     * consecutive iterations, below which the results of the cells on a
+     * circular reference path are considered converged.  By default it's
+     * 0.001.
+     */
+    double iteration_epsilon;
+
+    /**
+     * Whether to keep an index of the numeric values of each column that
+     * gets aggregated, so that SUM, COUNT, AVERAGE, MIN and MAX over a range
+     * within a single column can get their results without walking the
+     * range.  The index of a column gets built on first use, and updated
+     * when the column changes.  By default it's false.
+     */
+    bool aggregate_index;
+
     config();
     config(const config& r);
 };
@@ -77,6 +77,20 @@ public:
 
     abs_range_set_t query_dirty_cells(const abs_range_t& modified_cell) const;
 
+    /**
+     * Get all formula cells that directly depend on the specified cell
+     * range.  Unlike query_dirty_cells(), this method does not follow the
+     * chain of dependencies beyond the first level.  The returned ranges
+     * are the same precedent-dependent relations that
+     * query_and_sort_dirty_cells() uses to sort the dirty cells.
+     *
+     * @param range cell range whose direct dependents are to be queried.
+     *
+     * @return collection of formula cell ranges that directly depend on the
+     *         specified range.
+     */
+    abs_range_set_t query_dependents(const abs_range_t& range) const;
+
     abs_range_set_t query_dirty_cells(const abs_range_set_t& modified_cells) const;
 
     std::vector<abs_range_t> query_and_sort_dirty_cells(const abs_range_t& modified_cell) const;
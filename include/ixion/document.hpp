@@ -11,14 +11,91 @@
 #include "types.hpp"
 #include "address.hpp"
 
+#include <chrono>
+#include <functional>
 #include <memory>
 #include <string>
 #include <string_view>
 #include <variant>
+#include <vector>
 
 namespace ixion {
 
+class cancellation_token;
 class cell_access;
+class document;
+
+/**
+ * Handle to a calculation running in the background, returned from
+ * document::calculate_async().
+ *
+ * While the calculation is running, the document must not be modified,
+ * and no other calculation may be started on it.  The results of the cells
+ * may be read from any thread, however.  Reading the result of a cell that
+ * has not yet been calculated blocks until the cell gets calculated, or
+ * until the calculation gets cancelled, in which case the cell has no
+ * result.  The only exception is a cell on a circular reference path when
+ * iterative calculation is enabled, since its result gets updated with
+ * each iteration.  Such a cell may be read only after it gets reported as
+ * calculated.
+ *
+ * The destructor blocks until the calculation finishes.
+ */
+class IXION_DLLPUBLIC calculation_handle
+{
+    friend class document;
+
+    struct impl;
+    std::unique_ptr<impl> mp_impl;
+
+    calculation_handle(std::unique_ptr<impl> p);
+
+public:
+    calculation_handle(const calculation_handle&) = delete;
+    calculation_handle& operator= (const calculation_handle&) = delete;
+
+    calculation_handle(calculation_handle&& other);
+    calculation_handle& operator= (calculation_handle&& other);
+    ~calculation_handle();
+
+    /**
+     * @return true if the calculation has finished, either by calculating
+     *         all the cells or by getting cancelled, false otherwise.
+     */
+    bool is_done() const;
+
+    /**
+     * Block until the calculation finishes.
+     */
+    void wait() const;
+
+    /**
+     * Block until either the calculation finishes or the timeout expires.
+     *
+     * @param timeout maximum duration to block for.
+     *
+     * @return true if the calculation has finished, false otherwise.
+     */
+    bool wait_for(std::chrono::milliseconds timeout) const;
+
+    /**
+     * Request cancellation of the calculation.  This does not block.  The
+     * cells left uncalculated have no results, and stay queued for
+     * recalculation so that the next calculation of the document resumes
+     * from them.
+     */
+    void cancel();
+
+    /**
+     * Block until the calculation finishes, and get its outcome.  Any
+     * exception thrown during the calculation gets re-thrown from this
+     * method.
+     *
+     * @return true if all the dirty formula cells have been calculated,
+     *         false if the calculation has been cancelled.
+     */
+    bool get() const;
+};
 
 /**
  * Higher level document representation designed to handle both cell value
@@ -40,6 +117,13 @@ public:
     document(formula_name_resolver_t cell_address_type);
     ~document();
 
+    /**
+     * Type of the callback that receives the cells in batches as they get
+     * calculated.  For a grouped formula cell, the range of the whole group
+     * gets reported.
+     */
+    using calc_callback_type = std::function<void(const std::vector<abs_range_t>&)>;
+
     struct IXION_DLLPUBLIC cell_pos
     {
         enum class cp_type { string, address };
@@ -90,6 +174,77 @@ public:
      *                     When 0 is specified, it only uses the main thread.
      */
     void calculate(size_t thread_count);
+
+    /**
+     * Calculate all the "dirty" formula cells in the document, until either
+     * all of them are calculated or the calculation gets cancelled via the
+     * token.  The cells left uncalculated have no results, and stay queued
+     * for recalculation so that the next call to calculate() resumes the calculation from them without
+     * recalculating any of the cells calculated so far.
+     *
+     * @param thread_count number of threads to use to perform calculation.
+     *                     When 0 is specified, it only uses the main thread.
+     * @param token token to check for cancellation and deadline.
+     *
+     * @return true if all the dirty formula cells have been calculated,
+     *         false if the calculation has been cancelled.
+     */
+    bool calculate(size_t thread_count, const cancellation_token& token);
+
+    /**
+     * Start calculating all the "dirty" formula cells in the document in the
+     * background, and return without waiting for the calculation to finish.
+     * Refer to calculation_handle for what can be done with the document
+     * while the calculation is running.
+     *
+     * @param thread_count number of threads to use to perform calculation.
+     *                     When 0 is specified, it uses a single background
+     *                     thread.
+     * @param callback optional callback to receive the cells in batches as
+     *                 they get calculated.  It gets called from the
+     *                 calculation threads, but never concurrently.  The
+     *                 results of the reported cells can be read from within
+     *                 the callback.
+     * @param batch_size number of calculated cells to collect before passing
+     *                   them to the callback.  The last batch may be
+     *                   smaller.
+     *
+     * @return handle to the calculation.
+     */
+    calculation_handle calculate_async(
+        size_t thread_count, calc_callback_type callback = calc_callback_type(),
+        size_t batch_size = 64);
+
+    /**
+     * Calculate only those "dirty" formula cells needed to obtain the
+     * results of the specified cells, i.e. the specified cells themselves
+     * and the dirty formula cells they depend on either directly or
+     * indirectly.  All the other dirty formula cells remain dirty until
+     * the next call to calculate().
+     *
+     * @param cells positions of the cells whose results are needed.
+     * @param thread_count number of threads to use to perform calculation.
+     *                     When 0 is specified, it only uses the main thread.
+     */
+    void calculate_cells(const std::vector<cell_pos>& cells, size_t thread_count);
+
+    /**
+     * Calculate only those "dirty" formula cells needed to obtain the
+     * results of the specified cells, until either all of them are
+     * calculated or the calculation gets cancelled via the token.  The
+     * cells left uncalculated have no results, and stay queued for
+     * recalculation.
+     *
+     * @param cells positions of the cells whose results are needed.
+     * @param thread_count number of threads to use to perform calculation.
+     *                     When 0 is specified, it only uses the main thread.
+     * @param token token to check for cancellation and deadline.
+     *
+     * @return true if all the needed cells have been calculated, false if
+     *         the calculation has been cancelled.
+     */
+    bool calculate_cells(
+        const std::vector<cell_pos>& cells, size_t thread_count, const cancellation_token& token);
 };
 
 }
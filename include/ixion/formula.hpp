@@ -16,6 +16,7 @@
 
 namespace ixion {
 
+class cancellation_token;
 class formula_cell;
 class formula_name_resolver;
 class model_context;
@@ -191,6 +192,31 @@ IXION_DLLPUBLIC std::vector<abs_range_t> query_and_sort_dirty_cells(
     model_context& cxt, const abs_range_set_t& modified_cells,
     const abs_range_set_t* dirty_formula_cells = nullptr);
 
+/**
+ * Extract from a sequence of dirty formula cells only those cells that need
+ * to be calculated in order to obtain the results of the specified target
+ * cells.  They consist of the target cells themselves, and all the formula
+ * cells in the sequence that the target cells depend on either directly or
+ * indirectly.  Calculating only the extracted cells does not require
+ * calculating any of the cells that remain in the sequence.
+ *
+ * @param cxt model context.
+ * @param formula_cells sorted sequence of dirty formula cells, typically
+ *                      the returned value from query_and_sort_dirty_cells.
+ *                      The extracted cells get removed from this sequence,
+ *                      and the remaining cells stay in their original
+ *                      order.
+ * @param target_cells positions of the cells whose results are needed.
+ *                     Positions not found in the dirty sequence are
+ *                     ignored.
+ *
+ * @return sequence of the extracted cells in their original order, to be
+ *         passed to calculate_sorted_cells.
+ */
+IXION_DLLPUBLIC std::vector<abs_range_t> extract_dirty_precedent_cells(
+    model_context& cxt, std::vector<abs_range_t>& formula_cells,
+    const abs_address_set_t& target_cells);
+
 /**
  * Calculate all specified formula cells in the order they occur in the
  * sequence.
@@ -210,6 +236,37 @@ IXION_DLLPUBLIC std::vector<abs_range_t> query_and_sort_dirty_cells(
 void IXION_DLLPUBLIC calculate_sorted_cells(
     model_context& cxt, const std::vector<abs_range_t>& formula_cells, size_t thread_count);
 
+/**
+ * Calculate all specified formula cells in the order they occur in the
+ * sequence, until either all of them are calculated or the calculation
+ * gets cancelled via the token.
+ *
+ * The calculation checks the token before each cell, and stops as soon as
+ * it finds it cancelled.  All the cells left uncalculated are put in the
+ * cancelled state, in which they have no result and querying their results
+ * throws an exception.  They stay in that state until the next calculation
+ * that includes them resets them.  Since none of the calculated cells
+ * depends on any of the uncalculated ones, passing the returned sequence
+ * to this function again resumes the calculation without recalculating
+ * any of the cells calculated so far.
+ *
+ * @param cxt model context.
+ * @param formula_cells formula cells to be calculated.  The cells will be
+ *                      calculated in the order they appear in the sequence.
+ *                      In a typical use case, this will be the returned
+ *                      value from query_and_sort_dirty_cells.
+ * @param thread_count number of calculation threads to use.  Refer to the
+ *                     other overload of this function for details.
+ * @param token token to check for cancellation and deadline.
+ *
+ * @return sequence of the cells left uncalculated, in the order they occur
+ *         in the original sequence.  It is empty when all cells have been
+ *         calculated.
+ */
+IXION_DLLPUBLIC std::vector<abs_range_t> calculate_sorted_cells(
+    model_context& cxt, const std::vector<abs_range_t>& formula_cells, size_t thread_count,
+    const cancellation_token& token);
+
 } // namespace ixion
 
 #endif
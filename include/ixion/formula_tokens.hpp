@@ -152,6 +152,9 @@ struct IXION_DLLPUBLIC formula_token final
     bool operator!= (const formula_token& r) const;
 };
 
+class formula_interpreter;
+class formula_program_cache;
+
 /**
  * Storage for a series of formula tokens.
  */
@@ -159,6 +162,7 @@ class IXION_DLLPUBLIC formula_tokens_store
 {
     friend void intrusive_ptr_add_ref(formula_tokens_store*);
     friend void intrusive_ptr_release(formula_tokens_store*);
+    friend class formula_interpreter;
 
     struct impl;
     std::unique_ptr<impl> mp_impl;
@@ -166,6 +170,14 @@ class IXION_DLLPUBLIC formula_tokens_store
     void add_ref();
     void release_ref();
 
+    /**
+     * Get the programs compiled from the stored tokens.  The tokens get
+     * compiled on first use, and the programs are shared by all formula
+     * cells that share this store.  Accessing the tokens for modification
+     * discards the programs.
+     */
+    formula_program_cache& get_program_cache() const;
+
     formula_tokens_store();
 
 public:
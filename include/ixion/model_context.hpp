@@ -21,6 +21,7 @@ namespace ixion {
 class cell_access;
 class dirty_cell_tracker;
 class formula_cell;
+class formula_cell_queue;
 class formula_name_resolver;
 class formula_result;
 class matrix;
@@ -54,6 +55,13 @@ class IXION_DLLPUBLIC model_context final
 {
     friend class named_expressions_iterator;
     friend class cell_access;
+    friend class component_iteration;
+    friend class formula_cell_queue;
+    friend class formula_cell;
+    friend class formula_functions;
+    friend class formula_group_evaluator;
+    friend class formula_interpreter;
+    friend class pooled_interpreter;
 
     std::unique_ptr<detail::model_context_impl> mp_impl;
 
@@ -410,8 +418,26 @@ public:
      */
     void set_cell_values(sheet_t sheet, std::initializer_list<input_row> rows);
 
+    /**
+     * Set the factory that creates a session handler for each formula cell
+     * being interpreted.  The model context does not take ownership of the
+     * factory.
+     *
+     * @param factory pointer to the factory, or nullptr to remove the
+     *                current one, in which case no session handler gets
+     *                created.
+     */
     void set_session_handler_factory(session_handler_factory* factory);
 
+    /**
+     * Set the handler that provides the ranges of the table references.
+     * The model context does not take ownership of the handler.  The
+     * ranges of the references to named tables get cached, so notify
+     * formula_event_t::table_definitions_changed whenever the tables
+     * provided by the handler change.
+     *
+     * @param handler pointer to the table handler.
+     */
     void set_table_handler(iface::table_handler* handler);
 
     size_t get_string_count() const;
@@ -224,6 +224,12 @@ enum class formula_event_t
     calculation_begins,
     /** End of the calculations of formula cells. */
     calculation_ends,
+    /**
+     * Change of the table definitions provided by the table handler.  The
+     * ranges of the references to named tables get resolved once, and are
+     * reused until this event is notified.
+     */
+    table_definitions_changed,
 };
 
 /**
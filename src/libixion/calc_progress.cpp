@@ -0,0 +1,63 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "calc_progress.hpp"
+
+#include <algorithm>
+
+namespace ixion {
+
+calc_progress::calc_progress(
+    const std::vector<abs_range_t>& cells, callback_type callback, size_t batch_size) :
+    m_cells(cells),
+    m_callback(std::move(callback)),
+    m_batch_size(std::max<size_t>(batch_size, 1))
+{
+    m_batch.reserve(m_batch_size);
+}
+
+void calc_progress::flush_if_full()
+{
+    if (m_batch.size() < m_batch_size)
+        return;
+
+    m_callback(m_batch);
+    m_batch.clear();
+}
+
+void calc_progress::report(size_t i)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_batch.push_back(m_cells[i]);
+    flush_if_full();
+}
+
+void calc_progress::report(const std::vector<size_t>& indices)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+
+    for (size_t i : indices)
+    {
+        m_batch.push_back(m_cells[i]);
+        flush_if_full();
+    }
+}
+
+void calc_progress::flush()
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+
+    if (m_batch.empty())
+        return;
+
+    m_callback(m_batch);
+    m_batch.clear();
+}
+
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,79 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_CALC_PROGRESS_HPP
+#define INCLUDED_IXION_CALC_PROGRESS_HPP
+
+#include <ixion/address.hpp>
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace ixion {
+
+/**
+ * Collects the formula cells as they get calculated, and passes them to a
+ * callback in batches.  The cells may get reported from multiple threads
+ * concurrently, but the callback never gets called concurrently.
+ */
+class calc_progress
+{
+public:
+    using callback_type = std::function<void(const std::vector<abs_range_t>&)>;
+
+private:
+    const std::vector<abs_range_t>& m_cells;
+    callback_type m_callback;
+    size_t m_batch_size;
+
+    std::mutex m_mtx;
+    std::vector<abs_range_t> m_batch;
+
+    void flush_if_full();
+
+public:
+    calc_progress() = delete;
+    calc_progress(const calc_progress&) = delete;
+    calc_progress& operator= (const calc_progress&) = delete;
+
+    /**
+     * Constructor.
+     *
+     * @param cells cells being calculated.  The reported indices refer to
+     *              the positions of the cells in this array.
+     * @param callback callback to pass the calculated cells to.
+     * @param batch_size number of calculated cells to collect before
+     *                   passing them to the callback.
+     */
+    calc_progress(const std::vector<abs_range_t>& cells, callback_type callback, size_t batch_size);
+
+    /**
+     * Report a cell as calculated.
+     *
+     * @param i index of the cell.
+     */
+    void report(size_t i);
+
+    /**
+     * Report multiple cells as calculated.
+     *
+     * @param indices indices of the cells.
+     */
+    void report(const std::vector<size_t>& indices);
+
+    /**
+     * Pass the cells collected so far to the callback, if any.
+     */
+    void flush();
+};
+
+}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -7,23 +7,143 @@
 
 #include "calc_status.hpp"
 
+#include <condition_variable>
+#include <cassert>
+#include <functional>
+
 namespace ixion {
 
-calc_status::calc_status() : result(nullptr), circular_safe(false), refcount(0) {}
+namespace {
+
+/**
+ * Lock and condition variable pair on which the threads waiting for the
+ * results of the calc status instances get parked.  Each slot is shared by
+ * all instances that hash to it.
+ */
+struct parking_slot
+{
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::atomic<size_t> waiters{0};
+
+    /** mutex to serialize in-place updates of the results. */
+    std::mutex data_mtx;
+};
+
+constexpr size_t parking_slot_count = 64;
+
+parking_slot& get_parking_slot(const calc_status* p)
+{
+    static parking_slot slots[parking_slot_count];
+    size_t pos = std::hash<const calc_status*>{}(p) / alignof(calc_status);
+    return slots[pos % parking_slot_count];
+}
+
+/**
+ * Wake up the threads waiting for the result of a calc status instance, if
+ * any.  The state of the instance must have been updated with sequentially
+ * consistent ordering.
+ */
+void notify_waiters(const calc_status* p)
+{
+    parking_slot& slot = get_parking_slot(p);
+    if (!slot.waiters.load(std::memory_order_seq_cst))
+        return;
+
+    {
+        // Acquire the lock to make sure that no waiter is in between its
+        // state check and its wait.
+        std::lock_guard<std::mutex> lock(slot.mtx);
+    }
+
+    slot.cond.notify_all();
+}
+
+}
+
+calc_status::calc_status() :
+    result(nullptr), circular_safe(false), state(calc_state_t::dirty), refcount(0) {}
 calc_status::calc_status(const rc_size_t& _group_size) :
-    result(nullptr), group_size(_group_size), circular_safe(false), refcount(0) {}
+    result(nullptr), group_size(_group_size), circular_safe(false), state(calc_state_t::dirty), refcount(0) {}
 
 void calc_status::add_ref()
 {
-    ++refcount;
+    refcount.fetch_add(1, std::memory_order_relaxed);
 }
 
 void calc_status::release_ref()
 {
-    if (--refcount == 0)
+    if (refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
         delete this;
 }
 
+bool calc_status::begin_calc()
+{
+    calc_state_t expected = calc_state_t::dirty;
+    return state.compare_exchange_strong(expected, calc_state_t::in_progress, std::memory_order_acq_rel);
+}
+
+void calc_status::set_result(std::unique_ptr<formula_result> res, calc_state_t st)
+{
+    assert(st == calc_state_t::done || st == calc_state_t::error);
+
+    result = std::move(res);
+
+    // Both this store and the load of the waiter count below must be
+    // sequentially consistent, so that either this thread sees the waiter,
+    // or the waiter sees the new state.
+    state.store(st, std::memory_order_seq_cst);
+    notify_waiters(this);
+}
+
+void calc_status::cancel()
+{
+    calc_state_t st = state.load(std::memory_order_acquire);
+
+    do
+    {
+        if (st == calc_state_t::done || st == calc_state_t::error || st == calc_state_t::cancelled)
+            return;
+    }
+    while (!state.compare_exchange_weak(st, calc_state_t::cancelled, std::memory_order_seq_cst));
+
+    notify_waiters(this);
+}
+
+void calc_status::wait_for_result() const
+{
+    if (has_result() || get_state() == calc_state_t::cancelled)
+        return;
+
+    parking_slot& slot = get_parking_slot(this);
+    std::unique_lock<std::mutex> lock(slot.mtx);
+    slot.waiters.fetch_add(1, std::memory_order_seq_cst);
+
+    // This load must also be sequentially consistent.  See set_result().
+    auto done = [this]()
+    {
+        calc_state_t st = state.load(std::memory_order_seq_cst);
+        return st == calc_state_t::done || st == calc_state_t::error || st == calc_state_t::cancelled;
+    };
+
+    while (!done())
+        slot.cond.wait(lock);
+
+    slot.waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void calc_status::reset()
+{
+    state.store(calc_state_t::dirty, std::memory_order_relaxed);
+    result.reset();
+    circular_safe = false;
+}
+
+std::mutex& calc_status::get_mutex() const
+{
+    return get_parking_slot(this).data_mtx;
+}
+
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -10,32 +10,116 @@
 
 #include "ixion/formula_result.hpp"
 
+#include <atomic>
 #include <mutex>
-#include <condition_variable>
+#include <cstdint>
 
 #include <boost/intrusive_ptr.hpp>
 
 namespace ixion {
 
+/**
+ * Calculation state of a formula cell (or a group of formula cells).
+ */
+enum class calc_state_t : uint8_t
+{
+    /** Result is not available. */
+    dirty,
+    /** Cell is being interpreted. */
+    in_progress,
+    /** Result is available. */
+    done,
+    /** Error result was assigned prior to interpretation, e.g. for a cell
+     * on a circular reference path. */
+    error,
+    /** Calculation was cancelled before the result became available. */
+    cancelled
+};
+
+/**
+ * Calculation status shared by all formula cells of the same group.
+ *
+ * The result is published by storing it first, then storing the state with
+ * release semantics.  Once a cell is in either done or error state, its
+ * result can be read after a single acquire load of the state without
+ * taking any lock.  The rare reader that needs to block until the result
+ * becomes available gets parked on a lock shared by many instances, so that
+ * no instance needs to carry its own mutex and condition variable.
+ */
 struct calc_status
 {
     calc_status(const calc_status&) = delete;
     calc_status& operator=(const calc_status&) = delete;
 
-    std::mutex mtx;
-    std::condition_variable cond;
     std::unique_ptr<formula_result> result;
 
     const rc_size_t group_size;
     bool circular_safe;
 
-    size_t refcount;
+    std::atomic<calc_state_t> state;
+    std::atomic<size_t> refcount;
 
     calc_status();
     calc_status(const rc_size_t& _group_size);
 
     void add_ref();
     void release_ref();
+
+    calc_state_t get_state() const
+    {
+        return state.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @return true if the result is available, false otherwise.
+     */
+    bool has_result() const
+    {
+        calc_state_t st = get_state();
+        return st == calc_state_t::done || st == calc_state_t::error;
+    }
+
+    /**
+     * Transition the state from dirty to in-progress.
+     *
+     * @return true if this call has made the transition, false if the
+     *         state was not dirty.
+     */
+    bool begin_calc();
+
+    /**
+     * Store the result and publish it by updating the state.  Any threads
+     * waiting for the result get woken up.
+     *
+     * @param res result to store.
+     * @param st new state, which must be either done or error.
+     */
+    void set_result(std::unique_ptr<formula_result> res, calc_state_t st = calc_state_t::done);
+
+    /**
+     * Put the state to cancelled unless the result is already available,
+     * and wake up any threads waiting for the result.
+     */
+    void cancel();
+
+    /**
+     * Block until either the result becomes available, or the calculation
+     * gets cancelled.
+     */
+    void wait_for_result() const;
+
+    /**
+     * Clear the result and put the state back to dirty.  This must not be
+     * called while other threads may be accessing this instance.
+     */
+    void reset();
+
+    /**
+     * Get the mutex to use to serialize modifications to the stored result,
+     * for those cases where the result gets updated in place, such as when
+     * setting a cached result of a grouped formula cell.
+     */
+    std::mutex& get_mutex() const;
 };
 
 inline void intrusive_ptr_add_ref(calc_status* p)
@@ -0,0 +1,76 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <ixion/cancellation_token.hpp>
+
+#include <atomic>
+#include <limits>
+
+namespace ixion {
+
+namespace {
+
+using rep_type = cancellation_token::clock_type::rep;
+
+constexpr rep_type no_deadline = std::numeric_limits<rep_type>::max();
+
+}
+
+struct cancellation_token::impl
+{
+    std::atomic<bool> cancelled;
+
+    /** deadline as the clock tick count since the clock's epoch. */
+    std::atomic<rep_type> deadline;
+
+    impl() : cancelled(false), deadline(no_deadline) {}
+};
+
+cancellation_token::cancellation_token() : mp_impl(std::make_unique<impl>()) {}
+cancellation_token::~cancellation_token() = default;
+
+void cancellation_token::cancel()
+{
+    mp_impl->cancelled.store(true, std::memory_order_relaxed);
+}
+
+void cancellation_token::set_deadline(clock_type::time_point deadline)
+{
+    mp_impl->deadline.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+void cancellation_token::set_timeout(clock_type::duration timeout)
+{
+    set_deadline(clock_type::now() + timeout);
+}
+
+bool cancellation_token::is_cancelled() const
+{
+    if (mp_impl->cancelled.load(std::memory_order_relaxed))
+        return true;
+
+    rep_type deadline = mp_impl->deadline.load(std::memory_order_relaxed);
+    if (deadline == no_deadline)
+        return false;
+
+    if (clock_type::now().time_since_epoch().count() < deadline)
+        return false;
+
+    // Latch the state so that subsequent checks don't need to read the clock.
+    mp_impl->cancelled.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void cancellation_token::reset()
+{
+    mp_impl->cancelled.store(false, std::memory_order_relaxed);
+    mp_impl->deadline.store(no_deadline, std::memory_order_relaxed);
+}
+
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -18,6 +18,7 @@
 #include <ixion/model_context.hpp>
 
 #include "formula_interpreter.hpp"
+#include "model_context_impl.hpp"
 #include "debug.hpp"
 
 #include <cassert>
@@ -70,23 +71,11 @@ struct formula_cell::impl
 
     /**
      * Block until the result becomes available.
-     *
-     * @param lock mutex lock associated with the result cache data.
      */
-    void wait_for_interpreted_result(std::unique_lock<std::mutex>& lock) const
+    void wait_for_interpreted_result() const
     {
         IXION_TRACE("Wait for the interpreted result");
-
-        while (!m_calc_status->result)
-        {
-            IXION_TRACE("Waiting...");
-            m_calc_status->cond.wait(lock);
-        }
-    }
-
-    void reset_flag()
-    {
-        m_calc_status->circular_safe = false;
+        m_calc_status->wait_for_result();
     }
 
     /**
@@ -106,9 +95,10 @@ struct formula_cell::impl
         {
             // Circular dependency detected !!
             IXION_DEBUG("Circular dependency detected !!");
-            assert(!m_calc_status->result);
-            m_calc_status->result =
-                std::make_unique<formula_result>(formula_error_t::ref_result_not_available);
+            assert(!m_calc_status->has_result());
+            m_calc_status->set_result(
+                std::make_unique<formula_result>(formula_error_t::ref_result_not_available),
+                calc_state_t::error);
 
             return false;
         }
@@ -117,7 +107,7 @@ struct formula_cell::impl
 
     void check_calc_status_or_throw() const
     {
-        if (!m_calc_status->result)
+        if (!m_calc_status->has_result())
         {
             // Result not cached yet.  Reference error.
             IXION_DEBUG("Result not cached yet. This is a reference error.");
@@ -289,13 +279,13 @@ struct formula_cell::impl
     {
         if (is_grouped())
         {
-            std::unique_lock<std::mutex> lock(m_calc_status->mtx);
+            std::lock_guard<std::mutex> lock(m_calc_status->get_mutex());
 
-            if (!m_calc_status->result)
+            if (!m_calc_status->has_result())
             {
-                m_calc_status->result =
+                m_calc_status->set_result(
                     std::make_unique<formula_result>(
-                        matrix(m_calc_status->group_size.row, m_calc_status->group_size.column));
+                        matrix(m_calc_status->group_size.row, m_calc_status->group_size.column)));
             }
 
             matrix& m = m_calc_status->result->get_matrix();
@@ -323,8 +313,7 @@ struct formula_cell::impl
             return;
         }
 
-        std::unique_lock<std::mutex> lock(m_calc_status->mtx);
-        m_calc_status->result = std::make_unique<formula_result>(std::move(result));
+        m_calc_status->set_result(std::make_unique<formula_result>(std::move(result)));
     }
 };
 
@@ -355,17 +344,15 @@ void formula_cell::set_tokens(const formula_tokens_store_ptr_t& tokens)
 
 double formula_cell::get_value(formula_result_wait_policy_t policy) const
 {
-    std::unique_lock<std::mutex> lock(mp_impl->m_calc_status->mtx);
     if (policy == formula_result_wait_policy_t::block_until_done)
-        mp_impl->wait_for_interpreted_result(lock);
+        mp_impl->wait_for_interpreted_result();
     return mp_impl->fetch_value_from_result();
 }
 
 std::string_view formula_cell::get_string(formula_result_wait_policy_t policy) const
 {
-    std::unique_lock<std::mutex> lock(mp_impl->m_calc_status->mtx);
     if (policy == formula_result_wait_policy_t::block_until_done)
-        mp_impl->wait_for_interpreted_result(lock);
+        mp_impl->wait_for_interpreted_result();
     return mp_impl->fetch_string_from_result();
 }
 
@@ -378,43 +365,45 @@ void formula_cell::interpret(model_context& context, const abs_address_t& pos)
 
     calc_status& status = *mp_impl->m_calc_status;
 
+    if (!status.begin_calc())
     {
-        std::lock_guard<std::mutex> lock(status.mtx);
+        // When the result is already cached before the cell is interpreted,
+        // it can mean the cell has circular dependency.
+        status.wait_for_result();
+        if (!status.has_result())
+            // The calculation has been cancelled.
+            return;
 
-        if (mp_impl->m_calc_status->result)
+        if (status.result->get_type() == formula_result::result_type::error)
         {
-            // When the result is already cached before the cell is interpreted,
-            // it can mean the cell has circular dependency.
-            if (status.result->get_type() == formula_result::result_type::error)
+            auto handler = context.create_session_handler();
+            if (handler)
             {
-                auto handler = context.create_session_handler();
-                if (handler)
-                {
-                    handler->begin_cell_interpret(pos);
-                    std::string_view msg = get_formula_error_name(status.result->get_error());
-                    handler->set_formula_error(msg);
-                    handler->end_cell_interpret();
-                }
+                handler->begin_cell_interpret(pos);
+                std::string_view msg = get_formula_error_name(status.result->get_error());
+                handler->set_formula_error(msg);
+                handler->end_cell_interpret();
             }
-            return;
         }
+        return;
+    }
 
-        formula_interpreter fin(this, context);
-        fin.set_origin(pos);
-        status.result = std::make_unique<formula_result>();
-        if (fin.interpret())
-        {
-            // Successful interpretation.
-            *status.result = fin.transfer_result();
-        }
-        else
-        {
-            // Interpretation ended with an error condition.
-            status.result->set_error(fin.get_error());
-        }
+    pooled_interpreter pi(this, context);
+    formula_interpreter& fin = pi.get();
+    fin.set_origin(pos);
+    auto res = std::make_unique<formula_result>();
+    if (fin.interpret())
+    {
+        // Successful interpretation.
+        *res = fin.transfer_result();
+    }
+    else
+    {
+        // Interpretation ended with an error condition.
+        res->set_error(fin.get_error());
     }
 
-    status.cond.notify_all();
+    status.set_result(std::move(res));
 }
 
 void formula_cell::check_circular(const model_context& cxt, const abs_address_t& pos)
@@ -439,28 +428,16 @@ void formula_cell::check_circular(const model_context& cxt, const abs_address_t&
             }
             case fop_range_ref:
             {
-                abs_range_t range = std::get<range_t>(t.value).to_abs(pos);
+                // The cells past the data extent are empty, and none of
+                // them can be a formula cell.
+                abs_range_t range = cxt.mp_impl->clip_to_data_extent(
+                    std::get<range_t>(t.value).to_abs(pos));
+
                 for (sheet_t sheet = range.first.sheet; sheet <= range.last.sheet; ++sheet)
                 {
-                    rc_size_t sheet_size = cxt.get_sheet_size();
-                    col_t col_first = range.first.column, col_last = range.last.column;
-                    if (range.all_columns())
+                    for (col_t col = range.first.column; col <= range.last.column; ++col)
                     {
-                        col_first = 0;
-                        col_last = sheet_size.column - 1;
-                    }
-
-                    for (col_t col = col_first; col <= col_last; ++col)
-                    {
-                        row_t row_first = range.first.row, row_last = range.last.row;
-                        if (range.all_rows())
-                        {
-                            assert(row_last == row_unset);
-                            row_first = 0;
-                            row_last = sheet_size.row - 1;
-                        }
-
-                        for (row_t row = row_first; row <= row_last; ++row)
+                        for (row_t row = range.first.row; row <= range.last.row; ++row)
                         {
                             abs_address_t addr(sheet, row, col);
                             if (cxt.get_celltype(addr) != cell_t::formula)
@@ -484,11 +461,27 @@ void formula_cell::check_circular(const model_context& cxt, const abs_address_t&
     mp_impl->m_calc_status->circular_safe = true;
 }
 
+void formula_cell::set_circular_safe(bool safe)
+{
+    calc_status& status = *mp_impl->m_calc_status;
+    status.circular_safe = safe;
+
+    if (!safe && !status.has_result())
+    {
+        status.set_result(
+            std::make_unique<formula_result>(formula_error_t::ref_result_not_available),
+            calc_state_t::error);
+    }
+}
+
+void formula_cell::cancel_calc()
+{
+    mp_impl->m_calc_status->cancel();
+}
+
 void formula_cell::reset()
 {
-    std::lock_guard<std::mutex> lock(mp_impl->m_calc_status->mtx);
-    mp_impl->m_calc_status->result.reset();
-    mp_impl->reset_flag();
+    mp_impl->m_calc_status->reset();
 }
 
 std::vector<const formula_token*> formula_cell::get_ref_tokens(
@@ -531,12 +524,10 @@ std::vector<const formula_token*> formula_cell::get_ref_tokens(
 
 const formula_result& formula_cell::get_raw_result_cache(formula_result_wait_policy_t policy) const
 {
-    std::unique_lock<std::mutex> lock(mp_impl->m_calc_status->mtx);
-
     if (policy == formula_result_wait_policy_t::block_until_done)
-        mp_impl->wait_for_interpreted_result(lock);
+        mp_impl->wait_for_interpreted_result();
 
-    if (!mp_impl->m_calc_status->result)
+    if (!mp_impl->m_calc_status->has_result())
     {
         IXION_DEBUG("Result not yet available.");
         throw formula_error(formula_error_t::ref_result_not_available);
@@ -556,6 +547,11 @@ void formula_cell::set_result_cache(formula_result result)
     mp_impl->set_single_formula_result(result);
 }
 
+void formula_cell::set_raw_result_cache(formula_result result)
+{
+    mp_impl->m_calc_status->set_result(std::make_unique<formula_result>(std::move(result)));
+}
+
 formula_group_t formula_cell::get_group_properties() const
 {
     uintptr_t identity = reinterpret_cast<uintptr_t>(mp_impl->m_calc_status.get());
@@ -0,0 +1,334 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "cell_dependency_graph.hpp"
+#include "queue_entry.hpp"
+#include "debug.hpp"
+
+#include <ixion/cell.hpp>
+#include <ixion/model_context.hpp>
+#include <ixion/dirty_cell_tracker.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+
+namespace ixion {
+
+namespace {
+
+constexpr size_t unvisited = std::numeric_limits<size_t>::max();
+
+}
+
+struct cell_dependency_graph::impl
+{
+    const model_context& m_context;
+    const std::vector<queue_entry>& m_cells;
+
+    std::unordered_map<abs_address_t, size_t, abs_address_t::hash> m_cell_indices;
+
+    /** dependent cell indices for each cell, by cell index. */
+    std::vector<std::vector<size_t>> m_dependents;
+
+
+    /**
+     * Flags indicating whether or not each cell references itself.  Note
+     * that std::vector<bool> is avoided on purpose, as its elements cannot
+     * be written to concurrently.
+     */
+    std::vector<uint8_t> m_self_refs;
+
+    /** cell indices of each strongly connected component, in topological order. */
+    std::vector<std::vector<size_t>> m_components;
+
+    /** whether or not each component forms a cycle, by component index. */
+    std::vector<bool> m_cyclic_components;
+
+    /** component index of each cell, by cell index. */
+    std::vector<size_t> m_component_ids;
+
+    /** dependent component indices for each component, by component index. */
+    std::vector<std::vector<size_t>> m_component_dependents;
+
+    /** number of precedent components, by component index. */
+    std::vector<size_t> m_component_precedent_counts;
+
+    impl(const model_context& cxt, const std::vector<queue_entry>& cells) :
+        m_context(cxt),
+        m_cells(cells),
+        m_dependents(cells.size()),
+        m_self_refs(cells.size(), 0)
+    {
+        m_cell_indices.reserve(cells.size());
+        for (size_t i = 0, n = cells.size(); i < n; ++i)
+            m_cell_indices.insert({cells[i].pos, i});
+    }
+
+    void build(size_t first, size_t last)
+    {
+        assert(first <= last && last <= m_cells.size());
+
+        const dirty_cell_tracker& tracker = m_context.get_cell_tracker();
+
+        for (size_t i = first; i < last; ++i)
+        {
+            const queue_entry& e = m_cells[i];
+
+            // Grouped formula cells are tracked by the range of the group.
+            abs_range_t src = e.pos;
+            formula_group_t fg_props = e.p->get_group_properties();
+            if (fg_props.grouped)
+            {
+                src.last.column += fg_props.size.column - 1;
+                src.last.row += fg_props.size.row - 1;
+            }
+
+            std::vector<size_t>& deps = m_dependents[i];
+            deps.clear();
+
+            for (const abs_range_t& dep : tracker.query_dependents(src))
+            {
+                auto it = m_cell_indices.find(dep.first);
+                if (it == m_cell_indices.end())
+                    // Not a cell to calculate in this run.
+                    continue;
+
+                if (it->second == i)
+                {
+                    // A grouped formula cell may legitimately reference
+                    // other cells within the same group.
+                    if (!fg_props.grouped)
+                        m_self_refs[i] = 1;
+                    continue;
+                }
+
+                deps.push_back(it->second);
+            }
+        }
+    }
+
+    /**
+     * Find the strongly connected components with Tarjan's algorithm,
+     * without recursion to avoid overflowing the stack on long dependency
+     * chains.  Tarjan's algorithm emits each component only after all the
+     * components that depend on it, so reversing the order in which they
+     * get emitted gives a topological order.
+     */
+    void find_components()
+    {
+        const size_t n = m_cells.size();
+
+        m_components.clear();
+        m_cyclic_components.clear();
+
+        std::vector<size_t> indices(n, unvisited);
+        std::vector<size_t> lowlinks(n, 0);
+        std::vector<bool> on_stack(n, false);
+        std::vector<size_t> stack;
+
+        struct frame
+        {
+            size_t cell;
+            size_t next_edge;
+        };
+
+        std::vector<frame> call_stack;
+        size_t counter = 0;
+
+        auto visit = [&](size_t v)
+        {
+            indices[v] = lowlinks[v] = counter++;
+            stack.push_back(v);
+            on_stack[v] = true;
+            call_stack.push_back({v, 0});
+        };
+
+        for (size_t root = 0; root < n; ++root)
+        {
+            if (indices[root] != unvisited)
+                continue;
+
+            visit(root);
+
+            while (!call_stack.empty())
+            {
+                frame& f = call_stack.back();
+                const std::vector<size_t>& deps = m_dependents[f.cell];
+
+                if (f.next_edge < deps.size())
+                {
+                    size_t w = deps[f.next_edge++];
+                    if (indices[w] == unvisited)
+                        visit(w); // this invalidates the frame reference.
+                    else if (on_stack[w])
+                        lowlinks[f.cell] = std::min(lowlinks[f.cell], indices[w]);
+                    continue;
+                }
+
+                size_t v = f.cell;
+                call_stack.pop_back();
+
+                if (!call_stack.empty())
+                {
+                    size_t u = call_stack.back().cell;
+                    lowlinks[u] = std::min(lowlinks[u], lowlinks[v]);
+                }
+
+                if (lowlinks[v] != indices[v])
+                    continue;
+
+                // v is the root of a strongly connected component, which
+                // consists of v and all cells above it on the stack.
+                // Search from the top so that the overall cost stays linear.
+                auto it_end = stack.end();
+                auto it_begin = std::find(stack.rbegin(), stack.rend(), v).base() - 1;
+                assert(*it_begin == v);
+
+                for (auto it = it_begin; it != it_end; ++it)
+                    on_stack[*it] = false;
+
+                bool cyclic = std::distance(it_begin, it_end) > 1 || m_self_refs[v];
+                m_components.emplace_back(it_begin, it_end);
+                m_cyclic_components.push_back(cyclic);
+
+                stack.erase(it_begin, it_end);
+            }
+        }
+
+        std::reverse(m_components.begin(), m_components.end());
+        std::reverse(m_cyclic_components.begin(), m_cyclic_components.end());
+
+        const size_t n_comps = m_components.size();
+
+        m_component_ids.assign(n, 0);
+        for (size_t c = 0; c < n_comps; ++c)
+        {
+            for (size_t i : m_components[c])
+                m_component_ids[i] = c;
+        }
+
+        // Collect the relations between the components, without duplicates.
+        m_component_dependents.assign(n_comps, std::vector<size_t>());
+        m_component_precedent_counts.assign(n_comps, 0);
+        std::vector<size_t> last_seen(n_comps, unvisited);
+
+        for (size_t c = 0; c < n_comps; ++c)
+        {
+            for (size_t i : m_components[c])
+            {
+                for (size_t dep : m_dependents[i])
+                {
+                    size_t dep_c = m_component_ids[dep];
+                    if (dep_c == c || last_seen[dep_c] == c)
+                        continue;
+
+                    last_seen[dep_c] = c;
+                    m_component_dependents[c].push_back(dep_c);
+                    ++m_component_precedent_counts[dep_c];
+                }
+            }
+        }
+    }
+
+    void flag_circular_cells()
+    {
+        // Cells that depend on the cells on circular paths cannot be
+        // calculated either.  Since the components are stored in
+        // topological order, a single pass is enough to propagate the flags.
+        std::vector<bool> circular = m_cyclic_components;
+
+        for (size_t c = 0, n = m_components.size(); c < n; ++c)
+        {
+            if (!circular[c])
+                continue;
+
+            for (size_t dep_c : m_component_dependents[c])
+                circular[dep_c] = true;
+        }
+
+        for (size_t c = 0, n = m_components.size(); c < n; ++c)
+        {
+            for (size_t i : m_components[c])
+            {
+                if (circular[c])
+                {
+                    IXION_DEBUG("Circular dependency detected at " << m_cells[i].pos.get_name());
+                }
+
+                m_cells[i].p->set_circular_safe(!circular[c]);
+            }
+        }
+    }
+};
+
+cell_dependency_graph::cell_dependency_graph(
+    const model_context& cxt, const std::vector<queue_entry>& cells) :
+    mp_impl(std::make_unique<impl>(cxt, cells)) {}
+
+cell_dependency_graph::~cell_dependency_graph() = default;
+
+void cell_dependency_graph::build(size_t first, size_t last)
+{
+    mp_impl->build(first, last);
+}
+
+void cell_dependency_graph::build()
+{
+    mp_impl->build(0, mp_impl->m_cells.size());
+}
+
+void cell_dependency_graph::find_components()
+{
+    mp_impl->find_components();
+}
+
+void cell_dependency_graph::flag_circular_cells()
+{
+    mp_impl->flag_circular_cells();
+}
+
+size_t cell_dependency_graph::size() const
+{
+    return mp_impl->m_cells.size();
+}
+
+const std::vector<size_t>& cell_dependency_graph::get_dependents(size_t i) const
+{
+    return mp_impl->m_dependents[i];
+}
+
+size_t cell_dependency_graph::get_component_count() const
+{
+    return mp_impl->m_components.size();
+}
+
+const std::vector<size_t>& cell_dependency_graph::get_component(size_t c) const
+{
+    return mp_impl->m_components[c];
+}
+
+bool cell_dependency_graph::is_cyclic_component(size_t c) const
+{
+    return mp_impl->m_cyclic_components[c];
+}
+
+const std::vector<size_t>& cell_dependency_graph::get_component_dependents(size_t c) const
+{
+    return mp_impl->m_component_dependents[c];
+}
+
+size_t cell_dependency_graph::get_component_precedent_count(size_t c) const
+{
+    return mp_impl->m_component_precedent_counts[c];
+}
+
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,139 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_CELL_DEPENDENCY_GRAPH_HPP
+#define INCLUDED_IXION_CELL_DEPENDENCY_GRAPH_HPP
+
+#include <ixion/address.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace ixion {
+
+class model_context;
+struct queue_entry;
+
+/**
+ * Precedent-dependent relations between the formula cells to be calculated
+ * in a single recalculation run, built from the dependency information
+ * stored in the dirty cell tracker.  Each cell is identified by its index
+ * in the array of queue entries the graph is built from.
+ */
+class cell_dependency_graph
+{
+    struct impl;
+    std::unique_ptr<impl> mp_impl;
+
+public:
+    cell_dependency_graph() = delete;
+    cell_dependency_graph(const cell_dependency_graph&) = delete;
+    cell_dependency_graph& operator= (const cell_dependency_graph&) = delete;
+
+    /**
+     * Constructor.  Note that the graph stores a reference to the array of
+     * cells, which therefore must outlive the graph instance.
+     *
+     * @param cxt model context instance.
+     * @param cells cells to be calculated.
+     */
+    cell_dependency_graph(const model_context& cxt, const std::vector<queue_entry>& cells);
+    ~cell_dependency_graph();
+
+    /**
+     * Collect the dependent cells of the cells within the specified index
+     * range.  It is safe to call this method concurrently from multiple
+     * threads as long as their index ranges don't overlap.
+     *
+     * @param first index of the first cell in the range.
+     * @param last index of the cell past the last cell in the range.
+     */
+    void build(size_t first, size_t last);
+
+    /**
+     * Collect the dependent cells of all cells.
+     */
+    void build();
+
+    /**
+     * Find all strongly connected components in the graph in a single
+     * O(V+E) pass.  Each component consists of either a single cell that is
+     * not on any circular reference path, or of all cells on one or more
+     * intersecting circular reference paths.  The graph must be fully built
+     * prior to calling this method.
+     */
+    void find_components();
+
+    /**
+     * Mark those cells that are on a circular reference path, or downstream
+     * of one, with an error result.  All the other cells get marked as
+     * circular-safe.  The components must be found prior to calling this
+     * method.
+     */
+    void flag_circular_cells();
+
+    /**
+     * @return number of cells in the graph.
+     */
+    size_t size() const;
+
+    /**
+     * Get the indices of the cells that directly depend on a cell.
+     *
+     * @param i index of the precedent cell.
+     *
+     * @return indices of the dependent cells.
+     */
+    const std::vector<size_t>& get_dependents(size_t i) const;
+
+    /**
+     * @return number of strongly connected components in the graph.
+     */
+    size_t get_component_count() const;
+
+    /**
+     * Get the indices of the cells that belong to a component.  The
+     * components are indexed in topological order, i.e. a component never
+     * depends on another component with a greater index.
+     *
+     * @param c index of the component.
+     *
+     * @return indices of the cells in the component.
+     */
+    const std::vector<size_t>& get_component(size_t c) const;
+
+    /**
+     * @param c index of the component.
+     *
+     * @return true if the cells in the component form a cycle, false
+     *         otherwise.
+     */
+    bool is_cyclic_component(size_t c) const;
+
+    /**
+     * Get the indices of the components that directly depend on a
+     * component.  Each dependent component is listed only once.
+     *
+     * @param c index of the precedent component.
+     *
+     * @return indices of the dependent components.
+     */
+    const std::vector<size_t>& get_component_dependents(size_t c) const;
+
+    /**
+     * @param c index of the dependent component.
+     *
+     * @return number of components the component directly depends on.
+     */
+    size_t get_component_precedent_count(size_t c) const;
+};
+
+}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
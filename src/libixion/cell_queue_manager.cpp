@@ -6,14 +6,25 @@
  */
 
 #include "cell_queue_manager.hpp"
+#include "calc_progress.hpp"
+#include "cell_dependency_graph.hpp"
+#include "component_iteration.hpp"
 #include "queue_entry.hpp"
+#include "model_context_impl.hpp"
+#include "thread_pool.hpp"
+#include <ixion/cancellation_token.hpp>
 #include <ixion/cell.hpp>
 #include <ixion/model_context.hpp>
+#include <ixion/config.hpp>
 
 #include <cassert>
-#include <queue>
-#include <future>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <atomic>
 #include <algorithm>
+#include <functional>
 
 #if !IXION_THREADS
 #error "This file is not to be compiled when the threads are disabled."
@@ -21,127 +32,327 @@
 
 namespace ixion {
 
-namespace {
-
-class scoped_guard
+/**
+ * Schedules the formula cells based on their precedent-dependent relations.
+ * The cells are scheduled by the strongly connected components of the
+ * dependency graph, each of which is either a single cell or a group of
+ * cells forming a cycle.  Each component keeps an atomic count of its
+ * precedent components yet to be calculated, and it gets submitted to the
+ * thread pool only when that count reaches zero.  This way, no worker
+ * thread ever needs to block while waiting for the result of another cell.
+ *
+ * When iterative calculation is enabled, independent cycles get iterated
+ * concurrently, and each sweep of a large cycle gets split into chunks
+ * that are evaluated concurrently.
+ *
+ * When the calculation gets cancelled, a component that has not started
+ * yet does not get calculated, and does not release its dependents either.
+ * The dependents therefore never get submitted, which lets the remaining
+ * tasks drain quickly.
+ */
+struct formula_cell_queue::impl
 {
-    std::thread m_thread;
-public:
-    scoped_guard(std::thread thread) : m_thread(std::move(thread)) {}
-    scoped_guard(scoped_guard&& other) : m_thread(std::move(other.m_thread)) {}
-
-    scoped_guard(const scoped_guard&) = delete;
-    scoped_guard& operator= (const scoped_guard&) = delete;
-
-    ~scoped_guard()
+    /**
+     * State of a cycle being iterated.
+     */
+    struct cycle_state
     {
-        m_thread.join();
-    }
-};
+        component_iteration iteration;
 
-class interpreter_queue
-{
-    using future_type = std::future<void>;
+        /** number of chunks of the current sweep yet to be evaluated. */
+        std::atomic<size_t> pending_chunks;
+
+        cycle_state(model_context& cxt, const std::vector<queue_entry>& cells, const std::vector<size_t>& members) :
+            iteration(cxt, cells, members), pending_chunks(0) {}
+    };
 
     model_context& m_context;
+    std::vector<queue_entry> m_cells;
+    size_t m_thread_count;
+    const cancellation_token* m_token;
+    calc_progress* m_progress;
+    bool m_iterative;
+
+    cell_dependency_graph m_graph;
+
+    /** number of precedent components yet to be calculated, by component index. */
+    std::unique_ptr<std::atomic<size_t>[]> m_pending_precedents;
+
+    /** states of the cycles being iterated, by component index. */
+    std::vector<std::unique_ptr<cycle_state>> m_cycles;
+
+    /**
+     * Flags indicating whether or not each component has been calculated,
+     * by component index.  Note that std::vector<bool> is avoided on
+     * purpose, as its elements cannot be written to concurrently.
+     */
+    std::vector<uint8_t> m_finished;
 
-    std::queue<future_type> m_futures;
     std::mutex m_mtx;
     std::condition_variable m_cond;
+    size_t m_in_flight;
+    std::exception_ptr m_exception;
+
+    impl(model_context& cxt, std::vector<queue_entry>&& cells, size_t thread_count,
+        const cancellation_token* token, calc_progress* progress) :
+        m_context(cxt),
+        m_cells(std::move(cells)),
+        m_thread_count(thread_count),
+        m_token(token),
+        m_progress(progress),
+        m_iterative(cxt.get_config().max_iterations > 0),
+        m_graph(cxt, m_cells),
+        m_in_flight(0) {}
+
+    bool is_cancelled() const
+    {
+        return m_token && m_token->is_cancelled();
+    }
 
-    size_t m_max_queue;
+    size_t get_chunk_size(detail::thread_pool& pool, size_t n, size_t min_size) const
+    {
+        return std::max<size_t>(min_size, n / (pool.size() * 4) + 1);
+    }
 
-    void interpret(formula_cell* p, const abs_address_t& pos)
+    void submit_task(detail::thread_pool& pool, std::function<void()> task)
     {
-        p->interpret(m_context, pos);
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            ++m_in_flight;
+        }
+
+        pool.submit([this, task = std::move(task)]()
+        {
+            try
+            {
+                task();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                if (!m_exception)
+                    m_exception = std::current_exception();
+            }
+
+            // Notify while holding the lock, as this instance may get
+            // destroyed as soon as the waiting thread sees the counter
+            // reach zero.
+            std::lock_guard<std::mutex> lock(m_mtx);
+            --m_in_flight;
+            m_cond.notify_all();
+        });
     }
 
-public:
-    interpreter_queue(model_context& cxt, size_t max_queue) :
-        m_context(cxt), m_max_queue(max_queue) {}
+    void wait_for_tasks()
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            while (m_in_flight)
+                m_cond.wait(lock);
+        }
+
+        if (m_exception)
+            std::rethrow_exception(m_exception);
+    }
 
     /**
-     * Push one formula cell to the interpreter queue for future
-     * intepretation.
-     *
-     * @param p pointer to formula cell instance.
-     * @param pos position of the formual cell.
+     * Build the precedent-dependent relations between the cells to
+     * interpret, by querying the cell tracker for chunks of cells
+     * concurrently.
      */
-    void push(formula_cell* p, const abs_address_t& pos)
+    void build_relations(detail::thread_pool& pool)
     {
-        std::unique_lock<std::mutex> lock(m_mtx);
+        const size_t n = m_cells.size();
+        const size_t chunk_size = get_chunk_size(pool, n, 64);
 
-        while (m_futures.size() >= m_max_queue)
-            m_cond.wait(lock);
+        for (size_t first = 0; first < n; first += chunk_size)
+        {
+            size_t last = std::min(first + chunk_size, n);
+            submit_task(pool, [this, first, last]() { m_graph.build(first, last); });
+        }
 
-        future_type f = std::async(
-            std::launch::async, &interpreter_queue::interpret, this, p, pos);
-        m_futures.push(std::move(f));
-        lock.unlock();
+        wait_for_tasks();
 
-        m_cond.notify_one();
-    }
+        m_graph.find_components();
 
-    /**
-     * Wait for one formula cell to finish its interpretation.
-     */
-    void wait_one()
-    {
-        std::unique_lock<std::mutex> lock(m_mtx);
+        if (!m_iterative)
+            m_graph.flag_circular_cells();
 
-        while (m_futures.empty())
-            m_cond.wait(lock);
+        const size_t n_comps = m_graph.get_component_count();
+        m_pending_precedents = std::make_unique<std::atomic<size_t>[]>(n_comps);
+        for (size_t c = 0; c < n_comps; ++c)
+            m_pending_precedents[c].store(m_graph.get_component_precedent_count(c), std::memory_order_relaxed);
 
-        future_type ret = std::move(m_futures.front());
-        m_futures.pop();
-        lock.unlock();
+        m_cycles.resize(n_comps);
+        m_finished.assign(n_comps, 0);
+    }
 
-        ret.get();  // This may throw if an exception was thrown on the thread.
+    void submit(detail::thread_pool& pool, size_t c)
+    {
+        submit_task(pool, [this, &pool, c]() { calculate(pool, c); });
+    }
 
-        m_cond.notify_one();
+    /**
+     * Release the dependent components that have no more precedent
+     * components to wait for.  Since they get pushed from within a worker
+     * thread, they go to the same worker's queue and are likely to be
+     * picked up by this same thread next.
+     */
+    void release_dependents(detail::thread_pool& pool, size_t c)
+    {
+        for (size_t dep : m_graph.get_component_dependents(c))
+        {
+            if (m_pending_precedents[dep].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                submit(pool, dep);
+        }
     }
-};
 
-}
+    /**
+     * Mark a component as calculated, and release its dependent components.
+     */
+    void finish(detail::thread_pool& pool, size_t c)
+    {
+        m_finished[c] = 1;
 
-struct formula_cell_queue::impl
-{
-    model_context& m_context;
-    std::vector<queue_entry> m_cells;
-    size_t m_thread_count;
+        if (m_progress)
+            m_progress->report(m_graph.get_component(c));
 
-    impl(model_context& cxt, std::vector<queue_entry>&& cells, size_t thread_count) :
-        m_context(cxt),
-        m_cells(cells),
-        m_thread_count(thread_count) {}
+        release_dependents(pool, c);
+    }
 
-    void thread_launch(interpreter_queue* queue)
+    void calculate(detail::thread_pool& pool, size_t c)
     {
-        for (queue_entry& e : m_cells)
-            queue->push(e.p, e.pos);
+        if (is_cancelled())
+            return;
+
+        if (m_iterative && m_graph.is_cyclic_component(c))
+        {
+            m_cycles[c] = std::make_unique<cycle_state>(m_context, m_cells, m_graph.get_component(c));
+            m_cycles[c]->iteration.begin();
+            start_sweep(pool, c);
+            return;
+        }
+
+        // Release the dependent components even when the interpretation
+        // throws, so that the remaining cells do not get stuck.
+        try
+        {
+            for (size_t i : m_graph.get_component(c))
+                m_cells[i].p->interpret(m_context, m_cells[i].pos);
+        }
+        catch (...)
+        {
+            release_dependents(pool, c);
+            throw;
+        }
+
+        finish(pool, c);
     }
 
-    void run()
+    /**
+     * Evaluate all cells of a cycle once, splitting them into chunks when
+     * the cycle is large enough.  The last chunk to finish either starts
+     * the next sweep, or releases the dependent components once the
+     * iteration is over.
+     */
+    void start_sweep(detail::thread_pool& pool, size_t c)
     {
-        interpreter_queue queue(m_context, m_thread_count);
+        cycle_state& cs = *m_cycles[c];
+        const size_t n = cs.iteration.size();
+        const size_t chunk_size = get_chunk_size(pool, n, 16);
+
+        if (n <= chunk_size)
+        {
+            // Not worth splitting.  Run the whole iteration on this thread.
+            do
+            {
+                if (is_cancelled())
+                {
+                    cs.iteration.abort();
+                    return;
+                }
+
+                cs.iteration.sweep(0, n);
+            }
+            while (!cs.iteration.end_sweep());
+
+            finish(pool, c);
+            return;
+        }
+
+        if (is_cancelled())
+        {
+            cs.iteration.abort();
+            return;
+        }
+
+        cs.pending_chunks.store((n + chunk_size - 1) / chunk_size, std::memory_order_relaxed);
+
+        for (size_t first = 0; first < n; first += chunk_size)
+        {
+            size_t last = std::min(first + chunk_size, n);
+            submit_task(pool, [this, &pool, &cs, c, first, last]()
+            {
+                cs.iteration.sweep(first, last);
+                if (cs.pending_chunks.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    end_sweep(pool, c);
+            });
+        }
+    }
 
-        std::thread t(&formula_cell_queue::impl::thread_launch, this, &queue);
-        scoped_guard guard(std::move(t));
+    void end_sweep(detail::thread_pool& pool, size_t c)
+    {
+        if (m_cycles[c]->iteration.end_sweep())
+            finish(pool, c);
+        else
+            start_sweep(pool, c);
+    }
 
-        for (size_t i = 0, n = m_cells.size(); i < n; ++i)
-            queue.wait_one();
+    std::vector<size_t> run(detail::thread_pool& pool)
+    {
+        build_relations(pool);
+
+        // Collect the components with no precedents before submitting any
+        // of them, as the counters start changing as soon as the first
+        // component gets submitted.
+        std::vector<size_t> roots;
+        for (size_t c = 0, n = m_graph.get_component_count(); c < n; ++c)
+        {
+            if (!m_pending_precedents[c].load(std::memory_order_relaxed))
+                roots.push_back(c);
+        }
+
+        for (size_t c : roots)
+            submit(pool, c);
+
+        wait_for_tasks();
+
+        std::vector<size_t> unfinished;
+        for (size_t c = 0, n = m_graph.get_component_count(); c < n; ++c)
+        {
+            if (!m_finished[c])
+            {
+                const std::vector<size_t>& members = m_graph.get_component(c);
+                unfinished.insert(unfinished.end(), members.begin(), members.end());
+            }
+        }
+
+        std::sort(unfinished.begin(), unfinished.end());
+        return unfinished;
     }
 };
 
 formula_cell_queue::formula_cell_queue(
-    model_context& cxt, std::vector<queue_entry>&& cells, size_t thread_count) :
-    mp_impl(std::make_unique<impl>(cxt, std::move(cells), thread_count)) {}
+    model_context& cxt, std::vector<queue_entry>&& cells, size_t thread_count,
+    const cancellation_token* token, calc_progress* progress) :
+    mp_impl(std::make_unique<impl>(cxt, std::move(cells), thread_count, token, progress)) {}
 
 formula_cell_queue::~formula_cell_queue() {}
 
-void formula_cell_queue::run()
+std::vector<size_t> formula_cell_queue::run()
 {
-    mp_impl->run();
+    detail::thread_pool& pool = mp_impl->m_context.mp_impl->get_thread_pool(mp_impl->m_thread_count);
+    return mp_impl->run(pool);
 }
 
 }
@@ -15,6 +15,8 @@
 
 namespace ixion {
 
+class calc_progress;
+class cancellation_token;
 class formula_cell;
 class model_context;
 struct queue_entry;
@@ -30,14 +32,32 @@ class formula_cell_queue
 public:
     formula_cell_queue() = delete;
 
+    /**
+     * Constructor.
+     *
+     * @param cxt model context instance.
+     * @param cells cells to be calculated.
+     * @param thread_count number of calculation threads to use.
+     * @param token optional token to check for cancellation before the
+     *              calculation of each cell.
+     * @param progress optional progress to report the calculated cells to.
+     */
     formula_cell_queue(
         model_context& cxt,
         std::vector<queue_entry>&& cells,
-        size_t thread_count);
+        size_t thread_count,
+        const cancellation_token* token = nullptr,
+        calc_progress* progress = nullptr);
 
     ~formula_cell_queue();
 
-    void run();
+    /**
+     * Calculate the cells.
+     *
+     * @return indices of the cells left uncalculated due to cancellation,
+     *         in ascending order.
+     */
+    std::vector<size_t> run();
 };
 
 }
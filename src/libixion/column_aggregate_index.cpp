@@ -0,0 +1,242 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "column_aggregate_index.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+namespace ixion { namespace detail {
+
+namespace {
+
+constexpr std::size_t no_dirty_row = std::numeric_limits<std::size_t>::max();
+constexpr double inf = std::numeric_limits<double>::infinity();
+
+}
+
+column_aggregate_index::column_aggregate_index() :
+    m_size(0), m_dirty(0),
+    m_sums(1, 0.0), m_sum_errors(1, 0.0), m_counts(1, 0), m_formula_counts(1, 0),
+    m_capacity(0) {}
+
+column_aggregate_index::~column_aggregate_index() {}
+
+void column_aggregate_index::invalidate(row_t row)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_dirty = std::min<std::size_t>(m_dirty, row);
+}
+
+std::optional<column_aggregates> column_aggregate_index::query(
+    const column_store_t& store, row_t row1, row_t row2)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+
+    if (m_dirty != no_dirty_row)
+        update(store);
+
+    column_aggregates ret;
+
+    // The index covers the rows in [0, m_size).  The rows past it are empty.
+    std::size_t pos1 = row1;
+    std::size_t pos2 = std::min<std::size_t>(std::size_t(row2) + 1, m_size);
+    if (row1 < 0 || row2 < row1 || pos2 <= pos1)
+        return ret;
+
+    if (m_formula_counts[pos2] != m_formula_counts[pos1])
+        return {};
+
+    ret.count = m_counts[pos2] - m_counts[pos1];
+    if (!ret.count)
+        return ret;
+
+    ret.sum = (m_sums[pos2] - m_sums[pos1]) + (m_sum_errors[pos2] - m_sum_errors[pos1]);
+    ret.min = get_min(pos1, pos2);
+    ret.max = get_max(pos1, pos2);
+
+    return ret;
+}
+
+void column_aggregate_index::update(const column_store_t& store)
+{
+    std::size_t old_size = m_size;
+    std::size_t size = get_column_data_size(store);
+    std::size_t start = std::min({m_dirty, old_size, size});
+
+    if (size > m_capacity)
+    {
+        std::size_t capacity = 1;
+        while (capacity < size)
+            capacity <<= 1;
+
+        resize_tree(capacity);
+        start = 0;
+        old_size = 0;
+    }
+
+    m_sums.resize(size + 1);
+    m_sum_errors.resize(size + 1);
+    m_counts.resize(size + 1);
+    m_formula_counts.resize(size + 1);
+
+    double sum = m_sums[start];
+    double sum_error = m_sum_errors[start];
+    std::uint32_t count = m_counts[start];
+    std::uint32_t formula_count = m_formula_counts[start];
+
+    std::size_t row = start;
+
+    auto push = [&](std::optional<double> v, bool formula)
+    {
+        if (v)
+        {
+            // Neumaier's variant of the compensated summation.
+            double t = sum + *v;
+            if (std::abs(sum) >= std::abs(*v))
+                sum_error += (sum - t) + *v;
+            else
+                sum_error += (*v - t) + sum;
+            sum = t;
+            ++count;
+        }
+
+        if (formula)
+            ++formula_count;
+
+        set_leaf(row, v);
+
+        ++row;
+        m_sums[row] = sum;
+        m_sum_errors[row] = sum_error;
+        m_counts[row] = count;
+        m_formula_counts[row] = formula_count;
+    };
+
+    if (row < size)
+    {
+        auto pos = store.position(row);
+        std::size_t offset = pos.second;
+
+        for (auto it = pos.first; row < size; ++it, offset = 0)
+        {
+            assert(it != store.end());
+            std::size_t len = std::min(it->size - offset, size - row);
+
+            switch (it->type)
+            {
+                case element_type_numeric:
+                {
+                    const double* p = &numeric_element_block::at(*it->data, offset);
+                    for (const double* p_end = p + len; p != p_end; ++p)
+                        push(*p, false);
+                    break;
+                }
+                case element_type_boolean:
+                {
+                    auto it_blk = boolean_element_block::cbegin(*it->data);
+                    std::advance(it_blk, offset);
+                    for (std::size_t i = 0; i < len; ++i, ++it_blk)
+                        push(*it_blk ? 1.0 : 0.0, false);
+                    break;
+                }
+                case element_type_formula:
+                {
+                    for (std::size_t i = 0; i < len; ++i)
+                        push(std::nullopt, true);
+                    break;
+                }
+                default:
+                {
+                    for (std::size_t i = 0; i < len; ++i)
+                        push(std::nullopt, false);
+                }
+            }
+        }
+    }
+
+    // Clear the leaves of the rows that are no longer covered.
+    for (std::size_t i = size; i < old_size; ++i)
+        set_leaf(i, std::nullopt);
+
+    std::size_t end = std::max(size, old_size);
+    if (start < end)
+        update_parents(start, end);
+
+    m_size = size;
+    m_dirty = no_dirty_row;
+}
+
+void column_aggregate_index::resize_tree(std::size_t capacity)
+{
+    m_capacity = capacity;
+    m_mins.assign(capacity * 2, inf);
+    m_maxs.assign(capacity * 2, -inf);
+}
+
+void column_aggregate_index::set_leaf(std::size_t pos, std::optional<double> v)
+{
+    m_mins[m_capacity + pos] = v ? *v : inf;
+    m_maxs[m_capacity + pos] = v ? *v : -inf;
+}
+
+void column_aggregate_index::update_parents(std::size_t pos1, std::size_t pos2)
+{
+    assert(pos1 < pos2);
+
+    std::size_t lo = (m_capacity + pos1) >> 1;
+    std::size_t hi = (m_capacity + pos2 - 1) >> 1;
+
+    while (lo >= 1)
+    {
+        for (std::size_t i = lo; i <= hi; ++i)
+        {
+            m_mins[i] = std::min(m_mins[i * 2], m_mins[i * 2 + 1]);
+            m_maxs[i] = std::max(m_maxs[i * 2], m_maxs[i * 2 + 1]);
+        }
+
+        lo >>= 1;
+        hi >>= 1;
+    }
+}
+
+double column_aggregate_index::get_min(std::size_t pos1, std::size_t pos2) const
+{
+    double ret = inf;
+
+    for (pos1 += m_capacity, pos2 += m_capacity; pos1 < pos2; pos1 >>= 1, pos2 >>= 1)
+    {
+        if (pos1 & 1)
+            ret = std::min(ret, m_mins[pos1++]);
+        if (pos2 & 1)
+            ret = std::min(ret, m_mins[--pos2]);
+    }
+
+    return ret;
+}
+
+double column_aggregate_index::get_max(std::size_t pos1, std::size_t pos2) const
+{
+    double ret = -inf;
+
+    for (pos1 += m_capacity, pos2 += m_capacity; pos1 < pos2; pos1 >>= 1, pos2 >>= 1)
+    {
+        if (pos1 & 1)
+            ret = std::max(ret, m_maxs[pos1++]);
+        if (pos2 & 1)
+            ret = std::max(ret, m_maxs[--pos2]);
+    }
+
+    return ret;
+}
+
+}}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,123 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_COLUMN_AGGREGATE_INDEX_HPP
+#define INCLUDED_IXION_COLUMN_AGGREGATE_INDEX_HPP
+
+#include "column_store_type.hpp"
+
+#include <ixion/types.hpp>
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace ixion { namespace detail {
+
+/**
+ * Aggregates of the numeric values in a range of cells.  Boolean values
+ * count as numeric values of 1 or 0.
+ */
+struct column_aggregates
+{
+    double sum = 0.0;
+    std::size_t count = 0;
+
+    /** smallest value, valid only when the count is not 0. */
+    double min = 0.0;
+
+    /** largest value, valid only when the count is not 0. */
+    double max = 0.0;
+};
+
+/**
+ * Index of the numeric values in a single column, to get the aggregates of
+ * any range of rows in the column without walking it.  It stores the
+ * prefix sums and counts of the values, and segment trees of their
+ * minimums and maximums.  The prefix sums are compensated, so that the
+ * sum of a range does not lose the precision of the sums before it.
+ *
+ * <p>The index gets built from the column store on the first query.  A
+ * change to the column only marks the rows from the changed row onward as
+ * outdated, and the next query updates these rows.</p>
+ *
+ * <p>Since the results of the formula cells change during calculation,
+ * they do not get indexed.  A query for a range that contains a formula
+ * cell gets no result.  Queries are safe to run concurrently.</p>
+ */
+class column_aggregate_index
+{
+public:
+    column_aggregate_index();
+    ~column_aggregate_index();
+
+    /**
+     * Mark the rows from the specified row onward as outdated.
+     *
+     * @param row first row that has changed.
+     */
+    void invalidate(row_t row);
+
+    /**
+     * Get the aggregates of the numeric values in a range of rows,
+     * updating the outdated rows of the index first.
+     *
+     * @param store column store the index is for.
+     * @param row1 first row of the range.
+     * @param row2 last row of the range.
+     *
+     * @return aggregates of the values in the range, or nothing if the
+     *         range contains a formula cell.
+     */
+    std::optional<column_aggregates> query(const column_store_t& store, row_t row1, row_t row2);
+
+private:
+    void update(const column_store_t& store);
+    void resize_tree(std::size_t capacity);
+    void set_leaf(std::size_t pos, std::optional<double> v);
+    void update_parents(std::size_t pos1, std::size_t pos2);
+    double get_min(std::size_t pos1, std::size_t pos2) const;
+    double get_max(std::size_t pos1, std::size_t pos2) const;
+
+private:
+    std::mutex m_mtx;
+
+    /** number of rows covered by the index, up to the last non-empty row. */
+    std::size_t m_size;
+
+    /** first outdated row. */
+    std::size_t m_dirty;
+
+    /**
+     * Prefix sums and their compensations.  The element at i stores the
+     * sum of the values in the rows before row i.
+     */
+    std::vector<double> m_sums;
+    std::vector<double> m_sum_errors;
+
+    /** prefix counts of the numeric values. */
+    std::vector<std::uint32_t> m_counts;
+
+    /** prefix counts of the formula cells. */
+    std::vector<std::uint32_t> m_formula_counts;
+
+    /**
+     * Segment trees with their leaves at [capacity, 2 * capacity), where
+     * the capacity is a power of 2.  The leaves of the rows without a
+     * numeric value store infinity.
+     */
+    std::size_t m_capacity;
+    std::vector<double> m_mins;
+    std::vector<double> m_maxs;
+};
+
+}}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
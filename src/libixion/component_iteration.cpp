@@ -0,0 +1,167 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "component_iteration.hpp"
+#include "formula_interpreter.hpp"
+#include "model_context_impl.hpp"
+#include "queue_entry.hpp"
+#include "debug.hpp"
+
+#include <ixion/cancellation_token.hpp>
+#include <ixion/cell.hpp>
+#include <ixion/config.hpp>
+#include <ixion/matrix.hpp>
+#include <ixion/model_context.hpp>
+
+#include <cassert>
+#include <cmath>
+
+namespace ixion {
+
+namespace {
+
+bool converged(const formula_result& prev, const formula_result& next, double epsilon)
+{
+    if (prev.get_type() == formula_result::result_type::value &&
+        next.get_type() == formula_result::result_type::value)
+    {
+        return std::abs(next.get_value() - prev.get_value()) < epsilon;
+    }
+
+    return prev == next;
+}
+
+}
+
+component_iteration::component_iteration(
+    model_context& cxt, const std::vector<queue_entry>& cells,
+    const std::vector<size_t>& members) :
+    m_context(cxt),
+    m_cells(cells),
+    m_members(members),
+    m_next_results(members.size()),
+    m_max_iterations(cxt.get_config().max_iterations),
+    m_epsilon(cxt.get_config().iteration_epsilon),
+    m_iteration(0)
+{
+}
+
+void component_iteration::invalidate_results()
+{
+    for (size_t i : m_members)
+    {
+        const queue_entry& e = m_cells[i];
+        formula_group_t fg_props = e.p->get_group_properties();
+
+        abs_range_t range(e.p->get_parent_position(e.pos), 1, 1);
+        if (fg_props.grouped)
+            range = abs_range_t(range.first, fg_props.size.row, fg_props.size.column);
+
+        m_context.mp_impl->invalidate_formula_results(range);
+    }
+}
+
+size_t component_iteration::size() const
+{
+    return m_members.size();
+}
+
+void component_iteration::begin()
+{
+    m_iteration = 0;
+
+    for (size_t i : m_members)
+    {
+        const queue_entry& e = m_cells[i];
+        formula_group_t fg_props = e.p->get_group_properties();
+
+        if (fg_props.grouped)
+            e.p->set_raw_result_cache(matrix(fg_props.size.row, fg_props.size.column, 0.0));
+        else
+            e.p->set_raw_result_cache(formula_result(0.0));
+    }
+
+    invalidate_results();
+}
+
+void component_iteration::sweep(size_t first, size_t last)
+{
+    assert(first <= last && last <= m_members.size());
+
+    for (size_t pos = first; pos < last; ++pos)
+    {
+        const queue_entry& e = m_cells[m_members[pos]];
+
+        pooled_interpreter pi(e.p, m_context);
+        formula_interpreter& fin = pi.get();
+        fin.set_origin(e.pos);
+
+        if (fin.interpret())
+            m_next_results[pos].emplace(fin.transfer_result());
+        else
+            m_next_results[pos].emplace(fin.get_error());
+    }
+}
+
+bool component_iteration::end_sweep()
+{
+    ++m_iteration;
+
+    bool all_converged = true;
+
+    for (size_t pos = 0, n = m_members.size(); pos < n; ++pos)
+    {
+        formula_cell& cell = *m_cells[m_members[pos]].p;
+
+        if (all_converged)
+        {
+            const formula_result& prev = cell.get_raw_result_cache(formula_result_wait_policy_t::throw_exception);
+            all_converged = converged(prev, *m_next_results[pos], m_epsilon);
+        }
+
+        cell.set_raw_result_cache(std::move(*m_next_results[pos]));
+        m_next_results[pos].reset();
+    }
+
+    invalidate_results();
+
+    IXION_TRACE("iteration=" << m_iteration << " converged=" << all_converged);
+
+    return all_converged || m_iteration >= m_max_iterations;
+}
+
+void component_iteration::abort()
+{
+    for (size_t pos = 0, n = m_members.size(); pos < n; ++pos)
+    {
+        m_cells[m_members[pos]].p->reset();
+        m_next_results[pos].reset();
+    }
+}
+
+bool component_iteration::run(const cancellation_token* token)
+{
+    begin();
+
+    do
+    {
+        if (token && token->is_cancelled())
+        {
+            abort();
+            return false;
+        }
+
+        sweep(0, m_members.size());
+    }
+    while (!end_sweep());
+
+    return true;
+}
+
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
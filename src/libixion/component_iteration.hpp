@@ -0,0 +1,122 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_COMPONENT_ITERATION_HPP
+#define INCLUDED_IXION_COMPONENT_ITERATION_HPP
+
+#include <ixion/formula_result.hpp>
+
+#include <optional>
+#include <vector>
+
+namespace ixion {
+
+class cancellation_token;
+class model_context;
+struct queue_entry;
+
+/**
+ * Iterative calculation of the formula cells that form a cycle, i.e. of a
+ * cyclic strongly connected component of the dependency graph.
+ *
+ * Each sweep evaluates all cells in the component against the results of
+ * the previous sweep (Jacobi iteration), which means that the cells within
+ * a single sweep can be evaluated in any order, and concurrently.  The
+ * results of a sweep get published all at once at the end of it.  The
+ * iteration stops either when no numeric result changes by the configured
+ * epsilon or more, and no non-numeric result changes at all, or when the
+ * configured maximum number of iterations is reached.
+ */
+class component_iteration
+{
+    model_context& m_context;
+    const std::vector<queue_entry>& m_cells;
+    const std::vector<size_t>& m_members;
+
+    /** results of the current sweep, by member position. */
+    std::vector<std::optional<formula_result>> m_next_results;
+
+    size_t m_max_iterations;
+    double m_epsilon;
+    size_t m_iteration;
+
+    /**
+     * Drop the cached results that have been derived from the previous
+     * results of the cells in the component.
+     */
+    void invalidate_results();
+
+public:
+    component_iteration() = delete;
+    component_iteration(const component_iteration&) = delete;
+    component_iteration& operator= (const component_iteration&) = delete;
+
+    /**
+     * Constructor.
+     *
+     * @param cxt model context instance.
+     * @param cells all cells being calculated.
+     * @param members indices of the cells that belong to the component.
+     */
+    component_iteration(
+        model_context& cxt, const std::vector<queue_entry>& cells,
+        const std::vector<size_t>& members);
+
+    /**
+     * @return number of cells in the component.
+     */
+    size_t size() const;
+
+    /**
+     * Assign the initial result of zero to all cells in the component, so
+     * that the first sweep has results to evaluate against.
+     */
+    void begin();
+
+    /**
+     * Evaluate a range of cells in the component.  It is safe to call this
+     * method concurrently from multiple threads as long as their ranges
+     * don't overlap.
+     *
+     * @param first position of the first cell within the component.
+     * @param last position past the last cell within the component.
+     */
+    void sweep(size_t first, size_t last);
+
+    /**
+     * Publish the results of the current sweep.  This must be called only
+     * after all cells in the component have been evaluated.
+     *
+     * @return true if the iteration has finished, false if another sweep is
+     *         needed.
+     */
+    bool end_sweep();
+
+    /**
+     * Discard the results of an unfinished iteration, and put all cells in
+     * the component back to the dirty state.
+     */
+    void abort();
+
+    /**
+     * Run the whole iteration on the calling thread.
+     *
+     * @param token optional token to check for cancellation before each
+     *              sweep.
+     *
+     * @return true if the iteration has finished, false if it has been
+     *         cancelled, in which case all cells in the component are left
+     *         without results.
+     */
+    bool run(const cancellation_token* token = nullptr);
+};
+
+}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -13,14 +13,20 @@ config::config() :
     sep_function_arg(','),
     sep_matrix_column(','),
     sep_matrix_row(';'),
-    output_precision(-1)
+    output_precision(-1),
+    max_iterations(0),
+    iteration_epsilon(0.001),
+    aggregate_index(false)
 {}
 
 config::config(const config& r) :
     sep_function_arg(r.sep_function_arg),
     sep_matrix_column(r.sep_matrix_column),
     sep_matrix_row(r.sep_matrix_row),
-    output_precision(r.output_precision) {}
+    output_precision(r.output_precision),
+    max_iterations(r.max_iterations),
+    iteration_epsilon(r.iteration_epsilon),
+    aggregate_index(r.aggregate_index) {}
 
 }
 
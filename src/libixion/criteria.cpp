@@ -0,0 +1,519 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "criteria.hpp"
+#include "model_context_impl.hpp"
+#include "numeric_kernels.hpp"
+#include "utf8.hpp"
+#include "utils.hpp"
+
+#include <ixion/formula_result.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <sstream>
+
+namespace ixion { namespace detail {
+
+namespace {
+
+template<typename T>
+bool compare(criterion::op_t op, const T& v1, const T& v2)
+{
+    switch (op)
+    {
+        case criterion::op_t::equal:
+            return v1 == v2;
+        case criterion::op_t::not_equal:
+            return v1 != v2;
+        case criterion::op_t::less:
+            return v1 < v2;
+        case criterion::op_t::less_equal:
+            return v1 <= v2;
+        case criterion::op_t::greater:
+            return v1 > v2;
+        case criterion::op_t::greater_equal:
+            return v1 >= v2;
+    }
+
+    return false;
+}
+
+kernel::op_t to_kernel_op(criterion::op_t op)
+{
+    switch (op)
+    {
+        case criterion::op_t::equal:
+            return kernel::op_t::equal;
+        case criterion::op_t::not_equal:
+            return kernel::op_t::not_equal;
+        case criterion::op_t::less:
+            return kernel::op_t::less;
+        case criterion::op_t::less_equal:
+            return kernel::op_t::less_equal;
+        case criterion::op_t::greater:
+            return kernel::op_t::greater;
+        case criterion::op_t::greater_equal:
+            return kernel::op_t::greater_equal;
+    }
+
+    return kernel::op_t::equal;
+}
+
+/**
+ * Parse a string that consists only of a number.
+ */
+std::optional<double> parse_number(std::string_view s)
+{
+    if (s.empty())
+        return {};
+
+    char c = s[0];
+    if (!(('0' <= c && c <= '9') || c == '.' || c == '-' || c == '+'))
+        // Reject the strings that strtod takes as infinity or NaN.
+        return {};
+
+    std::string buf{s};
+    char* p_end = nullptr;
+    double v = std::strtod(buf.c_str(), &p_end);
+    if (p_end != buf.c_str() + buf.size())
+        return {};
+
+    return v;
+}
+
+bool equals_ignore_case(std::string_view s1, std::string_view s2)
+{
+    auto to_upper = [](char c) { return ('a' <= c && c <= 'z') ? char(c - 'a' + 'A') : c; };
+
+    return s1.size() == s2.size() &&
+        std::equal(s1.begin(), s1.end(), s2.begin(), [&](char c1, char c2) { return to_upper(c1) == to_upper(c2); });
+}
+
+bool has_wildcard(std::string_view s)
+{
+    for (std::size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] == '~')
+            ++i; // skip the escaped character.
+        else if (s[i] == '*' || s[i] == '?')
+            return true;
+    }
+
+    return false;
+}
+
+std::string unescape(std::string_view s)
+{
+    std::string ret;
+    ret.reserve(s.size());
+
+    for (std::size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] == '~' && i + 1 < s.size())
+            ++i;
+
+        ret.push_back(s[i]);
+    }
+
+    return ret;
+}
+
+/**
+ * Match a string against a pattern, in which * matches any sequence of
+ * characters, ? matches any single character, and ~ escapes the character
+ * that follows it.
+ */
+bool match_wildcard(std::string_view pattern, std::string_view s)
+{
+    std::size_t pi = 0, si = 0;
+
+    // Positions right after the last * in the pattern, and of the string
+    // where it started to match, to backtrack to.
+    std::optional<std::size_t> star_pi;
+    std::size_t star_si = 0;
+
+    while (si < s.size())
+    {
+        if (pi < pattern.size())
+        {
+            char c = pattern[pi];
+
+            if (c == '*')
+            {
+                star_pi = ++pi;
+                star_si = si;
+                continue;
+            }
+
+            if (c == '?')
+            {
+                ++pi;
+                si += calc_utf8_char_length(s[si]);
+                continue;
+            }
+
+            std::size_t n = 1;
+            if (c == '~' && pi + 1 < pattern.size())
+            {
+                c = pattern[pi + 1];
+                n = 2;
+            }
+
+            if (c == s[si])
+            {
+                pi += n;
+                ++si;
+                continue;
+            }
+        }
+
+        if (!star_pi)
+            return false;
+
+        // Let the last * match one more character, and try again.
+        pi = *star_pi;
+        si = ++star_si;
+    }
+
+    while (pi < pattern.size() && pattern[pi] == '*')
+        ++pi;
+
+    return pi == pattern.size();
+}
+
+} // anonymous namespace
+
+criterion::criterion(double v) :
+    m_op(op_t::equal), m_operand_type(operand_t::numeric), m_numeric(v), m_boolean(false), m_wildcard(false)
+{
+    build_key();
+}
+
+criterion::criterion(bool b) :
+    m_op(op_t::equal), m_operand_type(operand_t::boolean), m_numeric(0.0), m_boolean(b), m_wildcard(false)
+{
+    build_key();
+}
+
+criterion::criterion(const model_context_impl& cxt, std::string_view s) :
+    m_op(op_t::equal), m_operand_type(operand_t::empty), m_numeric(0.0), m_boolean(false), m_wildcard(false)
+{
+    // Longer operators first.
+    constexpr std::pair<std::string_view, op_t> ops[] = {
+        { "<=", op_t::less_equal },
+        { ">=", op_t::greater_equal },
+        { "<>", op_t::not_equal },
+        { "<", op_t::less },
+        { ">", op_t::greater },
+        { "=", op_t::equal },
+    };
+
+    for (const auto& [prefix, op] : ops)
+    {
+        if (s.substr(0, prefix.size()) == prefix)
+        {
+            m_op = op;
+            s.remove_prefix(prefix.size());
+            break;
+        }
+    }
+
+    if (s.empty())
+    {
+        build_key();
+        return;
+    }
+
+    if (std::optional<double> v = parse_number(s); v)
+    {
+        m_operand_type = operand_t::numeric;
+        m_numeric = *v;
+    }
+    else if (equals_ignore_case(s, "TRUE") || equals_ignore_case(s, "FALSE"))
+    {
+        m_operand_type = operand_t::boolean;
+        m_boolean = equals_ignore_case(s, "TRUE");
+    }
+    else
+    {
+        m_operand_type = operand_t::string;
+
+        bool equality = m_op == op_t::equal || m_op == op_t::not_equal;
+        m_wildcard = equality && has_wildcard(s);
+        m_string = equality && !m_wildcard ? unescape(s) : std::string{s};
+
+        if (equality && !m_wildcard && cxt.has_unique_strings())
+            // A string not in the pool does not match any pooled string.
+            m_string_id = cxt.get_identifier_from_string(m_string);
+    }
+
+    build_key();
+}
+
+const std::string& criterion::get_key() const
+{
+    return m_key;
+}
+
+criterion::op_t criterion::get_op() const
+{
+    return m_op;
+}
+
+std::optional<double> criterion::get_numeric_operand() const
+{
+    if (m_operand_type != operand_t::numeric)
+        return {};
+
+    return m_numeric;
+}
+
+bool criterion::match_numeric(double v) const
+{
+    switch (m_operand_type)
+    {
+        case operand_t::numeric:
+            return compare(m_op, v, m_numeric);
+        case operand_t::empty:
+            return m_op == op_t::not_equal;
+        default:
+            ;
+    }
+
+    return match_other_type();
+}
+
+bool criterion::match_boolean(bool b) const
+{
+    switch (m_operand_type)
+    {
+        case operand_t::boolean:
+            return compare(m_op, b, m_boolean);
+        case operand_t::empty:
+            return m_op == op_t::not_equal;
+        default:
+            ;
+    }
+
+    return match_other_type();
+}
+
+bool criterion::match_string(string_id_t sid, std::string_view s) const
+{
+    if (m_string_id && sid != empty_string_id)
+    {
+        bool equal = sid == *m_string_id;
+        return m_op == op_t::equal ? equal : !equal;
+    }
+
+    return match_string(s);
+}
+
+bool criterion::match_string(std::string_view s) const
+{
+    switch (m_operand_type)
+    {
+        case operand_t::empty:
+        {
+            if (m_op == op_t::equal)
+                return s.empty();
+            if (m_op == op_t::not_equal)
+                return !s.empty();
+
+            return compare_strings(s);
+        }
+        case operand_t::string:
+            return compare_strings(s);
+        default:
+            ;
+    }
+
+    return match_other_type();
+}
+
+bool criterion::match_empty() const
+{
+    if (m_operand_type == operand_t::empty)
+        return m_op == op_t::equal;
+
+    return match_other_type();
+}
+
+bool criterion::match_other_type() const
+{
+    return m_op == op_t::not_equal;
+}
+
+bool criterion::compare_strings(std::string_view s) const
+{
+    if (m_wildcard)
+    {
+        bool matched = match_wildcard(m_string, s);
+        return m_op == op_t::equal ? matched : !matched;
+    }
+
+    return compare(m_op, s, std::string_view{m_string});
+}
+
+void criterion::build_key()
+{
+    std::ostringstream os;
+    os << int(m_op) << ':' << int(m_operand_type) << ':';
+
+    switch (m_operand_type)
+    {
+        case operand_t::numeric:
+            os << std::hexfloat << m_numeric;
+            break;
+        case operand_t::boolean:
+            os << m_boolean;
+            break;
+        case operand_t::string:
+            os << m_wildcard << ':' << m_string;
+            break;
+        case operand_t::empty:
+            break;
+    }
+
+    m_key = os.str();
+}
+
+std::size_t get_data_row_size(const model_context_impl& cxt, const abs_range_t& range)
+{
+    const std::size_t rows = range.last.row - range.first.row + 1;
+    std::size_t ret = 0;
+
+    for (col_t col = range.first.column; col <= range.last.column; ++col)
+    {
+        const column_store_t* store = cxt.get_column(range.first.sheet, col);
+        if (!store)
+            continue;
+
+        std::size_t n = get_column_data_size(*store);
+        if (n > std::size_t(range.first.row))
+            ret = std::max(ret, std::min(n - range.first.row, rows));
+    }
+
+    return ret;
+}
+
+criteria_match match_criterion(const model_context_impl& cxt, const abs_range_t& range, const criterion& crit)
+{
+    assert(range.valid());
+    assert(range.first.sheet == range.last.sheet);
+
+    criteria_match ret;
+    ret.empty_match = crit.match_empty();
+    ret.row_size = get_data_row_size(cxt, range);
+
+    const std::size_t cols = range.last.column - range.first.column + 1;
+
+    if (!ret.row_size)
+        return ret;
+
+    ret.mask.resize(ret.row_size * cols);
+
+    abs_rc_range_t walk_range;
+    walk_range.first.row = range.first.row;
+    walk_range.first.column = range.first.column;
+    walk_range.last.row = range.first.row + ret.row_size - 1;
+    walk_range.last.column = range.last.column;
+
+    const formula_result_wait_policy_t wait_policy = cxt.get_formula_result_wait_policy();
+    const std::optional<double> numeric_operand = crit.get_numeric_operand();
+    const kernel::op_t kernel_op = to_kernel_op(crit.get_op());
+    std::vector<double> buf;
+
+    column_block_callback_t cb = [&](col_t col, row_t row1, row_t row2, const column_block_shape_t& node)
+    {
+        assert(row1 <= row2);
+        row_t length = row2 - row1 + 1;
+        std::uint8_t* p = ret.mask.data() + (col - range.first.column) * ret.row_size + (row1 - range.first.row);
+
+        switch (node.type)
+        {
+            case column_block_t::numeric:
+            {
+                auto values = make_element_range<column_block_t::numeric>{}(node, length);
+
+                if (numeric_operand)
+                {
+                    // Compare the whole block at once.
+                    buf.resize(length);
+                    kernel::transform(kernel_op, values.begin(), *numeric_operand, buf.data(), length);
+                    std::transform(buf.begin(), buf.end(), p, [](double v) { return v != 0.0; });
+                }
+                else
+                {
+                    for (double v : values)
+                        *p++ = crit.match_numeric(v);
+                }
+                break;
+            }
+            case column_block_t::boolean:
+            {
+                for (bool b : make_element_range<column_block_t::boolean>{}(node, length))
+                    *p++ = crit.match_boolean(b);
+                break;
+            }
+            case column_block_t::string:
+            {
+                for (string_id_t sid : make_element_range<column_block_t::string>{}(node, length))
+                {
+                    const std::string* s = cxt.get_string(sid);
+                    *p++ = crit.match_string(sid, s ? std::string_view{*s} : std::string_view{});
+                }
+                break;
+            }
+            case column_block_t::formula:
+            {
+                ret.has_formula = true;
+
+                for (const formula_cell* fc : make_element_range<column_block_t::formula>{}(node, length))
+                {
+                    formula_result res = fc->get_result_cache(wait_policy);
+                    bool matched = false;
+
+                    switch (res.get_type())
+                    {
+                        case formula_result::result_type::value:
+                            matched = crit.match_numeric(res.get_value());
+                            break;
+                        case formula_result::result_type::boolean:
+                            matched = crit.match_boolean(res.get_boolean());
+                            break;
+                        case formula_result::result_type::string:
+                            matched = crit.match_string(res.get_string());
+                            break;
+                        case formula_result::result_type::error:
+                        case formula_result::result_type::matrix:
+                            break;
+                    }
+
+                    *p++ = matched;
+                }
+                break;
+            }
+            case column_block_t::empty:
+            case column_block_t::unknown:
+                std::fill(p, p + length, ret.empty_match);
+                break;
+        }
+
+        return true;
+    };
+
+    cxt.walk(range.first.sheet, walk_range, cb);
+
+    return ret;
+}
+
+}}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,174 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_CRITERIA_HPP
+#define INCLUDED_IXION_CRITERIA_HPP
+
+#include <ixion/address.hpp>
+#include <ixion/types.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ixion { namespace detail {
+
+class model_context_impl;
+
+/**
+ * Criterion of the conditional functions such as COUNTIF and SUMIFS,
+ * compiled once from its argument into a typed predicate on the cell
+ * values.
+ *
+ * <p>A criterion string may start with one of the relational operators
+ * =, &lt;&gt;, &lt;, &lt;=, &gt; and &gt;=, followed by the operand.  An
+ * operand that is a number, or TRUE or FALSE, only matches the numeric or
+ * the boolean values respectively.  A string operand of the equality may
+ * contain the wildcards * and ?, which ~ escapes.  An empty operand
+ * matches the empty cells with =, and the non-empty cells with
+ * &lt;&gt;.</p>
+ *
+ * <p>The values of different types never match each other, except with
+ * &lt;&gt; which matches all values of the other types.  The string
+ * comparisons are case-sensitive, same as the string comparison
+ * operators.</p>
+ */
+class criterion
+{
+public:
+    enum class op_t { equal, not_equal, less, less_equal, greater, greater_equal };
+
+    /**
+     * Criterion matching the numeric values equal to the specified value.
+     */
+    explicit criterion(double v);
+
+    /**
+     * Criterion matching the boolean values equal to the specified value.
+     */
+    explicit criterion(bool b);
+
+    /**
+     * Compile a criterion string.
+     *
+     * @param cxt model context whose string pool the string values of the
+     *            cells are interned in.
+     * @param s criterion string.
+     */
+    criterion(const model_context_impl& cxt, std::string_view s);
+
+    /**
+     * @return string that uniquely identifies the criterion, for caching
+     *         the results of matching it.
+     */
+    const std::string& get_key() const;
+
+    op_t get_op() const;
+
+    /**
+     * @return numeric operand, or nothing if the operand is not numeric.
+     */
+    std::optional<double> get_numeric_operand() const;
+
+    bool match_numeric(double v) const;
+    bool match_boolean(bool b) const;
+
+    /**
+     * Match a string value interned in the string pool.  The equality of
+     * strings without any wildcards gets checked through the identifiers
+     * of the strings, without comparing their text.
+     *
+     * @param sid identifier of the string.
+     * @param s string value.
+     */
+    bool match_string(string_id_t sid, std::string_view s) const;
+
+    /**
+     * Match a string value not interned in the string pool, such as the
+     * string result of a formula cell.
+     */
+    bool match_string(std::string_view s) const;
+
+    bool match_empty() const;
+
+private:
+    enum class operand_t { empty, numeric, boolean, string };
+
+    bool match_other_type() const;
+    bool compare_strings(std::string_view s) const;
+    void build_key();
+
+private:
+    op_t m_op;
+    operand_t m_operand_type;
+    double m_numeric;
+    bool m_boolean;
+
+    /** string operand, with the escapes resolved when it has no wildcards. */
+    std::string m_string;
+
+    /**
+     * Identifier of the string operand in the string pool, or nothing if
+     * the string operand contains wildcards or the string pool cannot be
+     * used to check the equality of strings.
+     */
+    std::optional<string_id_t> m_string_id;
+
+    bool m_wildcard;
+    std::string m_key;
+};
+
+/**
+ * Result of matching a criterion against the cells of a range, as a map
+ * of one byte per cell that is 1 for a matching cell and 0 otherwise.
+ *
+ * <p>Only the rows up to the last non-empty row of the columns of the range
+ * are stored.  The cells in the rows past them are empty, and they all
+ * match or not depending on whether the criterion matches the empty
+ * cells.</p>
+ */
+struct criteria_match
+{
+    /** match map of the stored rows, in column-major order. */
+    std::vector<std::uint8_t> mask;
+
+    /** number of stored rows of each column. */
+    std::size_t row_size = 0;
+
+    /** whether the empty cells in the rows past the stored ones match. */
+    bool empty_match = false;
+
+    /** whether the range contains a formula cell. */
+    bool has_formula = false;
+};
+
+/**
+ * Get the number of rows of a range up to the last non-empty row of its
+ * columns.  The cells in the rows past it are all empty.
+ *
+ * @param cxt model context to get the columns from.
+ * @param range range within a single sheet and within the sheet size.
+ */
+std::size_t get_data_row_size(const model_context_impl& cxt, const abs_range_t& range);
+
+/**
+ * Match a criterion against the cells of a range, block by block.
+ *
+ * @param cxt model context to get the values of the cells from.
+ * @param range range of cells within a single sheet and within the sheet
+ *              size.
+ * @param crit criterion to match.
+ */
+criteria_match match_criterion(const model_context_impl& cxt, const abs_range_t& range, const criterion& crit);
+
+}}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
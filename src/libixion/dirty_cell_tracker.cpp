@@ -265,6 +265,11 @@ abs_range_set_t dirty_cell_tracker::query_dirty_cells(const abs_range_set_t& mod
     return dirty_formula_cells;
 }
 
+abs_range_set_t dirty_cell_tracker::query_dependents(const abs_range_t& range) const
+{
+    return mp_impl->get_affected_cell_ranges(range);
+}
+
 std::vector<abs_range_t> dirty_cell_tracker::query_and_sort_dirty_cells(const abs_range_t& modified_cell) const
 {
     abs_range_set_t mod_cells;
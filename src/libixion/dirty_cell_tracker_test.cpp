@@ -377,6 +377,36 @@ void test_listen_to_3d_range()
     assert(tracker.empty());
 }
 
+void test_query_dependents()
+{
+    IXION_TEST_FUNC_SCOPE;
+
+    dirty_cell_tracker tracker;
+
+    abs_address_t A1(0, 0, 0);
+    abs_address_t A2(0, 1, 0);
+    abs_address_t A3(0, 2, 0);
+    abs_address_t B1(0, 0, 1);
+
+    // A2 listens to A1, A3 listens to A2, and B1 listens to A1:A3.
+    tracker.add(A2, A1);
+    tracker.add(A3, A2);
+    tracker.add(B1, abs_range_t(A1, 3, 1));
+
+    // Only the direct dependents should be returned.
+    abs_range_set_t res = tracker.query_dependents(A1);
+    assert(res.size() == 2);
+    assert(res.count(A2) > 0);
+    assert(res.count(B1) > 0);
+
+    res = tracker.query_dependents(A3);
+    assert(res.size() == 1);
+    assert(res.count(B1) > 0);
+
+    res = tracker.query_dependents(B1);
+    assert(res.empty());
+}
+
 int main()
 {
     test_empty_query();
@@ -388,6 +418,7 @@ int main()
     test_recursive_tracking();
     test_listen_to_cell_in_range();
     test_listen_to_3d_range();
+    test_query_dependents();
 
     return EXIT_SUCCESS;
 }
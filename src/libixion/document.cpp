@@ -11,8 +11,12 @@
 #include "ixion/formula_name_resolver.hpp"
 #include "ixion/formula.hpp"
 #include "ixion/cell_access.hpp"
+#include "ixion/cancellation_token.hpp"
+
+#include "formula_calc.hpp"
 
 #include <cstring>
+#include <future>
 #include <sstream>
 
 namespace ixion {
@@ -164,15 +168,98 @@ struct document::impl
         modified_formula_cells.insert(addr);
     }
 
-    void calculate(size_t thread_count)
+    std::vector<abs_range_t> calculate_sorted(
+        const std::vector<abs_range_t>& sorted_cells, size_t thread_count,
+        const cancellation_token* token)
     {
-        auto sorted_cells = query_and_sort_dirty_cells(cxt, modified_cells, &modified_formula_cells);
+        if (token)
+            return calculate_sorted_cells(cxt, sorted_cells, thread_count, *token);
+
         calculate_sorted_cells(cxt, sorted_cells, thread_count);
+        return std::vector<abs_range_t>();
+    }
+
+    bool calculate(size_t thread_count, const cancellation_token* token)
+    {
+        auto sorted_cells = query_and_sort_dirty_cells(cxt, modified_cells, &modified_formula_cells);
+        auto unfinished = calculate_sorted(sorted_cells, thread_count, token);
+
+        // Keep the cells left uncalculated dirty, so that the next
+        // calculation picks up where this one has left off.
         modified_cells.clear();
         modified_formula_cells.clear();
+        modified_formula_cells.insert(unfinished.begin(), unfinished.end());
+
+        return unfinished.empty();
+    }
+
+    bool calculate_cells(
+        const std::vector<cell_pos>& cells, size_t thread_count, const cancellation_token* token)
+    {
+        abs_address_set_t targets;
+        for (const cell_pos& pos : cells)
+            targets.insert(to_address(cxt, *resolver, pos));
+
+        auto sorted_cells = query_and_sort_dirty_cells(cxt, modified_cells, &modified_formula_cells);
+        auto precedent_cells = extract_dirty_precedent_cells(cxt, sorted_cells, targets);
+        auto unfinished = calculate_sorted(precedent_cells, thread_count, token);
+
+        // The cells left uncalculated are all the dirty formula cells there
+        // are, since none of them is a precedent of the calculated ones.
+        modified_cells.clear();
+        modified_formula_cells.clear();
+        modified_formula_cells.insert(sorted_cells.begin(), sorted_cells.end());
+        modified_formula_cells.insert(unfinished.begin(), unfinished.end());
+
+        return unfinished.empty();
+    }
+};
+
+struct calculation_handle::impl
+{
+    cancellation_token token;
+    std::shared_future<bool> outcome;
+
+    ~impl()
+    {
+        // The calculation refers to the token.
+        if (outcome.valid())
+            outcome.wait();
     }
 };
 
+calculation_handle::calculation_handle(std::unique_ptr<impl> p) :
+    mp_impl(std::move(p)) {}
+
+calculation_handle::calculation_handle(calculation_handle&& other) = default;
+calculation_handle& calculation_handle::operator= (calculation_handle&& other) = default;
+calculation_handle::~calculation_handle() = default;
+
+bool calculation_handle::is_done() const
+{
+    return wait_for(std::chrono::milliseconds(0));
+}
+
+void calculation_handle::wait() const
+{
+    mp_impl->outcome.wait();
+}
+
+bool calculation_handle::wait_for(std::chrono::milliseconds timeout) const
+{
+    return mp_impl->outcome.wait_for(timeout) == std::future_status::ready;
+}
+
+void calculation_handle::cancel()
+{
+    mp_impl->token.cancel();
+}
+
+bool calculation_handle::get() const
+{
+    return mp_impl->outcome.get();
+}
+
 document::document() :
     mp_impl(std::make_unique<impl>()) {}
 
@@ -233,7 +320,65 @@ void document::set_formula_cell(const cell_pos& pos, std::string_view formula)
 
 void document::calculate(size_t thread_count)
 {
-    mp_impl->calculate(thread_count);
+    mp_impl->calculate(thread_count, nullptr);
+}
+
+bool document::calculate(size_t thread_count, const cancellation_token& token)
+{
+    return mp_impl->calculate(thread_count, &token);
+}
+
+calculation_handle document::calculate_async(
+    size_t thread_count, calc_callback_type callback, size_t batch_size)
+{
+    impl& doc = *mp_impl;
+
+    auto sorted_cells = query_and_sort_dirty_cells(doc.cxt, doc.modified_cells, &doc.modified_formula_cells);
+    doc.modified_cells.clear();
+    doc.modified_formula_cells.clear();
+
+    // Reset the cells on this thread before returning, so that reading
+    // their results from this point on blocks until they are calculated.
+    auto calc = std::make_unique<sorted_cells_calculation>(doc.cxt, std::move(sorted_cells), thread_count);
+
+    auto handle = std::make_unique<calculation_handle::impl>();
+    calc->set_cancellation_token(&handle->token);
+    if (callback)
+        calc->set_progress_callback(std::move(callback), batch_size);
+
+    handle->outcome = std::async(std::launch::async, [&doc, calc = std::move(calc)]()
+    {
+        std::vector<abs_range_t> unfinished;
+
+        try
+        {
+            unfinished = calc->run();
+        }
+        catch (...)
+        {
+            const std::vector<abs_range_t>& cells = calc->get_cells();
+            doc.modified_formula_cells.insert(cells.begin(), cells.end());
+            throw;
+        }
+
+        // Keep the cells left uncalculated dirty, so that the next
+        // calculation picks up where this one has left off.
+        doc.modified_formula_cells.insert(unfinished.begin(), unfinished.end());
+        return unfinished.empty();
+    }).share();
+
+    return calculation_handle(std::move(handle));
+}
+
+void document::calculate_cells(const std::vector<cell_pos>& cells, size_t thread_count)
+{
+    mp_impl->calculate_cells(cells, thread_count, nullptr);
+}
+
+bool document::calculate_cells(
+    const std::vector<cell_pos>& cells, size_t thread_count, const cancellation_token& token)
+{
+    return mp_impl->calculate_cells(cells, thread_count, &token);
 }
 
 }
@@ -10,10 +10,13 @@
 #include <ixion/document.hpp>
 #include <ixion/address.hpp>
 #include <ixion/cell_access.hpp>
+#include <ixion/cancellation_token.hpp>
+#include <ixion/exceptions.hpp>
 
 #include <iostream>
 #include <cassert>
 #include <sstream>
+#include <future>
 
 using namespace std;
 using namespace ixion;
@@ -176,6 +179,241 @@ void test_rename_sheets()
     }
 }
 
+void test_calculate_cells()
+{
+    IXION_TEST_FUNC_SCOPE;
+
+    document doc;
+    doc.append_sheet("test");
+    doc.set_numeric_cell("A1", 1.0);
+    doc.set_numeric_cell("A2", 2.0);
+    doc.set_formula_cell("B1", "A1*10");
+    doc.set_formula_cell("B2", "B1+A2");
+    doc.set_formula_cell("C1", "A2*100");
+    doc.set_formula_cell("C2", "B1+C1");
+    doc.calculate(0);
+
+    assert(doc.get_numeric_value("B2") == 12.0);
+    assert(doc.get_numeric_value("C2") == 210.0);
+
+    // Only B1 and B2 need calculating to obtain the result of B2.  C2 is
+    // also dirty, but should remain uncalculated.
+    for (size_t thread_count : {0, 2})
+    {
+        double c2 = doc.get_numeric_value("C2");
+
+        doc.set_numeric_cell("A1", 3.0 + thread_count);
+        doc.calculate_cells({"B2"}, thread_count);
+
+        double expected = (3.0 + thread_count) * 10.0;
+        assert(doc.get_numeric_value("B2") == expected + 2.0);
+        assert(doc.get_numeric_value("C2") == c2);
+
+        // Calculate the rest.
+        doc.calculate(thread_count);
+        assert(doc.get_numeric_value("C2") == expected + 200.0);
+    }
+
+    // Cells that are not dirty are simply ignored.
+    doc.calculate_cells({"C1", "A1"}, 0);
+    assert(doc.get_numeric_value("C1") == 200.0);
+}
+
+void test_cancellation_token()
+{
+    IXION_TEST_FUNC_SCOPE;
+
+    cancellation_token token;
+    assert(!token.is_cancelled());
+
+    token.cancel();
+    assert(token.is_cancelled());
+
+    token.reset();
+    assert(!token.is_cancelled());
+
+    token.set_timeout(std::chrono::hours(1));
+    assert(!token.is_cancelled());
+
+    token.set_deadline(cancellation_token::clock_type::now());
+    assert(token.is_cancelled());
+
+    token.reset();
+    assert(!token.is_cancelled());
+}
+
+void test_cancelled_calculation()
+{
+    IXION_TEST_FUNC_SCOPE;
+
+    auto is_dirty = [](const document& doc, const char* pos)
+    {
+        try
+        {
+            doc.get_numeric_value(pos);
+        }
+        catch (const formula_error& e)
+        {
+            return e.get_error() == formula_error_t::ref_result_not_available;
+        }
+
+        return false;
+    };
+
+    for (size_t thread_count : {0, 2})
+    {
+        document doc;
+        doc.append_sheet("test");
+        doc.set_numeric_cell("A1", 1.0);
+        doc.set_formula_cell("B1", "A1*10");
+        doc.set_formula_cell("B2", "B1+1");
+        doc.calculate(thread_count);
+        assert(doc.get_numeric_value("B2") == 11.0);
+
+        // A cancelled calculation leaves all cells it has not reached dirty.
+        cancellation_token token;
+        token.cancel();
+        doc.set_numeric_cell("A1", 2.0);
+        bool finished = doc.calculate(thread_count, token);
+        assert(!finished);
+        assert(is_dirty(doc, "B1"));
+        assert(is_dirty(doc, "B2"));
+
+        // So does one that has run past its deadline.
+        token.reset();
+        token.set_deadline(cancellation_token::clock_type::now());
+        finished = doc.calculate_cells({"B1"}, thread_count, token);
+        assert(!finished);
+        assert(is_dirty(doc, "B1"));
+
+        // The next calculation picks up the uncalculated cells.
+        token.reset();
+        finished = doc.calculate(thread_count, token);
+        assert(finished);
+        assert(doc.get_numeric_value("B1") == 20.0);
+        assert(doc.get_numeric_value("B2") == 21.0);
+    }
+}
+
+/**
+ * Set a chain of formulas into B1:B50, each depending on the previous one,
+ * plus one more formula in C1.  All of them depend on A1.
+ */
+void set_formula_chain(document& doc)
+{
+    doc.set_numeric_cell("A1", 1.0);
+    doc.set_formula_cell("B1", "A1+1");
+
+    for (int row = 2; row <= 50; ++row)
+    {
+        std::ostringstream pos, exp;
+        pos << 'B' << row;
+        exp << 'B' << (row - 1) << "+1";
+        doc.set_formula_cell(pos.str(), exp.str());
+    }
+
+    doc.set_formula_cell("C1", "A1*2");
+}
+
+void test_calculate_async()
+{
+    IXION_TEST_FUNC_SCOPE;
+
+    for (size_t thread_count : {0, 2})
+    {
+        document doc;
+        doc.append_sheet("test");
+        set_formula_chain(doc);
+
+        // Hold the calculation in the callback after the first cell gets
+        // reported.  The callback never gets called concurrently.
+        std::promise<abs_address_t> first;
+        std::promise<void> go;
+        std::shared_future<void> go_future = go.get_future().share();
+        std::vector<abs_range_t> reported;
+
+        auto callback = [&](const std::vector<abs_range_t>& cells)
+        {
+            bool first_call = reported.empty();
+            reported.insert(reported.end(), cells.begin(), cells.end());
+
+            if (first_call)
+            {
+                first.set_value(cells[0].first);
+                go_future.wait();
+            }
+        };
+
+        calculation_handle handle = doc.calculate_async(thread_count, callback, 1);
+
+        // The result of the reported cell is readable while the rest of the
+        // cells are still being calculated.
+        abs_address_t pos = first.get_future().get();
+        double expected = pos.column == 1 ? pos.row + 2.0 : 2.0;
+        assert(doc.get_numeric_value(pos) == expected);
+        assert(!handle.is_done());
+
+        go.set_value();
+
+        // Reading the result of a cell yet to be calculated blocks until it
+        // gets calculated.
+        assert(doc.get_numeric_value("B50") == 51.0);
+
+        assert(handle.get());
+        assert(handle.is_done());
+        assert(reported.size() == 51);
+    }
+}
+
+void test_cancel_calculate_async()
+{
+    IXION_TEST_FUNC_SCOPE;
+
+    for (size_t thread_count : {0, 2})
+    {
+        document doc;
+        doc.append_sheet("test");
+        set_formula_chain(doc);
+
+        // Cancel the calculation from within the callback, once the first
+        // cell gets reported.
+        std::promise<calculation_handle*> handle_ptr;
+        std::shared_future<calculation_handle*> handle_future = handle_ptr.get_future().share();
+        size_t reported = 0;
+
+        auto callback = [&](const std::vector<abs_range_t>& cells)
+        {
+            if (!reported)
+                handle_future.get()->cancel();
+
+            reported += cells.size();
+        };
+
+        calculation_handle handle = doc.calculate_async(thread_count, callback, 1);
+        handle_ptr.set_value(&handle);
+
+        // Reading a cell left uncalculated does not block.
+        bool threw = false;
+        try
+        {
+            doc.get_numeric_value("B50");
+        }
+        catch (const formula_error& e)
+        {
+            threw = e.get_error() == formula_error_t::ref_result_not_available;
+        }
+
+        assert(threw);
+        assert(!handle.get());
+        assert(reported < 51);
+
+        // The next calculation resumes from the uncalculated cells.
+        doc.calculate(thread_count);
+        assert(doc.get_numeric_value("B50") == 51.0);
+        assert(doc.get_numeric_value("C1") == 2.0);
+    }
+}
+
 int main()
 {
     test_basic_calc();
@@ -183,6 +421,11 @@ int main()
     test_boolean_io();
     test_custom_cell_address_syntax();
     test_rename_sheets();
+    test_calculate_cells();
+    test_cancellation_token();
+    test_cancelled_calculation();
+    test_calculate_async();
+    test_cancel_calculate_async();
 
     return EXIT_SUCCESS;
 }
@@ -310,6 +310,130 @@ void check_sheet_or_throw(const char* func_name, sheet_t sheet, const model_cont
     throw ixion::formula_registration_error(os.str());
 }
 
+/**
+ * Get the reference that a function argument consists of, either directly
+ * or through a named expression.
+ *
+ * @return pointer to the reference token, or nullptr if the argument is
+ *         not a single reference.
+ */
+const formula_token* get_ref_argument(
+    const model_context& cxt, const abs_address_t& pos,
+    formula_tokens_t::const_iterator first, formula_tokens_t::const_iterator last)
+{
+    if (std::distance(first, last) != 1)
+        return nullptr;
+
+    const formula_token* t = &*first;
+
+    if (t->opcode == fop_named_expression)
+    {
+        const named_expression_t* named_exp =
+            cxt.get_named_expression(pos.sheet, std::get<std::string>(t->value));
+
+        if (!named_exp || named_exp->tokens.size() != 1u)
+            return nullptr;
+
+        t = &named_exp->tokens.front();
+    }
+
+    return (t->opcode == fop_single_ref || t->opcode == fop_range_ref) ? t : nullptr;
+}
+
+abs_range_t to_sheet_range(const formula_token& t, const abs_address_t& pos, const rc_size_t& sheet_size)
+{
+    if (t.opcode == fop_single_ref)
+        return std::get<address_t>(t.value).to_abs(pos);
+
+    abs_range_t range = std::get<range_t>(t.value).to_abs(pos);
+    if (range.all_columns())
+    {
+        range.first.column = 0;
+        range.last.column = sheet_size.column - 1;
+    }
+    if (range.all_rows())
+    {
+        range.first.row = 0;
+        range.last.row = sheet_size.row - 1;
+    }
+    range.reorder();
+    return range;
+}
+
+/**
+ * SUMIF and AVERAGEIF extend their range of the values to the shape of
+ * their criteria range, from its top-left cell.  Get the extended ranges
+ * of the values of these functions in a formula, which the formula
+ * depends on in addition to the references in it.  Only the arguments that
+ * are references by themselves can be tracked; the others are resolved
+ * during the calculation.
+ */
+std::vector<abs_range_t> get_extended_value_ranges(
+    const model_context& cxt, const abs_address_t& pos, const formula_tokens_t& tokens)
+{
+    std::vector<abs_range_t> ranges;
+    const rc_size_t sheet_size = cxt.get_sheet_size();
+
+    for (auto it = tokens.begin(), it_end = tokens.end(); it != it_end; ++it)
+    {
+        if (it->opcode != fop_function)
+            continue;
+
+        auto func = std::get<formula_function_t>(it->value);
+        if (func != formula_function_t::func_sumif && func != formula_function_t::func_averageif)
+            continue;
+
+        auto it_arg = std::next(it);
+        if (it_arg == it_end || it_arg->opcode != fop_open)
+            continue;
+
+        // Split the arguments at the separators outside of the nested
+        // parentheses.
+        std::vector<std::pair<formula_tokens_t::const_iterator, formula_tokens_t::const_iterator>> args;
+        auto it_begin = ++it_arg;
+        int depth = 0;
+        for (; it_arg != it_end; ++it_arg)
+        {
+            if (it_arg->opcode == fop_open)
+                ++depth;
+            else if (it_arg->opcode == fop_close && depth-- == 0)
+                break;
+            else if (it_arg->opcode == fop_sep && depth == 0)
+            {
+                args.emplace_back(it_begin, it_arg);
+                it_begin = std::next(it_arg);
+            }
+        }
+
+        if (it_arg == it_end)
+            break;
+
+        args.emplace_back(it_begin, it_arg);
+
+        if (args.size() != 3u)
+            continue;
+
+        const formula_token* crit_ref = get_ref_argument(cxt, pos, args[0].first, args[0].second);
+        const formula_token* value_ref = get_ref_argument(cxt, pos, args[2].first, args[2].second);
+        if (!crit_ref || !value_ref)
+            continue;
+
+        abs_range_t shape = to_sheet_range(*crit_ref, pos, sheet_size);
+        abs_range_t values = to_sheet_range(*value_ref, pos, sheet_size);
+
+        abs_range_t extended = values;
+        extended.last.row = std::min<row_t>(
+            values.first.row + shape.last.row - shape.first.row, sheet_size.row - 1);
+        extended.last.column = std::min<col_t>(
+            values.first.column + shape.last.column - shape.first.column, sheet_size.column - 1);
+
+        if (extended.last.row > values.last.row || extended.last.column > values.last.column)
+            ranges.push_back(extended);
+    }
+
+    return ranges;
+}
+
 }
 
 void register_formula_cell(
@@ -389,9 +513,15 @@ void register_formula_cell(
         }
     }
 
-    // Check if the cell is volatile.
     const formula_tokens_store_ptr_t& ts = cell->get_tokens();
-    if (ts && has_volatile(ts->get()))
+    if (!ts)
+        return;
+
+    for (const abs_range_t& range : get_extended_value_ranges(cxt, pos, ts->get()))
+        tracker.add(src_pos, range);
+
+    // Check if the cell is volatile.
+    if (has_volatile(ts->get()))
         tracker.add_volatile(pos);
 }
 
@@ -435,6 +565,12 @@ void unregister_formula_cell(model_context& cxt, const abs_address_t& pos)
                 ; // ignore the rest.
         }
     }
+
+    if (const formula_tokens_store_ptr_t& ts = fcell->get_tokens(); ts)
+    {
+        for (const abs_range_t& range : get_extended_value_ranges(cxt, pos, ts->get()))
+            tracker.remove(pos, range);
+    }
 }
 
 abs_address_set_t query_dirty_cells(model_context& cxt, const abs_address_set_t& modified_cells)
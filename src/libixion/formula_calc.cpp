@@ -7,11 +7,17 @@
 
 #include <ixion/formula.hpp>
 #include <ixion/address.hpp>
+#include <ixion/cancellation_token.hpp>
 #include <ixion/cell.hpp>
 #include <ixion/formula_name_resolver.hpp>
 #include <ixion/model_context.hpp>
+#include <ixion/config.hpp>
 
+#include "formula_calc.hpp"
+#include "formula_group_evaluator.hpp"
 #include "queue_entry.hpp"
+#include "cell_dependency_graph.hpp"
+#include "component_iteration.hpp"
 #include "debug.hpp"
 
 #if IXION_THREADS
@@ -19,69 +25,302 @@
 #endif
 
 #include <algorithm>
+#include <cassert>
 
 namespace ixion {
 
-namespace {
-
-class calc_scope
+std::vector<abs_range_t> extract_dirty_precedent_cells(
+    model_context& cxt, std::vector<abs_range_t>& formula_cells,
+    const abs_address_set_t& target_cells)
 {
-    model_context& m_cxt;
-public:
-    calc_scope(model_context& cxt) : m_cxt(cxt)
+    std::vector<queue_entry> entries;
+    entries.reserve(formula_cells.size());
+
+    for (const abs_range_t& r : formula_cells)
+        entries.emplace_back(cxt.get_formula_cell(r.first), r.first);
+
+    const size_t n = entries.size();
+
+    // Collect the precedent cells of each cell by reversing the relations.
+    cell_dependency_graph graph(cxt, entries);
+    graph.build();
+
+    std::vector<std::vector<size_t>> precedents(n);
+    for (size_t i = 0; i < n; ++i)
     {
-        m_cxt.notify(formula_event_t::calculation_begins);
+        for (size_t dep : graph.get_dependents(i))
+            precedents[dep].push_back(i);
     }
 
-    ~calc_scope()
+    std::vector<bool> extracted(n, false);
+    std::vector<size_t> pending;
+
+    for (size_t i = 0; i < n; ++i)
     {
-        m_cxt.notify(formula_event_t::calculation_ends);
+        // A target cell may be any cell in a group.
+        const abs_range_t& r = formula_cells[i];
+        bool is_target = r.first == r.last ?
+            target_cells.count(r.first) > 0 :
+            std::any_of(target_cells.begin(), target_cells.end(),
+                [&r](const abs_address_t& pos) { return r.contains(pos); });
+
+        if (is_target)
+        {
+            extracted[i] = true;
+            pending.push_back(i);
+        }
     }
-};
 
+    while (!pending.empty())
+    {
+        size_t i = pending.back();
+        pending.pop_back();
+
+        for (size_t prec : precedents[i])
+        {
+            if (extracted[prec])
+                continue;
+
+            extracted[prec] = true;
+            pending.push_back(prec);
+        }
+    }
+
+    std::vector<abs_range_t> ret, remaining;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (extracted[i])
+            ret.push_back(formula_cells[i]);
+        else
+            remaining.push_back(formula_cells[i]);
+    }
+
+    formula_cells.swap(remaining);
+    return ret;
 }
 
-void calculate_sorted_cells(
-    model_context& cxt, const std::vector<abs_range_t>& formula_cells, size_t thread_count)
+namespace {
+
+/**
+ * Calculate the cells, and return the indices of the cells left
+ * uncalculated due to cancellation, in ascending order.
+ */
+std::vector<size_t> calculate_entries(
+    model_context& cxt, std::vector<queue_entry>&& entries, size_t thread_count,
+    const cancellation_token* token, calc_progress* progress)
+{
+    std::vector<size_t> unfinished;
+
+    auto is_cancelled = [token]() { return token && token->is_cancelled(); };
+
+    // Evaluate the runs of cells sharing the same tokens up front.  The
+    // interpretation of the evaluated cells returns immediately.
+    formula_group_evaluator(cxt).run(entries, token);
+
+    if (!thread_count)
+    {
+        // Detect circular dependencies in a single pass over the dependency
+        // graph.
+        cell_dependency_graph graph(cxt, entries);
+        graph.build();
+        graph.find_components();
+
+        if (!cxt.get_config().max_iterations)
+        {
+            // Mark those circular dependent cells with appropriate error
+            // flags, then interpret cells using just a single thread.
+            graph.flag_circular_cells();
+
+            for (size_t i = 0, n = entries.size(); i < n; ++i)
+            {
+                if (is_cancelled())
+                {
+                    // The cells are sorted, so none of the remaining cells
+                    // is a precedent of the cells calculated so far.
+                    for (; i < n; ++i)
+                        unfinished.push_back(i);
+                    break;
+                }
+
+                queue_entry& e = entries[i];
+                e.p->interpret(cxt, e.pos);
+
+                if (progress)
+                    progress->report(i);
+            }
+
+            return unfinished;
+        }
+
+        // Interpret cells one component at a time in topological order,
+        // and iterate the cells in each cycle until they converge.
+        for (size_t c = 0, n = graph.get_component_count(); c < n; ++c)
+        {
+            const std::vector<size_t>& members = graph.get_component(c);
+
+            if (is_cancelled())
+            {
+                for (; c < n; ++c)
+                {
+                    const std::vector<size_t>& rest = graph.get_component(c);
+                    unfinished.insert(unfinished.end(), rest.begin(), rest.end());
+                }
+                break;
+            }
+
+            if (graph.is_cyclic_component(c))
+            {
+                component_iteration iteration(cxt, entries, members);
+                if (!iteration.run(token))
+                    unfinished.insert(unfinished.end(), members.begin(), members.end());
+                else if (progress)
+                    progress->report(members);
+                continue;
+            }
+
+            assert(members.size() == 1);
+            queue_entry& e = entries[members[0]];
+            e.p->interpret(cxt, e.pos);
+
+            if (progress)
+                progress->report(members[0]);
+        }
+
+        std::sort(unfinished.begin(), unfinished.end());
+        return unfinished;
+    }
+
+#if IXION_THREADS
+    // Detect circular dependencies, then interpret cells in topological
+    // order using threads.
+    formula_cell_queue queue(cxt, std::move(entries), thread_count, token, progress);
+    unfinished = queue.run();
+#endif
+
+    return unfinished;
+}
+
+}
+
+sorted_cells_calculation::sorted_cells_calculation(
+    model_context& cxt, std::vector<abs_range_t> cells, size_t thread_count) :
+    m_context(cxt),
+    m_cells(std::move(cells)),
+    m_thread_count(thread_count),
+    m_running(true),
+    mp_token(nullptr),
+    m_batch_size(0)
 {
 #if IXION_THREADS == 0
-    thread_count = 0;  // threads are disabled thus not to be used.
+    m_thread_count = 0;  // threads are disabled thus not to be used.
 #endif
 
-    calc_scope cs(cxt);
+    m_context.notify(formula_event_t::calculation_begins);
 
-    std::vector<queue_entry> entries;
-    entries.reserve(formula_cells.size());
+    m_entries.reserve(m_cells.size());
 
-    for (const abs_range_t& r : formula_cells)
-        entries.emplace_back(cxt.get_formula_cell(r.first), r.first);
+    for (const abs_range_t& r : m_cells)
+        m_entries.emplace_back(m_context.get_formula_cell(r.first), r.first);
 
     // Reset cell status.
-    for (queue_entry& e : entries)
+    for (queue_entry& e : m_entries)
     {
         e.p->reset();
-        IXION_TRACE("pos=" << e.pos.get_name() << " formula=" << detail::print_formula_expression(cxt, e.pos, *e.p));
+        IXION_TRACE("pos=" << e.pos.get_name() << " formula=" << detail::print_formula_expression(m_context, e.pos, *e.p));
     }
+}
 
-    // First, detect circular dependencies and mark those circular
-    // dependent cells with appropriate error flags.
-    for (queue_entry& e : entries)
-        e.p->check_circular(cxt, e.pos);
+sorted_cells_calculation::~sorted_cells_calculation()
+{
+    end();
+}
 
-    if (!thread_count)
+void sorted_cells_calculation::end()
+{
+    if (!m_running)
+        return;
+
+    m_running = false;
+    m_context.notify(formula_event_t::calculation_ends);
+}
+
+void sorted_cells_calculation::set_cancellation_token(const cancellation_token* token)
+{
+    mp_token = token;
+}
+
+void sorted_cells_calculation::set_progress_callback(calc_progress::callback_type callback, size_t batch_size)
+{
+    m_callback = std::move(callback);
+    m_batch_size = batch_size;
+}
+
+const std::vector<abs_range_t>& sorted_cells_calculation::get_cells() const
+{
+    return m_cells;
+}
+
+std::vector<abs_range_t> sorted_cells_calculation::run()
+{
+    assert(m_running);
+
+    // The queue entries get moved into the calculation, so keep the cell
+    // pointers to handle the cells left uncalculated.
+    std::vector<formula_cell*> cells;
+    cells.reserve(m_entries.size());
+    for (const queue_entry& e : m_entries)
+        cells.push_back(e.p);
+
+    std::unique_ptr<calc_progress> progress;
+    if (m_callback)
+        progress = std::make_unique<calc_progress>(m_cells, m_callback, m_batch_size);
+
+    std::vector<size_t> unfinished;
+
+    try
     {
-        // Interpret cells using just a single thread.
-        for (queue_entry& e : entries)
-            e.p->interpret(cxt, e.pos);
+        unfinished = calculate_entries(m_context, std::move(m_entries), m_thread_count, mp_token, progress.get());
 
-        return;
+        if (progress)
+            progress->flush();
     }
+    catch (...)
+    {
+        // Don't let anyone wait for the results that will never arrive.
+        for (formula_cell* p : cells)
+            p->cancel_calc();
 
-#if IXION_THREADS
-    // Interpret cells in topological order using threads.
-    formula_cell_queue queue(cxt, std::move(entries), thread_count);
-    queue.run();
-#endif
+        end();
+        throw;
+    }
+
+    std::vector<abs_range_t> ret;
+    ret.reserve(unfinished.size());
+
+    for (size_t i : unfinished)
+    {
+        cells[i]->cancel_calc();
+        ret.push_back(m_cells[i]);
+    }
+
+    end();
+    return ret;
+}
+
+void calculate_sorted_cells(
+    model_context& cxt, const std::vector<abs_range_t>& formula_cells, size_t thread_count)
+{
+    sorted_cells_calculation calc(cxt, formula_cells, thread_count);
+    calc.run();
+}
+
+std::vector<abs_range_t> calculate_sorted_cells(
+    model_context& cxt, const std::vector<abs_range_t>& formula_cells, size_t thread_count,
+    const cancellation_token& token)
+{
+    sorted_cells_calculation calc(cxt, formula_cells, thread_count);
+    calc.set_cancellation_token(&token);
+    return calc.run();
 }
 
 }
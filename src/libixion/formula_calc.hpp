@@ -0,0 +1,107 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_FORMULA_CALC_HPP
+#define INCLUDED_IXION_FORMULA_CALC_HPP
+
+#include "queue_entry.hpp"
+#include "calc_progress.hpp"
+
+#include <ixion/address.hpp>
+
+#include <vector>
+
+namespace ixion {
+
+class cancellation_token;
+class model_context;
+
+/**
+ * Calculation of a sorted sequence of formula cells, split into two stages
+ * so that the calculation can run on a different thread from the one that
+ * sets it up.
+ *
+ * The constructor resets the cells and puts the model context into the
+ * calculation mode, after which querying the result of any of the cells
+ * blocks until the cell gets calculated.  This makes it safe to read the
+ * results of the cells from other threads while the calculation is running.
+ */
+class sorted_cells_calculation
+{
+    model_context& m_context;
+    std::vector<abs_range_t> m_cells;
+    std::vector<queue_entry> m_entries;
+    size_t m_thread_count;
+    bool m_running;
+
+    const cancellation_token* mp_token;
+    calc_progress::callback_type m_callback;
+    size_t m_batch_size;
+
+    void end();
+
+public:
+    sorted_cells_calculation() = delete;
+    sorted_cells_calculation(const sorted_cells_calculation&) = delete;
+    sorted_cells_calculation& operator= (const sorted_cells_calculation&) = delete;
+
+    /**
+     * Constructor.
+     *
+     * @param cxt model context.
+     * @param cells sorted sequence of formula cells to calculate.
+     * @param thread_count number of calculation threads to use.
+     */
+    sorted_cells_calculation(model_context& cxt, std::vector<abs_range_t> cells, size_t thread_count);
+
+    /**
+     * The destructor takes the model context out of the calculation mode
+     * if run() has not been called.
+     */
+    ~sorted_cells_calculation();
+
+    /**
+     * Set a token to check for cancellation before the calculation of each
+     * cell.  The token must stay alive until run() returns.
+     *
+     * @param token pointer to the token, or nullptr to clear it.
+     */
+    void set_cancellation_token(const cancellation_token* token);
+
+    /**
+     * Set a callback to receive the cells in batches as they get
+     * calculated.  The callback may get called from any of the calculation
+     * threads, but never concurrently.
+     *
+     * @param callback callback to receive the calculated cells.
+     * @param batch_size number of calculated cells to collect before passing
+     *                   them to the callback.  The last batch may be
+     *                   smaller.
+     */
+    void set_progress_callback(calc_progress::callback_type callback, size_t batch_size);
+
+    /**
+     * @return cells to calculate.
+     */
+    const std::vector<abs_range_t>& get_cells() const;
+
+    /**
+     * Calculate the cells.  This can be called only once.  The cells that
+     * get left uncalculated due to cancellation are put in the cancelled
+     * state without results, and any threads waiting for their results get
+     * woken up.  The next calculation that includes them resets them.
+     *
+     * @return cells left uncalculated, in their original order.
+     */
+    std::vector<abs_range_t> run();
+};
+
+}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
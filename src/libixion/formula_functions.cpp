@@ -8,6 +8,9 @@
 #include "formula_functions.hpp"
 #include "debug.hpp"
 #include "column_store_type.hpp" // internal mdds::multi_type_vector
+#include "model_context_impl.hpp"
+#include "numeric_kernels.hpp"
+#include "range_view.hpp"
 #include "utils.hpp"
 #include "utf8.hpp"
 
@@ -24,7 +27,9 @@
 #undef min
 #endif
 
+#include <algorithm>
 #include <cassert>
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include <thread>
@@ -32,6 +37,9 @@
 #include <cmath>
 #include <optional>
 #include <iterator>
+#include <numeric>
+#include <variant>
+#include <limits>
 
 #include <mdds/sorted_string_map.hpp>
 
@@ -379,21 +387,6 @@ const map_type& get()
 
 } // builtin_funcs namespace
 
-/**
- * Traverse all elements of a passed matrix to sum up their values.
- */
-double sum_matrix_elements(const matrix& mx)
-{
-    double sum = 0.0;
-    size_t rows = mx.row_size();
-    size_t cols = mx.col_size();
-    for (size_t row = 0; row < rows; ++row)
-        for (size_t col = 0; col < cols; ++col)
-            sum += mx.get_numeric(row, col);
-
-    return sum;
-}
-
 numeric_matrix multiply_matrices(const matrix& left, const matrix& right)
 {
     // The column size of the left matrix must equal the row size of the right
@@ -409,16 +402,20 @@ numeric_matrix multiply_matrices(const matrix& left, const matrix& right)
 
     numeric_matrix output(left_nm.row_size(), right_nm.col_size());
 
+    // Both matrices store their values in column-major order.  Copy the
+    // rows of the left matrix into a contiguous array, so that each output
+    // value becomes the dot product of two contiguous arrays.
+    std::vector<double> left_rows(left_nm.row_size() * n);
+    for (size_t row = 0; row < left_nm.row_size(); ++row)
+    {
+        for (size_t i = 0; i < n; ++i)
+            left_rows[row * n + i] = left_nm(row, i);
+    }
+
     for (size_t row = 0; row < output.row_size(); ++row)
     {
         for (size_t col = 0; col < output.col_size(); ++col)
-        {
-            double v = 0.0;
-            for (size_t i = 0; i < n; ++i)
-                v += left_nm(row, i) * right_nm(i, col);
-
-            output(row, col) = v;
-        }
+            output(row, col) = kernel::dot(&left_rows[row * n], &right_nm(0, col), n);
     }
 
     return output;
@@ -485,7 +482,7 @@ std::optional<bool> pop_one_value_as_boolean(const model_context& cxt, formula_v
  */
 template<typename ContT>
 void append_values_from_stack(
-    const model_context& cxt, formula_value_stack& args, std::back_insert_iterator<ContT> insert_it)
+    const detail::model_context_impl& cxt, formula_value_stack& args, std::back_insert_iterator<ContT> insert_it)
 {
     static_assert(
         std::is_floating_point_v<typename ContT::value_type>,
@@ -500,14 +497,13 @@ void append_values_from_stack(
         case stack_value_t::single_ref:
         {
             abs_address_t addr = args.pop_single_ref();
-            auto ca = cxt.get_cell_access(addr);
-            switch (ca.get_value_type())
+            switch (cxt.get_cell_value_type(addr))
             {
                 case cell_value_t::boolean:
-                    insert_it = ca.get_boolean_value() ? 1.0 : 0.0;
+                    insert_it = cxt.get_boolean_value(addr) ? 1.0 : 0.0;
                     break;
                 case cell_value_t::numeric:
-                    insert_it = ca.get_numeric_value();
+                    insert_it = cxt.get_numeric_value(addr);
                     break;
                 default:;
             }
@@ -518,55 +514,50 @@ void append_values_from_stack(
             const formula_result_wait_policy_t wait_policy = cxt.get_formula_result_wait_policy();
             abs_range_t range = args.pop_range_ref();
 
-            column_block_callback_t cb = [&insert_it, wait_policy](
-                col_t col, row_t row1, row_t row2, const column_block_shape_t& node)
+            for (sheet_t sheet = range.first.sheet; sheet <= range.last.sheet; ++sheet)
             {
-                assert(row1 <= row2);
-                row_t length = row2 - row1 + 1;
+                abs_range_t sheet_range = range;
+                sheet_range.first.sheet = sheet_range.last.sheet = sheet;
 
-                switch (node.type)
+                for (const detail::range_view::block& blk : detail::range_view(cxt, sheet_range))
                 {
-                    case column_block_t::boolean:
-                    {
-                        auto blk_range = detail::make_element_range<column_block_t::boolean>{}(node, length);
-                        auto func = [](bool b) { return b ? 1.0 : 0.0; };
-                        std::transform(blk_range.begin(), blk_range.end(), insert_it, func);
-                        break;
-                    }
-                    case column_block_t::numeric:
-                    {
-                        auto blk_range = detail::make_element_range<column_block_t::numeric>{}(node, length);
-                        std::copy(blk_range.begin(), blk_range.end(), insert_it);
-                        break;
-                    }
-                    case column_block_t::formula:
+                    switch (blk.type())
                     {
-                        auto blk_range = detail::make_element_range<column_block_t::formula>{}(node, length);
-
-                        for (const formula_cell* fc : blk_range)
+                        case column_block_t::boolean:
+                        {
+                            auto values = blk.values<column_block_t::boolean>();
+                            auto func = [](bool b) { return b ? 1.0 : 0.0; };
+                            std::transform(values.begin(), values.end(), insert_it, func);
+                            break;
+                        }
+                        case column_block_t::numeric:
+                        {
+                            auto values = blk.values<column_block_t::numeric>();
+                            std::copy(values.begin(), values.end(), insert_it);
+                            break;
+                        }
+                        case column_block_t::formula:
                         {
-                            formula_result res = fc->get_result_cache(wait_policy);
-                            switch (res.get_type())
+                            for (const formula_cell* fc : blk.values<column_block_t::formula>())
                             {
-                                case formula_result::result_type::boolean:
-                                    insert_it = res.get_boolean() ? 1.0 : 0.0;
-                                    break;
-                                case formula_result::result_type::value:
-                                    insert_it = res.get_value();
-                                    break;
-                                default:;
+                                formula_result res = fc->get_result_cache(wait_policy);
+                                switch (res.get_type())
+                                {
+                                    case formula_result::result_type::boolean:
+                                        insert_it = res.get_boolean() ? 1.0 : 0.0;
+                                        break;
+                                    case formula_result::result_type::value:
+                                        insert_it = res.get_value();
+                                        break;
+                                    default:;
+                                }
                             }
+                            break;
                         }
-
-                        break;
+                        default:;
                     }
-                    default:;
                 }
-                return true;
-            };
-
-            for (sheet_t sheet = range.first.sheet; sheet <= range.last.sheet; ++sheet)
-                cxt.walk(sheet, range, cb);
+            }
 
             break;
         }
@@ -575,83 +566,1563 @@ void append_values_from_stack(
     }
 }
 
-} // anonymous namespace
+/**
+ * Values of the arguments of a function that takes their order statistics.
+ * The sorted values of a single range argument come from the cache in the
+ * model context, shared with the other formula cells that use the same
+ * range.  The values of any other arguments get collected, and only get
+ * ordered as much as each query needs.
+ */
+class order_statistics
+{
+    std::shared_ptr<const detail::sorted_values> m_sorted;
+    std::vector<double> m_values;
+
+public:
+    /**
+     * Constructor.  Pop the arguments off of the stack.
+     *
+     * @param n number of the arguments to pop.
+     */
+    order_statistics(const detail::model_context_impl& cxt, formula_value_stack& args, std::size_t n)
+    {
+        if (n == 1u && args.get_type() == stack_value_t::range_ref)
+        {
+            abs_range_t range = args.pop_range_ref();
+            if (range.first.sheet == range.last.sheet)
+            {
+                m_sorted = cxt.get_sorted_values(range);
+                return;
+            }
 
-// ============================================================================
+            args.push_range_ref(range);
+        }
 
-formula_functions::invalid_arg::invalid_arg(const std::string& msg) :
-    general_error(msg) {}
+        for (std::size_t i = 0; i < n; ++i)
+            append_values_from_stack(cxt, args, std::back_inserter(m_values));
+    }
 
-formula_function_t formula_functions::get_function_opcode(const formula_token& token)
+    std::size_t size() const
+    {
+        return m_sorted ? m_sorted->values.size() : m_values.size();
+    }
+
+    /**
+     * @return n-th smallest value, where n is 0-based.
+     */
+    double nth(std::size_t n)
+    {
+        assert(n < size());
+
+        if (m_sorted)
+            return m_sorted->values[n];
+
+        auto it = m_values.begin() + n;
+        std::nth_element(m_values.begin(), it, m_values.end());
+        return *it;
+    }
+
+    /**
+     * @return n-th and (n+1)-th smallest values, where n is 0-based.
+     */
+    std::pair<double, double> nth_pair(std::size_t n)
+    {
+        assert(n + 1 < size());
+
+        if (m_sorted)
+            return { m_sorted->values[n], m_sorted->values[n + 1] };
+
+        // All values after the n-th one are not less than it once it is in
+        // place, and the smallest of them is the next one.
+        auto it = m_values.begin() + n;
+        std::nth_element(m_values.begin(), it, m_values.end());
+        return { *it, *std::min_element(it + 1, m_values.end()) };
+    }
+
+    /**
+     * @return all values in ascending order.
+     */
+    const std::vector<double>& sorted()
+    {
+        if (m_sorted)
+            return m_sorted->values;
+
+        std::sort(m_values.begin(), m_values.end());
+        return m_values;
+    }
+
+    /**
+     * @return numbers of the values that are less than, and that are equal
+     *         to the specified value.
+     */
+    std::pair<std::size_t, std::size_t> count_less_equal(double v) const
+    {
+        if (m_sorted)
+        {
+            const std::vector<double>& values = m_sorted->values;
+            auto [it_begin, it_end] = std::equal_range(values.begin(), values.end(), v);
+            return { std::distance(values.begin(), it_begin), std::distance(it_begin, it_end) };
+        }
+
+        std::size_t less = std::count_if(m_values.begin(), m_values.end(), [v](double e) { return e < v; });
+        std::size_t equal = std::count(m_values.begin(), m_values.end(), v);
+        return { less, equal };
+    }
+};
+
+/**
+ * Limit a range that spans all rows or all columns to the rows or the
+ * columns of the sheet.
+ */
+abs_range_t clip_to_sheet(abs_range_t range, const rc_size_t& sheet_size)
 {
-    assert(token.opcode == fop_function);
-    return std::get<formula_function_t>(token.value);
+    if (range.all_rows())
+    {
+        range.first.row = 0;
+        range.last.row = sheet_size.row - 1;
+    }
+    if (range.all_columns())
+    {
+        range.first.column = 0;
+        range.last.column = sheet_size.column - 1;
+    }
+
+    return range;
 }
 
-formula_function_t formula_functions::get_function_opcode(std::string_view s)
+/**
+ * Walk the cells of a range one column block at a time, and pass their
+ * numeric values to the reducer in runs of contiguous values, as pairs of
+ * pointers to the first and one past the last value.  The runs of numeric
+ * cells point directly into the numeric blocks of the column stores.
+ * Boolean values get passed as 1 or 0, while strings and empty cells get
+ * skipped.  Whole rows or columns only get walked up to their last
+ * non-empty cells.
+ *
+ * @return error of the first formula cell in the range whose result is an
+ *         error, which ends the walk, or nothing if no such cell exists.
+ */
+template<typename Func>
+std::optional<formula_error_t> reduce_range_values(
+    const detail::model_context_impl& cxt, const abs_range_t& range, Func& func)
 {
-    std::string upper;
+    const formula_result_wait_policy_t wait_policy = cxt.get_formula_result_wait_policy();
 
-    for (char c : s)
+    for (sheet_t sheet = range.first.sheet; sheet <= range.last.sheet; ++sheet)
     {
-        if (c > 'Z')
+        abs_range_t sheet_range = range;
+        sheet_range.first.sheet = sheet_range.last.sheet = sheet;
+
+        for (const detail::range_view::block& blk : detail::range_view(cxt, sheet_range))
         {
-            // Convert to upper case.
-            c -= 'a' - 'A';
+            switch (blk.type())
+            {
+                case column_block_t::boolean:
+                {
+                    for (bool b : blk.values<column_block_t::boolean>())
+                    {
+                        double v = b ? 1.0 : 0.0;
+                        func(&v, &v + 1);
+                    }
+                    break;
+                }
+                case column_block_t::numeric:
+                {
+                    auto values = blk.values<column_block_t::numeric>();
+                    func(values.begin(), values.end());
+                    break;
+                }
+                case column_block_t::formula:
+                {
+                    for (const formula_cell* fc : blk.values<column_block_t::formula>())
+                    {
+                        formula_result res = fc->get_result_cache(wait_policy);
+                        double v = 0.0;
+                        switch (res.get_type())
+                        {
+                            case formula_result::result_type::boolean:
+                                v = res.get_boolean() ? 1.0 : 0.0;
+                                break;
+                            case formula_result::result_type::value:
+                                v = res.get_value();
+                                break;
+                            case formula_result::result_type::error:
+                                return res.get_error();
+                            default:
+                                continue;
+                        }
+
+                        func(&v, &v + 1);
+                    }
+                    break;
+                }
+                default:;
+            }
         }
+    }
 
-        upper.push_back(c);
+    return {};
+}
+
+/**
+ * Pop one argument from the stack, and pass its numeric values to the
+ * reducer in runs of contiguous values without building a matrix for a
+ * range.  A reference to a single cell gets treated the same way as a
+ * range of one cell.
+ *
+ * <p>When the reducer of the aggregates is given, a range whose aggregates
+ * are available from the aggregate index of its column gets passed to it
+ * instead.</p>
+ *
+ * @return error value found in the argument, or nothing if the argument
+ *         contains no error.
+ */
+template<typename Func, typename AggFunc>
+std::optional<formula_error_t> reduce_numeric_arg(
+    const detail::model_context_impl& cxt, formula_value_stack& args, Func& func, AggFunc& agg_func)
+{
+    switch (args.get_type())
+    {
+        case stack_value_t::range_ref:
+        case stack_value_t::single_ref:
+        {
+            abs_range_t range = args.pop_range_ref();
+
+            if constexpr (!std::is_null_pointer_v<AggFunc>)
+            {
+                if (auto agg = cxt.get_range_aggregates(range); agg)
+                {
+                    agg_func(*agg);
+                    break;
+                }
+            }
+
+            return reduce_range_values(cxt, range, func);
+        }
+        case stack_value_t::matrix:
+        {
+            matrix mx = args.pop_matrix();
+            for (std::size_t col = 0; col < mx.col_size(); ++col)
+            {
+                for (std::size_t row = 0; row < mx.row_size(); ++row)
+                {
+                    if (!mx.is_numeric(row, col))
+                        continue;
+
+                    double v = mx.get_numeric(row, col);
+                    func(&v, &v + 1);
+                }
+            }
+            break;
+        }
+        case stack_value_t::error:
+            return args.pop_error();
+        default:
+        {
+            double v = args.pop_value();
+            func(&v, &v + 1);
+        }
     }
 
-    return builtin_funcs::get().find(upper.data(), upper.size());
+    return {};
 }
 
-std::string_view formula_functions::get_function_name(formula_function_t oc)
+/**
+ * Pop all arguments from the stack, and pass their numeric values to the
+ * reducer one argument at a time.
+ *
+ * @return first error value found among the arguments, or nothing if no
+ *         argument contains an error.
+ *
+ * @see reduce_numeric_arg
+ */
+template<typename Func, typename AggFunc = std::nullptr_t>
+std::optional<formula_error_t> reduce_numeric_args(
+    const detail::model_context_impl& cxt, formula_value_stack& args, Func func,
+    AggFunc agg_func = nullptr)
 {
-    return builtin_funcs::get().find_key(oc);
+    while (!args.empty())
+    {
+        if (auto err = reduce_numeric_arg(cxt, args, func, agg_func); err)
+            return err;
+    }
+
+    return {};
 }
 
-formula_functions::formula_functions(model_context& cxt, const abs_address_t& pos) :
-    m_context(cxt), m_pos(pos)
+bool is_reference(stack_value_t type)
 {
+    return type == stack_value_t::single_ref || type == stack_value_t::range_ref;
 }
 
-formula_functions::~formula_functions()
+/**
+ * Count, mean and sum of squared deviations from the mean of a sequence of
+ * values, updated one run of values at a time in a single pass.  Each run
+ * gets its own mean and sum of squared deviations, which then get merged
+ * into the running ones, so that the result does not suffer from the
+ * cancellation that summing the squares of the values would.
+ */
+struct moments
+{
+    std::size_t count = 0;
+    double mean = 0.0;
+    double m2 = 0.0;
+
+    void append(const double* p, std::size_t n)
+    {
+        if (!n)
+            return;
+
+        double mean_run = kernel::sum(p, n) / n;
+        merge(n, mean_run, kernel::sum_squared_deviations(p, n, mean_run));
+    }
+
+    void merge(std::size_t n, double mean_run, double m2_run)
+    {
+        if (!n)
+            return;
+
+        double ratio = double(n) / (count + n);
+        double delta = mean_run - mean;
+        m2 += m2_run + delta * delta * count * ratio;
+        mean += delta * ratio;
+        count += n;
+    }
+};
+
+/**
+ * Count, means and sum of the products of deviations from the means of a
+ * sequence of value pairs, updated one run of pairs at a time the same way
+ * as the moments of a single sequence.
+ */
+struct co_moments
+{
+    std::size_t count = 0;
+    double mean1 = 0.0;
+    double mean2 = 0.0;
+    double c12 = 0.0;
+
+    void append(const double* p1, const double* p2, std::size_t n)
+    {
+        if (!n)
+            return;
+
+        double mean1_run = kernel::sum(p1, n) / n;
+        double mean2_run = kernel::sum(p2, n) / n;
+        double c12_run = kernel::dot_deviations(p1, mean1_run, p2, mean2_run, n);
+
+        double ratio = double(n) / (count + n);
+        double delta1 = mean1_run - mean1;
+        double delta2 = mean2_run - mean2;
+        c12 += c12_run + delta1 * delta2 * count * ratio;
+        mean1 += delta1 * ratio;
+        mean2 += delta2 * ratio;
+        count += n;
+    }
+};
+
+enum class variance_t { sample, population };
+
+/**
+ * Pop all arguments from the stack, and push either the variance of their
+ * numeric values or its square root.
+ *
+ * @param text_as_zero when true, each string in the referenced cells
+ *                     counts as a value of 0, as the functions whose names
+ *                     end with A do.
+ * @param root when true, push the standard deviation instead of the
+ *             variance.
+ */
+void push_variance(
+    const detail::model_context_impl& cxt, formula_value_stack& args, variance_t type, bool text_as_zero, bool root)
 {
+    moments m;
+    auto func = [&m](const double* p, const double* p_end)
+    {
+        m.append(p, p_end - p);
+    };
+
+    std::nullptr_t agg_func = nullptr;
+
+    while (!args.empty())
+    {
+        if (text_as_zero && is_reference(args.get_type()))
+        {
+            // Count the strings in the range, and put the range back for
+            // its numeric values.
+            abs_range_t range = args.pop_range_ref();
+            m.merge(cxt.count_range(range, value_string), 0.0, 0.0);
+            args.push_range_ref(range);
+        }
+
+        if (auto err = reduce_numeric_arg(cxt, args, func, agg_func); err)
+        {
+            args.clear();
+            args.push_error(*err);
+            return;
+        }
+    }
+
+    std::size_t min_count = type == variance_t::sample ? 2 : 1;
+    if (m.count < min_count)
+    {
+        args.push_error(formula_error_t::division_by_zero);
+        return;
+    }
+
+    double v = m.m2 / (type == variance_t::sample ? m.count - 1 : m.count);
+    args.push_value(root ? std::sqrt(v) : v);
 }
 
-void formula_functions::interpret(formula_function_t oc, formula_value_stack& args)
+/**
+ * Walk the cells of two ranges of the same shape side by side, and pass
+ * the numeric values of the pairs of cells at the same positions to the
+ * reducer in runs of contiguous pairs, as pointers to the first values of
+ * the two runs and the length of the runs.  The runs of pairs of numeric
+ * cells point directly into the numeric blocks of the column stores.
+ * Boolean values count as 1 or 0, while the pairs in which either cell is
+ * a string or empty get skipped.
+ *
+ * @param range1 first range within a single sheet, whose whole rows or
+ *               columns only get walked up to its last non-empty cells.
+ * @param range2 second range within a single sheet, of the same shape as
+ *               the first range.
+ *
+ * @return error of the first formula cell paired with a non-empty cell
+ *         whose result is an error, which ends the walk, or nothing if no
+ *         such cell exists.
+ */
+template<typename Func>
+std::optional<formula_error_t> reduce_paired_range_values(
+    const detail::model_context_impl& cxt, const abs_range_t& range1, const abs_range_t& range2, Func& func)
 {
-    try
+    using detail::range_view;
+
+    const formula_result_wait_policy_t wait_policy = cxt.get_formula_result_wait_policy();
+
+    // Numeric value of a cell in a segment, or the error of a formula cell.
+    using cell_value_type = std::variant<std::monostate, double, formula_error_t>;
+    auto get_value = [wait_policy](const range_view::block& blk, std::size_t i) -> cell_value_type
     {
-        switch (oc)
+        switch (blk.type())
         {
-            case formula_function_t::func_abs:
-                fnc_abs(args);
-                break;
-            case formula_function_t::func_and:
-                fnc_and(args);
-                break;
-            case formula_function_t::func_average:
-                fnc_average(args);
-                break;
-            case formula_function_t::func_column:
-                fnc_column(args);
-                break;
-            case formula_function_t::func_columns:
-                fnc_columns(args);
-                break;
-            case formula_function_t::func_concatenate:
-                fnc_concatenate(args);
-                break;
-            case formula_function_t::func_count:
-                fnc_count(args);
-                break;
-            case formula_function_t::func_counta:
-                fnc_counta(args);
+            case column_block_t::numeric:
+                return blk.values<column_block_t::numeric>().begin()[i];
+            case column_block_t::boolean:
+                return *std::next(blk.values<column_block_t::boolean>().begin(), i) ? 1.0 : 0.0;
+            case column_block_t::formula:
+            {
+                formula_result res = blk.values<column_block_t::formula>().begin()[i]->get_result_cache(wait_policy);
+                switch (res.get_type())
+                {
+                    case formula_result::result_type::boolean:
+                        return res.get_boolean() ? 1.0 : 0.0;
+                    case formula_result::result_type::value:
+                        return res.get_value();
+                    case formula_result::result_type::error:
+                        return res.get_error();
+                    default:;
+                }
                 break;
-            case formula_function_t::func_countblank:
-                fnc_countblank(args);
+            }
+            default:;
+        }
+
+        return {};
+    };
+
+    std::vector<double> buf1, buf2;
+
+    range_view view1(cxt, range1);
+    const abs_address_t origin1 = view1.get_range().first;
+    const abs_address_t origin2 = cxt.clip_to_data_extent(range2).first;
+
+    for (const range_view::block& blk1 : view1)
+    {
+        if (blk1.type() == column_block_t::string)
+            continue;
+
+        // Walk the segment of the second range that pairs with the block.
+        abs_range_t sub2;
+        sub2.first.sheet = sub2.last.sheet = origin2.sheet;
+        sub2.first.column = sub2.last.column = origin2.column + (blk1.column() - origin1.column);
+        sub2.first.row = origin2.row + (blk1.row() - origin1.row);
+        sub2.last.row = sub2.first.row + blk1.size() - 1;
+
+        for (const range_view::block& blk2 : range_view(cxt, sub2))
+        {
+            std::size_t offset = blk2.row() - sub2.first.row;
+
+            if (blk1.type() == column_block_t::numeric && blk2.type() == column_block_t::numeric)
+            {
+                func(blk1.values<column_block_t::numeric>().begin() + offset,
+                     blk2.values<column_block_t::numeric>().begin(), blk2.size());
+                continue;
+            }
+
+            buf1.clear();
+            buf2.clear();
+
+            for (std::size_t i = 0; i < blk2.size(); ++i)
+            {
+                cell_value_type v1 = get_value(blk1, offset + i);
+                cell_value_type v2 = get_value(blk2, i);
+
+                if (const auto* err = std::get_if<formula_error_t>(&v1); err)
+                    return *err;
+                if (const auto* err = std::get_if<formula_error_t>(&v2); err)
+                    return *err;
+
+                if (v1.index() == 1 && v2.index() == 1)
+                {
+                    buf1.push_back(std::get<double>(v1));
+                    buf2.push_back(std::get<double>(v2));
+                }
+            }
+
+            func(buf1.data(), buf2.data(), buf1.size());
+        }
+    }
+
+    return {};
+}
+
+/**
+ * Pop one argument from the stack as a matrix.  A single value becomes a
+ * matrix of one element.
+ */
+matrix pop_matrix_operand(formula_value_stack& args)
+{
+    if (auto mx = args.maybe_pop_matrix(); mx)
+        return std::move(*mx);
+
+    return matrix(1, 1, args.pop_value());
+}
+
+/**
+ * Pop two arguments of the same shape from the stack, and pass the numeric
+ * values of the pairs of their elements at the same positions to the
+ * reducer in runs of contiguous pairs.  When both arguments are references,
+ * their cells get walked side by side without building a matrix for either
+ * of them.
+ *
+ * @param shape_error error to return when the shapes of the arguments
+ *                    differ.
+ *
+ * @return error found in the arguments, or nothing if the arguments
+ *         contain no error.
+ */
+template<typename Func>
+std::optional<formula_error_t> reduce_paired_args(
+    const detail::model_context_impl& cxt, formula_value_stack& args, formula_error_t shape_error, Func func)
+{
+    if (is_reference(args.get_type()))
+    {
+        abs_range_t range2 = args.pop_range_ref();
+
+        if (is_reference(args.get_type()))
+        {
+            abs_range_t range1 = args.pop_range_ref();
+
+            if (range1.first.sheet != range1.last.sheet || range2.first.sheet != range2.last.sheet)
+                return formula_error_t::invalid_value_type;
+
+            rc_size_t sheet_size = cxt.get_sheet_size();
+            abs_range_t clipped1 = clip_to_sheet(range1, sheet_size);
+            abs_range_t clipped2 = clip_to_sheet(range2, sheet_size);
+
+            if (clipped1.last.row - clipped1.first.row != clipped2.last.row - clipped2.first.row ||
+                clipped1.last.column - clipped1.first.column != clipped2.last.column - clipped2.first.column)
+                return shape_error;
+
+            return reduce_paired_range_values(cxt, range1, range2, func);
+        }
+
+        args.push_range_ref(range2);
+    }
+
+    matrix mx2 = pop_matrix_operand(args);
+    matrix mx1 = pop_matrix_operand(args);
+
+    if (mx1.row_size() != mx2.row_size() || mx1.col_size() != mx2.col_size())
+        return shape_error;
+
+    std::vector<double> buf1, buf2;
+
+    for (std::size_t col = 0; col < mx1.col_size(); ++col)
+    {
+        for (std::size_t row = 0; row < mx1.row_size(); ++row)
+        {
+            if (mx1.is_numeric(row, col) && mx2.is_numeric(row, col))
+            {
+                buf1.push_back(mx1.get_numeric(row, col));
+                buf2.push_back(mx2.get_numeric(row, col));
+                continue;
+            }
+
+            for (const matrix* mx : { &mx1, &mx2 })
+            {
+                matrix::element e = mx->get(row, col);
+                if (e.type == matrix::element_type::error)
+                    return std::get<formula_error_t>(e.value);
+            }
+        }
+    }
+
+    func(buf1.data(), buf2.data(), buf1.size());
+
+    return {};
+}
+
+/**
+ * Layout of the values of the independent variables of a linear model
+ * relative to the values of the dependent variable.
+ */
+enum class variable_layout_t
+{
+    /** one variable of the same shape as the dependent values. */
+    single,
+    /** one variable per column, with the dependent values in one column. */
+    columns,
+    /** one variable per row, with the dependent values in one row. */
+    rows
+};
+
+/**
+ * Copy the values of a matrix into an array in which the values of each
+ * variable are contiguous.
+ */
+std::vector<double> flatten_variables(const numeric_matrix& mx, variable_layout_t layout)
+{
+    std::vector<double> ret;
+    ret.reserve(mx.row_size() * mx.col_size());
+
+    if (layout == variable_layout_t::rows)
+    {
+        for (std::size_t row = 0; row < mx.row_size(); ++row)
+        {
+            for (std::size_t col = 0; col < mx.col_size(); ++col)
+                ret.push_back(mx(row, col));
+        }
+    }
+    else
+    {
+        for (std::size_t col = 0; col < mx.col_size(); ++col)
+        {
+            for (std::size_t row = 0; row < mx.row_size(); ++row)
+                ret.push_back(mx(row, col));
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Known values of the dependent and the independent variables of a linear
+ * model.
+ */
+struct regression_data
+{
+    std::size_t y_rows = 0;
+    std::size_t y_cols = 0;
+    std::vector<double> ys;
+
+    variable_layout_t layout = variable_layout_t::single;
+
+    /** number of the independent variables. */
+    std::size_t k = 0;
+
+    /** values of the independent variables, one variable after another. */
+    std::vector<double> xs;
+};
+
+using regression_data_arg_t = std::variant<regression_data, formula_error_t>;
+
+/**
+ * Pop the known values of the dependent variable, preceded by those of the
+ * independent variables if present, off of the stack.  When the values of
+ * the independent variables are not present, they default to 1, 2, 3 and
+ * so on in the shape of the dependent values.
+ */
+regression_data_arg_t pop_regression_data(formula_value_stack& args, bool has_xs)
+{
+    std::optional<matrix> mx_x;
+    if (has_xs)
+        mx_x = pop_matrix_operand(args);
+
+    matrix mx_y = pop_matrix_operand(args);
+
+    if (!mx_y.is_numeric() || (mx_x && !mx_x->is_numeric()))
+        return formula_error_t::invalid_value_type;
+
+    regression_data ret;
+    numeric_matrix ys = mx_y.as_numeric();
+    ret.y_rows = ys.row_size();
+    ret.y_cols = ys.col_size();
+    ret.ys = flatten_variables(ys, variable_layout_t::single);
+
+    if (!mx_x)
+    {
+        ret.k = 1;
+        ret.xs.resize(ret.ys.size());
+        std::iota(ret.xs.begin(), ret.xs.end(), 1.0);
+        return ret;
+    }
+
+    numeric_matrix xs = mx_x->as_numeric();
+
+    if (xs.row_size() == ret.y_rows && xs.col_size() == ret.y_cols)
+    {
+        ret.layout = variable_layout_t::single;
+        ret.k = 1;
+    }
+    else if (ret.y_cols == 1u && xs.row_size() == ret.y_rows)
+    {
+        ret.layout = variable_layout_t::columns;
+        ret.k = xs.col_size();
+    }
+    else if (ret.y_rows == 1u && xs.col_size() == ret.y_cols)
+    {
+        ret.layout = variable_layout_t::rows;
+        ret.k = xs.row_size();
+    }
+    else
+        return formula_error_t::ref_result_not_available;
+
+    ret.xs = flatten_variables(xs, ret.layout);
+    return ret;
+}
+
+/**
+ * Linear model fitted to the known values by least squares.
+ */
+struct linear_model
+{
+    std::size_t n = 0;
+    std::size_t k = 0;
+    bool constant = true;
+
+    /** coefficients of the independent variables. */
+    std::vector<double> coefs;
+    double intercept = 0.0;
+
+    /** means of the independent variables, or 0 without the constant. */
+    std::vector<double> x_means;
+
+    /** inverse of the matrix of the normal equations, in row-major order. */
+    std::vector<double> inverse;
+
+    double ss_resid = 0.0;
+    double ss_total = 0.0;
+};
+
+/**
+ * Fit a linear model to the known values by solving the normal equations,
+ * whose matrix consists of the dot products of the contiguous values of
+ * the independent variables.  With the constant term, the values get
+ * centered on their means first, which keeps the normal equations well
+ * conditioned.
+ *
+ * @return fitted model, or nothing if the normal equations are singular.
+ */
+std::optional<linear_model> fit_linear_model(regression_data data, bool constant)
+{
+    const std::size_t n = data.ys.size();
+    const std::size_t k = data.k;
+    std::vector<double>& ys = data.ys;
+    std::vector<double>& xs = data.xs;
+
+    linear_model model;
+    model.n = n;
+    model.k = k;
+    model.constant = constant;
+    model.x_means.assign(k, 0.0);
+
+    double y_mean = 0.0;
+
+    if (constant)
+    {
+        y_mean = kernel::sum(ys.data(), n) / n;
+        kernel::transform(kernel::op_t::subtract, ys.data(), y_mean, ys.data(), n);
+
+        for (std::size_t j = 0; j < k; ++j)
+        {
+            double* p = &xs[j * n];
+            model.x_means[j] = kernel::sum(p, n) / n;
+            kernel::transform(kernel::op_t::subtract, p, model.x_means[j], p, n);
+        }
+    }
+
+    // Invert the matrix of the normal equations by Gauss-Jordan elimination
+    // with partial pivoting.
+
+    std::vector<double> a(k * k);
+    std::vector<double>& inv = model.inverse;
+    inv.assign(k * k, 0.0);
+    double scale = 0.0;
+
+    for (std::size_t i = 0; i < k; ++i)
+    {
+        for (std::size_t j = i; j < k; ++j)
+            a[i * k + j] = a[j * k + i] = kernel::dot(&xs[i * n], &xs[j * n], n);
+
+        inv[i * k + i] = 1.0;
+        scale = std::max(scale, a[i * k + i]);
+    }
+
+    for (std::size_t c = 0; c < k; ++c)
+    {
+        std::size_t pivot = c;
+        for (std::size_t r = c + 1; r < k; ++r)
+        {
+            if (std::abs(a[r * k + c]) > std::abs(a[pivot * k + c]))
+                pivot = r;
+        }
+
+        if (!(std::abs(a[pivot * k + c]) > scale * 1e-13))
+            return {};
+
+        if (pivot != c)
+        {
+            std::swap_ranges(&a[pivot * k], &a[pivot * k] + k, &a[c * k]);
+            std::swap_ranges(&inv[pivot * k], &inv[pivot * k] + k, &inv[c * k]);
+        }
+
+        double v = a[c * k + c];
+        kernel::transform(kernel::op_t::divide, &a[c * k], v, &a[c * k], k);
+        kernel::transform(kernel::op_t::divide, &inv[c * k], v, &inv[c * k], k);
+
+        for (std::size_t r = 0; r < k; ++r)
+        {
+            double f = a[r * k + c];
+            if (r == c || f == 0.0)
+                continue;
+
+            for (std::size_t j = 0; j < k; ++j)
+            {
+                a[r * k + j] -= f * a[c * k + j];
+                inv[r * k + j] -= f * inv[c * k + j];
+            }
+        }
+    }
+
+    std::vector<double> xty(k);
+    for (std::size_t j = 0; j < k; ++j)
+        xty[j] = kernel::dot(&xs[j * n], ys.data(), n);
+
+    model.coefs.assign(k, 0.0);
+    for (std::size_t i = 0; i < k; ++i)
+        model.coefs[i] = kernel::dot(&inv[i * k], xty.data(), k);
+
+    if (constant)
+        model.intercept = y_mean - kernel::dot(model.coefs.data(), model.x_means.data(), k);
+
+    model.ss_total = kernel::sum_squares(ys.data(), n);
+
+    // Take the sum of squared residuals from the residuals themselves
+    // rather than from the difference of the sums of squares.
+    for (std::size_t j = 0; j < k; ++j)
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            ys[i] -= model.coefs[j] * xs[j * n + i];
+    }
+
+    model.ss_resid = kernel::sum_squares(ys.data(), n);
+
+    return model;
+}
+
+/**
+ * Value to look up in a lookup function, or the error to be the result of
+ * the lookup when there is no value to look up.
+ */
+using lookup_value_t = std::variant<double, bool, std::string, formula_error_t>;
+
+/**
+ * Pop the value to look up off of the stack.  A reference to a cell gets
+ * resolved to the value of the cell.
+ */
+lookup_value_t pop_lookup_value(const model_context& cxt, formula_value_stack& args)
+{
+    switch (args.get_type())
+    {
+        case stack_value_t::value:
+            return args.pop_value();
+        case stack_value_t::boolean:
+            return args.pop_boolean();
+        case stack_value_t::string:
+            return args.pop_string();
+        case stack_value_t::single_ref:
+        {
+            auto ca = cxt.get_cell_access(args.pop_single_ref());
+
+            switch (ca.get_value_type())
+            {
+                case cell_value_t::numeric:
+                    return ca.get_numeric_value();
+                case cell_value_t::boolean:
+                    return ca.get_boolean_value();
+                case cell_value_t::string:
+                    return std::string{ca.get_string_value()};
+                case cell_value_t::error:
+                    return ca.get_error_value();
+                case cell_value_t::empty:
+                case cell_value_t::unknown:
+                    break;
+            }
+
+            return formula_error_t::no_value_available;
+        }
+        default:
+            args.pop_back();
+    }
+
+    return formula_error_t::invalid_value_type;
+}
+
+/**
+ * Look a value up in a range within a single column or a single row, using
+ * the lookup index of the range.
+ *
+ * @return 0-based position of the matching cell in the range, or nothing
+ *         if no cell matches or the range is not within a single column or
+ *         a single row.
+ */
+std::optional<std::size_t> find_lookup_value(
+    const detail::model_context_impl& cxt, const abs_range_t& range,
+    const lookup_value_t& value, detail::lookup_match_t match)
+{
+    std::shared_ptr<const detail::lookup_index> index = cxt.get_lookup_index(range);
+    if (!index)
+        return {};
+
+    if (const double* v = std::get_if<double>(&value); v)
+        return index->find(*v, match);
+
+    if (const bool* b = std::get_if<bool>(&value); b)
+        return index->find_boolean(*b, match);
+
+    if (const std::string* str = std::get_if<std::string>(&value); str)
+        return index->find(std::string_view{*str}, match);
+
+    return {};
+}
+
+/**
+ * Common part of VLOOKUP and HLOOKUP.  Look a value up in the first column
+ * of a table, or in its first row when the direction is horizontal, and
+ * push the reference to the cell at the same position in another column
+ * or row of the table.
+ */
+void lookup_in_table(
+    const model_context& cxt, const detail::model_context_impl& cxt_impl,
+    formula_value_stack& args, rc_direction_t dir)
+{
+    bool approximate = args.size() == 4u ? args.pop_boolean() : true;
+    double offset = args.pop_value();
+
+    if (!is_reference(args.get_type()))
+    {
+        args.clear();
+        args.push_error(formula_error_t::invalid_value_type);
+        return;
+    }
+
+    abs_range_t table = clip_to_sheet(args.pop_range_ref(), cxt.get_sheet_size());
+    table.last.sheet = table.first.sheet;
+
+    lookup_value_t value = pop_lookup_value(cxt, args);
+    if (const formula_error_t* err = std::get_if<formula_error_t>(&value); err)
+    {
+        args.push_error(*err);
+        return;
+    }
+
+    const bool vertical = dir == rc_direction_t::vertical;
+    double width = vertical ?
+        table.last.column - table.first.column + 1 : table.last.row - table.first.row + 1;
+
+    if (offset < 1.0)
+    {
+        args.push_error(formula_error_t::invalid_value_type);
+        return;
+    }
+
+    if (offset >= width + 1.0)
+    {
+        args.push_error(formula_error_t::ref_result_not_available);
+        return;
+    }
+
+    abs_range_t keys = table;
+    if (vertical)
+        keys.last.column = keys.first.column;
+    else
+        keys.last.row = keys.first.row;
+
+    auto match = approximate ? detail::lookup_match_t::less_or_equal : detail::lookup_match_t::exact;
+    std::optional<std::size_t> pos = find_lookup_value(cxt_impl, keys, value, match);
+    if (!pos)
+    {
+        args.push_error(formula_error_t::no_value_available);
+        return;
+    }
+
+    abs_address_t addr = table.first;
+    if (vertical)
+    {
+        addr.row += *pos;
+        addr.column += col_t(offset) - 1;
+    }
+    else
+    {
+        addr.column += *pos;
+        addr.row += row_t(offset) - 1;
+    }
+
+    args.push_single_ref(addr);
+}
+
+/**
+ * Criterion of a conditional function, or the error to be the result of
+ * the function when the criterion is an error.
+ */
+using criterion_arg_t = std::variant<detail::criterion, formula_error_t>;
+
+/**
+ * Pop a criterion of a conditional function off of the stack.  A reference
+ * to a cell gets resolved to the value of the cell, and an empty cell is
+ * taken as 0.
+ */
+criterion_arg_t pop_criterion(
+    const model_context& cxt, const detail::model_context_impl& cxt_impl, formula_value_stack& args)
+{
+    switch (args.get_type())
+    {
+        case stack_value_t::value:
+            return detail::criterion{args.pop_value()};
+        case stack_value_t::boolean:
+            return detail::criterion{args.pop_boolean()};
+        case stack_value_t::string:
+            return detail::criterion{cxt_impl, args.pop_string()};
+        case stack_value_t::single_ref:
+        {
+            auto ca = cxt.get_cell_access(args.pop_single_ref());
+
+            switch (ca.get_value_type())
+            {
+                case cell_value_t::numeric:
+                    return detail::criterion{ca.get_numeric_value()};
+                case cell_value_t::boolean:
+                    return detail::criterion{ca.get_boolean_value()};
+                case cell_value_t::string:
+                    return detail::criterion{cxt_impl, ca.get_string_value()};
+                case cell_value_t::error:
+                    return ca.get_error_value();
+                case cell_value_t::empty:
+                case cell_value_t::unknown:
+                    break;
+            }
+
+            return detail::criterion{0.0};
+        }
+        default:
+            args.pop_back();
+    }
+
+    return formula_error_t::invalid_value_type;
+}
+
+/**
+ * Type of the aggregate of a conditional function.
+ */
+enum class conditional_aggregate_t { count, sum, average, max, min };
+
+/**
+ * Map of the cells that match all criteria of a conditional function,
+ * combined from the cached match maps of the individual criteria.
+ */
+struct combined_match
+{
+    /** match map of the stored rows, in column-major order. */
+    std::vector<std::uint8_t> mask;
+
+    /** number of stored rows of each column. */
+    std::size_t row_size = 0;
+
+    /** whether the cells in the rows past the stored ones match. */
+    bool empty_match = true;
+};
+
+/**
+ * Combine the match maps of the criteria of a conditional function.  All
+ * criteria ranges must have the same shape.
+ *
+ * @param min_row_size minimum number of rows to store, which is the number
+ *                     of the non-empty rows of the range of the values to
+ *                     aggregate.
+ */
+combined_match combine_criteria_matches(
+    const detail::model_context_impl& cxt_impl,
+    const std::vector<std::pair<abs_range_t, detail::criterion>>& criteria,
+    std::size_t min_row_size)
+{
+    assert(!criteria.empty());
+
+    const abs_range_t& shape = criteria.front().first;
+    const std::size_t rows = shape.last.row - shape.first.row + 1;
+    const std::size_t cols = shape.last.column - shape.first.column + 1;
+
+    std::vector<std::shared_ptr<const detail::criteria_match>> matches;
+    matches.reserve(criteria.size());
+
+    combined_match ret;
+    ret.row_size = min_row_size;
+
+    for (const auto& [range, crit] : criteria)
+    {
+        matches.push_back(cxt_impl.get_criteria_match(range, crit));
+        ret.row_size = std::max(ret.row_size, matches.back()->row_size);
+        ret.empty_match = ret.empty_match && matches.back()->empty_match;
+    }
+
+    ret.row_size = std::min(ret.row_size, rows);
+    ret.mask.assign(ret.row_size * cols, 1);
+
+    for (const auto& match : matches)
+    {
+        for (std::size_t col = 0; col < cols; ++col)
+        {
+            std::uint8_t* p = ret.mask.data() + col * ret.row_size;
+            const std::uint8_t* p_match = match->mask.data() + col * match->row_size;
+            std::size_t n = std::min(match->row_size, ret.row_size);
+
+            for (std::size_t row = 0; row < n; ++row)
+                p[row] &= p_match[row];
+
+            if (!match->empty_match)
+                std::fill(p + n, p + ret.row_size, 0);
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Walk the cells of a range one column block at a time, and pass the
+ * numeric values of the cells that are set in the match map to the
+ * function.  Boolean values get passed as 1 or 0, while strings and empty
+ * cells get skipped.
+ *
+ * @param range range of the values, which has the same shape as the match
+ *              map, and which has no non-empty rows past its stored rows.
+ *
+ * @return error of the first matching formula cell whose result is an
+ *         error, which ends the walk, or nothing if no such cell exists.
+ */
+template<typename Func>
+std::optional<formula_error_t> reduce_matched_values(
+    const detail::model_context_impl& cxt, abs_range_t range, const combined_match& match, Func func)
+{
+    if (!match.row_size)
+        return {};
+
+    range.last.row = range.first.row + match.row_size - 1;
+
+    const formula_result_wait_policy_t wait_policy = cxt.get_formula_result_wait_policy();
+
+    for (const detail::range_view::block& blk : detail::range_view(cxt, range))
+    {
+        const std::uint8_t* p_mask = match.mask.data() +
+            (blk.column() - range.first.column) * match.row_size + (blk.row() - range.first.row);
+
+        switch (blk.type())
+        {
+            case column_block_t::numeric:
+            {
+                for (double v : blk.values<column_block_t::numeric>())
+                {
+                    if (*p_mask++)
+                        func(v);
+                }
+                break;
+            }
+            case column_block_t::boolean:
+            {
+                for (bool b : blk.values<column_block_t::boolean>())
+                {
+                    if (*p_mask++)
+                        func(b ? 1.0 : 0.0);
+                }
+                break;
+            }
+            case column_block_t::formula:
+            {
+                for (const formula_cell* fc : blk.values<column_block_t::formula>())
+                {
+                    if (!*p_mask++)
+                        continue;
+
+                    formula_result res = fc->get_result_cache(wait_policy);
+                    switch (res.get_type())
+                    {
+                        case formula_result::result_type::boolean:
+                            func(res.get_boolean() ? 1.0 : 0.0);
+                            break;
+                        case formula_result::result_type::value:
+                            func(res.get_value());
+                            break;
+                        case formula_result::result_type::error:
+                            return res.get_error();
+                        default:;
+                    }
+                }
+                break;
+            }
+            default:;
+        }
+    }
+
+    return {};
+}
+
+/**
+ * Common part of the conditional functions.  Pop the ranges and the
+ * criteria off of the stack, and push the aggregate of the values of the
+ * cells that match all criteria.  The matching of each criterion against
+ * its range gets cached in the model context, to be shared with the other
+ * formula cells that use the same range and criterion.
+ *
+ * @param ifs true for the functions that take one or more pairs of a
+ *            range and a criterion, preceded by the range of the values
+ *            except for COUNTIFS.  False for the functions that take one
+ *            range and one criterion, optionally followed by the range of
+ *            the values.
+ */
+void aggregate_matched_values(
+    const model_context& cxt, const detail::model_context_impl& cxt_impl,
+    formula_value_stack& args, conditional_aggregate_t type, bool ifs)
+{
+    const rc_size_t sheet_size = cxt.get_sheet_size();
+    const bool has_values = type != conditional_aggregate_t::count;
+
+    auto pop_range = [&args, &sheet_size]() -> std::optional<abs_range_t>
+    {
+        if (!is_reference(args.get_type()))
+            return {};
+
+        abs_range_t range = clip_to_sheet(args.pop_range_ref(), sheet_size);
+        range.last.sheet = range.first.sheet;
+        return range;
+    };
+
+    auto push_error = [&args](formula_error_t err)
+    {
+        args.clear();
+        args.push_error(err);
+    };
+
+    std::vector<std::pair<abs_range_t, detail::criterion>> criteria;
+    std::optional<abs_range_t> values;
+
+    if (!ifs && args.size() == 3u)
+    {
+        values = pop_range();
+        if (!values)
+        {
+            push_error(formula_error_t::invalid_value_type);
+            return;
+        }
+    }
+
+    while (args.size() > (ifs && has_values ? 1u : 0u))
+    {
+        criterion_arg_t crit = pop_criterion(cxt, cxt_impl, args);
+        if (const formula_error_t* err = std::get_if<formula_error_t>(&crit); err)
+        {
+            push_error(*err);
+            return;
+        }
+
+        std::optional<abs_range_t> range = pop_range();
+        if (!range)
+        {
+            push_error(formula_error_t::invalid_value_type);
+            return;
+        }
+
+        criteria.emplace_back(*range, std::get<detail::criterion>(crit));
+    }
+
+    std::reverse(criteria.begin(), criteria.end());
+    const abs_range_t& shape = criteria.front().first;
+
+    if (ifs && has_values)
+    {
+        values = pop_range();
+        if (!values)
+        {
+            push_error(formula_error_t::invalid_value_type);
+            return;
+        }
+    }
+
+    auto same_shape = [&shape](const abs_range_t& range)
+    {
+        return range.last.row - range.first.row == shape.last.row - shape.first.row &&
+            range.last.column - range.first.column == shape.last.column - shape.first.column;
+    };
+
+    if (!std::all_of(criteria.begin(), criteria.end(), [&](const auto& v) { return same_shape(v.first); }))
+    {
+        push_error(formula_error_t::invalid_value_type);
+        return;
+    }
+
+    if (has_values)
+    {
+        if (!values)
+            values = shape;
+        else if (ifs)
+        {
+            if (!same_shape(*values))
+            {
+                push_error(formula_error_t::invalid_value_type);
+                return;
+            }
+        }
+        else
+        {
+            // The range of the values takes the shape of the criteria
+            // range from its top-left cell.
+            abs_range_t range{values->first.sheet, values->first.row, values->first.column,
+                shape.last.row - shape.first.row + 1, shape.last.column - shape.first.column + 1};
+
+            if (range.last.row >= sheet_size.row || range.last.column >= sheet_size.column)
+            {
+                push_error(formula_error_t::ref_result_not_available);
+                return;
+            }
+
+            values = range;
+        }
+    }
+
+    std::size_t min_row_size = values ? detail::get_data_row_size(cxt_impl, *values) : 0;
+    combined_match match = combine_criteria_matches(cxt_impl, criteria, min_row_size);
+
+    if (type == conditional_aggregate_t::count)
+    {
+        std::size_t count = std::count(match.mask.begin(), match.mask.end(), 1u);
+        if (match.empty_match)
+        {
+            const std::size_t rows = shape.last.row - shape.first.row + 1;
+            const std::size_t cols = shape.last.column - shape.first.column + 1;
+            count += (rows - match.row_size) * cols;
+        }
+
+        args.push_value(count);
+        return;
+    }
+
+    double sum = 0.0;
+    double min = std::numeric_limits<double>::max();
+    double max = std::numeric_limits<double>::lowest();
+    std::size_t count = 0;
+
+    auto func = [&](double v)
+    {
+        sum += v;
+        min = std::min(min, v);
+        max = std::max(max, v);
+        ++count;
+    };
+
+    if (auto err = reduce_matched_values(cxt_impl, *values, match, func); err)
+    {
+        push_error(*err);
+        return;
+    }
+
+    switch (type)
+    {
+        case conditional_aggregate_t::sum:
+            args.push_value(sum);
+            break;
+        case conditional_aggregate_t::average:
+            if (!count)
+            {
+                push_error(formula_error_t::division_by_zero);
+                return;
+            }
+            args.push_value(sum / count);
+            break;
+        case conditional_aggregate_t::max:
+            args.push_value(count ? max : 0.0);
+            break;
+        case conditional_aggregate_t::min:
+            args.push_value(count ? min : 0.0);
+            break;
+        case conditional_aggregate_t::count:
+            break;
+    }
+}
+
+/**
+ * @return error of a function argument, which is either an error value or a
+ *         reference to a cell whose value is an error, or no_error if the
+ *         argument is not an error.
+ */
+formula_error_t get_argument_error(const model_context& cxt, const stack_value& v)
+{
+    switch (v.get_type())
+    {
+        case stack_value_t::error:
+            return v.get_error();
+        case stack_value_t::single_ref:
+            return cxt.get_cell_access(v.get_address()).get_error_value();
+        default:;
+    }
+
+    return formula_error_t::no_error;
+}
+
+/**
+ * @return true if the function takes error values as its arguments, false
+ *         if any error value among its arguments becomes its result.
+ */
+bool accepts_error_values(formula_function_t oc)
+{
+    switch (oc)
+    {
+        case formula_function_t::func_count:
+        case formula_function_t::func_counta:
+        case formula_function_t::func_isblank:
+        case formula_function_t::func_iserr:
+        case formula_function_t::func_iserror:
+        case formula_function_t::func_islogical:
+        case formula_function_t::func_isna:
+        case formula_function_t::func_isnontext:
+        case formula_function_t::func_isnumber:
+        case formula_function_t::func_isref:
+        case formula_function_t::func_istext:
+        case formula_function_t::func_type:
+            return true;
+        default:;
+    }
+
+    return false;
+}
+
+} // anonymous namespace
+
+// ============================================================================
+
+formula_functions::invalid_arg::invalid_arg(const std::string& msg) :
+    general_error(msg) {}
+
+formula_function_t formula_functions::get_function_opcode(const formula_token& token)
+{
+    assert(token.opcode == fop_function);
+    return std::get<formula_function_t>(token.value);
+}
+
+formula_function_t formula_functions::get_function_opcode(std::string_view s)
+{
+    std::string upper;
+
+    for (char c : s)
+    {
+        if (c > 'Z')
+        {
+            // Convert to upper case.
+            c -= 'a' - 'A';
+        }
+
+        upper.push_back(c);
+    }
+
+    return builtin_funcs::get().find(upper.data(), upper.size());
+}
+
+std::string_view formula_functions::get_function_name(formula_function_t oc)
+{
+    return builtin_funcs::get().find_key(oc);
+}
+
+formula_functions::formula_functions(model_context& cxt, const abs_address_t& pos) :
+    m_context(cxt), m_pos(pos)
+{
+}
+
+formula_functions::~formula_functions()
+{
+}
+
+void formula_functions::interpret(formula_function_t oc, formula_value_stack& args)
+{
+    try
+    {
+        if (!accepts_error_values(oc))
+        {
+            // The first error among the arguments is the result.  This
+            // includes the references to the cells with errors, so that
+            // the functions don't have to throw them when reading the cells.
+            for (const stack_value& v : args)
+            {
+                formula_error_t err = get_argument_error(m_context, v);
+                if (err == formula_error_t::no_error)
+                    continue;
+
+                args.clear();
+                args.push_error(err);
+                return;
+            }
+        }
+
+        switch (oc)
+        {
+            case formula_function_t::func_abs:
+                fnc_abs(args);
+                break;
+            case formula_function_t::func_and:
+                fnc_and(args);
+                break;
+            case formula_function_t::func_average:
+                fnc_average(args);
+                break;
+            case formula_function_t::func_averageif:
+                fnc_averageif(args);
+                break;
+            case formula_function_t::func_averageifs:
+                fnc_averageifs(args);
+                break;
+            case formula_function_t::func_column:
+                fnc_column(args);
+                break;
+            case formula_function_t::func_columns:
+                fnc_columns(args);
+                break;
+            case formula_function_t::func_concatenate:
+                fnc_concatenate(args);
+                break;
+            case formula_function_t::func_count:
+                fnc_count(args);
+                break;
+            case formula_function_t::func_counta:
+                fnc_counta(args);
+                break;
+            case formula_function_t::func_countblank:
+                fnc_countblank(args);
+                break;
+            case formula_function_t::func_countif:
+                fnc_countif(args);
+                break;
+            case formula_function_t::func_countifs:
+                fnc_countifs(args);
+                break;
+            case formula_function_t::func_covar:
+                fnc_covar(args);
                 break;
             case formula_function_t::func_exact:
                 fnc_exact(args);
@@ -662,9 +2133,15 @@ void formula_functions::interpret(formula_function_t oc, formula_value_stack& ar
             case formula_function_t::func_find:
                 fnc_find(args);
                 break;
+            case formula_function_t::func_hlookup:
+                fnc_hlookup(args);
+                break;
             case formula_function_t::func_if:
                 fnc_if(args);
                 break;
+            case formula_function_t::func_index:
+                fnc_index(args);
+                break;
             case formula_function_t::func_isblank:
                 fnc_isblank(args);
                 break;
@@ -704,15 +2181,30 @@ void formula_functions::interpret(formula_function_t oc, formula_value_stack& ar
             case formula_function_t::func_int:
                 fnc_int(args);
                 break;
+            case formula_function_t::func_large:
+                fnc_large(args);
+                break;
             case formula_function_t::func_left:
                 fnc_left(args);
                 break;
             case formula_function_t::func_len:
                 fnc_len(args);
                 break;
+            case formula_function_t::func_linest:
+                fnc_linest(args);
+                break;
+            case formula_function_t::func_lookup:
+                fnc_lookup(args);
+                break;
+            case formula_function_t::func_match:
+                fnc_match(args);
+                break;
             case formula_function_t::func_max:
                 fnc_max(args);
                 break;
+            case formula_function_t::func_maxifs:
+                fnc_maxifs(args);
+                break;
             case formula_function_t::func_median:
                 fnc_median(args);
                 break;
@@ -722,6 +2214,9 @@ void formula_functions::interpret(formula_function_t oc, formula_value_stack& ar
             case formula_function_t::func_min:
                 fnc_min(args);
                 break;
+            case formula_function_t::func_minifs:
+                fnc_minifs(args);
+                break;
             case formula_function_t::func_mmult:
                 fnc_mmult(args);
                 break;
@@ -743,9 +2238,18 @@ void formula_functions::interpret(formula_function_t oc, formula_value_stack& ar
             case formula_function_t::func_or:
                 fnc_or(args);
                 break;
+            case formula_function_t::func_percentile:
+                fnc_percentile(args);
+                break;
             case formula_function_t::func_pi:
                 fnc_pi(args);
                 break;
+            case formula_function_t::func_product:
+                fnc_product(args);
+                break;
+            case formula_function_t::func_rank:
+                fnc_rank(args);
+                break;
             case formula_function_t::func_replace:
                 fnc_replace(args);
                 break;
@@ -767,6 +2271,21 @@ void formula_functions::interpret(formula_function_t oc, formula_value_stack& ar
             case formula_function_t::func_sheets:
                 fnc_sheets(args);
                 break;
+            case formula_function_t::func_small:
+                fnc_small(args);
+                break;
+            case formula_function_t::func_stdev:
+                fnc_stdev(args);
+                break;
+            case formula_function_t::func_stdeva:
+                fnc_stdeva(args);
+                break;
+            case formula_function_t::func_stdevp:
+                fnc_stdevp(args);
+                break;
+            case formula_function_t::func_stdevpa:
+                fnc_stdevpa(args);
+                break;
             case formula_function_t::func_substitute:
                 fnc_substitute(args);
                 break;
@@ -776,12 +2295,27 @@ void formula_functions::interpret(formula_function_t oc, formula_value_stack& ar
             case formula_function_t::func_sum:
                 fnc_sum(args);
                 break;
+            case formula_function_t::func_sumif:
+                fnc_sumif(args);
+                break;
+            case formula_function_t::func_sumifs:
+                fnc_sumifs(args);
+                break;
+            case formula_function_t::func_sumproduct:
+                fnc_sumproduct(args);
+                break;
+            case formula_function_t::func_sumsq:
+                fnc_sumsq(args);
+                break;
             case formula_function_t::func_t:
                 fnc_t(args);
                 break;
             case formula_function_t::func_textjoin:
                 fnc_textjoin(args);
                 break;
+            case formula_function_t::func_trend:
+                fnc_trend(args);
+                break;
             case formula_function_t::func_trim:
                 fnc_trim(args);
                 break;
@@ -791,9 +2325,37 @@ void formula_functions::interpret(formula_function_t oc, formula_value_stack& ar
             case formula_function_t::func_type:
                 fnc_type(args);
                 break;
+            case formula_function_t::func_var:
+                fnc_var(args);
+                break;
+            case formula_function_t::func_vara:
+                fnc_vara(args);
+                break;
+            case formula_function_t::func_varp:
+                fnc_varp(args);
+                break;
+            case formula_function_t::func_varpa:
+                fnc_varpa(args);
+                break;
+            case formula_function_t::func_vlookup:
+                fnc_vlookup(args);
+                break;
             case formula_function_t::func_wait:
                 fnc_wait(args);
                 break;
+            case formula_function_t::func_choose:
+            case formula_function_t::func_iferror:
+            case formula_function_t::func_ifna:
+            case formula_function_t::func_ifs:
+            case formula_function_t::func_switch:
+            {
+                // The arguments of these functions get evaluated lazily, and
+                // only a call with an invalid number of arguments ends up
+                // here.  See formula_program for the rest.
+                std::ostringstream os;
+                os << get_formula_function_name(oc) << " has an invalid number of arguments.";
+                throw formula_functions::invalid_arg(os.str());
+            }
             case formula_function_t::func_unknown:
             default:
             {
@@ -823,14 +2385,39 @@ void formula_functions::fnc_max(formula_value_stack& args) const
     if (args.empty())
         throw formula_functions::invalid_arg("MAX requires one or more arguments.");
 
-    double ret = args.pop_value();
-    while (!args.empty())
+    std::optional<double> ret;
+    auto func = [&ret](const double* p, const double* p_end)
     {
-        double v = args.pop_value();
-        if (v > ret)
+        if (p == p_end)
+            return;
+
+        double v = kernel::max(p, p_end - p);
+        if (!ret || *ret < v)
             ret = v;
+    };
+
+    auto agg_func = [&ret](const detail::column_aggregates& agg)
+    {
+        if (agg.count && (!ret || *ret < agg.max))
+            ret = agg.max;
+    };
+
+    if (auto err = reduce_numeric_args(*m_context.mp_impl, args, func, agg_func); err)
+    {
+        args.clear();
+        args.push_error(*err);
+        return;
     }
-    args.push_value(ret);
+
+    args.push_value(ret ? *ret : 0.0);
+}
+
+void formula_functions::fnc_maxifs(formula_value_stack& args) const
+{
+    if (args.size() < 3u || args.size() % 2u == 0)
+        throw formula_functions::invalid_arg("MAXIFS requires a range followed by one or more pairs of a range and a criterion.");
+
+    aggregate_matched_values(m_context, *m_context.mp_impl, args, conditional_aggregate_t::max, true);
 }
 
 void formula_functions::fnc_median(formula_value_stack& args) const
@@ -838,26 +2425,26 @@ void formula_functions::fnc_median(formula_value_stack& args) const
     if (args.empty())
         throw formula_functions::invalid_arg("MEDIAN requires one or more arguments.");
 
-    std::vector<double> seq;
+    order_statistics stats(*m_context.mp_impl, args, args.size());
 
-    while (!args.empty())
-        append_values_from_stack(m_context, args, std::back_inserter(seq));
+    if (!stats.size())
+    {
+        args.push_error(formula_error_t::invalid_expression);
+        return;
+    }
 
-    std::size_t mid_pos = seq.size() / 2;
+    std::size_t mid_pos = stats.size() / 2;
 
-    if (seq.size() & 0x01)
+    if (stats.size() & 0x01)
     {
         // odd number of values
-        auto it_mid = seq.begin() + mid_pos;
-        std::nth_element(seq.begin(), it_mid, seq.end());
-        args.push_value(seq[mid_pos]);
+        args.push_value(stats.nth(mid_pos));
     }
     else
     {
         // even number of values.  Take the average of the two mid values.
-        std::sort(seq.begin(), seq.end());
-        double v = seq[mid_pos - 1] + seq[mid_pos];
-        args.push_value(v / 2.0);
+        auto [v1, v2] = stats.nth_pair(mid_pos - 1);
+        args.push_value((v1 + v2) / 2.0);
     }
 }
 
@@ -866,70 +2453,288 @@ void formula_functions::fnc_min(formula_value_stack& args) const
     if (args.empty())
         throw formula_functions::invalid_arg("MIN requires one or more arguments.");
 
-    double ret = args.pop_value();
-    while (!args.empty())
+    std::optional<double> ret;
+    auto func = [&ret](const double* p, const double* p_end)
     {
-        double v = args.pop_value();
-        if (v < ret)
+        if (p == p_end)
+            return;
+
+        double v = kernel::min(p, p_end - p);
+        if (!ret || v < *ret)
             ret = v;
+    };
+
+    auto agg_func = [&ret](const detail::column_aggregates& agg)
+    {
+        if (agg.count && (!ret || agg.min < *ret))
+            ret = agg.min;
+    };
+
+    if (auto err = reduce_numeric_args(*m_context.mp_impl, args, func, agg_func); err)
+    {
+        args.clear();
+        args.push_error(*err);
+        return;
     }
-    args.push_value(ret);
+
+    args.push_value(ret ? *ret : 0.0);
 }
 
-void formula_functions::fnc_mode(formula_value_stack& args) const
+void formula_functions::fnc_minifs(formula_value_stack& args) const
+{
+    if (args.size() < 3u || args.size() % 2u == 0)
+        throw formula_functions::invalid_arg("MINIFS requires a range followed by one or more pairs of a range and a criterion.");
+
+    aggregate_matched_values(m_context, *m_context.mp_impl, args, conditional_aggregate_t::min, true);
+}
+
+void formula_functions::fnc_small(formula_value_stack& args) const
+{
+    if (args.size() != 2u)
+        throw formula_functions::invalid_arg("SMALL requires exactly 2 arguments.");
+
+    double k = std::ceil(args.pop_value());
+    order_statistics stats(*m_context.mp_impl, args, 1);
+
+    if (k < 1.0 || k > stats.size())
+    {
+        args.push_error(formula_error_t::invalid_expression);
+        return;
+    }
+
+    args.push_value(stats.nth(std::size_t(k) - 1));
+}
+
+void formula_functions::fnc_stdev(formula_value_stack& args) const
 {
     if (args.empty())
-        throw formula_functions::invalid_arg("MODE requires one or more arguments.");
+        throw formula_functions::invalid_arg("STDEV requires one or more arguments.");
+
+    push_variance(*m_context.mp_impl, args, variance_t::sample, false, true);
+}
 
-    std::vector<double> seq;
+void formula_functions::fnc_stdeva(formula_value_stack& args) const
+{
+    if (args.empty())
+        throw formula_functions::invalid_arg("STDEVA requires one or more arguments.");
 
-    while (!args.empty())
-        append_values_from_stack(m_context, args, std::back_inserter(seq));
+    push_variance(*m_context.mp_impl, args, variance_t::sample, true, true);
+}
+
+void formula_functions::fnc_stdevp(formula_value_stack& args) const
+{
+    if (args.empty())
+        throw formula_functions::invalid_arg("STDEVP requires one or more arguments.");
+
+    push_variance(*m_context.mp_impl, args, variance_t::population, false, true);
+}
+
+void formula_functions::fnc_stdevpa(formula_value_stack& args) const
+{
+    if (args.empty())
+        throw formula_functions::invalid_arg("STDEVPA requires one or more arguments.");
+
+    push_variance(*m_context.mp_impl, args, variance_t::population, true, true);
+}
+
+void formula_functions::fnc_trend(formula_value_stack& args) const
+{
+    if (args.empty() || args.size() > 4u)
+        throw formula_functions::invalid_arg("TREND requires 1 to 4 arguments.");
+
+    bool constant = args.size() == 4u ? args.pop_boolean() : true;
+
+    std::optional<matrix> mx_new;
+    if (args.size() == 3u)
+        mx_new = pop_matrix_operand(args);
 
-    if (seq.empty())
+    regression_data_arg_t data_arg = pop_regression_data(args, args.size() == 2u);
+    if (const auto* err = std::get_if<formula_error_t>(&data_arg); err)
     {
-        args.push_error(formula_error_t::no_value_available);
+        args.push_error(*err);
+        return;
+    }
+
+    const regression_data& data = std::get<regression_data>(data_arg);
+
+    // Values of the independent variables to predict the dependent values
+    // for, and the shape of the predicted values.
+    std::vector<double> new_xs;
+    std::size_t rows = data.y_rows;
+    std::size_t cols = data.y_cols;
+
+    if (mx_new)
+    {
+        if (!mx_new->is_numeric())
+        {
+            args.push_error(formula_error_t::invalid_value_type);
+            return;
+        }
+
+        numeric_matrix nm = mx_new->as_numeric();
+        rows = nm.row_size();
+        cols = nm.col_size();
+
+        switch (data.layout)
+        {
+            case variable_layout_t::single:
+                break;
+            case variable_layout_t::columns:
+                if (cols != data.k)
+                {
+                    args.push_error(formula_error_t::ref_result_not_available);
+                    return;
+                }
+                cols = 1;
+                break;
+            case variable_layout_t::rows:
+                if (rows != data.k)
+                {
+                    args.push_error(formula_error_t::ref_result_not_available);
+                    return;
+                }
+                rows = 1;
+                break;
+        }
+
+        new_xs = flatten_variables(nm, data.layout);
+    }
+    else
+        new_xs = data.xs;
+
+    std::optional<linear_model> model = fit_linear_model(std::get<regression_data>(std::move(data_arg)), constant);
+    if (!model)
+    {
+        args.push_error(formula_error_t::invalid_expression);
         return;
     }
 
-    std::sort(seq.begin(), seq.end());
+    const std::size_t m = rows * cols;
+    std::vector<double> ys(m, model->intercept);
+
+    for (std::size_t j = 0; j < model->k; ++j)
+    {
+        for (std::size_t i = 0; i < m; ++i)
+            ys[i] += model->coefs[j] * new_xs[j * m + i];
+    }
+
+    args.push_matrix(numeric_matrix(std::move(ys), rows, cols));
+}
+
+void formula_functions::fnc_var(formula_value_stack& args) const
+{
+    if (args.empty())
+        throw formula_functions::invalid_arg("VAR requires one or more arguments.");
+
+    push_variance(*m_context.mp_impl, args, variance_t::sample, false, false);
+}
+
+void formula_functions::fnc_vara(formula_value_stack& args) const
+{
+    if (args.empty())
+        throw formula_functions::invalid_arg("VARA requires one or more arguments.");
+
+    push_variance(*m_context.mp_impl, args, variance_t::sample, true, false);
+}
+
+void formula_functions::fnc_varp(formula_value_stack& args) const
+{
+    if (args.empty())
+        throw formula_functions::invalid_arg("VARP requires one or more arguments.");
+
+    push_variance(*m_context.mp_impl, args, variance_t::population, false, false);
+}
+
+void formula_functions::fnc_varpa(formula_value_stack& args) const
+{
+    if (args.empty())
+        throw formula_functions::invalid_arg("VARPA requires one or more arguments.");
+
+    push_variance(*m_context.mp_impl, args, variance_t::population, true, false);
+}
+
+void formula_functions::fnc_mode(formula_value_stack& args) const
+{
+    if (args.empty())
+        throw formula_functions::invalid_arg("MODE requires one or more arguments.");
+
+    order_statistics stats(*m_context.mp_impl, args, args.size());
+    const std::vector<double>& seq = stats.sorted();
 
-    // keep counting the number of adjacent equal values in the sorted sequence.
+    // Find the longest run of equal values in the sorted sequence.  The
+    // smallest value wins when more than one run is the longest.
 
-    using value_count_type = std::tuple<double, std::size_t>;
-    std::vector<value_count_type> value_counts;
+    double top_value = 0.0;
+    std::size_t top_count = 0;
 
     for (auto it = seq.begin(); it != seq.end(); )
     {
-        double cur_v = *it;
-        auto it_tail = std::find_if(it, seq.end(), [cur_v](double v) { return cur_v < v; });
+        auto it_tail = std::upper_bound(it, seq.end(), *it);
         std::size_t len = std::distance(it, it_tail);
-        value_counts.emplace_back(cur_v, len);
+        if (len > top_count)
+        {
+            top_value = *it;
+            top_count = len;
+        }
         it = it_tail;
     }
 
-    assert(!value_counts.empty());
+    if (top_count < 2u)
+    {
+        args.push_error(formula_error_t::no_value_available);
+        return;
+    }
+
+    args.push_value(top_value);
+}
+
+void formula_functions::fnc_percentile(formula_value_stack& args) const
+{
+    if (args.size() != 2u)
+        throw formula_functions::invalid_arg("PERCENTILE requires exactly 2 arguments.");
 
-    // Sort the results by the frequency in descending order first, then the
-    // value in ascending order.
-    auto func_comp = [](value_count_type lhs, value_count_type rhs)
+    double k = args.pop_value();
+    order_statistics stats(*m_context.mp_impl, args, 1);
+
+    if (!stats.size() || k < 0.0 || k > 1.0)
     {
-        if (std::get<1>(lhs) > std::get<1>(rhs))
-            return true;
+        args.push_error(formula_error_t::invalid_expression);
+        return;
+    }
 
-        return std::get<0>(lhs) < std::get<0>(rhs);
-    };
+    // Interpolate between the two values around the position.
+    double pos = k * (stats.size() - 1);
+    std::size_t n = pos;
+    double frac = pos - n;
+
+    if (frac == 0.0)
+    {
+        args.push_value(stats.nth(n));
+        return;
+    }
+
+    auto [v1, v2] = stats.nth_pair(n);
+    args.push_value(v1 + frac * (v2 - v1));
+}
+
+void formula_functions::fnc_rank(formula_value_stack& args) const
+{
+    if (args.size() < 2u || args.size() > 3u)
+        throw formula_functions::invalid_arg("RANK requires 2 or 3 arguments.");
 
-    std::sort(value_counts.begin(), value_counts.end(), func_comp);
-    auto [top_value, top_count] = value_counts[0];
+    bool ascending = args.size() == 3u ? args.pop_value() != 0.0 : false;
+    order_statistics stats(*m_context.mp_impl, args, 1);
+    double v = args.pop_value();
 
-    if (top_count == 1)
+    auto [less, equal] = stats.count_less_equal(v);
+    if (!equal)
     {
         args.push_error(formula_error_t::no_value_available);
         return;
     }
 
-    args.push_value(top_value);
+    std::size_t preceding = ascending ? less : stats.size() - less - equal;
+    args.push_value(preceding + 1);
 }
 
 void formula_functions::fnc_sum(formula_value_stack& args) const
@@ -940,24 +2745,174 @@ void formula_functions::fnc_sum(formula_value_stack& args) const
         throw formula_functions::invalid_arg("SUM requires one or more arguments.");
 
     double ret = 0;
-    while (!args.empty())
+    auto func = [&ret](const double* p, const double* p_end)
     {
-        switch (args.get_type())
+        ret += kernel::sum(p, p_end - p);
+    };
+
+    auto agg_func = [&ret](const detail::column_aggregates& agg)
+    {
+        ret += agg.sum;
+    };
+
+    if (auto err = reduce_numeric_args(*m_context.mp_impl, args, func, agg_func); err)
+    {
+        args.clear();
+        args.push_error(*err);
+        return;
+    }
+
+    args.push_value(ret);
+
+    IXION_TRACE("function: sum end (result=" << ret << ")");
+}
+
+void formula_functions::fnc_sumif(formula_value_stack& args) const
+{
+    if (args.size() < 2u || args.size() > 3u)
+        throw formula_functions::invalid_arg("SUMIF requires 2 or 3 arguments.");
+
+    aggregate_matched_values(m_context, *m_context.mp_impl, args, conditional_aggregate_t::sum, false);
+}
+
+void formula_functions::fnc_sumifs(formula_value_stack& args) const
+{
+    if (args.size() < 3u || args.size() % 2u == 0)
+        throw formula_functions::invalid_arg("SUMIFS requires a range followed by one or more pairs of a range and a criterion.");
+
+    aggregate_matched_values(m_context, *m_context.mp_impl, args, conditional_aggregate_t::sum, true);
+}
+
+void formula_functions::fnc_sumproduct(formula_value_stack& args) const
+{
+    if (args.empty())
+        throw formula_functions::invalid_arg("SUMPRODUCT requires one or more arguments.");
+
+    double ret = 0.0;
+    std::optional<formula_error_t> err;
+
+    if (args.size() == 1u)
+    {
+        auto func = [&ret](const double* p, const double* p_end)
         {
-            case stack_value_t::range_ref:
-                ret += sum_matrix_elements(args.pop_range_value());
+            ret += kernel::sum(p, p_end - p);
+        };
+
+        err = reduce_numeric_args(*m_context.mp_impl, args, func);
+    }
+    else if (args.size() == 2u)
+    {
+        // Multiply and add the pairs of values in one pass.
+        auto func = [&ret](const double* p1, const double* p2, std::size_t n)
+        {
+            ret += kernel::dot(p1, p2, n);
+        };
+
+        err = reduce_paired_args(*m_context.mp_impl, args, formula_error_t::invalid_value_type, func);
+    }
+    else
+    {
+        // Multiply the values of each argument into one array of products.
+        std::vector<double> products;
+        std::size_t rows = 0, cols = 0;
+
+        while (!args.empty() && !err)
+        {
+            matrix mx = pop_matrix_operand(args);
+
+            if (products.empty())
+            {
+                rows = mx.row_size();
+                cols = mx.col_size();
+                products.assign(rows * cols, 1.0);
+            }
+            else if (mx.row_size() != rows || mx.col_size() != cols)
+            {
+                err = formula_error_t::invalid_value_type;
                 break;
-            case stack_value_t::single_ref:
-            case stack_value_t::string:
-            case stack_value_t::value:
-            default:
-                ret += args.pop_value();
+            }
+
+            for (std::size_t col = 0; col < cols && !err; ++col)
+            {
+                for (std::size_t row = 0; row < rows; ++row)
+                {
+                    double& v = products[col * rows + row];
+
+                    if (mx.is_numeric(row, col))
+                    {
+                        v *= mx.get_numeric(row, col);
+                        continue;
+                    }
+
+                    matrix::element e = mx.get(row, col);
+                    if (e.type == matrix::element_type::error)
+                    {
+                        err = std::get<formula_error_t>(e.value);
+                        break;
+                    }
+
+                    v = 0.0;
+                }
+            }
         }
+
+        if (!err)
+            ret = kernel::sum(products.data(), products.size());
+    }
+
+    if (err)
+    {
+        args.clear();
+        args.push_error(*err);
+        return;
+    }
+
+    args.push_value(ret);
+}
+
+void formula_functions::fnc_sumsq(formula_value_stack& args) const
+{
+    if (args.empty())
+        throw formula_functions::invalid_arg("SUMSQ requires one or more arguments.");
+
+    double ret = 0;
+    auto func = [&ret](const double* p, const double* p_end)
+    {
+        ret += kernel::sum_squares(p, p_end - p);
+    };
+
+    if (auto err = reduce_numeric_args(*m_context.mp_impl, args, func); err)
+    {
+        args.clear();
+        args.push_error(*err);
+        return;
+    }
+
+    args.push_value(ret);
+}
+
+void formula_functions::fnc_product(formula_value_stack& args) const
+{
+    if (args.empty())
+        throw formula_functions::invalid_arg("PRODUCT requires one or more arguments.");
+
+    double ret = 1.0;
+    std::size_t count = 0;
+    auto func = [&ret, &count](const double* p, const double* p_end)
+    {
+        ret = std::accumulate(p, p_end, ret, std::multiplies<double>());
+        count += p_end - p;
+    };
+
+    if (auto err = reduce_numeric_args(*m_context.mp_impl, args, func); err)
+    {
+        args.clear();
+        args.push_error(*err);
+        return;
     }
 
-    args.push_value(ret);
-
-    IXION_TRACE("function: sum end (result=" << ret << ")");
+    // PRODUCT of no numeric values is 0, not 1.
+    args.push_value(count ? ret : 0.0);
 }
 
 void formula_functions::fnc_count(formula_value_stack& args) const
@@ -975,7 +2930,10 @@ void formula_functions::fnc_count(formula_value_stack& args) const
             case stack_value_t::range_ref:
             {
                 abs_range_t range = args.pop_range_ref();
-                ret += m_context.count_range(range, value_numeric | value_boolean);
+                if (auto agg = m_context.mp_impl->get_range_aggregates(range); agg)
+                    ret += agg->count;
+                else
+                    ret += m_context.count_range(range, value_numeric | value_boolean);
                 break;
             }
             case stack_value_t::single_ref:
@@ -1050,6 +3008,141 @@ void formula_functions::fnc_countblank(formula_value_stack& args) const
     }
 }
 
+void formula_functions::fnc_countif(formula_value_stack& args) const
+{
+    if (args.size() != 2u)
+        throw formula_functions::invalid_arg("COUNTIF requires exactly 2 arguments.");
+
+    aggregate_matched_values(m_context, *m_context.mp_impl, args, conditional_aggregate_t::count, false);
+}
+
+void formula_functions::fnc_countifs(formula_value_stack& args) const
+{
+    if (args.empty() || args.size() % 2u != 0)
+        throw formula_functions::invalid_arg("COUNTIFS requires one or more pairs of a range and a criterion.");
+
+    aggregate_matched_values(m_context, *m_context.mp_impl, args, conditional_aggregate_t::count, true);
+}
+
+void formula_functions::fnc_covar(formula_value_stack& args) const
+{
+    if (args.size() != 2u)
+        throw formula_functions::invalid_arg("COVAR requires exactly 2 arguments.");
+
+    co_moments m;
+    auto func = [&m](const double* p1, const double* p2, std::size_t n)
+    {
+        m.append(p1, p2, n);
+    };
+
+    if (auto err = reduce_paired_args(*m_context.mp_impl, args, formula_error_t::no_value_available, func); err)
+    {
+        args.clear();
+        args.push_error(*err);
+        return;
+    }
+
+    if (!m.count)
+    {
+        args.push_error(formula_error_t::division_by_zero);
+        return;
+    }
+
+    args.push_value(m.c12 / m.count);
+}
+
+void formula_functions::fnc_large(formula_value_stack& args) const
+{
+    if (args.size() != 2u)
+        throw formula_functions::invalid_arg("LARGE requires exactly 2 arguments.");
+
+    double k = std::ceil(args.pop_value());
+    order_statistics stats(*m_context.mp_impl, args, 1);
+
+    if (k < 1.0 || k > stats.size())
+    {
+        args.push_error(formula_error_t::invalid_expression);
+        return;
+    }
+
+    args.push_value(stats.nth(stats.size() - std::size_t(k)));
+}
+
+void formula_functions::fnc_linest(formula_value_stack& args) const
+{
+    if (args.empty() || args.size() > 4u)
+        throw formula_functions::invalid_arg("LINEST requires 1 to 4 arguments.");
+
+    bool stats = args.size() == 4u ? args.pop_boolean() : false;
+    bool constant = args.size() >= 3u ? args.pop_boolean() : true;
+
+    regression_data_arg_t data = pop_regression_data(args, args.size() == 2u);
+    if (const auto* err = std::get_if<formula_error_t>(&data); err)
+    {
+        args.push_error(*err);
+        return;
+    }
+
+    std::optional<linear_model> model = fit_linear_model(std::get<regression_data>(std::move(data)), constant);
+    if (!model)
+    {
+        args.push_error(formula_error_t::invalid_expression);
+        return;
+    }
+
+    // The coefficients come in the reverse order of the variables, followed
+    // by the intercept.
+    const std::size_t k = model->k;
+    matrix ret(stats ? 5 : 1, k + 1, formula_error_t::no_value_available);
+
+    for (std::size_t j = 0; j < k; ++j)
+        ret.set(0, k - 1 - j, model->coefs[j]);
+    ret.set(0, k, model->intercept);
+
+    if (stats)
+    {
+        const double df = double(model->n) - k - (constant ? 1 : 0);
+        if (df < 1.0)
+        {
+            args.push_error(formula_error_t::invalid_expression);
+            return;
+        }
+
+        const double ss_reg = model->ss_total - model->ss_resid;
+        const double se_y = std::sqrt(model->ss_resid / df);
+
+        for (std::size_t j = 0; j < k; ++j)
+            ret.set(1, k - 1 - j, se_y * std::sqrt(model->inverse[j * k + j]));
+
+        if (constant)
+        {
+            double q = 0.0;
+            for (std::size_t i = 0; i < k; ++i)
+                q += model->x_means[i] * kernel::dot(&model->inverse[i * k], model->x_means.data(), k);
+
+            ret.set(1, k, se_y * std::sqrt(1.0 / model->n + q));
+        }
+
+        if (model->ss_total > 0.0)
+            ret.set(2, 0, ss_reg / model->ss_total);
+        else
+            ret.set(2, 0, formula_error_t::invalid_expression);
+
+        ret.set(2, 1, se_y);
+
+        if (model->ss_resid > 0.0)
+            ret.set(3, 0, (ss_reg / k) / (model->ss_resid / df));
+        else
+            ret.set(3, 0, formula_error_t::invalid_expression);
+
+        ret.set(3, 1, df);
+        ret.set(4, 0, ss_reg);
+        ret.set(4, 1, model->ss_resid);
+    }
+
+    args.push_matrix(ret);
+}
+
 void formula_functions::fnc_abs(formula_value_stack& args) const
 {
     if (args.size() != 1)
@@ -1065,40 +3158,49 @@ void formula_functions::fnc_average(formula_value_stack& args) const
         throw formula_functions::invalid_arg("AVERAGE requires one or more arguments.");
 
     double ret = 0;
-    double count = 0.0;
-    while (!args.empty())
+    std::size_t count = 0;
+    auto func = [&ret, &count](const double* p, const double* p_end)
     {
-        switch (args.get_type())
-        {
-            case stack_value_t::range_ref:
-            {
-                matrix mx = args.pop_range_value();
-                size_t rows = mx.row_size();
-                size_t cols = mx.col_size();
+        ret += kernel::sum(p, p_end - p);
+        count += p_end - p;
+    };
 
-                for (size_t r = 0; r < rows; ++r)
-                {
-                    for (size_t c = 0; c < cols; ++c)
-                    {
-                        if (!mx.is_numeric(r, c))
-                            continue;
+    auto agg_func = [&ret, &count](const detail::column_aggregates& agg)
+    {
+        ret += agg.sum;
+        count += agg.count;
+    };
 
-                        ret += mx.get_numeric(r, c);
-                        ++count;
-                    }
-                }
-                break;
-            }
-            case stack_value_t::single_ref:
-            case stack_value_t::string:
-            case stack_value_t::value:
-            default:
-                ret += args.pop_value();
-                ++count;
-        }
+    if (auto err = reduce_numeric_args(*m_context.mp_impl, args, func, agg_func); err)
+    {
+        args.clear();
+        args.push_error(*err);
+        return;
+    }
+
+    if (!count)
+    {
+        args.push_error(formula_error_t::division_by_zero);
+        return;
     }
 
-    args.push_value(ret/count);
+    args.push_value(ret / count);
+}
+
+void formula_functions::fnc_averageif(formula_value_stack& args) const
+{
+    if (args.size() < 2u || args.size() > 3u)
+        throw formula_functions::invalid_arg("AVERAGEIF requires 2 or 3 arguments.");
+
+    aggregate_matched_values(m_context, *m_context.mp_impl, args, conditional_aggregate_t::average, false);
+}
+
+void formula_functions::fnc_averageifs(formula_value_stack& args) const
+{
+    if (args.size() < 3u || args.size() % 2u == 0)
+        throw formula_functions::invalid_arg("AVERAGEIFS requires a range followed by one or more pairs of a range and a criterion.");
+
+    aggregate_matched_values(m_context, *m_context.mp_impl, args, conditional_aggregate_t::average, true);
 }
 
 void formula_functions::fnc_mmult(formula_value_stack& args) const
@@ -1366,9 +3468,9 @@ void formula_functions::fnc_if(formula_value_stack& args) const
     else
         std::advance(pos, 2);
 
-    formula_value_stack ret(m_context);
-    ret.push_back(args.release(pos));
-    args.swap(ret);
+    stack_value ret = args.release(pos);
+    args.clear();
+    args.push_back(std::move(ret));
 }
 
 void formula_functions::fnc_true(formula_value_stack& args) const
@@ -2095,8 +4197,12 @@ void formula_functions::fnc_textjoin(formula_value_stack& args) const
     std::string delim = args.pop_string();
     std::vector<std::string> tokens;
 
-    for (const abs_range_t& range : ranges)
+    for (abs_range_t range : ranges)
     {
+        if (skip_empty)
+            // The cells past the data extent would all get skipped.
+            range = m_context.mp_impl->clip_to_data_extent(range);
+
         for (sheet_t sheet = range.first.sheet; sheet <= range.last.sheet; ++sheet)
         {
             model_iterator miter = m_context.get_model_iterator(sheet, rc_direction_t::horizontal, range);
@@ -2244,8 +4350,18 @@ void formula_functions::fnc_subtotal(formula_value_stack& args) const
         case 109:
         {
             // SUM
-            matrix mx = m_context.get_range_value(range);
-            args.push_value(sum_matrix_elements(mx));
+            double sum = 0.0;
+            auto func = [&sum](const double* p, const double* p_end)
+            {
+                sum += kernel::sum(p, p_end - p);
+            };
+
+            if (auto agg = m_context.mp_impl->get_range_aggregates(range); agg)
+                args.push_value(agg->sum);
+            else if (auto err = reduce_range_values(*m_context.mp_impl, range, func); err)
+                args.push_error(*err);
+            else
+                args.push_value(sum);
             break;
         }
         default:
@@ -2278,7 +4394,9 @@ void formula_functions::fnc_column(formula_value_stack& args) const
             break;
         }
         default:
-            throw formula_error(formula_error_t::invalid_value_type);
+            args.clear();
+            args.push_error(formula_error_t::invalid_value_type);
+            return;
     }
 }
 
@@ -2298,7 +4416,9 @@ void formula_functions::fnc_columns(formula_value_stack& args) const
                 break;
             }
             default:
-                throw formula_error(formula_error_t::invalid_value_type);
+                args.clear();
+                args.push_error(formula_error_t::invalid_value_type);
+                return;
         }
     }
 
@@ -2326,7 +4446,9 @@ void formula_functions::fnc_row(formula_value_stack& args) const
             break;
         }
         default:
-            throw formula_error(formula_error_t::invalid_value_type);
+            args.clear();
+            args.push_error(formula_error_t::invalid_value_type);
+            return;
     }
 }
 
@@ -2346,7 +4468,9 @@ void formula_functions::fnc_rows(formula_value_stack& args) const
                 break;
             }
             default:
-                throw formula_error(formula_error_t::invalid_value_type);
+                args.clear();
+                args.push_error(formula_error_t::invalid_value_type);
+                return;
         }
     }
 
@@ -2380,13 +4504,18 @@ void formula_functions::fnc_sheet(formula_value_stack& args) const
             std::string sheet_name = args.pop_string();
             sheet_t sheet_id = m_context.get_sheet_index(sheet_name);
             if (sheet_id == invalid_sheet)
-                throw formula_error(formula_error_t::no_value_available);
+            {
+                args.push_error(formula_error_t::no_value_available);
+                return;
+            }
 
             args.push_value(sheet_id + 1);
             break;
         }
         default:
-            throw formula_error(formula_error_t::invalid_value_type);
+            args.clear();
+            args.push_error(formula_error_t::invalid_value_type);
+            return;
     }
 }
 
@@ -2412,8 +4541,251 @@ void formula_functions::fnc_sheets(formula_value_stack& args) const
             break;
         }
         default:
-            throw formula_error(formula_error_t::no_value_available);
+            args.clear();
+            args.push_error(formula_error_t::no_value_available);
+            return;
+    }
+}
+
+void formula_functions::fnc_hlookup(formula_value_stack& args) const
+{
+    if (args.size() < 3u || args.size() > 4u)
+        throw formula_functions::invalid_arg("HLOOKUP requires 3 or 4 arguments.");
+
+    lookup_in_table(m_context, *m_context.mp_impl, args, rc_direction_t::horizontal);
+}
+
+void formula_functions::fnc_index(formula_value_stack& args) const
+{
+    if (args.size() < 2u || args.size() > 3u)
+        throw formula_functions::invalid_arg("INDEX requires 2 or 3 arguments.");
+
+    std::optional<double> col_num;
+    if (args.size() == 3u)
+        col_num = args.pop_value();
+
+    double row_num = args.pop_value();
+
+    // Get the number of rows and columns of the array, and resolve the
+    // position in it.  A position of 0 means the entire row or column.
+    auto resolve_position = [&row_num, &col_num](std::size_t rows, std::size_t cols) -> bool
+    {
+        if (!col_num)
+        {
+            if (rows == 1u && cols > 1u)
+            {
+                // The only position of a single row is the column position.
+                col_num = row_num;
+                row_num = 1.0;
+            }
+            else
+                col_num = cols == 1u ? 1.0 : 0.0;
+        }
+
+        return row_num >= 0.0 && row_num < rows + 1.0 && *col_num >= 0.0 && *col_num < cols + 1.0;
+    };
+
+    switch (args.get_type())
+    {
+        case stack_value_t::single_ref:
+        case stack_value_t::range_ref:
+        {
+            abs_range_t range = clip_to_sheet(args.pop_range_ref(), m_context.get_sheet_size());
+            std::size_t rows = range.last.row - range.first.row + 1;
+            std::size_t cols = range.last.column - range.first.column + 1;
+
+            if (!resolve_position(rows, cols))
+            {
+                args.push_error(formula_error_t::ref_result_not_available);
+                return;
+            }
+
+            row_t row = row_num;
+            col_t col = *col_num;
+
+            if (row)
+            {
+                range.first.row += row - 1;
+                range.last.row = range.first.row;
+            }
+
+            if (col)
+            {
+                range.first.column += col - 1;
+                range.last.column = range.first.column;
+            }
+
+            if (range.first == range.last)
+                args.push_single_ref(range.first);
+            else
+                args.push_range_ref(range);
+            break;
+        }
+        case stack_value_t::matrix:
+        {
+            matrix mx = args.pop_matrix();
+
+            if (!resolve_position(mx.row_size(), mx.col_size()) || row_num < 1.0 || *col_num < 1.0)
+            {
+                // Getting an entire row or column of an array is not
+                // supported.
+                args.push_error(formula_error_t::ref_result_not_available);
+                return;
+            }
+
+            matrix::element e = mx.get(std::size_t(row_num) - 1, std::size_t(*col_num) - 1);
+
+            switch (e.type)
+            {
+                case matrix::element_type::numeric:
+                    args.push_value(std::get<double>(e.value));
+                    break;
+                case matrix::element_type::boolean:
+                    args.push_boolean(std::get<bool>(e.value));
+                    break;
+                case matrix::element_type::string:
+                    args.push_string(std::string{std::get<std::string_view>(e.value)});
+                    break;
+                case matrix::element_type::error:
+                    args.push_error(std::get<formula_error_t>(e.value));
+                    break;
+                case matrix::element_type::empty:
+                    args.push_value(0.0);
+                    break;
+            }
+            break;
+        }
+        default:
+            args.clear();
+            args.push_error(formula_error_t::invalid_value_type);
+    }
+}
+
+void formula_functions::fnc_lookup(formula_value_stack& args) const
+{
+    if (args.size() < 2u || args.size() > 3u)
+        throw formula_functions::invalid_arg("LOOKUP requires 2 or 3 arguments.");
+
+    const rc_size_t sheet_size = m_context.get_sheet_size();
+    std::optional<abs_range_t> results;
+
+    if (args.size() == 3u)
+    {
+        if (!is_reference(args.get_type()))
+        {
+            args.clear();
+            args.push_error(formula_error_t::invalid_value_type);
+            return;
+        }
+
+        results = clip_to_sheet(args.pop_range_ref(), sheet_size);
+    }
+
+    if (!is_reference(args.get_type()))
+    {
+        args.clear();
+        args.push_error(formula_error_t::invalid_value_type);
+        return;
+    }
+
+    abs_range_t keys = clip_to_sheet(args.pop_range_ref(), sheet_size);
+
+    lookup_value_t value = pop_lookup_value(m_context, args);
+    if (const formula_error_t* err = std::get_if<formula_error_t>(&value); err)
+    {
+        args.push_error(*err);
+        return;
+    }
+
+    if (!results)
+    {
+        // Look the value up in the first row of the array when it is wider
+        // than it is tall, or in its first column otherwise, and take the
+        // result from its last row or column.
+        results = keys;
+        if (keys.last.column - keys.first.column > keys.last.row - keys.first.row)
+        {
+            keys.last.row = keys.first.row;
+            results->first.row = results->last.row;
+        }
+        else
+        {
+            keys.last.column = keys.first.column;
+            results->first.column = results->last.column;
+        }
+    }
+
+    std::optional<std::size_t> pos = find_lookup_value(
+        *m_context.mp_impl, keys, value, detail::lookup_match_t::less_or_equal);
+
+    if (!pos)
+    {
+        args.push_error(formula_error_t::no_value_available);
+        return;
+    }
+
+    // The result vector extends in its direction when it is shorter than
+    // the lookup vector.
+    abs_address_t addr = results->first;
+    if (results->first.row == results->last.row && results->first.column != results->last.column)
+        addr.column += *pos;
+    else
+        addr.row += *pos;
+
+    if (addr.row >= sheet_size.row || addr.column >= sheet_size.column)
+    {
+        args.push_error(formula_error_t::ref_result_not_available);
+        return;
+    }
+
+    args.push_single_ref(addr);
+}
+
+void formula_functions::fnc_match(formula_value_stack& args) const
+{
+    if (args.size() < 2u || args.size() > 3u)
+        throw formula_functions::invalid_arg("MATCH requires 2 or 3 arguments.");
+
+    double match_type = args.size() == 3u ? args.pop_value() : 1.0;
+
+    if (!is_reference(args.get_type()))
+    {
+        args.clear();
+        args.push_error(formula_error_t::invalid_value_type);
+        return;
     }
+
+    abs_range_t range = clip_to_sheet(args.pop_range_ref(), m_context.get_sheet_size());
+
+    lookup_value_t value = pop_lookup_value(m_context, args);
+    if (const formula_error_t* err = std::get_if<formula_error_t>(&value); err)
+    {
+        args.push_error(*err);
+        return;
+    }
+
+    detail::lookup_match_t match = detail::lookup_match_t::exact;
+    if (match_type > 0.0)
+        match = detail::lookup_match_t::less_or_equal;
+    else if (match_type < 0.0)
+        match = detail::lookup_match_t::greater_or_equal;
+
+    std::optional<std::size_t> pos = find_lookup_value(*m_context.mp_impl, range, value, match);
+    if (!pos)
+    {
+        args.push_error(formula_error_t::no_value_available);
+        return;
+    }
+
+    args.push_value(*pos + 1);
+}
+
+void formula_functions::fnc_vlookup(formula_value_stack& args) const
+{
+    if (args.size() < 3u || args.size() > 4u)
+        throw formula_functions::invalid_arg("VLOOKUP requires 3 or 4 arguments.");
+
+    lookup_in_table(m_context, *m_context.mp_impl, args, rc_direction_t::vertical);
 }
 
 }
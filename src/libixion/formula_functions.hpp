@@ -50,20 +50,46 @@ private:
     // category: statistical
     void fnc_abs(formula_value_stack& args) const;
     void fnc_average(formula_value_stack& args) const;
+    void fnc_averageif(formula_value_stack& args) const;
+    void fnc_averageifs(formula_value_stack& args) const;
     void fnc_count(formula_value_stack& args) const;
     void fnc_counta(formula_value_stack& args) const;
     void fnc_countblank(formula_value_stack& args) const;
+    void fnc_countif(formula_value_stack& args) const;
+    void fnc_countifs(formula_value_stack& args) const;
+    void fnc_covar(formula_value_stack& args) const;
+    void fnc_large(formula_value_stack& args) const;
+    void fnc_linest(formula_value_stack& args) const;
     void fnc_max(formula_value_stack& args) const;
+    void fnc_maxifs(formula_value_stack& args) const;
     void fnc_median(formula_value_stack& args) const;
     void fnc_min(formula_value_stack& args) const;
+    void fnc_minifs(formula_value_stack& args) const;
     void fnc_mode(formula_value_stack& args) const;
+    void fnc_percentile(formula_value_stack& args) const;
     void fnc_pi(formula_value_stack& args) const;
+    void fnc_rank(formula_value_stack& args) const;
+    void fnc_small(formula_value_stack& args) const;
+    void fnc_stdev(formula_value_stack& args) const;
+    void fnc_stdeva(formula_value_stack& args) const;
+    void fnc_stdevp(formula_value_stack& args) const;
+    void fnc_stdevpa(formula_value_stack& args) const;
+    void fnc_trend(formula_value_stack& args) const;
+    void fnc_var(formula_value_stack& args) const;
+    void fnc_vara(formula_value_stack& args) const;
+    void fnc_varp(formula_value_stack& args) const;
+    void fnc_varpa(formula_value_stack& args) const;
 
     // category: mathematical
     void fnc_int(formula_value_stack& args) const;
     void fnc_mmult(formula_value_stack& args) const;
+    void fnc_product(formula_value_stack& args) const;
     void fnc_subtotal(formula_value_stack& args) const;
     void fnc_sum(formula_value_stack& args) const;
+    void fnc_sumif(formula_value_stack& args) const;
+    void fnc_sumifs(formula_value_stack& args) const;
+    void fnc_sumproduct(formula_value_stack& args) const;
+    void fnc_sumsq(formula_value_stack& args) const;
 
     // category: logical
     void fnc_and(formula_value_stack& args) const;
@@ -116,6 +142,13 @@ private:
     void fnc_sheet(formula_value_stack& args) const;
     void fnc_sheets(formula_value_stack& args) const;
 
+    // category: lookup
+    void fnc_hlookup(formula_value_stack& args) const;
+    void fnc_index(formula_value_stack& args) const;
+    void fnc_lookup(formula_value_stack& args) const;
+    void fnc_match(formula_value_stack& args) const;
+    void fnc_vlookup(formula_value_stack& args) const;
+
     // category: development
     void fnc_wait(formula_value_stack& args) const;
 
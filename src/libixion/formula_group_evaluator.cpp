@@ -0,0 +1,521 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "formula_group_evaluator.hpp"
+#include "formula_program.hpp"
+#include "model_context_impl.hpp"
+#include "column_store_type.hpp"
+#include "numeric_kernels.hpp"
+#include "queue_entry.hpp"
+
+#include <ixion/cancellation_token.hpp>
+#include <ixion/cell.hpp>
+#include <ixion/formula_result.hpp>
+#include <ixion/model_context.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <tuple>
+
+namespace ixion {
+
+namespace {
+
+/**
+ * Runs with fewer cells than this are left for the interpreter, as they
+ * are not worth the setup.
+ */
+constexpr std::size_t min_run_size = 8;
+
+/**
+ * Formula cell to calculate, with the key to sort the cells by, so that the
+ * cells of each run end up next to each other.
+ */
+struct run_cell
+{
+    const formula_tokens_store* store;
+    abs_address_t pos;
+    formula_cell* p;
+
+    bool operator< (const run_cell& other) const
+    {
+        return std::tie(store, pos.sheet, pos.column, pos.row) <
+            std::tie(other.store, other.pos.sheet, other.pos.column, other.pos.row);
+    }
+};
+
+/**
+ * Check whether the program only consists of the instructions that the
+ * evaluator supports.
+ */
+bool is_supported(const formula_program& program)
+{
+    if (program.empty() || program.has_trailing_tokens())
+        return false;
+
+    for (const formula_instruction& inst : program.get_instructions())
+    {
+        switch (inst.type)
+        {
+            case formula_instruction_t::push_value:
+            case formula_instruction_t::push_single_ref:
+            case formula_instruction_t::negate:
+            case formula_instruction_t::hold_value:
+            case formula_instruction_t::hold_numeric:
+            case formula_instruction_t::multiply:
+            case formula_instruction_t::divide:
+            case formula_instruction_t::exponent:
+                break;
+            case formula_instruction_t::compare:
+            {
+                switch (std::get<fopcode_t>(inst.operand))
+                {
+                    case fop_plus:
+                    case fop_minus:
+                    case fop_equal:
+                    case fop_not_equal:
+                    case fop_less:
+                    case fop_less_equal:
+                    case fop_greater:
+                    case fop_greater_equal:
+                        break;
+                    default:
+                        return false;
+                }
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Operand of an instruction, which is either a single value shared by all
+ * cells of the run, or one value for each cell.
+ */
+struct operand
+{
+    bool scalar = true;
+    double value = 0.0;
+    std::vector<double> values;
+};
+
+/**
+ * Apply a binary operator to each pair of values, and store the results in
+ * the left-hand side operand.
+ */
+template<typename Op>
+void apply(operand& lhs, operand& rhs, Op op)
+{
+    if (lhs.scalar && rhs.scalar)
+    {
+        lhs.value = op(lhs.value, rhs.value);
+        return;
+    }
+
+    if (lhs.scalar)
+    {
+        // Store the results in the right-hand side operand, and move them
+        // over.
+        double v1 = lhs.value;
+        for (double& v : rhs.values)
+            v = op(v1, v);
+
+        lhs.scalar = false;
+        lhs.values.swap(rhs.values);
+        return;
+    }
+
+    if (rhs.scalar)
+    {
+        double v2 = rhs.value;
+        for (double& v : lhs.values)
+            v = op(v, v2);
+        return;
+    }
+
+    double* p1 = lhs.values.data();
+    const double* p2 = rhs.values.data();
+    for (std::size_t i = 0, n = lhs.values.size(); i < n; ++i)
+        p1[i] = op(p1[i], p2[i]);
+}
+
+/**
+ * Same as above, but with an operator that the numeric kernels implement.
+ */
+void apply(operand& lhs, operand& rhs, kernel::op_t op)
+{
+    if (lhs.scalar && rhs.scalar)
+    {
+        lhs.value = kernel::evaluate(op, lhs.value, rhs.value);
+        return;
+    }
+
+    if (lhs.scalar)
+    {
+        kernel::transform(op, lhs.value, rhs.values.data(), rhs.values.data(), rhs.values.size());
+        lhs.scalar = false;
+        lhs.values.swap(rhs.values);
+        return;
+    }
+
+    if (rhs.scalar)
+    {
+        kernel::transform(op, lhs.values.data(), rhs.value, lhs.values.data(), lhs.values.size());
+        return;
+    }
+
+    kernel::transform(op, lhs.values.data(), rhs.values.data(), lhs.values.data(), lhs.values.size());
+}
+
+}
+
+struct formula_group_evaluator::impl
+{
+    const detail::model_context_impl& m_cxt_impl;
+
+    /**
+     * Stack of the operands.  The operands past the current depth are kept
+     * around, so that their buffers get reused by the subsequent runs.
+     */
+    std::vector<operand> m_stack;
+    std::size_t m_depth;
+
+    /** error of each cell in the run, if any. */
+    std::vector<formula_error_t> m_errors;
+
+    impl(const detail::model_context_impl& cxt_impl) :
+        m_cxt_impl(cxt_impl), m_depth(0) {}
+
+    operand& push()
+    {
+        if (m_depth == m_stack.size())
+            m_stack.emplace_back();
+
+        return m_stack[m_depth++];
+    }
+
+    operand& top()
+    {
+        assert(m_depth > 0);
+        return m_stack[m_depth - 1];
+    }
+
+    /**
+     * Read the values of the cells referenced by a single cell reference
+     * across the run.
+     *
+     * @return false if the reference goes out of bounds, or any of the
+     *         referenced cells is neither numeric nor empty.
+     */
+    bool load(const formula_token& t, const abs_address_t& origin, std::size_t n, operand& dst)
+    {
+        const address_t& addr = std::get<address_t>(t.value);
+        abs_address_t first = addr.to_abs(origin);
+
+        // An absolute row reference points to the same cell from all cells
+        // in the run.
+        const std::size_t len = addr.abs_row ? 1 : n;
+
+        rc_size_t ss = m_cxt_impl.get_sheet_size();
+        if (first.sheet < 0 || std::size_t(first.sheet) >= m_cxt_impl.get_sheet_count())
+            return false;
+
+        if (first.column < 0 || first.column >= ss.column)
+            return false;
+
+        if (first.row < 0 || std::size_t(first.row) + len > std::size_t(ss.row))
+            return false;
+
+        const column_store_t* col = m_cxt_impl.get_column(first.sheet, first.column);
+        if (!col)
+            return false;
+
+        double* p = nullptr;
+        if (len == 1)
+        {
+            dst.scalar = true;
+            p = &dst.value;
+        }
+        else
+        {
+            dst.scalar = false;
+            dst.values.resize(len);
+            p = dst.values.data();
+        }
+
+        auto pos = col->position(first.row);
+        auto blk = pos.first;
+        std::size_t offset = pos.second;
+
+        for (std::size_t remaining = len; remaining; )
+        {
+            assert(blk != col->end());
+
+            std::size_t k = std::min(remaining, blk->size - offset);
+
+            switch (blk->type)
+            {
+                case element_type_numeric:
+                {
+                    auto it = numeric_element_block::begin(*blk->data);
+                    std::advance(it, offset);
+                    std::copy_n(it, k, p);
+                    break;
+                }
+                case element_type_empty:
+                    std::fill_n(p, k, 0.0);
+                    break;
+                default:
+                    return false;
+            }
+
+            p += k;
+            remaining -= k;
+            ++blk;
+            offset = 0;
+        }
+
+        return true;
+    }
+
+    /**
+     * Flag the cells whose divisor is zero with an error.
+     */
+    void check_divisor(const operand& rhs)
+    {
+        if (rhs.scalar)
+        {
+            if (rhs.value == 0.0)
+                std::fill(m_errors.begin(), m_errors.end(), formula_error_t::division_by_zero);
+            return;
+        }
+
+        for (std::size_t i = 0, n = rhs.values.size(); i < n; ++i)
+        {
+            if (rhs.values[i] == 0.0)
+                m_errors[i] = formula_error_t::division_by_zero;
+        }
+    }
+
+    /**
+     * Evaluate the program for a run of cells.
+     *
+     * @return false if the run cannot be evaluated, in which case no cells
+     *         get their results set.
+     */
+    bool evaluate(const formula_program& program, const run_cell* cells, std::size_t n)
+    {
+        m_depth = 0;
+        m_errors.assign(n, formula_error_t::no_error);
+
+        for (const formula_instruction& inst : program.get_instructions())
+        {
+            switch (inst.type)
+            {
+                case formula_instruction_t::push_value:
+                {
+                    operand& op = push();
+                    op.scalar = true;
+                    op.value = std::get<double>(inst.operand);
+                    break;
+                }
+                case formula_instruction_t::push_single_ref:
+                {
+                    const formula_token& t = *std::get<const formula_token*>(inst.operand);
+                    if (!load(t, cells[0].pos, n, push()))
+                        return false;
+                    break;
+                }
+                case formula_instruction_t::negate:
+                {
+                    operand& op = top();
+                    if (op.scalar)
+                        op.value *= -1.0;
+                    else
+                        kernel::transform(kernel::op_t::multiply, op.values.data(), -1.0, op.values.data(), op.values.size());
+                    break;
+                }
+                case formula_instruction_t::hold_value:
+                case formula_instruction_t::hold_numeric:
+                    // All values are already numeric.
+                    break;
+                case formula_instruction_t::compare:
+                {
+                    operand& rhs = top();
+                    --m_depth;
+                    operand& lhs = top();
+
+                    switch (std::get<fopcode_t>(inst.operand))
+                    {
+                        case fop_plus:
+                            apply(lhs, rhs, kernel::op_t::add);
+                            break;
+                        case fop_minus:
+                            apply(lhs, rhs, kernel::op_t::subtract);
+                            break;
+                        case fop_equal:
+                            apply(lhs, rhs, kernel::op_t::equal);
+                            break;
+                        case fop_not_equal:
+                            apply(lhs, rhs, kernel::op_t::not_equal);
+                            break;
+                        case fop_less:
+                            apply(lhs, rhs, kernel::op_t::less);
+                            break;
+                        case fop_less_equal:
+                            apply(lhs, rhs, kernel::op_t::less_equal);
+                            break;
+                        case fop_greater:
+                            apply(lhs, rhs, kernel::op_t::greater);
+                            break;
+                        case fop_greater_equal:
+                            apply(lhs, rhs, kernel::op_t::greater_equal);
+                            break;
+                        default:
+                            return false;
+                    }
+                    break;
+                }
+                case formula_instruction_t::multiply:
+                {
+                    operand& rhs = top();
+                    --m_depth;
+                    apply(top(), rhs, kernel::op_t::multiply);
+                    break;
+                }
+                case formula_instruction_t::divide:
+                {
+                    operand& rhs = top();
+                    --m_depth;
+                    check_divisor(rhs);
+
+                    // The results of the cells flagged with an error get
+                    // discarded.
+                    apply(top(), rhs, kernel::op_t::divide);
+                    break;
+                }
+                case formula_instruction_t::exponent:
+                {
+                    operand& rhs = top();
+                    --m_depth;
+                    apply(top(), rhs, [](double v1, double v2) { return std::pow(v1, v2); });
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+
+        if (m_depth != 1)
+            return false;
+
+        // NB: the result of a formula that consists of a single reference to
+        // an empty cell is also 0.
+        const operand& res = top();
+
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            formula_result fr;
+            if (m_errors[i] != formula_error_t::no_error)
+                fr.set_error(m_errors[i]);
+            else
+                fr.set_value(res.scalar ? res.value : res.values[i]);
+
+            cells[i].p->set_raw_result_cache(std::move(fr));
+        }
+
+        return true;
+    }
+
+    std::size_t run(const std::vector<queue_entry>& entries, const cancellation_token* token)
+    {
+        // The interpreter reports each cell to the session handler.
+        if (m_cxt_impl.has_session_handler_factory())
+            return 0;
+
+        std::vector<run_cell> cells;
+        cells.reserve(entries.size());
+
+        for (const queue_entry& e : entries)
+        {
+            const formula_tokens_store_ptr_t& ts = e.p->get_tokens();
+
+            // Grouped cells already get calculated only once per group.
+            if (!ts || e.p->get_group_properties().grouped)
+                continue;
+
+            cells.push_back({ts.get(), e.pos, e.p});
+        }
+
+        std::sort(cells.begin(), cells.end());
+
+        std::size_t evaluated = 0;
+        const formula_tokens_store* cur_store = nullptr;
+        std::unique_ptr<formula_program> program;
+
+        for (std::size_t first = 0, n = cells.size(); first < n; )
+        {
+            // Find the end of the run that starts at the current cell.
+            const run_cell& head = cells[first];
+            std::size_t last = first + 1;
+
+            for (; last < n; ++last)
+            {
+                const run_cell& c = cells[last];
+                if (c.store != head.store || c.pos.sheet != head.pos.sheet || c.pos.column != head.pos.column)
+                    break;
+
+                if (c.pos.row != head.pos.row + row_t(last - first))
+                    break;
+            }
+
+            std::size_t run_size = last - first;
+
+            if (run_size >= min_run_size)
+            {
+                if (token && token->is_cancelled())
+                    break;
+
+                if (head.store != cur_store)
+                {
+                    // Only access the tokens via the const interface, so
+                    // as not to discard the programs cached in the store.
+                    cur_store = head.store;
+                    program = std::make_unique<formula_program>(cur_store->get());
+                    if (program->is_context_dependent() || !is_supported(*program))
+                        program.reset();
+                }
+
+                if (program && evaluate(*program, &cells[first], run_size))
+                    evaluated += run_size;
+            }
+
+            first = last;
+        }
+
+        return evaluated;
+    }
+};
+
+formula_group_evaluator::formula_group_evaluator(model_context& cxt) :
+    mp_impl(std::make_unique<impl>(*cxt.mp_impl)) {}
+
+formula_group_evaluator::~formula_group_evaluator() = default;
+
+std::size_t formula_group_evaluator::run(const std::vector<queue_entry>& cells, const cancellation_token* token)
+{
+    return mp_impl->run(cells, token);
+}
+
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,65 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_FORMULA_GROUP_EVALUATOR_HPP
+#define INCLUDED_IXION_FORMULA_GROUP_EVALUATOR_HPP
+
+#include <memory>
+#include <vector>
+
+namespace ixion {
+
+class cancellation_token;
+class model_context;
+struct queue_entry;
+
+/**
+ * Evaluates runs of formula cells that are vertically adjacent in a single
+ * column and share the same token store, by running each instruction of
+ * their program over all cells of the run at once.  The values of the
+ * referenced cells get read one column block at a time, and the results of
+ * all cells in the run get stored at the end.
+ *
+ * <p>Only a program that consists of numeric constants, references to
+ * single cells, and arithmetic and relational operators gets evaluated
+ * this way, and only when all cells it references across the run are
+ * either numeric or empty.  Since such a run does not depend on any other
+ * formula cell, it can be evaluated before all the other cells.  The cells
+ * not evaluated here are left for the interpreter.</p>
+ */
+class formula_group_evaluator
+{
+    struct impl;
+    std::unique_ptr<impl> mp_impl;
+
+public:
+    formula_group_evaluator() = delete;
+    formula_group_evaluator(const formula_group_evaluator&) = delete;
+    formula_group_evaluator& operator= (const formula_group_evaluator&) = delete;
+
+    formula_group_evaluator(model_context& cxt);
+    ~formula_group_evaluator();
+
+    /**
+     * Find the runs among the cells to calculate, and evaluate them.  The
+     * evaluated cells get their results set, and the interpretation of
+     * these cells returns immediately.
+     *
+     * @param cells cells to be calculated.
+     * @param token optional token to check for cancellation before the
+     *              evaluation of each run.
+     *
+     * @return number of cells evaluated.
+     */
+    std::size_t run(const std::vector<queue_entry>& cells, const cancellation_token* token);
+};
+
+}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
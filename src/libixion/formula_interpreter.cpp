@@ -7,6 +7,8 @@
 
 #include "formula_interpreter.hpp"
 #include "formula_functions.hpp"
+#include "model_context_impl.hpp"
+#include "numeric_kernels.hpp"
 #include "debug.hpp"
 
 #include <ixion/cell.hpp>
@@ -35,14 +37,12 @@ public:
     invalid_expression(const std::string& msg) : general_error(msg) {}
 };
 
-const formula_token paren_open = formula_token{fop_open};
-const formula_token paren_close = formula_token{fop_close};
-
 }
 
 formula_interpreter::formula_interpreter(const formula_cell* cell, model_context& cxt) :
     m_parent_cell(cell),
     m_context(cxt),
+    m_stack(cxt),
     m_error(formula_error_t::no_error)
 {
 }
@@ -51,6 +51,16 @@ formula_interpreter::~formula_interpreter()
 {
 }
 
+void formula_interpreter::set_cell(const formula_cell* cell)
+{
+    m_parent_cell = cell;
+}
+
+model_context& formula_interpreter::get_context() const
+{
+    return m_context;
+}
+
 void formula_interpreter::set_origin(const abs_address_t& pos)
 {
     m_pos = pos;
@@ -58,27 +68,45 @@ void formula_interpreter::set_origin(const abs_address_t& pos)
 
 bool formula_interpreter::interpret()
 {
+    // The handler must not outlive the interpretation of a single cell, as
+    // this instance may be kept around for the next cell.
+    struct handler_scope
+    {
+        std::unique_ptr<iface::session_handler>& handler;
+        std::shared_ptr<const formula_program>& program;
+
+        ~handler_scope()
+        {
+            handler.reset();
+            program.reset();
+        }
+    };
+
     mp_handler = m_context.create_session_handler();
+    handler_scope hs{mp_handler, m_program};
     if (mp_handler)
         mp_handler->begin_cell_interpret(m_pos);
 
+    m_error = formula_error_t::no_error;
+
     try
     {
-        init_tokens();
+        const formula_program& program = init_program();
 
-        if (m_tokens.empty())
+        if (program.empty())
         {
             IXION_DEBUG("interpreter has no tokens to interpret");
             return false;
         }
 
-        m_cur_token_itr = m_tokens.begin();
-        m_error = formula_error_t::no_error;
-        m_result.reset();
+        if (mp_handler)
+            report_tokens(program);
+
+        m_result.emplace();
 
-        expression();
+        execute(program);
 
-        if (m_cur_token_itr != m_tokens.end())
+        if (program.has_trailing_tokens())
         {
             if (mp_handler)
                 mp_handler->set_invalid_expression("formula token interpretation ended prematurely.");
@@ -121,7 +149,7 @@ bool formula_interpreter::interpret()
 
 formula_result formula_interpreter::transfer_result()
 {
-    return std::move(m_result);
+    return std::move(*m_result);
 }
 
 formula_error_t formula_interpreter::get_error() const
@@ -129,35 +157,30 @@ formula_error_t formula_interpreter::get_error() const
     return m_error;
 }
 
-void formula_interpreter::init_tokens()
+const formula_program& formula_interpreter::init_program()
 {
     clear_stacks();
 
-    name_set used_names;
-    m_tokens.clear();
-
     const formula_tokens_store_ptr_t& ts = m_parent_cell->get_tokens();
     if (!ts)
-        return;
-
-    for (const formula_token& t : ts->get())
     {
-        if (t.opcode == fop_named_expression)
-        {
-            // Named expression.  Expand it.
-            const auto& name = std::get<std::string>(t.value);
-            const named_expression_t* expr = m_context.get_named_expression(
-                m_pos.sheet, name);
+        static const formula_program empty_program{formula_tokens_t{}};
+        return empty_program;
+    }
 
-            used_names.insert(name);
-            expand_named_expression(expr, used_names);
-        }
-        else
-            // Normal token.
-            m_tokens.push_back(&t);
+    // Make sure to only access the tokens via the const interface, so as
+    // not to discard the compiled programs.
+    const formula_tokens_store& store = *ts;
+    formula_program_cache& cache = store.get_program_cache();
+    m_program = cache.get(store.get());
+
+    if (m_program->is_context_dependent())
+    {
+        std::size_t revision = m_context.mp_impl->get_definitions_revision();
+        m_program = cache.get(store.get(), m_context, m_pos.sheet, revision);
     }
 
-    m_end_token_pos = m_tokens.end();
+    return *m_program;
 }
 
 namespace {
@@ -201,139 +224,86 @@ void formula_interpreter::pop_result()
         case stack_value_t::range_ref:
         {
             const abs_range_t& range = res.get_range();
-            get_result_from_cell(m_context, range.first, m_result);
+            get_result_from_cell(m_context, range.first, *m_result);
             break;
         }
         case stack_value_t::single_ref:
         {
-            get_result_from_cell(m_context, res.get_address(), m_result);
+            get_result_from_cell(m_context, res.get_address(), *m_result);
             break;
         }
         case stack_value_t::string:
         {
-            m_result.set_string_value(res.get_string());
+            m_result->set_string_value(res.get_string());
             break;
         }
         case stack_value_t::boolean:
         {
-            m_result.set_boolean(res.get_boolean());
+            m_result->set_boolean(res.get_boolean());
             break;
         }
         case stack_value_t::value:
             IXION_TRACE("value=" << res.get_value());
-            m_result.set_value(res.get_value());
+            m_result->set_value(res.get_value());
             break;
         case stack_value_t::matrix:
-            m_result.set_matrix(res.pop_matrix());
+            m_result->set_matrix(res.pop_matrix());
             break;
         case stack_value_t::error:
-            m_result.set_error(res.get_error());
+            m_result->set_error(res.get_error());
             break;
     }
 
     if (mp_handler)
-        mp_handler->set_result(m_result);
+        mp_handler->set_result(*m_result);
 }
 
-void formula_interpreter::expand_named_expression(const named_expression_t* expr, name_set& used_names)
+void formula_interpreter::report_tokens(const formula_program& program)
 {
-    if (!expr)
-        throw formula_error(formula_error_t::name_not_found);
+    assert(mp_handler);
 
-    m_tokens.push_back(&paren_open);
-    for (const auto& t : expr->tokens)
+    for (const formula_token* t : program.get_tokens())
     {
-        if (t.opcode == fop_named_expression)
+        switch (t->opcode)
         {
-            const auto& expr_name = std::get<std::string>(t.value);
-            if (used_names.count(expr_name) > 0)
-            {
-                // Circular reference detected.
-                throw invalid_expression("circular referencing of named expressions");
-            }
-            const named_expression_t* this_expr = m_context.get_named_expression(m_pos.sheet, expr_name);
-            used_names.insert(expr_name);
-            expand_named_expression(this_expr, used_names);
+            case fop_single_ref:
+                mp_handler->push_single_ref(std::get<address_t>(t->value), m_pos);
+                break;
+            case fop_range_ref:
+                mp_handler->push_range_ref(std::get<range_t>(t->value), m_pos);
+                break;
+            case fop_table_ref:
+                mp_handler->push_table_ref(std::get<table_t>(t->value));
+                break;
+            case fop_value:
+                mp_handler->push_value(std::get<double>(t->value));
+                break;
+            case fop_error:
+                mp_handler->push_error(std::get<formula_error_t>(t->value));
+                break;
+            case fop_string:
+                mp_handler->push_string(std::get<string_id_t>(t->value));
+                break;
+            case fop_function:
+                mp_handler->push_function(formula_functions::get_function_opcode(*t));
+                break;
+            default:
+                mp_handler->push_token(t->opcode);
         }
-        else
-            m_tokens.push_back(&t);
     }
-    m_tokens.push_back(&paren_close);
-}
-
-void formula_interpreter::ensure_token_exists() const
-{
-    if (!has_token())
-        throw invalid_expression("formula expression ended prematurely");
-}
-
-bool formula_interpreter::has_token() const
-{
-    return m_cur_token_itr != m_end_token_pos;
-}
-
-void formula_interpreter::next()
-{
-    ++m_cur_token_itr;
-}
-
-const formula_token& formula_interpreter::token() const
-{
-    assert(m_cur_token_itr != m_end_token_pos);
-    return *(*m_cur_token_itr);
-}
-
-const formula_token& formula_interpreter::token_or_throw() const
-{
-    ensure_token_exists();
-    return *(*m_cur_token_itr);
-}
-
-const formula_token& formula_interpreter::next_token()
-{
-    next();
-    if (!has_token())
-        throw invalid_expression("expecting a token but no more tokens found.");
-
-    return token();
 }
 
-const std::string& formula_interpreter::string_or_throw() const
+const std::string& formula_interpreter::get_string(string_id_t sid) const
 {
-    assert(token().opcode == fop_string);
-
-    const string_id_t sid = std::get<string_id_t>(token().value);
     const std::string* p = m_context.get_string(sid);
     if (!p)
         throw general_error("no string found for the specified string ID.");
 
-    if (mp_handler)
-        mp_handler->push_string(sid);
-
     return *p;
 }
 
 namespace {
 
-bool valid_expression_op(fopcode_t oc)
-{
-    switch (oc)
-    {
-        case fop_plus:
-        case fop_minus:
-        case fop_equal:
-        case fop_not_equal:
-        case fop_less:
-        case fop_less_equal:
-        case fop_greater:
-        case fop_greater_equal:
-            return true;
-        default:
-            ;
-    }
-    return false;
-}
-
 /**
  * Pop the value off of the stack but only as one of the following type:
  *
@@ -352,7 +322,7 @@ std::optional<stack_value> pop_stack_value(const model_context& cxt, formula_val
         case stack_value_t::value:
             return stack_value{stack.pop_value()};
         case stack_value_t::string:
-            return stack_value{stack.pop_string()};
+            return stack.release_back();
         case stack_value_t::matrix:
             return stack_value{stack.pop_matrix()};
         case stack_value_t::error:
@@ -388,7 +358,7 @@ std::optional<stack_value> pop_stack_value(const model_context& cxt, formula_val
                         return {};
                     }
 
-                    return stack_value{*ps};
+                    return stack_value{ps};
                 }
                 case cell_t::formula:
                 {
@@ -818,6 +788,74 @@ struct exponent_op
     }
 };
 
+/**
+ * Numeric kernel operator of each arithmetic operator type.
+ */
+template<typename Op>
+constexpr std::optional<kernel::op_t> kernel_op_of = std::nullopt;
+
+template<>
+constexpr std::optional<kernel::op_t> kernel_op_of<add_op> = kernel::op_t::add;
+
+template<>
+constexpr std::optional<kernel::op_t> kernel_op_of<sub_op> = kernel::op_t::subtract;
+
+template<>
+constexpr std::optional<kernel::op_t> kernel_op_of<multiply_op> = kernel::op_t::multiply;
+
+template<>
+constexpr std::optional<kernel::op_t> kernel_op_of<divide_op> = kernel::op_t::divide;
+
+/**
+ * Apply an arithmetic operator to all elements of matrices that consist
+ * only of numeric and boolean values, using the numeric kernels.  Either
+ * operand may be a single value instead of a matrix.
+ *
+ * @return matrix of the results, or nothing if the operator has no kernel,
+ *         an operand matrix has other types of values, or a divisor is 0.
+ */
+template<typename Op>
+std::optional<matrix> operate_numeric_elements(const matrix* m1, double v1, const matrix* m2, double v2)
+{
+    constexpr std::optional<kernel::op_t> op = kernel_op_of<Op>;
+    if constexpr (!op.has_value())
+        return {};
+    else
+    {
+        if ((m1 && !m1->is_numeric()) || (m2 && !m2->is_numeric()))
+            return {};
+
+        const matrix& mx = m1 ? *m1 : *m2;
+        std::size_t n = mx.row_size() * mx.col_size();
+        if (!n)
+            return {};
+
+        numeric_matrix nm1 = m1 ? m1->as_numeric() : numeric_matrix();
+        numeric_matrix nm2 = m2 ? m2->as_numeric() : numeric_matrix();
+
+        if (*op == kernel::op_t::divide)
+        {
+            // Leave the division by zero to the element-wise path, which
+            // sets the error to each such element.
+            bool has_zero = m2 ? kernel::count_if(&nm2(0, 0), n, kernel::op_t::equal, 0.0) > 0 : v2 == 0.0;
+            if (has_zero)
+                return {};
+        }
+
+        if (m1 && m2)
+            kernel::transform(*op, &nm1(0, 0), &nm2(0, 0), &nm1(0, 0), n);
+        else if (m1)
+            kernel::transform(*op, &nm1(0, 0), v2, &nm1(0, 0), n);
+        else
+        {
+            kernel::transform(*op, v1, &nm2(0, 0), &nm2(0, 0), n);
+            nm1.swap(nm2);
+        }
+
+        return matrix(nm1);
+    }
+}
+
 void compare_matrix_to_value(formula_value_stack& vs, fopcode_t oc, const matrix& mtx, double val)
 {
     switch (oc)
@@ -827,6 +865,12 @@ void compare_matrix_to_value(formula_value_stack& vs, fopcode_t oc, const matrix
             // fallthrough
         case fop_plus:
         {
+            if (auto res = operate_numeric_elements<add_op>(&mtx, 0.0, nullptr, val); res)
+            {
+                vs.push_matrix(*res);
+                break;
+            }
+
             matrix res = operate_all_elements<add_op>(mtx, val);
             vs.push_matrix(res);
             break;
@@ -878,12 +922,24 @@ void compare_value_to_matrix(formula_value_stack& vs, fopcode_t oc, double val,
     {
         case fop_minus:
         {
+            if (auto res = operate_numeric_elements<sub_op>(nullptr, val, &mtx, 0.0); res)
+            {
+                vs.push_matrix(*res);
+                break;
+            }
+
             matrix res = operate_all_elements<sub_op>(val, mtx);
             vs.push_matrix(res);
             break;
         }
         case fop_plus:
         {
+            if (auto res = operate_numeric_elements<add_op>(nullptr, val, &mtx, 0.0); res)
+            {
+                vs.push_matrix(*res);
+                break;
+            }
+
             matrix res = operate_all_elements<add_op>(val, mtx);
             vs.push_matrix(res);
             break;
@@ -948,6 +1004,13 @@ std::optional<double> elem_to_numeric(const matrix::element& e)
 template<typename Op>
 resolved_stack_value op_matrix_or_numeric(const resolved_stack_value& lhs, const resolved_stack_value& rhs)
 {
+    // An error operand becomes the result, the left-hand side first.
+    if (lhs.type() == resolved_stack_value::value_type::error)
+        return lhs.get_error();
+
+    if (rhs.type() == resolved_stack_value::value_type::error)
+        return rhs.get_error();
+
     switch (lhs.type())
     {
         case resolved_stack_value::value_type::matrix:
@@ -962,6 +1025,9 @@ resolved_stack_value op_matrix_or_numeric(const resolved_stack_value& lhs, const
                     if (m1.row_size() != m2.row_size() || m1.col_size() != m2.col_size())
                         throw invalid_expression("matrix size mis-match");
 
+                    if (auto res = operate_numeric_elements<Op>(&m1, 0.0, &m2, 0.0); res)
+                        return std::move(*res);
+
                     matrix res = m1; // copy
 
                     for (std::size_t col = 0; col < res.col_size(); ++col)
@@ -989,9 +1055,17 @@ resolved_stack_value op_matrix_or_numeric(const resolved_stack_value& lhs, const
                     return res;
                 }
                 case resolved_stack_value::value_type::numeric: // matrix * value
+                {
+                    if (auto res = operate_numeric_elements<Op>(&lhs.get_matrix(), 0.0, nullptr, rhs.get_numeric()); res)
+                        return std::move(*res);
+
                     return operate_all_elements<Op>(lhs.get_matrix(), rhs.get_numeric());
+                }
                 case resolved_stack_value::value_type::string:
                     throw invalid_expression("unexpected string value");
+                case resolved_stack_value::value_type::error:
+                    // error operands are handled above.
+                    break;
             }
             break;
         }
@@ -1000,22 +1074,33 @@ resolved_stack_value op_matrix_or_numeric(const resolved_stack_value& lhs, const
             switch (rhs.type())
             {
                 case resolved_stack_value::value_type::matrix: // value * matrix
+                {
+                    if (auto res = operate_numeric_elements<Op>(nullptr, lhs.get_numeric(), &rhs.get_matrix(), 0.0); res)
+                        return std::move(*res);
+
                     return operate_all_elements<Op>(lhs.get_numeric(), rhs.get_matrix());
+                }
                 case resolved_stack_value::value_type::numeric: // value * value
                 {
                     auto v = Op{}(lhs.get_numeric(), rhs.get_numeric());
                     if (!v)
-                        throw formula_error(v.error());
+                        return v.error();
 
                     return *v;
                 }
                 case resolved_stack_value::value_type::string:
                     throw invalid_expression("unexpected string value");
+                case resolved_stack_value::value_type::error:
+                    // error operands are handled above.
+                    break;
             }
             break;
         }
         case resolved_stack_value::value_type::string:
             throw invalid_expression("unexpected string value");
+        case resolved_stack_value::value_type::error:
+            // error operands are handled above.
+            break;
     }
 
     std::ostringstream os;
@@ -1045,6 +1130,12 @@ std::ostream& operator<<(std::ostream& os, const matrix::element& e)
 
 resolved_stack_value concat_matrix_or_string(const resolved_stack_value& lhs, const resolved_stack_value& rhs)
 {
+    if (lhs.type() == resolved_stack_value::value_type::error)
+        return lhs.get_error();
+
+    if (rhs.type() == resolved_stack_value::value_type::error)
+        return rhs.get_error();
+
     switch (lhs.type())
     {
         case resolved_stack_value::value_type::matrix:
@@ -1080,6 +1171,9 @@ resolved_stack_value concat_matrix_or_string(const resolved_stack_value& lhs, co
                     return operate_all_elements(lhs.get_matrix(), rhs.get_string());
                 case resolved_stack_value::value_type::numeric: // matrix & string
                     throw invalid_expression("unexpected numeric value");
+                case resolved_stack_value::value_type::error:
+                    // error operands are handled above.
+                    break;
             }
             break;
         }
@@ -1093,11 +1187,17 @@ resolved_stack_value concat_matrix_or_string(const resolved_stack_value& lhs, co
                     return lhs.get_string() + rhs.get_string();
                 case resolved_stack_value::value_type::numeric:
                     throw invalid_expression("unexpected numeric value");
+                case resolved_stack_value::value_type::error:
+                    // error operands are handled above.
+                    break;
             }
             break;
         }
         case resolved_stack_value::value_type::numeric:
             throw invalid_expression("unexpected numeric value");
+        case resolved_stack_value::value_type::error:
+            // error operands are handled above.
+            break;
     }
 
     std::ostringstream os;
@@ -1105,355 +1205,491 @@ resolved_stack_value concat_matrix_or_string(const resolved_stack_value& lhs, co
     throw invalid_expression(os.str());
 }
 
-} // anonymous namespace
-
-void formula_interpreter::expression()
+/**
+ * Apply a relational, addition or subtraction operator to two values
+ * popped off of the stack, and push the result onto the stack.
+ */
+void apply_expression_op(formula_value_stack& vs, fopcode_t oc, const stack_value& sv1, const stack_value& sv2)
 {
-    // <term> + <term> + <term> + ... + <term>
-    // valid operators are: +, -, =, <, >, <=, >=, <>.
-
-    term();
-    while (has_token())
+    // An error operand becomes the result, the left-hand side first.
+    if (sv1.get_type() == stack_value_t::error)
     {
-        fopcode_t oc = token().opcode;
-        if (!valid_expression_op(oc))
-        {
-            IXION_TRACE("expression ends with " << oc);
-            return;
-        }
-
-        auto sv1 = pop_stack_value(m_context, get_stack());
-        if (!sv1)
-        {
-            IXION_DEBUG("failed to pop value 1 from the stack");
-            throw formula_error(formula_error_t::general_error);
-        }
-
-        if (mp_handler)
-            mp_handler->push_token(oc);
-
-        next();
-        term();
+        vs.push_error(sv1.get_error());
+        return;
+    }
 
-        auto sv2 = pop_stack_value(m_context, get_stack());
-        if (!sv2)
-        {
-            IXION_DEBUG("failed to pop value 2 from the stack");
-            throw formula_error(formula_error_t::general_error);
-        }
+    if (sv2.get_type() == stack_value_t::error)
+    {
+        vs.push_error(sv2.get_error());
+        return;
+    }
 
-        switch (sv1->get_type())
+    switch (sv1.get_type())
+    {
+        case stack_value_t::value:
         {
-            case stack_value_t::value:
+            switch (sv2.get_type())
             {
-                switch (sv2->get_type())
+                case stack_value_t::value:
                 {
-                    case stack_value_t::value:
-                    {
-                        // Both are numeric values.
-                        compare_values(get_stack(), oc, sv1->get_value(), sv2->get_value());
-                        break;
-                    }
-                    case stack_value_t::string:
-                    {
-                        compare_value_to_string(get_stack(), oc, sv1->get_value(), sv2->get_string());
-                        break;
-                    }
-                    case stack_value_t::matrix:
-                    {
-                        compare_value_to_matrix(get_stack(), oc, sv1->get_value(), sv2->get_matrix());
-                        break;
-                    }
-                    case stack_value_t::error:
-                    {
-                        get_stack().push_error(sv2->get_error());
-                        break;
-                    }
-                    default:
-                    {
-                        IXION_DEBUG("unsupported value type for value 2: " << sv2->get_type());
-                        throw formula_error(formula_error_t::general_error);
-                    }
+                    // Both are numeric values.
+                    compare_values(vs, oc, sv1.get_value(), sv2.get_value());
+                    break;
                 }
-                break;
-            }
-            case stack_value_t::string:
-            {
-                switch (sv2->get_type())
+                case stack_value_t::string:
                 {
-                    case stack_value_t::value:
-                    {
-                        // Value 1 is string while value 2 is numeric.
-                        compare_string_to_value(get_stack(), oc, sv1->get_string(), sv2->get_value());
-                        break;
-                    }
-                    case stack_value_t::string:
-                    {
-                        // Both are strings.
-                        compare_strings(get_stack(), oc, sv1->get_string(), sv2->get_string());
-                        break;
-                    }
-                    default:
-                    {
-                        IXION_DEBUG("unsupported value type for value 2: " << sv2->get_type());
-                        throw formula_error(formula_error_t::general_error);
-                    }
+                    compare_value_to_string(vs, oc, sv1.get_value(), sv2.get_string());
+                    break;
                 }
-                break;
-            }
-            case stack_value_t::matrix:
-            {
-                switch (sv2->get_type())
+                case stack_value_t::matrix:
                 {
-                    case stack_value_t::value:
-                    {
-                        compare_matrix_to_value(get_stack(), oc, sv1->get_matrix(), sv2->get_value());
-                        break;
-                    }
-                    default:
-                    {
-                        IXION_DEBUG("unsupported value type for value 2: " << sv2->get_type());
-                        throw formula_error(formula_error_t::general_error);
-                    }
+                    compare_value_to_matrix(vs, oc, sv1.get_value(), sv2.get_matrix());
+                    break;
+                }
+                default:
+                {
+                    IXION_DEBUG("unsupported value type for value 2: " << sv2.get_type());
+                    throw formula_error(formula_error_t::general_error);
                 }
-                break;
             }
-            case stack_value_t::error:
+            break;
+        }
+        case stack_value_t::string:
+        {
+            switch (sv2.get_type())
             {
-                get_stack().push_error(sv1->get_error());
-                break;
+                case stack_value_t::value:
+                {
+                    // Value 1 is string while value 2 is numeric.
+                    compare_string_to_value(vs, oc, sv1.get_string(), sv2.get_value());
+                    break;
+                }
+                case stack_value_t::string:
+                {
+                    // Both are strings.
+                    compare_strings(vs, oc, sv1.get_string(), sv2.get_string());
+                    break;
+                }
+                default:
+                {
+                    IXION_DEBUG("unsupported value type for value 2: " << sv2.get_type());
+                    throw formula_error(formula_error_t::general_error);
+                }
             }
-            default:
+            break;
+        }
+        case stack_value_t::matrix:
+        {
+            switch (sv2.get_type())
             {
-                IXION_DEBUG("unsupported value type for value 1: " << sv1->get_type());
-                throw formula_error(formula_error_t::general_error);
+                case stack_value_t::value:
+                {
+                    compare_matrix_to_value(vs, oc, sv1.get_matrix(), sv2.get_value());
+                    break;
+                }
+                default:
+                {
+                    IXION_DEBUG("unsupported value type for value 2: " << sv2.get_type());
+                    throw formula_error(formula_error_t::general_error);
+                }
             }
+            break;
+        }
+        default:
+        {
+            IXION_DEBUG("unsupported value type for value 1: " << sv1.get_type());
+            throw formula_error(formula_error_t::general_error);
         }
     }
 }
 
-void formula_interpreter::term()
+void push_resolved_value(formula_value_stack& vs, resolved_stack_value v)
+{
+    switch (v.type())
+    {
+        case resolved_stack_value::value_type::matrix:
+            vs.push_matrix(v.get_matrix());
+            break;
+        case resolved_stack_value::value_type::numeric:
+            vs.push_value(v.get_numeric());
+            break;
+        case resolved_stack_value::value_type::string:
+            vs.push_string(v.get_string());
+            break;
+        case resolved_stack_value::value_type::error:
+            vs.push_error(v.get_error());
+            break;
+        default:
+            throw invalid_expression("result must be either matrix or double");
+    }
+}
+
+bool is_internal_error(formula_error_t err)
 {
-    // <factor> || <factor> (*|^|&|/) <term>
+    using t = std::underlying_type<formula_error_t>::type;
+    return static_cast<t>(err) >= 200u;
+}
 
-    factor();
-    if (!has_token())
-        return;
+} // anonymous namespace
 
-    fopcode_t oc = token().opcode;
+void formula_interpreter::execute(const formula_program& program)
+{
+    m_call_ends.clear();
+    m_error_traps.clear();
 
-    auto pop_matrix_or_numeric_values = [this]()
-    {
-        auto v1 = get_stack().pop_matrix_or_numeric();
-        next(); // skip the op token
-        term();
-        auto v2 = get_stack().pop_matrix_or_numeric();
-        return std::make_pair(std::move(v1), std::move(v2));
-    };
+    std::size_t pos = 0;
 
-    auto push_to_stack = [this](const resolved_stack_value& v)
+    while (true)
     {
-        switch (v.type())
+        try
         {
-            case resolved_stack_value::value_type::matrix:
-                get_stack().push_matrix(v.get_matrix());
-                break;
-            case resolved_stack_value::value_type::numeric:
-                get_stack().push_value(v.get_numeric());
-                break;
-            case resolved_stack_value::value_type::string:
-                get_stack().push_string(v.get_string());
-                break;
-            default:
-                throw invalid_expression("result must be either matrix or double");
-        }
-    };
-
-    switch (oc)
-    {
-        case fop_multiply:
-        {
-            if (mp_handler)
-                mp_handler->push_token(oc);
-
-            const auto& [lhs, rhs] = pop_matrix_or_numeric_values();
-            auto res = op_matrix_or_numeric<multiply_op>(lhs, rhs);
-            push_to_stack(res);
+            run(program, pos);
             return;
         }
-        case fop_exponent:
+        catch (const formula_error& e)
         {
-            if (mp_handler)
-                mp_handler->push_token(oc);
-
-            const auto& [base, exp] = pop_matrix_or_numeric_values();
-            auto res = op_matrix_or_numeric<exponent_op>(base, exp);
-            push_to_stack(res);
-            return;
-        }
-        case fop_concat:
-        {
-            if (mp_handler)
-                mp_handler->push_token(oc);
-
-            auto lhs = get_stack().pop_matrix_or_string();
-            next();
-            term();
-            auto rhs = get_stack().pop_matrix_or_string();
-            auto res = concat_matrix_or_string(lhs, rhs);
-            push_to_stack(res);
-            return;
-        }
-        case fop_divide:
-        {
-            if (mp_handler)
-                mp_handler->push_token(oc);
-
-            const auto& [lhs, rhs] = pop_matrix_or_numeric_values();
-            auto res = op_matrix_or_numeric<divide_op>(lhs, rhs);
-            push_to_stack(res);
-            return;
+            if (m_error_traps.empty() || is_internal_error(e.get_error()))
+                throw;
+
+            // The errors normally travel as values on the stack.  The few
+            // that still get thrown, such as a reference to the cell itself,
+            // unwind to the IFERROR or IFNA call that catches the error, to
+            // let it check the error as its first argument.
+            error_trap trap = m_error_traps.back();
+            m_error_traps.pop_back();
+            m_call_ends.resize(trap.call_depth);
+            get_stack().unwind(trap.stack_depth);
+            get_stack().push_error(e.get_error());
+            pos = trap.resume_pos;
         }
-        default:
-            ;
     }
 }
 
-void formula_interpreter::factor()
+void formula_interpreter::run(const formula_program& program, std::size_t pos)
 {
-    // <constant> || <error> || <variable> || '(' <expression> ')' || <function>
+    const formula_program::instructions_type& insts = program.get_instructions();
 
-    bool negative_sign = sign(); // NB: may be preceded by a '+' or '-' sign.
-    fopcode_t oc = token().opcode;
-
-    switch (oc)
+    while (pos < insts.size())
     {
-        case fop_open:
-            paren();
-            break;
-        case fop_named_expression:
-        {
-            // All named expressions are supposed to be expanded prior to interpretation.
-            IXION_DEBUG("named expression encountered in factor.");
-            throw formula_error(formula_error_t::general_error);
-        }
-        case fop_value:
-        {
-            constant();
-            break;
-        }
-        case fop_error:
-        {
-            error();
-            break;
-        }
-        case fop_single_ref:
-            single_ref();
-            break;
-        case fop_range_ref:
-            range_ref();
-            break;
-        case fop_table_ref:
-            table_ref();
-            break;
-        case fop_function:
-            function();
-            break;
-        case fop_string:
-            literal();
-            break;
-        case fop_array_open:
-            array();
-            break;
-        default:
+        const formula_instruction& inst = insts[pos++];
+
+        switch (inst.type)
         {
-            std::ostringstream os;
-            os << "factor: unexpected token type: <" << get_formula_opcode_name(oc) << ">";
-            throw invalid_expression(os.str());
-        }
-    }
+            case formula_instruction_t::push_value:
+                get_stack().push_value(std::get<double>(inst.operand));
+                break;
+            case formula_instruction_t::push_string:
+            {
+                const formula_token* t = std::get<const formula_token*>(inst.operand);
+                get_stack().push_pooled_string(&get_string(std::get<string_id_t>(t->value)));
+                break;
+            }
+            case formula_instruction_t::push_error:
+            {
+                const formula_token* t = std::get<const formula_token*>(inst.operand);
+                get_stack().push_error(std::get<formula_error_t>(t->value));
+                break;
+            }
+            case formula_instruction_t::push_single_ref:
+                push_single_ref(*std::get<const formula_token*>(inst.operand));
+                break;
+            case formula_instruction_t::push_range_ref:
+                push_range_ref(*std::get<const formula_token*>(inst.operand));
+                break;
+            case formula_instruction_t::push_table_ref:
+                push_table_ref(*std::get<const formula_token*>(inst.operand));
+                break;
+            case formula_instruction_t::push_table_range:
+                get_stack().push_range_ref(program.get_table_range(std::get<std::size_t>(inst.operand)));
+                break;
+            case formula_instruction_t::push_array:
+                push_array(program.get_array(std::get<std::size_t>(inst.operand)));
+                break;
+            case formula_instruction_t::negate:
+            {
+                if (auto err = get_stack().maybe_pop_error(); err)
+                {
+                    get_stack().push_error(*err);
+                    break;
+                }
 
-    if (negative_sign)
-    {
-        double v = get_stack().pop_value();
-        get_stack().push_value(v * -1.0);
-    }
-}
+                double v = get_stack().pop_value();
+                get_stack().push_value(v * -1.0);
+                break;
+            }
+            case formula_instruction_t::hold_value:
+            {
+                auto sv = pop_stack_value(m_context, get_stack());
+                if (!sv)
+                {
+                    IXION_DEBUG("failed to pop value 1 from the stack");
+                    throw formula_error(formula_error_t::general_error);
+                }
 
-bool formula_interpreter::sign()
-{
-    ensure_token_exists();
+                get_stack().push_back(std::move(*sv));
+                break;
+            }
+            case formula_instruction_t::hold_numeric:
+                push_resolved_value(get_stack(), get_stack().pop_matrix_or_numeric());
+                break;
+            case formula_instruction_t::hold_string:
+                push_resolved_value(get_stack(), get_stack().pop_matrix_or_string());
+                break;
+            case formula_instruction_t::compare:
+            {
+                auto sv2 = pop_stack_value(m_context, get_stack());
+                if (!sv2)
+                {
+                    IXION_DEBUG("failed to pop value 2 from the stack");
+                    throw formula_error(formula_error_t::general_error);
+                }
 
-    fopcode_t oc = token().opcode;
-    bool sign_set = false;
+                // The left-hand side value has already been resolved.
+                auto sv1 = pop_stack_value(m_context, get_stack());
+                assert(sv1);
 
-    switch (oc)
-    {
-        case fop_minus:
-            sign_set = true;
-            // fall through
-        case fop_plus:
-        {
-            if (mp_handler)
-                mp_handler->push_token(oc);
+                apply_expression_op(get_stack(), std::get<fopcode_t>(inst.operand), *sv1, *sv2);
+                break;
+            }
+            case formula_instruction_t::multiply:
+            {
+                auto rhs = get_stack().pop_matrix_or_numeric();
+                auto lhs = get_stack().pop_matrix_or_numeric();
+                push_resolved_value(get_stack(), op_matrix_or_numeric<multiply_op>(lhs, rhs));
+                break;
+            }
+            case formula_instruction_t::divide:
+            {
+                auto rhs = get_stack().pop_matrix_or_numeric();
+                auto lhs = get_stack().pop_matrix_or_numeric();
+                push_resolved_value(get_stack(), op_matrix_or_numeric<divide_op>(lhs, rhs));
+                break;
+            }
+            case formula_instruction_t::exponent:
+            {
+                auto exp = get_stack().pop_matrix_or_numeric();
+                auto base = get_stack().pop_matrix_or_numeric();
+                push_resolved_value(get_stack(), op_matrix_or_numeric<exponent_op>(base, exp));
+                break;
+            }
+            case formula_instruction_t::concat:
+            {
+                auto rhs = get_stack().pop_matrix_or_string();
+                auto lhs = get_stack().pop_matrix_or_string();
+                push_resolved_value(get_stack(), concat_matrix_or_string(lhs, rhs));
+                break;
+            }
+            case formula_instruction_t::begin_call:
+                push_stack();
+                break;
+            case formula_instruction_t::call:
+            {
+                formula_function_t func_oc = std::get<formula_function_t>(inst.operand);
+                IXION_TRACE("function='" << get_formula_function_name(func_oc) << "'");
 
-            next();
+                // Function call pops all stack values pushed onto the stack
+                // since the start of the call, and pushes the result onto
+                // the stack.
+                formula_functions(m_context, m_pos).interpret(func_oc, get_stack());
+                assert(get_stack().size() == 1);
+
+                pop_stack();
+                break;
+            }
+            case formula_instruction_t::begin_lazy_call:
+                push_stack();
+                m_call_ends.push_back(std::get<std::size_t>(inst.operand));
+                break;
+            case formula_instruction_t::end_lazy_call:
+                assert(get_stack().size() == 1);
+                pop_stack();
+                m_call_ends.pop_back();
+                break;
+            case formula_instruction_t::jump:
+                pos = std::get<std::size_t>(inst.operand);
+                break;
+            case formula_instruction_t::jump_if_false:
+            {
+                if (auto err = get_stack().maybe_pop_error(); err)
+                {
+                    pos = fail_call(*err);
+                    break;
+                }
+
+                try
+                {
+                    if (!pop_condition())
+                        pos = std::get<std::size_t>(inst.operand);
+                }
+                catch (const formula_error& e)
+                {
+                    pos = fail_call(e.get_error());
+                }
+                break;
+            }
+            case formula_instruction_t::jump_if_error:
+            case formula_instruction_t::jump_if_na:
+            {
+                formula_error_t err = formula_error_t::no_error;
+                const stack_value& v = get_stack().back();
+
+                switch (v.get_type())
+                {
+                    case stack_value_t::error:
+                        err = v.get_error();
+                        break;
+                    case stack_value_t::single_ref:
+                        err = m_context.get_cell_access(v.get_address()).get_error_value();
+                        break;
+                    default:
+                        ;
+                }
+
+                bool caught = inst.type == formula_instruction_t::jump_if_error ?
+                    err != formula_error_t::no_error : err == formula_error_t::no_value_available;
+
+                if (caught)
+                {
+                    get_stack().pop_back();
+                    pos = std::get<std::size_t>(inst.operand);
+                }
+                break;
+            }
+            case formula_instruction_t::jump_if_mismatch:
+            {
+                try
+                {
+                    auto sv2 = pop_stack_value(m_context, get_stack());
+                    if (!sv2)
+                    {
+                        IXION_DEBUG("failed to pop a value to compare from the stack");
+                        throw formula_error(formula_error_t::general_error);
+                    }
+
+                    // The value to compare against has already been resolved.
+                    stack_value sv1 = get_stack().release_back();
+                    apply_expression_op(get_stack(), fop_equal, sv1, *sv2);
+
+                    bool equal = false;
+                    switch (get_stack().get_type())
+                    {
+                        case stack_value_t::boolean:
+                            equal = get_stack().pop_boolean();
+                            break;
+                        case stack_value_t::value:
+                            equal = get_stack().pop_value() != 0.0;
+                            break;
+                        case stack_value_t::error:
+                            pos = fail_call(get_stack().pop_error());
+                            continue;
+                        default:
+                            throw formula_error(formula_error_t::invalid_value_type);
+                    }
+
+                    if (!equal)
+                    {
+                        get_stack().push_back(std::move(sv1));
+                        pos = std::get<std::size_t>(inst.operand);
+                    }
+                }
+                catch (const formula_error& e)
+                {
+                    pos = fail_call(e.get_error());
+                }
+                break;
+            }
+            case formula_instruction_t::jump_table:
+            {
+                const auto& table = program.get_jump_table(std::get<std::size_t>(inst.operand));
+
+                if (auto err = get_stack().maybe_pop_error(); err)
+                {
+                    pos = fail_call(*err);
+                    break;
+                }
 
-            if (!has_token())
-                throw invalid_expression("sign: a sign cannot be the last token");
+                try
+                {
+                    formula_value_stack& stack = get_stack();
+                    double index = std::trunc(stack.get_value(stack.size() - 1));
+                    stack.pop_back();
+
+                    if (index < 1.0 || table.size() < index)
+                        throw formula_error(formula_error_t::invalid_value_type);
+
+                    pos = table[std::size_t(index) - 1];
+                }
+                catch (const formula_error& e)
+                {
+                    pos = fail_call(e.get_error());
+                }
+                break;
+            }
+            case formula_instruction_t::discard:
+                get_stack().pop_back();
+                break;
+            case formula_instruction_t::begin_try:
+                m_error_traps.push_back({std::get<std::size_t>(inst.operand), m_stack.frame_depth(), m_call_ends.size()});
+                break;
+            case formula_instruction_t::end_try:
+                m_error_traps.pop_back();
+                break;
+            case formula_instruction_t::fail_call:
+                pos = fail_call(std::get<formula_error_t>(inst.operand));
+                break;
+            case formula_instruction_t::fail:
+            {
+                if (program.get_error() == formula_error_t::invalid_expression)
+                    throw invalid_expression(program.get_error_message());
+
+                throw formula_error(program.get_error());
+            }
         }
-        default:
-            ;
     }
-
-    return sign_set;
 }
 
-void formula_interpreter::paren()
+bool formula_interpreter::pop_condition()
 {
-    if (mp_handler)
-        mp_handler->push_token(fop_open);
-
-    next();
-    expression();
-    if (token_or_throw().opcode != fop_close)
-        throw invalid_expression("paren: expected close paren");
+    formula_value_stack& stack = get_stack();
+    bool cond = stack.get_value(stack.size() - 1) != 0.0;
+    stack.pop_back();
+    return cond;
+}
 
-    if (mp_handler)
-        mp_handler->push_token(fop_close);
+std::size_t formula_interpreter::fail_call(formula_error_t err)
+{
+    if (is_internal_error(err))
+        throw formula_error(err);
 
-    next();
+    assert(!m_call_ends.empty());
+    get_stack().clear();
+    get_stack().push_error(err);
+    return m_call_ends.back();
 }
 
-void formula_interpreter::single_ref()
+void formula_interpreter::push_single_ref(const formula_token& t)
 {
-    const address_t& addr = std::get<address_t>(token().value);
+    const address_t& addr = std::get<address_t>(t.value);
     IXION_TRACE("ref=" << addr.get_name() << "; origin=" << m_pos.get_name());
 
-    if (mp_handler)
-        mp_handler->push_single_ref(addr, m_pos);
-
     abs_address_t abs_addr = addr.to_abs(m_pos);
     IXION_TRACE("ref=" << abs_addr.get_name() << " (converted to absolute)");
 
-    if (abs_addr == m_pos)
+    if (abs_addr == m_pos && !m_context.get_config().max_iterations)
     {
-        // self-referencing is not permitted.
+        // self-referencing is not permitted unless iterative calculation is
+        // enabled.
         throw formula_error(formula_error_t::ref_result_not_available);
     }
 
     get_stack().push_single_ref(abs_addr);
-    next();
 }
 
-void formula_interpreter::range_ref()
+void formula_interpreter::push_range_ref(const formula_token& t)
 {
-    const range_t& range = std::get<range_t>(token().value);
+    const range_t& range = std::get<range_t>(t.value);
     IXION_TRACE("ref-start=" << range.first.get_name() << "; ref-end=" << range.last.get_name() << "; origin=" << m_pos.get_name());
 
-    if (mp_handler)
-        mp_handler->push_range_ref(range, m_pos);
-
     abs_range_t abs_range = range.to_abs(m_pos);
     abs_range.reorder();
 
@@ -1467,10 +1703,9 @@ void formula_interpreter::range_ref()
     }
 
     get_stack().push_range_ref(abs_range);
-    next();
 }
 
-void formula_interpreter::table_ref()
+void formula_interpreter::push_table_ref(const formula_token& t)
 {
     const iface::table_handler* table_hdl = m_context.get_table_handler();
     if (!table_hdl)
@@ -1479,10 +1714,7 @@ void formula_interpreter::table_ref()
         throw formula_error(formula_error_t::ref_result_not_available);
     }
 
-    const table_t& table = std::get<table_t>(token().value);
-
-    if (mp_handler)
-        mp_handler->push_table_ref(table);
+    const table_t& table = std::get<table_t>(t.value);
 
     abs_range_t range(abs_range_t::invalid);
     if (table.name != empty_string_id)
@@ -1497,289 +1729,63 @@ void formula_interpreter::table_ref()
     }
 
     get_stack().push_range_ref(range);
-    next();
 }
 
-void formula_interpreter::constant()
+void formula_interpreter::push_array(const formula_program_array& array)
 {
-    double val = std::get<double>(token().value);
-    next();
-    get_stack().push_value(val);
-    if (mp_handler)
-        mp_handler->push_value(val);
-}
+    assert(array.values);
 
-void formula_interpreter::error()
-{
-    auto err = std::get<formula_error_t>(token().value);
-    next();
-    get_stack().push_error(err);
-    if (mp_handler)
-        mp_handler->push_error(err);
-}
+    if (array.strings.empty())
+    {
+        // pure numeric matrix, shared with the program
+        get_stack().push_matrix(array.values);
+        return;
+    }
 
-void formula_interpreter::literal()
-{
-    const std::string& s = string_or_throw();
+    // multi-type matrix
+    matrix mtx(*array.values);
+    for (const auto& [r, c, sid] : array.strings)
+        mtx.set(r, c, get_string(sid));
 
-    next();
-    get_stack().push_string(s);
+    get_stack().push_matrix(std::move(mtx));
 }
 
-void formula_interpreter::array()
+void formula_interpreter::clear_stacks()
 {
-    // '{' <constant> or <literal> ',' or ';' <constant> or <literal> ',' or ';' .... '}'
-    assert(token().opcode == fop_array_open);
-
-    if (mp_handler)
-        mp_handler->push_token(fop_array_open);
-
-    next(); // skip '{'
-
-    std::vector<double> values;
-    std::vector<std::tuple<std::size_t, std::size_t, std::string>> strings;
-    std::size_t row = 0;
-    std::size_t col = 0;
-    std::optional<std::size_t> prev_col;
-
-    fopcode_t prev_op = fop_array_open;
-
-    for (; has_token(); next())
-    {
-        bool has_sign = false;
-
-        switch (prev_op)
-        {
-            case fop_array_open:
-            case fop_sep:
-            case fop_array_row_sep:
-                has_sign = sign();
-                break;
-            default:;
-        }
-
-        switch (token().opcode)
-        {
-            case fop_string:
-            {
-                switch (prev_op)
-                {
-                    case fop_array_open:
-                    case fop_sep:
-                    case fop_array_row_sep:
-                        break;
-                    default:
-                        throw invalid_expression("array: invalid placement of value");
-                }
-
-                strings.emplace_back(row, col, string_or_throw());
-                values.push_back(0); // placeholder value, will be replaced
-
-                ++col;
-                break;
-            }
-            case fop_value:
-            {
-                switch (prev_op)
-                {
-                    case fop_minus:
-                    case fop_plus:
-                    case fop_array_open:
-                    case fop_sep:
-                    case fop_array_row_sep:
-                        break;
-                    default:
-                        throw invalid_expression("array: invalid placement of value");
-                }
-
-                double v = std::get<double>(token().value);
-
-                if (mp_handler)
-                    mp_handler->push_value(v);
-
-                if (has_sign)
-                    v = -v;
-
-                values.push_back(v);
-
-                ++col;
-                break;
-            }
-            case fop_sep:
-            {
-                switch (prev_op)
-                {
-                    case fop_value:
-                    case fop_string:
-                        break;
-                    default:
-                        throw invalid_expression("array: unexpected separator");
-                }
-
-                if (mp_handler)
-                    mp_handler->push_token(fop_sep);
-                break;
-            }
-            case fop_array_row_sep:
-            {
-                switch (prev_op)
-                {
-                    case fop_value:
-                    case fop_string:
-                        break;
-                    default:
-                        throw invalid_expression("array: unexpected row separator");
-                }
-
-                if (mp_handler)
-                    mp_handler->push_token(fop_array_row_sep);
-
-                ++row;
-
-                if (prev_col && *prev_col != col)
-                    throw invalid_expression("array: inconsistent column width");
-
-                prev_col = col;
-                col = 0;
-                break;
-            }
-            case fop_array_close:
-            {
-                switch (prev_op)
-                {
-                    case fop_array_open:
-                    case fop_value:
-                    case fop_string:
-                        break;
-                    default:
-                        throw invalid_expression("array: invalid placement of array close operator");
-                }
-
-                if (prev_col && *prev_col != col)
-                    throw invalid_expression("array: inconsistent column width");
-
-                ++row;
-
-                // Stored values are in row-major order, but the matrix expects a column-major array.
-                numeric_matrix num_mtx_transposed(std::move(values), col, row);
-                numeric_matrix num_mtx(row, col);
-
-                for (std::size_t r = 0; r < row; ++r)
-                    for (std::size_t c = 0; c < col; ++c)
-                        num_mtx(r, c) = num_mtx_transposed(c, r);
-
-                if (strings.empty())
-                    // pure numeric matrix
-                    get_stack().push_matrix(std::move(num_mtx));
-                else
-                {
-                    // multi-type matrix
-                    matrix mtx(num_mtx);
-                    for (const auto& [r, c, str] : strings)
-                        mtx.set(r, c, str);
-
-                    get_stack().push_matrix(std::move(mtx));
-                }
-
-                if (mp_handler)
-                    mp_handler->push_token(fop_array_close);
-
-                next(); // skip '}'
-                return;
-            }
-            default:
-            {
-                std::ostringstream os;
-                os << "array: unexpected token type: <" << get_formula_opcode_name(token().opcode) << ">";
-                throw invalid_expression(os.str());
-            }
-        }
-
-        prev_op = token().opcode;
-    }
-
-    throw invalid_expression("array: ended prematurely");
+    m_stack.reset();
 }
 
-void formula_interpreter::function()
+void formula_interpreter::push_stack()
 {
-    // <func name> '(' <expression> ',' <expression> ',' ... ',' <expression> ')'
-    ensure_token_exists();
-    assert(token().opcode == fop_function);
-    formula_function_t func_oc = formula_functions::get_function_opcode(token());
-    if (mp_handler)
-        mp_handler->push_function(func_oc);
-
-    push_stack();
-
-    IXION_TRACE("function='" << get_formula_function_name(func_oc) << "'");
-    assert(get_stack().empty());
-
-    if (next_token().opcode != fop_open)
-        throw invalid_expression("expecting a '(' after a function name.");
-
-    if (mp_handler)
-        mp_handler->push_token(fop_open);
-
-    fopcode_t oc = next_token().opcode;
-    bool expect_sep = false;
-    while (oc != fop_close)
-    {
-        if (expect_sep)
-        {
-            if (oc != fop_sep)
-                throw invalid_expression("argument separator is expected, but not found.");
-            next();
-            expect_sep = false;
-
-            if (mp_handler)
-                mp_handler->push_token(oc);
-        }
-        else
-        {
-            expression();
-            expect_sep = true;
-        }
-        oc = token_or_throw().opcode;
-    }
-
-    if (mp_handler)
-        mp_handler->push_token(oc);
-
-    next();
-
-    // Function call pops all stack values pushed onto the stack this far, and
-    // pushes the result onto the stack.
-    formula_functions(m_context, m_pos).interpret(func_oc, get_stack());
-    assert(get_stack().size() == 1);
+    m_stack.push_frame();
+}
 
-    pop_stack();
+void formula_interpreter::pop_stack()
+{
+    assert(m_stack.frame_depth() >= 2);
+    assert(m_stack.size() == 1);
+    m_stack.pop_frame();
 }
 
-void formula_interpreter::clear_stacks()
+formula_value_stack& formula_interpreter::get_stack()
 {
-    m_stacks.clear();
-    m_stacks.emplace_back(m_context);
+    return m_stack;
 }
 
-void formula_interpreter::push_stack()
+pooled_interpreter::pooled_interpreter(const formula_cell* cell, model_context& cxt) :
+    m_context(cxt),
+    mp_interpreter(cxt.mp_impl->acquire_interpreter(cell))
 {
-    m_stacks.emplace_back(m_context);
 }
 
-void formula_interpreter::pop_stack()
+pooled_interpreter::~pooled_interpreter()
 {
-    assert(m_stacks.size() >= 2);
-    assert(m_stacks.back().size() == 1);
-    auto tmp = m_stacks.back().release_back();
-    m_stacks.pop_back();
-    m_stacks.back().push_back(std::move(tmp));
+    m_context.mp_impl->release_interpreter(std::move(mp_interpreter));
 }
 
-formula_value_stack& formula_interpreter::get_stack()
+formula_interpreter& pooled_interpreter::get()
 {
-    assert(!m_stacks.empty());
-    return m_stacks.back();
+    return *mp_interpreter;
 }
 
 }
@@ -13,10 +13,11 @@
 #include "ixion/formula_result.hpp"
 
 #include "formula_value_stack.hpp"
+#include "formula_program.hpp"
 
 #include <sstream>
-#include <unordered_set>
-#include <deque>
+#include <optional>
+#include <vector>
 
 namespace ixion {
 
@@ -29,26 +30,20 @@ class session_handler;
 }
 
 /**
- * The formula interpreter parses a series of formula tokens representing a
- * formula expression, and calculates the result of that expression.
+ * The formula interpreter runs the program compiled from a series of
+ * formula tokens representing a formula expression, and calculates the
+ * result of that expression.
  *
- * <p>Intermediate result of each handler is pushed onto the stack and
- * popped from it for the calling method to retrieve.  By the end of the
- * interpretation there should only be one result left on the stack which is
- * the final result of the interpretation of the expression.  The number of
- * intermediate results (or stack values) on the stack is normally one at
- * the end of each handler, except for the function handler where the number
- * of stack values may be more than one when the function may take more than
- * one argument.</p>
+ * <p>Each instruction pops its operands off the stack and pushes its
+ * result onto it.  By the end of the interpretation there should only be
+ * one result left on the stack which is the final result of the
+ * interpretation of the expression.  The arguments of each function call
+ * are collected on a frame of their own on the same stack, which the
+ * function pops all values from.</p>
  */
 class formula_interpreter
 {
-    using name_set = std::unordered_set<std::string>;
-    using fv_stacks_type = std::deque<formula_value_stack>;
-
 public:
-    typedef ::std::vector<const formula_token*> local_tokens_type;
-
     formula_interpreter() = delete;
     formula_interpreter(const formula_interpreter&) = delete;
     formula_interpreter& operator= (formula_interpreter) = delete;
@@ -56,6 +51,17 @@ public:
     formula_interpreter(const formula_cell* cell, model_context& cxt);
     ~formula_interpreter();
 
+    /**
+     * Set the formula cell to interpret next.  This allows the same
+     * instance to interpret multiple cells in turn, while keeping the
+     * memory allocated for its stack.
+     *
+     * @param cell formula cell to interpret.
+     */
+    void set_cell(const formula_cell* cell);
+
+    model_context& get_context() const;
+
     void set_origin(const abs_address_t& pos);
     bool interpret();
     formula_result transfer_result();
@@ -63,41 +69,47 @@ public:
 
 private:
     /**
-     * Expand all named expressions into a flat set of tokens.  This is also
-     * where we detect circular referencing of named expressions.
+     * Get the program to run for the current cell.  A program that depends
+     * on the named expressions or the tables gets compiled against the
+     * current definitions of them, on first use after they change.
      */
-    void init_tokens();
+    const formula_program& init_program();
 
     void pop_result();
 
-    void expand_named_expression(const named_expression_t* expr, name_set& used_names);
-
-    void ensure_token_exists() const;
-    bool has_token() const;
-    void next();
-    const formula_token& token() const;
-    const formula_token& token_or_throw() const;
-    const formula_token& next_token();
-    const std::string& string_or_throw() const;
-
-    // The following methods are handlers.  In each handler, the initial
-    // position is always set to the first unprocessed token.  Each handler is
-    // responsible for setting the token position to the next unprocessed
-    // position when it finishes.
-
-    void expression();
-    void term();
-    void factor();
-    bool sign();
-    void paren();
-    void single_ref();
-    void range_ref();
-    void table_ref();
-    void constant();
-    void error();
-    void literal();
-    void array();
-    void function();
+    /**
+     * Pass all tokens being interpreted to the session handler.
+     */
+    void report_tokens(const formula_program& program);
+
+    const std::string& get_string(string_id_t sid) const;
+
+    void execute(const formula_program& program);
+
+    /**
+     * Run the instructions of the program from the specified position
+     * until the end.
+     */
+    void run(const formula_program& program, std::size_t pos);
+
+    /**
+     * Pop the value on top of the stack as the condition of a lazy function
+     * call.
+     */
+    bool pop_condition();
+
+    /**
+     * Replace the values of the current lazy function call with an error.
+     * An internal error gets thrown instead.
+     *
+     * @return position of the end of the call.
+     */
+    std::size_t fail_call(formula_error_t err);
+
+    void push_single_ref(const formula_token& t);
+    void push_range_ref(const formula_token& t);
+    void push_table_ref(const formula_token& t);
+    void push_array(const formula_program_array& array);
 
     void clear_stacks();
     void push_stack();
@@ -111,15 +123,58 @@ private:
     std::unique_ptr<iface::session_handler> mp_handler;
     abs_address_t m_pos;
 
-    fv_stacks_type m_stacks;
-    local_tokens_type m_tokens;
-    local_tokens_type::const_iterator m_cur_token_itr;
-    local_tokens_type::const_iterator m_end_token_pos;
+    /**
+     * The stack gets reused across interpretations, with one frame for each
+     * function call being evaluated.
+     */
+    formula_value_stack m_stack;
 
-    formula_result m_result;
+    /**
+     * State of the interpretation to restore when an error gets caught for
+     * an IFERROR or IFNA call.
+     */
+    struct error_trap
+    {
+        std::size_t resume_pos;
+        std::size_t stack_depth;
+        std::size_t call_depth;
+    };
+
+    /** positions of the ends of the lazy function calls being evaluated. */
+    std::vector<std::size_t> m_call_ends;
+    std::vector<error_trap> m_error_traps;
+
+    /** program compiled from the token store of the cell. */
+    std::shared_ptr<const formula_program> m_program;
+
+    /** a new result instance gets created for each interpretation. */
+    std::optional<formula_result> m_result;
     formula_error_t m_error;
 };
 
+/**
+ * Provides access to a formula interpreter instance taken from the
+ * instances that the model context keeps for reuse, for the lifetime of
+ * this object.  Reusing the instances between cells saves the allocations
+ * otherwise needed to set up the interpreter for every cell.  Each nested
+ * interpretation takes an instance of its own.
+ */
+class pooled_interpreter
+{
+    model_context& m_context;
+    std::unique_ptr<formula_interpreter> mp_interpreter;
+
+public:
+    pooled_interpreter() = delete;
+    pooled_interpreter(const pooled_interpreter&) = delete;
+    pooled_interpreter& operator= (const pooled_interpreter&) = delete;
+
+    pooled_interpreter(const formula_cell* cell, model_context& cxt);
+    ~pooled_interpreter();
+
+    formula_interpreter& get();
+};
+
 }
 
 #endif
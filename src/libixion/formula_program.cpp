@@ -0,0 +1,1129 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "formula_program.hpp"
+
+#include <ixion/exceptions.hpp>
+#include <ixion/model_context.hpp>
+#include <ixion/interface/table_handler.hpp>
+
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <unordered_set>
+
+namespace ixion {
+
+namespace {
+
+/**
+ * Thrown when the compiler encounters a grammatically invalid expression.
+ */
+struct syntax_error
+{
+    std::string message;
+};
+
+/**
+ * Placeholder for the position of a jump that is not yet known.
+ */
+constexpr std::size_t unresolved_target = std::numeric_limits<std::size_t>::max();
+
+const formula_token paren_open = formula_token{fop_open};
+const formula_token paren_close = formula_token{fop_close};
+
+bool valid_expression_op(fopcode_t oc)
+{
+    switch (oc)
+    {
+        case fop_plus:
+        case fop_minus:
+        case fop_equal:
+        case fop_not_equal:
+        case fop_less:
+        case fop_less_equal:
+        case fop_greater:
+        case fop_greater_equal:
+            return true;
+        default:
+            ;
+    }
+    return false;
+}
+
+/**
+ * Recursive-descent parser that emits the instructions in the order in
+ * which the expression gets evaluated.
+ */
+class compiler
+{
+    using tokens_type = formula_program::tokens_type;
+
+    tokens_type::const_iterator m_cur;
+    tokens_type::const_iterator m_end;
+
+    formula_program::instructions_type& m_instructions;
+    std::vector<formula_program_array>& m_arrays;
+    std::vector<formula_program::jump_table_type>& m_jump_tables;
+
+public:
+    compiler(
+        const tokens_type& tokens, formula_program::instructions_type& instructions,
+        std::vector<formula_program_array>& arrays,
+        std::vector<formula_program::jump_table_type>& jump_tables) :
+        m_cur(tokens.begin()),
+        m_end(tokens.end()),
+        m_instructions(instructions),
+        m_arrays(arrays),
+        m_jump_tables(jump_tables) {}
+
+    bool has_token() const
+    {
+        return m_cur != m_end;
+    }
+
+    // In each of the following handlers, the initial position is always
+    // set to the first unprocessed token.  Each handler is responsible for
+    // setting the token position to the next unprocessed position when it
+    // finishes.
+
+    void expression()
+    {
+        // <term> + <term> + <term> + ... + <term>
+        // valid operators are: +, -, =, <, >, <=, >=, <>.
+
+        term();
+        while (has_token())
+        {
+            fopcode_t oc = token().opcode;
+            if (!valid_expression_op(oc))
+                return;
+
+            emit(formula_instruction_t::hold_value);
+            next();
+            term();
+            emit(formula_instruction_t::compare, oc);
+            fold_binary_op();
+        }
+    }
+
+private:
+    void emit(formula_instruction_t type, formula_instruction::operand_type operand = {})
+    {
+        m_instructions.push_back({type, std::move(operand)});
+    }
+
+    /**
+     * Emit a jump whose target gets resolved later.
+     *
+     * @return position of the jump instruction.
+     */
+    std::size_t emit_jump(formula_instruction_t type)
+    {
+        emit(type, unresolved_target);
+        return m_instructions.size() - 1;
+    }
+
+    /**
+     * Set the target of a previously emitted jump to the position of the
+     * next instruction.
+     */
+    void resolve_jump(std::size_t pos)
+    {
+        m_instructions[pos].operand = m_instructions.size();
+    }
+
+    /**
+     * @return numeric constant pushed by the instruction at the position, or
+     *         nothing if the instruction does not push a numeric constant.
+     */
+    std::optional<double> constant_at(std::size_t pos) const
+    {
+        const formula_instruction& inst = m_instructions[pos];
+        if (inst.type != formula_instruction_t::push_value)
+            return {};
+
+        return std::get<double>(inst.operand);
+    }
+
+    /**
+     * Replace all instructions from the position with one that pushes the
+     * constant.  Only the instructions of the subexpression just compiled
+     * may be replaced, since no jump targets any position inside it.
+     */
+    void fold(std::size_t pos, double v)
+    {
+        m_instructions.resize(pos);
+        emit(formula_instruction_t::push_value, v);
+    }
+
+    /**
+     * Fold the operator just emitted if both of its operands are numeric
+     * constants.  Each operand is then a single instruction, preceded by
+     * the instruction that holds the left-hand side operand.
+     */
+    void fold_binary_op()
+    {
+        std::size_t n = m_instructions.size();
+        if (n < 4)
+            return;
+
+        std::size_t pos = n - 4;
+        auto lhs = constant_at(pos);
+        auto rhs = constant_at(n - 2);
+        if (!lhs || !rhs)
+            return;
+
+        const formula_instruction& op = m_instructions[n - 1];
+
+        switch (op.type)
+        {
+            case formula_instruction_t::compare:
+            {
+                double v1 = *lhs, v2 = *rhs;
+                switch (std::get<fopcode_t>(op.operand))
+                {
+                    case fop_plus:
+                        fold(pos, v1 + v2);
+                        break;
+                    case fop_minus:
+                        fold(pos, v1 - v2);
+                        break;
+                    case fop_equal:
+                        fold(pos, v1 == v2);
+                        break;
+                    case fop_not_equal:
+                        fold(pos, v1 != v2);
+                        break;
+                    case fop_less:
+                        fold(pos, v1 < v2);
+                        break;
+                    case fop_less_equal:
+                        fold(pos, v1 <= v2);
+                        break;
+                    case fop_greater:
+                        fold(pos, v1 > v2);
+                        break;
+                    case fop_greater_equal:
+                        fold(pos, v1 >= v2);
+                        break;
+                    default:
+                        ;
+                }
+                break;
+            }
+            case formula_instruction_t::multiply:
+                fold(pos, *lhs * *rhs);
+                break;
+            case formula_instruction_t::divide:
+                // Leave the division by zero to raise its error when run.
+                if (*rhs != 0.0)
+                    fold(pos, *lhs / *rhs);
+                break;
+            case formula_instruction_t::exponent:
+                fold(pos, std::pow(*lhs, *rhs));
+                break;
+            default:
+                ;
+        }
+    }
+
+    void fold_negate()
+    {
+        std::size_t n = m_instructions.size();
+        assert(n >= 2);
+
+        if (auto v = constant_at(n - 2); v)
+            fold(n - 2, *v * -1.0);
+    }
+
+    /**
+     * Fold the call just emitted if the function always returns the same
+     * numeric value for the same numeric arguments, and all its arguments
+     * are numeric constants.  The result must be the same as the one the
+     * function computes when called.
+     *
+     * @param pos position of the begin_call instruction of the call.
+     * @param func_oc function being called.
+     */
+    void fold_call(std::size_t pos, formula_function_t func_oc)
+    {
+        std::size_t n = m_instructions.size();
+        std::vector<double> args;
+        for (std::size_t i = pos + 1; i < n - 1; ++i)
+        {
+            auto v = constant_at(i);
+            if (!v)
+                return;
+
+            args.push_back(*v);
+        }
+
+        switch (func_oc)
+        {
+            case formula_function_t::func_pi:
+                if (args.empty())
+                    fold(pos, M_PI);
+                break;
+            case formula_function_t::func_abs:
+                if (args.size() == 1u)
+                    fold(pos, std::abs(args[0]));
+                break;
+            case formula_function_t::func_int:
+                if (args.size() == 1u)
+                    fold(pos, std::floor(args[0]));
+                break;
+            default:
+                ;
+        }
+    }
+
+    void next()
+    {
+        ++m_cur;
+    }
+
+    const formula_token& token() const
+    {
+        assert(m_cur != m_end);
+        return **m_cur;
+    }
+
+    void ensure_token_exists() const
+    {
+        if (!has_token())
+            throw syntax_error{"formula expression ended prematurely"};
+    }
+
+    const formula_token& token_or_throw() const
+    {
+        ensure_token_exists();
+        return token();
+    }
+
+    const formula_token& next_token()
+    {
+        next();
+        if (!has_token())
+            throw syntax_error{"expecting a token but no more tokens found."};
+
+        return token();
+    }
+
+    void term()
+    {
+        // <factor> || <factor> (*|^|&|/) <term>
+
+        factor();
+        if (!has_token())
+            return;
+
+        auto binary_op = [this](formula_instruction_t hold, formula_instruction_t op)
+        {
+            emit(hold);
+            next(); // skip the op token
+            term();
+            emit(op);
+            fold_binary_op();
+        };
+
+        switch (token().opcode)
+        {
+            case fop_multiply:
+                binary_op(formula_instruction_t::hold_numeric, formula_instruction_t::multiply);
+                break;
+            case fop_exponent:
+                binary_op(formula_instruction_t::hold_numeric, formula_instruction_t::exponent);
+                break;
+            case fop_concat:
+                binary_op(formula_instruction_t::hold_string, formula_instruction_t::concat);
+                break;
+            case fop_divide:
+                binary_op(formula_instruction_t::hold_numeric, formula_instruction_t::divide);
+                break;
+            default:
+                ;
+        }
+    }
+
+    void factor()
+    {
+        // <constant> || <error> || <variable> || '(' <expression> ')' || <function>
+
+        bool negative_sign = sign(); // NB: may be preceded by a '+' or '-' sign.
+        fopcode_t oc = token().opcode;
+
+        switch (oc)
+        {
+            case fop_open:
+                paren();
+                break;
+            case fop_value:
+                emit(formula_instruction_t::push_value, std::get<double>(token().value));
+                next();
+                break;
+            case fop_error:
+                emit(formula_instruction_t::push_error, &token());
+                next();
+                break;
+            case fop_single_ref:
+                emit(formula_instruction_t::push_single_ref, &token());
+                next();
+                break;
+            case fop_range_ref:
+                emit(formula_instruction_t::push_range_ref, &token());
+                next();
+                break;
+            case fop_table_ref:
+                emit(formula_instruction_t::push_table_ref, &token());
+                next();
+                break;
+            case fop_function:
+                function();
+                break;
+            case fop_string:
+                emit(formula_instruction_t::push_string, &token());
+                next();
+                break;
+            case fop_array_open:
+                array();
+                break;
+            default:
+            {
+                // Named expressions are supposed to be expanded prior to
+                // the compilation.
+                std::ostringstream os;
+                os << "factor: unexpected token type: <" << get_formula_opcode_name(oc) << ">";
+                throw syntax_error{os.str()};
+            }
+        }
+
+        if (negative_sign)
+        {
+            emit(formula_instruction_t::negate);
+            fold_negate();
+        }
+    }
+
+    bool sign()
+    {
+        ensure_token_exists();
+
+        fopcode_t oc = token().opcode;
+        bool sign_set = false;
+
+        switch (oc)
+        {
+            case fop_minus:
+                sign_set = true;
+                // fall through
+            case fop_plus:
+            {
+                next();
+
+                if (!has_token())
+                    throw syntax_error{"sign: a sign cannot be the last token"};
+            }
+            default:
+                ;
+        }
+
+        return sign_set;
+    }
+
+    void paren()
+    {
+        next();
+        expression();
+        if (token_or_throw().opcode != fop_close)
+            throw syntax_error{"paren: expected close paren"};
+
+        next();
+    }
+
+    void array()
+    {
+        // '{' <constant> or <literal> ',' or ';' <constant> or <literal> ',' or ';' .... '}'
+        assert(token().opcode == fop_array_open);
+
+        next(); // skip '{'
+
+        formula_program_array data;
+        std::vector<double> values; // in row-major order
+        std::size_t row = 0;
+        std::size_t col = 0;
+        std::optional<std::size_t> prev_col;
+
+        fopcode_t prev_op = fop_array_open;
+
+        for (; has_token(); next())
+        {
+            bool has_sign = false;
+
+            switch (prev_op)
+            {
+                case fop_array_open:
+                case fop_sep:
+                case fop_array_row_sep:
+                    has_sign = sign();
+                    break;
+                default:;
+            }
+
+            switch (token().opcode)
+            {
+                case fop_string:
+                {
+                    switch (prev_op)
+                    {
+                        case fop_array_open:
+                        case fop_sep:
+                        case fop_array_row_sep:
+                            break;
+                        default:
+                            throw syntax_error{"array: invalid placement of value"};
+                    }
+
+                    data.strings.emplace_back(row, col, std::get<string_id_t>(token().value));
+                    values.push_back(0); // placeholder value, will be replaced
+
+                    ++col;
+                    break;
+                }
+                case fop_value:
+                {
+                    switch (prev_op)
+                    {
+                        case fop_minus:
+                        case fop_plus:
+                        case fop_array_open:
+                        case fop_sep:
+                        case fop_array_row_sep:
+                            break;
+                        default:
+                            throw syntax_error{"array: invalid placement of value"};
+                    }
+
+                    double v = std::get<double>(token().value);
+                    if (has_sign)
+                        v = -v;
+
+                    values.push_back(v);
+
+                    ++col;
+                    break;
+                }
+                case fop_sep:
+                {
+                    switch (prev_op)
+                    {
+                        case fop_value:
+                        case fop_string:
+                            break;
+                        default:
+                            throw syntax_error{"array: unexpected separator"};
+                    }
+                    break;
+                }
+                case fop_array_row_sep:
+                {
+                    switch (prev_op)
+                    {
+                        case fop_value:
+                        case fop_string:
+                            break;
+                        default:
+                            throw syntax_error{"array: unexpected row separator"};
+                    }
+
+                    ++row;
+
+                    if (prev_col && *prev_col != col)
+                        throw syntax_error{"array: inconsistent column width"};
+
+                    prev_col = col;
+                    col = 0;
+                    break;
+                }
+                case fop_array_close:
+                {
+                    switch (prev_op)
+                    {
+                        case fop_array_open:
+                        case fop_value:
+                        case fop_string:
+                            break;
+                        default:
+                            throw syntax_error{"array: invalid placement of array close operator"};
+                    }
+
+                    if (prev_col && *prev_col != col)
+                        throw syntax_error{"array: inconsistent column width"};
+
+                    ++row;
+
+                    // Stored values are in row-major order, but the matrix expects a column-major array.
+                    numeric_matrix num_mtx_transposed(std::move(values), col, row);
+                    numeric_matrix num_mtx(row, col);
+
+                    for (std::size_t r = 0; r < row; ++r)
+                        for (std::size_t c = 0; c < col; ++c)
+                            num_mtx(r, c) = num_mtx_transposed(c, r);
+
+                    data.values = std::make_shared<const matrix>(num_mtx);
+                    emit(formula_instruction_t::push_array, m_arrays.size());
+                    m_arrays.push_back(std::move(data));
+
+                    next(); // skip '}'
+                    return;
+                }
+                default:
+                {
+                    std::ostringstream os;
+                    os << "array: unexpected token type: <" << get_formula_opcode_name(token().opcode) << ">";
+                    throw syntax_error{os.str()};
+                }
+            }
+
+            prev_op = token().opcode;
+        }
+
+        throw syntax_error{"array: ended prematurely"};
+    }
+
+    void function()
+    {
+        // <func name> '(' <expression> ',' <expression> ',' ... ',' <expression> ')'
+        assert(token().opcode == fop_function);
+        formula_function_t func_oc = std::get<formula_function_t>(token().value);
+
+        if (lazy_function(func_oc))
+            return;
+
+        std::size_t call_pos = m_instructions.size();
+        emit(formula_instruction_t::begin_call);
+
+        if (next_token().opcode != fop_open)
+            throw syntax_error{"expecting a '(' after a function name."};
+
+        fopcode_t oc = next_token().opcode;
+        bool expect_sep = false;
+        while (oc != fop_close)
+        {
+            if (expect_sep)
+            {
+                if (oc != fop_sep)
+                    throw syntax_error{"argument separator is expected, but not found."};
+                next();
+                expect_sep = false;
+            }
+            else
+            {
+                expression();
+                expect_sep = true;
+            }
+            oc = token_or_throw().opcode;
+        }
+
+        next();
+
+        emit(formula_instruction_t::call, func_oc);
+        fold_call(call_pos, func_oc);
+    }
+
+    /**
+     * Count the arguments of the function call at the current position,
+     * without moving the position.
+     *
+     * @return number of the arguments, or nothing if the arguments are not
+     *         enclosed in parentheses.
+     */
+    std::optional<std::size_t> count_arguments() const
+    {
+        auto it = std::next(m_cur);
+        if (it == m_end || (*it)->opcode != fop_open)
+            return {};
+
+        ++it;
+        if (it != m_end && (*it)->opcode == fop_close)
+            return 0;
+
+        std::size_t depth = 0;
+        std::size_t n = 1;
+
+        for (; it != m_end; ++it)
+        {
+            switch ((*it)->opcode)
+            {
+                case fop_open:
+                case fop_array_open:
+                    ++depth;
+                    break;
+                case fop_close:
+                case fop_array_close:
+                    if (!depth)
+                        return n;
+                    --depth;
+                    break;
+                case fop_sep:
+                    if (!depth)
+                        ++n;
+                    break;
+                default:
+                    ;
+            }
+        }
+
+        return {};
+    }
+
+    /**
+     * Compile an argument of a lazy function call, and skip the separator
+     * or the close paren that follows it.
+     *
+     * @param last whether or not this is the last argument of the call.
+     */
+    void argument(bool last)
+    {
+        expression();
+
+        if (token_or_throw().opcode != (last ? fop_close : fop_sep))
+            throw syntax_error{"argument separator is expected, but not found."};
+
+        next();
+    }
+
+    /**
+     * Compile a call to a function whose arguments get evaluated lazily.
+     * Calls with an invalid number of arguments are left to the function
+     * itself to report.
+     *
+     * @return true if the call has been compiled, false otherwise.
+     */
+    bool lazy_function(formula_function_t func_oc)
+    {
+        std::optional<std::size_t> n = count_arguments();
+        if (!n)
+            return false;
+
+        switch (func_oc)
+        {
+            case formula_function_t::func_if:
+                if (*n != 3)
+                    return false;
+                break;
+            case formula_function_t::func_iferror:
+            case formula_function_t::func_ifna:
+                if (*n != 2)
+                    return false;
+                break;
+            case formula_function_t::func_ifs:
+                if (*n < 2 || *n % 2)
+                    return false;
+                break;
+            case formula_function_t::func_switch:
+                if (*n < 3)
+                    return false;
+                break;
+            case formula_function_t::func_choose:
+                if (*n < 2)
+                    return false;
+                break;
+            default:
+                return false;
+        }
+
+        std::size_t call_pos = emit_jump(formula_instruction_t::begin_lazy_call);
+        next(); // skip the function name
+        next(); // skip '('
+
+        // jumps from the end of each branch to the end of the call.
+        std::vector<std::size_t> exits;
+
+        switch (func_oc)
+        {
+            case formula_function_t::func_if:
+            {
+                // IF(condition, value if true, value if false)
+                argument(false);
+                std::size_t branch = emit_jump(formula_instruction_t::jump_if_false);
+                argument(false);
+                exits.push_back(emit_jump(formula_instruction_t::jump));
+                resolve_jump(branch);
+                argument(true);
+                break;
+            }
+            case formula_function_t::func_ifs:
+            {
+                // IFS(condition 1, value 1, condition 2, value 2, ...)
+                for (std::size_t i = 0; i < *n; i += 2)
+                {
+                    argument(false);
+                    std::size_t branch = emit_jump(formula_instruction_t::jump_if_false);
+                    argument(i + 2 == *n);
+                    exits.push_back(emit_jump(formula_instruction_t::jump));
+                    resolve_jump(branch);
+                }
+
+                emit(formula_instruction_t::fail_call, formula_error_t::no_value_available);
+                break;
+            }
+            case formula_function_t::func_iferror:
+            case formula_function_t::func_ifna:
+            {
+                // IFERROR(value, value if error)
+                std::size_t trap = emit_jump(formula_instruction_t::begin_try);
+                argument(false);
+                emit(formula_instruction_t::end_try);
+                resolve_jump(trap);
+
+                std::size_t branch = emit_jump(
+                    func_oc == formula_function_t::func_iferror ?
+                    formula_instruction_t::jump_if_error : formula_instruction_t::jump_if_na);
+                exits.push_back(emit_jump(formula_instruction_t::jump));
+                resolve_jump(branch);
+                argument(true);
+                break;
+            }
+            case formula_function_t::func_switch:
+            {
+                // SWITCH(expression, value 1, result 1, value 2, result 2, ..., default)
+                std::size_t n_pairs = (*n - 1) / 2;
+                bool has_default = (*n - 1) % 2;
+
+                argument(false);
+                emit(formula_instruction_t::hold_value);
+
+                for (std::size_t i = 0; i < n_pairs; ++i)
+                {
+                    argument(false);
+                    std::size_t branch = emit_jump(formula_instruction_t::jump_if_mismatch);
+                    argument(!has_default && i + 1 == n_pairs);
+                    exits.push_back(emit_jump(formula_instruction_t::jump));
+                    resolve_jump(branch);
+                }
+
+                if (has_default)
+                {
+                    emit(formula_instruction_t::discard);
+                    argument(true);
+                }
+                else
+                    emit(formula_instruction_t::fail_call, formula_error_t::no_value_available);
+                break;
+            }
+            case formula_function_t::func_choose:
+            {
+                // CHOOSE(index, value 1, value 2, ...)
+                argument(false);
+
+                // NB: the nested calls may add more tables.
+                std::size_t table = m_jump_tables.size();
+                m_jump_tables.emplace_back(*n - 1, unresolved_target);
+                emit(formula_instruction_t::jump_table, table);
+
+                for (std::size_t i = 1; i < *n; ++i)
+                {
+                    m_jump_tables[table][i - 1] = m_instructions.size();
+                    argument(i + 1 == *n);
+                    exits.push_back(emit_jump(formula_instruction_t::jump));
+                }
+                break;
+            }
+            default:
+                assert(!"unhandled lazy function");
+        }
+
+        for (std::size_t pos : exits)
+            resolve_jump(pos);
+
+        resolve_jump(call_pos);
+        emit(formula_instruction_t::end_lazy_call);
+        return true;
+    }
+};
+
+/**
+ * Expands the named expressions in a series of tokens into a flat series of
+ * tokens.  This is also where we detect circular referencing of named
+ * expressions.
+ */
+class named_expression_expander
+{
+    using name_set = std::unordered_set<std::string>;
+
+    const model_context& m_context;
+    sheet_t m_sheet;
+    formula_program::tokens_type& m_tokens;
+    name_set m_used_names;
+
+public:
+    named_expression_expander(const model_context& cxt, sheet_t sheet, formula_program::tokens_type& tokens) :
+        m_context(cxt), m_sheet(sheet), m_tokens(tokens) {}
+
+    void expand(const formula_tokens_t& tokens)
+    {
+        for (const formula_token& t : tokens)
+        {
+            if (t.opcode == fop_named_expression)
+            {
+                // Named expression.  Expand it.
+                const auto& name = std::get<std::string>(t.value);
+                const named_expression_t* expr = m_context.get_named_expression(m_sheet, name);
+
+                m_used_names.insert(name);
+                expand_named_expression(expr);
+            }
+            else
+                // Normal token.
+                m_tokens.push_back(&t);
+        }
+    }
+
+private:
+    void expand_named_expression(const named_expression_t* expr)
+    {
+        if (!expr)
+            throw formula_error(formula_error_t::name_not_found);
+
+        m_tokens.push_back(&paren_open);
+        for (const auto& t : expr->tokens)
+        {
+            if (t.opcode == fop_named_expression)
+            {
+                const auto& expr_name = std::get<std::string>(t.value);
+                if (m_used_names.count(expr_name) > 0)
+                {
+                    // Circular reference detected.
+                    throw syntax_error{"circular referencing of named expressions"};
+                }
+                const named_expression_t* this_expr = m_context.get_named_expression(m_sheet, expr_name);
+                m_used_names.insert(expr_name);
+                expand_named_expression(this_expr);
+            }
+            else
+                m_tokens.push_back(&t);
+        }
+        m_tokens.push_back(&paren_close);
+    }
+};
+
+bool is_named_table_ref(const formula_token& t)
+{
+    return t.opcode == fop_table_ref && std::get<table_t>(t.value).name != empty_string_id;
+}
+
+} // anonymous namespace
+
+formula_program::formula_program(const formula_tokens_t& tokens) :
+    m_error(formula_error_t::no_error), m_context_dependent(false), m_trailing_tokens(false)
+{
+    m_tokens.reserve(tokens.size());
+    for (const formula_token& t : tokens)
+    {
+        m_tokens.push_back(&t);
+        if (t.opcode == fop_named_expression || is_named_table_ref(t))
+            m_context_dependent = true;
+    }
+
+    if (!m_context_dependent)
+        compile();
+}
+
+formula_program::formula_program(const formula_tokens_t& tokens, const model_context& cxt, sheet_t sheet) :
+    m_error(formula_error_t::no_error), m_context_dependent(true), m_trailing_tokens(false)
+{
+    try
+    {
+        named_expression_expander(cxt, sheet, m_tokens).expand(tokens);
+    }
+    catch (const syntax_error& e)
+    {
+        m_tokens.clear();
+        fail(formula_error_t::invalid_expression, e.message);
+        return;
+    }
+    catch (const formula_error& e)
+    {
+        m_tokens.clear();
+        fail(e.get_error(), std::string());
+        return;
+    }
+
+    compile();
+
+    // Resolve the ranges of the named tables, which don't depend on the
+    // position of the formula cell.
+    const iface::table_handler* table_hdl = cxt.get_table_handler();
+    if (!table_hdl)
+        // Let each interpretation report the error.
+        return;
+
+    for (formula_instruction& inst : m_instructions)
+    {
+        if (inst.type != formula_instruction_t::push_table_ref)
+            continue;
+
+        const formula_token* t = std::get<const formula_token*>(inst.operand);
+        if (!is_named_table_ref(*t))
+            continue;
+
+        const table_t& table = std::get<table_t>(t->value);
+        m_table_ranges.push_back(
+            table_hdl->get_range(table.name, table.column_first, table.column_last, table.areas));
+
+        inst.type = formula_instruction_t::push_table_range;
+        inst.operand = m_table_ranges.size() - 1;
+    }
+}
+
+formula_program::~formula_program() = default;
+
+void formula_program::compile()
+{
+    if (m_tokens.empty())
+        return;
+
+    compiler c(m_tokens, m_instructions, m_arrays, m_jump_tables);
+
+    try
+    {
+        c.expression();
+        m_trailing_tokens = c.has_token();
+    }
+    catch (const syntax_error& e)
+    {
+        fail(formula_error_t::invalid_expression, e.message);
+
+        // Direct the jumps into the part that failed to compile to the
+        // fail instruction.
+        std::size_t fail_pos = m_instructions.size() - 1;
+
+        for (formula_instruction& inst : m_instructions)
+        {
+            const std::size_t* target = std::get_if<std::size_t>(&inst.operand);
+            if (target && *target == unresolved_target)
+                inst.operand = fail_pos;
+        }
+
+        for (jump_table_type& table : m_jump_tables)
+        {
+            for (std::size_t& target : table)
+            {
+                if (target == unresolved_target)
+                    target = fail_pos;
+            }
+        }
+    }
+}
+
+void formula_program::fail(formula_error_t error, std::string message)
+{
+    m_error = error;
+    m_error_message = std::move(message);
+    m_instructions.push_back({formula_instruction_t::fail, {}});
+}
+
+bool formula_program::is_context_dependent() const
+{
+    return m_context_dependent;
+}
+
+bool formula_program::empty() const
+{
+    return m_instructions.empty();
+}
+
+bool formula_program::has_trailing_tokens() const
+{
+    return m_trailing_tokens;
+}
+
+const formula_program::tokens_type& formula_program::get_tokens() const
+{
+    return m_tokens;
+}
+
+const formula_program::instructions_type& formula_program::get_instructions() const
+{
+    return m_instructions;
+}
+
+const formula_program_array& formula_program::get_array(std::size_t index) const
+{
+    assert(index < m_arrays.size());
+    return m_arrays[index];
+}
+
+const abs_range_t& formula_program::get_table_range(std::size_t index) const
+{
+    assert(index < m_table_ranges.size());
+    return m_table_ranges[index];
+}
+
+const formula_program::jump_table_type& formula_program::get_jump_table(std::size_t index) const
+{
+    assert(index < m_jump_tables.size());
+    return m_jump_tables[index];
+}
+
+formula_error_t formula_program::get_error() const
+{
+    return m_error;
+}
+
+const std::string& formula_program::get_error_message() const
+{
+    return m_error_message;
+}
+
+formula_program_cache::formula_program_cache() :
+    m_resolved_sheet(invalid_sheet), m_resolved_revision(0) {}
+
+formula_program_cache::~formula_program_cache() = default;
+
+std::shared_ptr<const formula_program> formula_program_cache::get(const formula_tokens_t& tokens)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (!m_program)
+        m_program = std::make_shared<formula_program>(tokens);
+
+    return m_program;
+}
+
+std::shared_ptr<const formula_program> formula_program_cache::get(
+    const formula_tokens_t& tokens, const model_context& cxt, sheet_t sheet, std::size_t revision)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_resolved && m_resolved_sheet == sheet && m_resolved_revision == revision)
+            return m_resolved;
+    }
+
+    // Compile outside the lock, as it may take a while.  Another thread
+    // may compile the same program concurrently, which is harmless.
+    auto program = std::make_shared<formula_program>(tokens, cxt, sheet);
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_resolved = program;
+    m_resolved_sheet = sheet;
+    m_resolved_revision = revision;
+    return program;
+}
+
+void formula_program_cache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_program.reset();
+    m_resolved.reset();
+}
+
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
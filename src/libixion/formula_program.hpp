@@ -0,0 +1,315 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_FORMULA_PROGRAM_HPP
+#define INCLUDED_IXION_FORMULA_PROGRAM_HPP
+
+#include <ixion/formula_tokens.hpp>
+#include <ixion/matrix.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <variant>
+#include <vector>
+
+namespace ixion {
+
+class model_context;
+
+/**
+ * Type of instruction in a compiled formula program.
+ */
+enum class formula_instruction_t : std::uint8_t
+{
+    /** push the numeric constant stored in the instruction. */
+    push_value,
+    /** push the string referenced by the string token. */
+    push_string,
+    /** push the error value of the error token. */
+    push_error,
+    /** push the single cell reference of the token, relative to the origin. */
+    push_single_ref,
+    /** push the range reference of the token, relative to the origin. */
+    push_range_ref,
+    /** push the range the table reference of the token refers to. */
+    push_table_ref,
+    /** push a range resolved from a table reference during the compilation. */
+    push_table_range,
+    /** push a matrix built from an inline array of the program. */
+    push_array,
+    /** negate the numeric value on top of the stack. */
+    negate,
+    /**
+     * Resolve the value on top of the stack as the left-hand side operand
+     * of a relational, addition or subtraction operator, before the
+     * right-hand side operand gets evaluated.
+     */
+    hold_value,
+    /**
+     * Resolve the value on top of the stack into a matrix or a numeric
+     * value, as the left-hand side operand of an arithmetic operator.
+     */
+    hold_numeric,
+    /**
+     * Resolve the value on top of the stack into a matrix or a string, as
+     * the left-hand side operand of a concatenation operator.
+     */
+    hold_string,
+    /** apply the relational, addition or subtraction operator of the instruction. */
+    compare,
+    multiply,
+    divide,
+    exponent,
+    concat,
+    /** start a new stack to collect the arguments of a function call. */
+    begin_call,
+    /** call the function of the instruction with the collected arguments. */
+    call,
+    /**
+     * Start a new stack for a function whose arguments get evaluated
+     * lazily.  The instruction stores the position of the end of the call.
+     */
+    begin_lazy_call,
+    /** move the single value left on the stack of the lazy call to its parent stack. */
+    end_lazy_call,
+    /** continue at the position stored in the instruction. */
+    jump,
+    /**
+     * Pop the condition on top of the stack, and jump if the condition is
+     * false.
+     */
+    jump_if_false,
+    /**
+     * Remove the value on top of the stack and jump if the value is an error,
+     * or a reference to a cell with an error.
+     */
+    jump_if_error,
+    /**
+     * Same as jump_if_error, but only for the error of an unavailable value.
+     */
+    jump_if_na,
+    /**
+     * Pop the value on top of the stack and compare it with the value
+     * below it.  Remove the value below as well if they are equal, or else
+     * jump.
+     */
+    jump_if_mismatch,
+    /**
+     * Pop the index on top of the stack, and jump to the position stored at
+     * the index in the jump table of the instruction.
+     */
+    jump_table,
+    /** remove the value on top of the stack. */
+    discard,
+    /**
+     * Catch the errors raised until the next end_try instruction, and
+     * continue at the position stored in the instruction with the error on
+     * the stack.
+     */
+    begin_try,
+    end_try,
+    /** end the lazy call with the error stored in the instruction as its result. */
+    fail_call,
+    /** abort the interpretation with the error of the program. */
+    fail,
+};
+
+struct formula_instruction
+{
+    using operand_type = std::variant<
+        std::monostate, double, fopcode_t, formula_function_t, formula_error_t, std::size_t,
+        const formula_token*>;
+
+    formula_instruction_t type;
+    operand_type operand;
+};
+
+/**
+ * Inline array in a formula expression.  The matrix gets built once during
+ * the compilation, and a purely numeric array gets pushed onto the stack
+ * without being copied.
+ */
+struct formula_program_array
+{
+    /** numeric values of the array, with 0 in place of strings. */
+    std::shared_ptr<const matrix> values;
+
+    /** row and column positions of the string values with their IDs. */
+    std::vector<std::tuple<std::size_t, std::size_t, string_id_t>> strings;
+};
+
+/**
+ * Formula tokens compiled into a series of instructions in postfix order,
+ * which the interpreter can run without having to parse the tokens again.
+ *
+ * <p>The grammar gets checked during the compilation.  Since the original
+ * interpretation evaluated the expression while parsing it, an expression
+ * that is not grammatically valid compiles into the instructions for its
+ * valid part followed by a fail instruction.  This way, running the
+ * program reports the same errors in the same order as before.</p>
+ *
+ * <p>Tokens that contain named expressions or references to named tables
+ * depend on the model context, and need to be compiled against it.  Such
+ * programs store the named expressions expanded, and the ranges of the
+ * named tables resolved.</p>
+ *
+ * <p>The arguments of the IF, IFS, IFERROR, IFNA, SWITCH and CHOOSE
+ * functions get evaluated lazily, which means only the arguments that
+ * determine the result get evaluated.  The instructions of each of these
+ * calls include the jumps between the arguments.</p>
+ *
+ * <p>Some instructions keep pointers to the tokens they are compiled
+ * from, which therefore must outlive the program.  This includes the
+ * tokens of the named expressions.</p>
+ */
+class formula_program
+{
+public:
+    using tokens_type = std::vector<const formula_token*>;
+    using instructions_type = std::vector<formula_instruction>;
+    using jump_table_type = std::vector<std::size_t>;
+
+    formula_program() = delete;
+    formula_program(const formula_program&) = delete;
+    formula_program& operator= (const formula_program&) = delete;
+
+    /**
+     * Constructor.  Compile the tokens unless they depend on the model
+     * context.
+     *
+     * @param tokens tokens to compile.
+     */
+    explicit formula_program(const formula_tokens_t& tokens);
+
+    /**
+     * Constructor.  Compile the tokens against the model context, by
+     * expanding all named expressions and resolving the ranges of all
+     * references to named tables.
+     *
+     * @param tokens tokens to compile.
+     * @param cxt model context to resolve the names against.
+     * @param sheet sheet of the formula cells, which determines the scope
+     *              of the named expressions.
+     */
+    formula_program(const formula_tokens_t& tokens, const model_context& cxt, sheet_t sheet);
+
+    ~formula_program();
+
+    /**
+     * @return true if the tokens depend on the model context and therefore
+     *         need to be compiled against it, false otherwise.
+     */
+    bool is_context_dependent() const;
+
+    /**
+     * @return true if the program was compiled from no tokens, false
+     *         otherwise.
+     */
+    bool empty() const;
+
+    /**
+     * @return true if the tokens contain more tokens past the end of a valid
+     *         expression, false otherwise.
+     */
+    bool has_trailing_tokens() const;
+
+    /**
+     * @return tokens the program has been compiled from, with all named
+     *         expressions expanded.
+     */
+    const tokens_type& get_tokens() const;
+
+    const instructions_type& get_instructions() const;
+
+    const formula_program_array& get_array(std::size_t index) const;
+
+    const abs_range_t& get_table_range(std::size_t index) const;
+
+    const jump_table_type& get_jump_table(std::size_t index) const;
+
+    /**
+     * @return error associated with the fail instruction.
+     */
+    formula_error_t get_error() const;
+
+    /**
+     * @return message associated with the fail instruction, if the error
+     *         is an invalid expression.
+     */
+    const std::string& get_error_message() const;
+
+private:
+    void compile();
+    void fail(formula_error_t error, std::string message);
+
+private:
+    tokens_type m_tokens;
+    instructions_type m_instructions;
+    std::vector<formula_program_array> m_arrays;
+    std::vector<abs_range_t> m_table_ranges;
+    std::vector<jump_table_type> m_jump_tables;
+    std::string m_error_message;
+    formula_error_t m_error;
+    bool m_context_dependent;
+    bool m_trailing_tokens;
+};
+
+/**
+ * Programs compiled from the tokens of a single token store, to be shared
+ * by all formula cells that share the store.  Programs that depend on the
+ * model context are cached for one sheet and one revision of the
+ * definitions of the named expressions and tables at a time.  All methods
+ * are safe to call concurrently.
+ */
+class formula_program_cache
+{
+    std::mutex m_mtx;
+    std::shared_ptr<const formula_program> m_program;
+    std::shared_ptr<const formula_program> m_resolved;
+    sheet_t m_resolved_sheet;
+    std::size_t m_resolved_revision;
+
+public:
+    formula_program_cache();
+    ~formula_program_cache();
+
+    /**
+     * Get the program compiled from the tokens without the model context,
+     * compiling it on first use.
+     *
+     * @param tokens tokens stored in the token store.
+     */
+    std::shared_ptr<const formula_program> get(const formula_tokens_t& tokens);
+
+    /**
+     * Get the program compiled from the tokens against the model context,
+     * compiling it when the cached program is for a different sheet or an
+     * outdated revision of the definitions.
+     *
+     * @param tokens tokens stored in the token store.
+     * @param cxt model context to resolve the names against.
+     * @param sheet sheet of the formula cell.
+     * @param revision current revision of the definitions of the named
+     *                 expressions and tables in the model context.
+     */
+    std::shared_ptr<const formula_program> get(
+        const formula_tokens_t& tokens, const model_context& cxt, sheet_t sheet, std::size_t revision);
+
+    /**
+     * Discard all cached programs.
+     */
+    void clear();
+};
+
+}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -9,6 +9,8 @@
 #include <ixion/exceptions.hpp>
 #include <ixion/global.hpp>
 
+#include "formula_program.hpp"
+
 #include <sstream>
 
 namespace ixion {
@@ -177,6 +179,9 @@ struct formula_tokens_store::impl
     formula_tokens_t m_tokens;
     size_t m_refcount;
 
+    /** programs compiled from the tokens on first use. */
+    formula_program_cache m_programs;
+
     impl() : m_refcount(0) {}
 };
 
@@ -212,6 +217,8 @@ size_t formula_tokens_store::get_reference_count() const
 
 formula_tokens_t& formula_tokens_store::get()
 {
+    // The tokens may get modified.
+    mp_impl->m_programs.clear();
     return mp_impl->m_tokens;
 }
 
@@ -220,6 +227,11 @@ const formula_tokens_t& formula_tokens_store::get() const
     return mp_impl->m_tokens;
 }
 
+formula_program_cache& formula_tokens_store::get_program_cache() const
+{
+    return mp_impl->m_programs;
+}
+
 named_expression_t::named_expression_t() {}
 named_expression_t::named_expression_t(const abs_address_t& _origin, formula_tokens_t _tokens) :
     origin(_origin), tokens(std::move(_tokens)) {}
@@ -109,6 +109,9 @@ stack_value::stack_value(double val) :
 stack_value::stack_value(std::string str) :
     m_type(stack_value_t::string), m_value(std::move(str)) {}
 
+stack_value::stack_value(const std::string* str) :
+    m_type(stack_value_t::string), m_value(str) {}
+
 stack_value::stack_value(const abs_address_t& val) :
     m_type(stack_value_t::single_ref), m_value(val) {}
 
@@ -121,6 +124,12 @@ stack_value::stack_value(formula_error_t err) :
 stack_value::stack_value(matrix mtx) :
     m_type(stack_value_t::matrix), m_value(std::move(mtx)) {}
 
+stack_value::stack_value(std::shared_ptr<const matrix> mtx) :
+    m_type(stack_value_t::matrix), m_value(std::move(mtx))
+{
+    assert(std::get<shared_matrix_type>(m_value));
+}
+
 stack_value::stack_value(stack_value&& other) :
     m_type(other.m_type), m_value(std::move(other.m_value)) {}
 
@@ -147,7 +156,7 @@ bool stack_value::get_boolean() const
         case stack_value_t::value:
             return std::get<double>(m_value) != 0.0;
         case stack_value_t::matrix:
-            return std::get<matrix>(m_value).get_boolean(0, 0);
+            return get_matrix().get_boolean(0, 0);
         default:;
     }
 
@@ -163,7 +172,7 @@ double stack_value::get_value() const
         case stack_value_t::value:
             return std::get<double>(m_value);
         case stack_value_t::matrix:
-            return std::get<matrix>(m_value).get_numeric(0, 0);
+            return get_matrix().get_numeric(0, 0);
         default:
             ;
     }
@@ -173,6 +182,9 @@ double stack_value::get_value() const
 
 const std::string& stack_value::get_string() const
 {
+    if (const auto* p = std::get_if<const std::string*>(&m_value))
+        return **p;
+
     return std::get<std::string>(m_value);
 }
 
@@ -193,6 +205,9 @@ formula_error_t stack_value::get_error() const
 
 const matrix& stack_value::get_matrix() const
 {
+    if (const auto* p = std::get_if<shared_matrix_type>(&m_value))
+        return **p;
+
     return std::get<matrix>(m_value);
 }
 
@@ -214,6 +229,9 @@ matrix stack_value::pop_matrix()
         }
         case stack_value_t::matrix:
         {
+            if (const auto* p = std::get_if<shared_matrix_type>(&m_value))
+                return **p;
+
             matrix mtx;
             mtx.swap(std::get<matrix>(m_value));
             return mtx;
@@ -223,11 +241,11 @@ matrix stack_value::pop_matrix()
     }
 }
 
-formula_value_stack::formula_value_stack(const model_context& cxt) : m_context(cxt) {}
+formula_value_stack::formula_value_stack(const model_context& cxt) : m_base(0), m_context(cxt) {}
 
 formula_value_stack::iterator formula_value_stack::begin()
 {
-    return m_stack.begin();
+    return m_stack.begin() + m_base;
 }
 
 formula_value_stack::iterator formula_value_stack::end()
@@ -237,7 +255,7 @@ formula_value_stack::iterator formula_value_stack::end()
 
 formula_value_stack::const_iterator formula_value_stack::begin() const
 {
-    return m_stack.begin();
+    return m_stack.begin() + m_base;
 }
 
 formula_value_stack::const_iterator formula_value_stack::end() const
@@ -254,7 +272,7 @@ formula_value_stack::value_type formula_value_stack::release(iterator pos)
 
 formula_value_stack::value_type formula_value_stack::release_back()
 {
-    assert(!m_stack.empty());
+    assert(!empty());
     auto tmp = std::move(m_stack.back());
     m_stack.pop_back();
     return tmp;
@@ -262,42 +280,75 @@ formula_value_stack::value_type formula_value_stack::release_back()
 
 bool formula_value_stack::empty() const
 {
-    return m_stack.empty();
+    return m_stack.size() == m_base;
 }
 
 size_t formula_value_stack::size() const
 {
-    return m_stack.size();
+    return m_stack.size() - m_base;
 }
 
 void formula_value_stack::clear()
 {
-    return m_stack.clear();
+    // Destroying the values keeps the capacity of the buffer.
+    m_stack.erase(m_stack.begin() + m_base, m_stack.end());
+}
+
+void formula_value_stack::push_frame()
+{
+    m_frames.push_back(m_base);
+    m_base = m_stack.size();
+}
+
+void formula_value_stack::pop_frame()
+{
+    assert(!m_frames.empty());
+    m_base = m_frames.back();
+    m_frames.pop_back();
 }
 
-void formula_value_stack::swap(formula_value_stack& other)
+std::size_t formula_value_stack::frame_depth() const
 {
-    m_stack.swap(other.m_stack);
+    return m_frames.size() + 1;
+}
+
+void formula_value_stack::unwind(std::size_t depth)
+{
+    assert(depth >= 1 && depth <= frame_depth());
+
+    while (frame_depth() > depth)
+        pop_frame();
+
+    clear();
+}
+
+void formula_value_stack::reset()
+{
+    m_frames.clear();
+    m_base = 0;
+    m_stack.clear();
 }
 
 stack_value& formula_value_stack::back()
 {
+    assert(!empty());
     return m_stack.back();
 }
 
 const stack_value& formula_value_stack::back() const
 {
+    assert(!empty());
     return m_stack.back();
 }
 
 const stack_value& formula_value_stack::operator[](size_t pos) const
 {
-    return m_stack[pos];
+    return m_stack[m_base + pos];
 }
 
 double formula_value_stack::get_value(size_t pos) const
 {
-    const stack_value& v = m_stack[pos];
+    const stack_value& v = (*this)[pos];
     return get_numeric_value(m_context, v);
 }
 
@@ -325,6 +376,13 @@ void formula_value_stack::push_string(std::string str)
     m_stack.emplace_back(std::move(str));
 }
 
+void formula_value_stack::push_pooled_string(const std::string* str)
+{
+    assert(str);
+    IXION_TRACE("str='" << *str << "'");
+    m_stack.emplace_back(str);
+}
+
 void formula_value_stack::push_single_ref(const abs_address_t& val)
 {
     IXION_TRACE("val=" << val.get_name());
@@ -344,6 +402,12 @@ void formula_value_stack::push_matrix(matrix mtx)
     m_stack.emplace_back(std::move(mtx));
 }
 
+void formula_value_stack::push_matrix(std::shared_ptr<const matrix> mtx)
+{
+    IXION_TRACE("push_matrix (shared)");
+    m_stack.emplace_back(std::move(mtx));
+}
+
 void formula_value_stack::push_error(formula_error_t err)
 {
     IXION_TRACE("err=" << short(err) << " (" << get_formula_error_name(err) << ")");
@@ -352,7 +416,7 @@ void formula_value_stack::push_error(formula_error_t err)
 
 bool formula_value_stack::pop_boolean()
 {
-    if (m_stack.empty())
+    if (empty())
         throw formula_error(formula_error_t::stack_error);
 
     const stack_value& v = m_stack.back();
@@ -365,7 +429,7 @@ bool formula_value_stack::pop_boolean()
 double formula_value_stack::pop_value()
 {
     double ret = 0.0;
-    if (m_stack.empty())
+    if (empty())
         throw formula_error(formula_error_t::stack_error);
 
     const stack_value& v = m_stack.back();
@@ -379,7 +443,7 @@ std::string formula_value_stack::pop_string()
 {
     IXION_TRACE("pop_string");
 
-    if (m_stack.empty())
+    if (empty())
         throw formula_error(formula_error_t::stack_error);
 
     const stack_value& v = m_stack.back();
@@ -480,7 +544,7 @@ matrix formula_value_stack::pop_matrix()
 
 std::optional<matrix> formula_value_stack::maybe_pop_matrix()
 {
-    if (m_stack.empty())
+    if (empty())
         throw formula_error(formula_error_t::stack_error);
 
     stack_value& v = m_stack.back();
@@ -504,7 +568,7 @@ abs_address_t formula_value_stack::pop_single_ref()
 {
     IXION_TRACE("pop_single_ref");
 
-    if (m_stack.empty())
+    if (empty())
         throw formula_error(formula_error_t::stack_error);
 
     const stack_value& v = m_stack.back();
@@ -533,7 +597,7 @@ abs_range_t formula_value_stack::pop_range_ref()
 {
     IXION_TRACE("pop_range_ref");
 
-    if (m_stack.empty())
+    if (empty())
         throw formula_error(formula_error_t::stack_error);
 
     const stack_value& v = m_stack.back();
@@ -561,7 +625,7 @@ matrix formula_value_stack::pop_range_value()
 {
     IXION_TRACE("pop_range_value");
 
-    if (m_stack.empty())
+    if (empty())
         throw formula_error(formula_error_t::stack_error);
 
     const stack_value& v = m_stack.back();
@@ -577,7 +641,7 @@ formula_error_t formula_value_stack::pop_error()
 {
     IXION_TRACE("pop_error");
 
-    if (m_stack.empty())
+    if (empty())
         throw formula_error(formula_error_t::stack_error);
 
     const stack_value& v = m_stack.back();
@@ -589,8 +653,55 @@ formula_error_t formula_value_stack::pop_error()
     return ret;
 }
 
+std::optional<formula_error_t> formula_value_stack::maybe_pop_error()
+{
+    if (empty())
+        throw formula_error(formula_error_t::stack_error);
+
+    const stack_value& v = m_stack.back();
+    switch (v.get_type())
+    {
+        case stack_value_t::error:
+            return pop_error();
+        case stack_value_t::single_ref:
+        {
+            formula_error_t err = m_context.get_cell_access(v.get_address()).get_error_value();
+            if (err == formula_error_t::no_error)
+                break;
+
+            m_stack.pop_back();
+            return err;
+        }
+        default:;
+    }
+
+    return {};
+}
+
 resolved_stack_value formula_value_stack::pop_matrix_or_numeric()
 {
+    if (empty())
+        throw formula_error(formula_error_t::stack_error);
+
+    const stack_value& v = m_stack.back();
+    switch (v.get_type())
+    {
+        case stack_value_t::error:
+            return pop_error();
+        case stack_value_t::single_ref:
+        {
+            // Look up the cell only once for both its error and its value.
+            auto ca = m_context.get_cell_access(v.get_address());
+            m_stack.pop_back();
+
+            if (formula_error_t err = ca.get_error_value(); err != formula_error_t::no_error)
+                return err;
+
+            return ca.get_numeric_value();
+        }
+        default:;
+    }
+
     if (auto mtx = maybe_pop_matrix(); mtx)
         return *mtx;
 
@@ -600,6 +711,9 @@ resolved_stack_value formula_value_stack::pop_matrix_or_numeric()
 
 resolved_stack_value formula_value_stack::pop_matrix_or_string()
 {
+    if (auto err = maybe_pop_error(); err)
+        return *err;
+
     if (auto mtx = maybe_pop_matrix(); mtx)
         return *mtx;
 
@@ -614,7 +728,7 @@ void formula_value_stack::pop_back()
 
 stack_value_t formula_value_stack::get_type() const
 {
-    if (m_stack.empty())
+    if (empty())
         throw formula_error(formula_error_t::stack_error);
 
     return m_stack.back().get_type();
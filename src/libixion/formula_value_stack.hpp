@@ -15,10 +15,11 @@
 
 #include "impl_types.hpp"
 
-#include <deque>
+#include <memory>
 #include <variant>
 #include <ostream>
 #include <optional>
+#include <vector>
 
 namespace ixion {
 
@@ -44,7 +45,10 @@ std::ostream& operator<<(std::ostream& os, stack_value_t sv);
  */
 class stack_value
 {
-    using stored_value_type = std::variant<bool, double, abs_address_t, abs_range_t, formula_error_t, matrix, std::string>;
+    using shared_matrix_type = std::shared_ptr<const matrix>;
+    using stored_value_type = std::variant<
+        bool, double, abs_address_t, abs_range_t, formula_error_t, matrix, shared_matrix_type, std::string,
+        const std::string*>;
 
     stack_value_t m_type;
     stored_value_type m_value;
@@ -57,10 +61,22 @@ public:
     explicit stack_value(bool b);
     explicit stack_value(double val);
     explicit stack_value(std::string str);
+
+    /**
+     * Constructor.  Reference a string stored in the string pool of the
+     * model context, which outlives the stack value.
+     */
+    explicit stack_value(const std::string* str);
     explicit stack_value(const abs_address_t& val);
     explicit stack_value(const abs_range_t& val);
     explicit stack_value(formula_error_t err);
     explicit stack_value(matrix mtx);
+
+    /**
+     * Constructor.  Reference an immutable matrix shared with its owner,
+     * such as a constant inline array of a formula program.
+     */
+    explicit stack_value(std::shared_ptr<const matrix> mtx);
     stack_value(stack_value&& other);
     ~stack_value();
 
@@ -78,18 +94,26 @@ public:
 
     /**
      * Move the matrix value out from storage.  The internal matrix content
-     * will be empty after this call.
+     * will be empty after this call.  A shared matrix gets copied instead.
      */
     matrix pop_matrix();
 };
 
 /**
  * FILO stack of values; last pushed value gets popped first.
+ *
+ * <p>The values of all nested function calls are stored in one contiguous
+ * buffer, which gets reused across interpretations.  Each call gets a
+ * frame that starts at the end of the values of its caller, and all
+ * methods other than the frame methods only see the values of the current
+ * frame.</p>
  */
 class formula_value_stack
 {
-    typedef std::deque<stack_value> store_type;
+    typedef std::vector<stack_value> store_type;
     store_type m_stack;
+    std::vector<std::size_t> m_frames;
+    std::size_t m_base;
     const model_context& m_context;
 
 public:
@@ -111,7 +135,35 @@ public:
     bool empty() const;
     size_t size() const;
     void clear();
-    void swap(formula_value_stack& other);
+
+    /**
+     * Start a new frame on top of the current frame.
+     */
+    void push_frame();
+
+    /**
+     * End the current frame.  The values left in it become the values on
+     * top of the parent frame.
+     */
+    void pop_frame();
+
+    /**
+     * @return number of the frames, including the initial frame.
+     */
+    std::size_t frame_depth() const;
+
+    /**
+     * End all frames above the specified depth, and remove all values of
+     * the frame at that depth.
+     *
+     * @param depth depth of the frame to clear.
+     */
+    void unwind(std::size_t depth);
+
+    /**
+     * Remove all values and frames.
+     */
+    void reset();
 
     stack_value& back();
     const stack_value& back() const;
@@ -123,9 +175,16 @@ public:
     void push_boolean(bool b);
     void push_value(double val);
     void push_string(std::string str);
+
+    /**
+     * Push a string stored in the string pool of the model context, without
+     * copying it.
+     */
+    void push_pooled_string(const std::string* str);
     void push_single_ref(const abs_address_t& val);
     void push_range_ref(const abs_range_t& val);
     void push_matrix(matrix mtx);
+    void push_matrix(std::shared_ptr<const matrix> mtx);
     void push_error(formula_error_t err);
 
     bool pop_boolean();
@@ -138,6 +197,14 @@ public:
     matrix pop_range_value();
     formula_error_t pop_error();
 
+    /**
+     * Pop the value on top of the stack if it is an error, or a reference to
+     * a cell whose value is an error.  Any other value stays on the stack.
+     *
+     * @return error popped, or nothing if the value is not an error.
+     */
+    std::optional<formula_error_t> maybe_pop_error();
+
     resolved_stack_value pop_matrix_or_numeric();
     resolved_stack_value pop_matrix_or_string();
 
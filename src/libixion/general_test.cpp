@@ -15,6 +15,8 @@
 #include <ixion/named_expressions_iterator.hpp>
 #include <ixion/global.hpp>
 #include <ixion/interface/table_handler.hpp>
+#include <ixion/interface/session_handler.hpp>
+#include <ixion/cancellation_token.hpp>
 #include <ixion/config.hpp>
 #include <ixion/matrix.hpp>
 #include <ixion/cell.hpp>
@@ -26,6 +28,7 @@
 #include <cstring>
 #include <sstream>
 #include <thread>
+#include <atomic>
 
 using namespace std;
 using namespace ixion;
@@ -1540,6 +1543,41 @@ void test_volatile_function()
     assert(0.2 <= delta && delta <= 0.3);
 }
 
+void test_interpreter_reuse_across_contexts()
+{
+    IXION_TEST_FUNC_SCOPE;
+
+    // Each context keeps its own interpreter instances, which must not get
+    // used by another context created after it is gone.
+    for (double v = 1.0; v <= 4.0; v += 1.0)
+    {
+        for (size_t thread_count : {0, 2})
+        {
+            auto cxt = std::make_unique<model_context>(rc_size_t{100, 10});
+            auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, cxt.get());
+            assert(resolver);
+
+            cxt->append_sheet("test");
+            cxt->set_numeric_cell(abs_address_t(0,0,0), v);
+
+            abs_range_set_t modified_cells;
+            abs_range_set_t dirty_cells;
+
+            for (row_t row = 1; row < 10; ++row)
+            {
+                insert_formula(*cxt, abs_address_t(0,row,0), "A1*2", *resolver);
+                dirty_cells.insert(abs_address_t(0,row,0));
+            }
+
+            auto sorted = query_and_sort_dirty_cells(*cxt, modified_cells, &dirty_cells);
+            calculate_sorted_cells(*cxt, sorted, thread_count);
+
+            for (row_t row = 1; row < 10; ++row)
+                assert(cxt->get_numeric_value(abs_address_t(0,row,0)) == v * 2.0);
+        }
+    }
+}
+
 void test_invalid_formula_tokens()
 {
     IXION_TEST_FUNC_SCOPE;
@@ -1586,6 +1624,490 @@ void test_grouped_formula_string_results()
     assert(s == "literal string");
 }
 
+void test_shared_formula_tokens_edit()
+{
+    IXION_TEST_FUNC_SCOPE;
+
+    model_context cxt;
+    cxt.append_sheet("test");
+
+    auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, &cxt);
+    assert(resolver);
+
+    abs_address_t A1(0, 0, 0), A2(0, 1, 0), A3(0, 2, 0);
+
+    formula_tokens_store_ptr_t ts = formula_tokens_store::create();
+    ts->get() = parse_formula_string(cxt, A1, *resolver, "1+2");
+    cxt.set_formula_cell(A1, ts);
+    cxt.set_formula_cell(A2, ts);
+
+    // The expression is missing its close parenthesis.
+    formula_tokens_t tokens = parse_formula_string(cxt, A3, *resolver, "(1+2");
+    tokens.pop_back();
+    cxt.set_formula_cell(A3, std::move(tokens));
+
+    std::vector<abs_range_t> cells = { A1, A2, A3 };
+    calculate_sorted_cells(cxt, cells, 0);
+
+    assert(cxt.get_numeric_value(A1) == 3.0);
+    assert(cxt.get_numeric_value(A2) == 3.0);
+    assert(cxt.get_formula_result(A3).get_error() == formula_error_t::invalid_expression);
+
+    // Modifying the shared tokens must take effect in both cells.
+    ts->get() = parse_formula_string(cxt, A1, *resolver, "2*5");
+    calculate_sorted_cells(cxt, cells, 0);
+
+    assert(cxt.get_numeric_value(A1) == 10.0);
+    assert(cxt.get_numeric_value(A2) == 10.0);
+}
+
+void test_formula_group_evaluation()
+{
+    IXION_TEST_FUNC_SCOPE;
+
+    // The cells sharing the same tokens on the first sheet get evaluated in
+    // runs, while each cell on the second sheet has its own copy of the
+    // tokens and gets interpreted on its own.  Both must give the same
+    // results.
+    model_context cxt;
+    cxt.append_sheet("shared");
+    cxt.append_sheet("single");
+
+    auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, &cxt);
+    assert(resolver);
+
+    const row_t row_count = 100;
+
+    for (sheet_t sheet = 0; sheet < 2; ++sheet)
+    {
+        for (row_t row = 0; row < row_count; ++row)
+        {
+            cxt.set_numeric_cell(abs_address_t(sheet, row, 0), row % 7);
+
+            // The string cell makes the runs that reference it fall back
+            // to the interpreter.
+            if (row == 60)
+                cxt.set_string_cell(abs_address_t(sheet, row, 1), "text");
+            else
+                cxt.set_numeric_cell(abs_address_t(sheet, row, 1), row * 0.5);
+        }
+    }
+
+    const char* formulas[] = {
+        "A1*2+1",
+        "1/A1",
+        "-A1^2-A2",
+        "A1>=$A$3",
+        "(A1+1)/(A2-3)",
+        "A1",
+        "Z1+1",
+        "B1*A1",
+    };
+
+    std::vector<abs_range_t> cells;
+
+    for (col_t i = 0; i < col_t(std::size(formulas)); ++i)
+    {
+        col_t col = i + 2;
+        abs_address_t origin(0, 0, col);
+
+        formula_tokens_store_ptr_t ts = formula_tokens_store::create();
+        ts->get() = parse_formula_string(cxt, origin, *resolver, formulas[i]);
+
+        for (row_t row = 0; row < row_count; ++row)
+        {
+            abs_address_t pos(0, row, col);
+            cxt.set_formula_cell(pos, ts);
+            cells.emplace_back(pos);
+
+            pos.sheet = 1;
+            formula_tokens_t tokens = parse_formula_string(cxt, origin, *resolver, formulas[i]);
+            cxt.set_formula_cell(pos, std::move(tokens));
+            cells.emplace_back(pos);
+        }
+    }
+
+    for (size_t thread_count : {0, 2})
+    {
+        calculate_sorted_cells(cxt, cells, thread_count);
+
+        for (col_t i = 0; i < col_t(std::size(formulas)); ++i)
+        {
+            for (row_t row = 0; row < row_count; ++row)
+            {
+                formula_result shared = cxt.get_formula_result(abs_address_t(0, row, i + 2));
+                formula_result single = cxt.get_formula_result(abs_address_t(1, row, i + 2));
+                if (shared != single)
+                {
+                    cerr << "formula: " << formulas[i] << "; row: " << row
+                        << "; shared: " << shared.str(cxt) << "; single: " << single.str(cxt) << endl;
+                    assert(!"results differ");
+                }
+            }
+        }
+    }
+
+    assert(cxt.get_numeric_value(abs_address_t(0, 0, 2)) == 1.0);
+    assert(cxt.get_formula_result(abs_address_t(0, 0, 3)).get_error() == formula_error_t::division_by_zero);
+    assert(cxt.get_numeric_value(abs_address_t(0, 1, 3)) == 1.0);
+}
+
+/**
+ * Table handler that always returns the same range, and counts the number
+ * of range requests.
+ */
+class counting_table_handler : public iface::table_handler
+{
+public:
+    abs_range_t range;
+    mutable std::atomic<size_t> count{0};
+
+    virtual abs_range_t get_range(
+        const abs_address_t& /*pos*/, string_id_t /*column_first*/, string_id_t /*column_last*/,
+        table_areas_t /*areas*/) const override
+    {
+        ++count;
+        return range;
+    }
+
+    virtual abs_range_t get_range(
+        string_id_t /*table*/, string_id_t /*column_first*/, string_id_t /*column_last*/,
+        table_areas_t /*areas*/) const override
+    {
+        ++count;
+        return range;
+    }
+};
+
+void test_named_definitions_change()
+{
+    IXION_TEST_FUNC_SCOPE;
+
+    model_context cxt;
+    cxt.append_sheet("test");
+
+    auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, &cxt);
+    assert(resolver);
+
+    // Grouped formula cells referencing a named expression yet to be defined.
+    abs_range_t B1B3(0, 0, 1, 3, 1);
+    formula_tokens_t tokens = parse_formula_string(cxt, B1B3.first, *resolver, "MyValue*2");
+    cxt.set_grouped_formula_cells(B1B3, std::move(tokens));
+
+    std::vector<abs_range_t> cells = { B1B3 };
+    calculate_sorted_cells(cxt, cells, 0);
+
+    for (row_t row = 0; row < 3; ++row)
+        assert(cxt.get_formula_result(abs_address_t(0, row, 1)).get_error() == formula_error_t::name_not_found);
+
+    cxt.set_named_expression("MyValue", parse_formula_string(cxt, abs_address_t(), *resolver, "10"));
+    calculate_sorted_cells(cxt, cells, 0);
+
+    for (row_t row = 0; row < 3; ++row)
+        assert(cxt.get_numeric_value(abs_address_t(0, row, 1)) == 20.0);
+
+    // Grouped formula cells referencing a named table.
+    cxt.set_numeric_cell(abs_address_t(0, 0, 0), 1.0);
+    cxt.set_numeric_cell(abs_address_t(0, 1, 0), 2.0);
+
+    counting_table_handler hdl;
+    hdl.range = abs_range_t(0, 0, 0, 2, 1); // A1:A2
+    cxt.set_table_handler(&hdl);
+
+    table_t table;
+    table.name = cxt.add_string("Table1");
+    table.column_first = cxt.add_string("Column");
+    table.areas = table_area_data;
+
+    tokens.clear();
+    tokens.emplace_back(formula_function_t::func_sum);
+    tokens.emplace_back(fop_open);
+    tokens.emplace_back(table);
+    tokens.emplace_back(fop_close);
+
+    abs_range_t C1C3(0, 0, 2, 3, 1);
+    cxt.set_grouped_formula_cells(C1C3, std::move(tokens));
+
+    cells = { C1C3 };
+    calculate_sorted_cells(cxt, cells, 0);
+    calculate_sorted_cells(cxt, cells, 0);
+
+    // The range of the table should only be requested once.
+    assert(hdl.count == 1);
+    for (row_t row = 0; row < 3; ++row)
+        assert(cxt.get_numeric_value(abs_address_t(0, row, 2)) == 3.0);
+
+    hdl.range = abs_range_t(0, 0, 0, 1, 1); // A1
+    cxt.notify(formula_event_t::table_definitions_changed);
+    calculate_sorted_cells(cxt, cells, 0);
+
+    assert(hdl.count == 2);
+    for (row_t row = 0; row < 3; ++row)
+        assert(cxt.get_numeric_value(abs_address_t(0, row, 2)) == 1.0);
+
+    cxt.set_table_handler(nullptr);
+}
+
+/**
+ * Session handler that cancels the calculation once a specified number of
+ * cells have been interpreted.
+ */
+class cancelling_session_handler : public iface::session_handler
+{
+    cancellation_token& m_token;
+    std::atomic<size_t>& m_count;
+    size_t m_limit;
+
+public:
+    cancelling_session_handler(cancellation_token& token, std::atomic<size_t>& count, size_t limit) :
+        m_token(token), m_count(count), m_limit(limit) {}
+
+    virtual void begin_cell_interpret(const abs_address_t&) override {}
+
+    virtual void end_cell_interpret() override
+    {
+        if (++m_count == m_limit)
+            m_token.cancel();
+    }
+
+    virtual void set_result(const formula_result&) override {}
+    virtual void set_invalid_expression(std::string_view) override {}
+    virtual void set_formula_error(std::string_view) override {}
+    virtual void push_token(fopcode_t) override {}
+    virtual void push_value(double) override {}
+    virtual void push_error(formula_error_t) override {}
+    virtual void push_string(size_t) override {}
+    virtual void push_single_ref(const address_t&, const abs_address_t&) override {}
+    virtual void push_range_ref(const range_t&, const abs_address_t&) override {}
+    virtual void push_table_ref(const table_t&) override {}
+    virtual void push_function(formula_function_t) override {}
+};
+
+class cancelling_session_handler_factory : public model_context::session_handler_factory
+{
+    cancellation_token& m_token;
+    std::atomic<size_t> m_count;
+    size_t m_limit;
+
+public:
+    cancelling_session_handler_factory(cancellation_token& token, size_t limit) :
+        m_token(token), m_count(0), m_limit(limit) {}
+
+    virtual std::unique_ptr<iface::session_handler> create() override
+    {
+        return std::make_unique<cancelling_session_handler>(m_token, m_count, m_limit);
+    }
+
+    size_t get_count() const { return m_count; }
+};
+
+void test_cancel_calculation()
+{
+    IXION_TEST_FUNC_SCOPE;
+
+    for (size_t thread_count : {0, 1})
+    {
+        model_context cxt{{100, 10}};
+        auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, &cxt);
+        assert(resolver);
+        cxt.append_sheet("test");
+
+        // Set a chain of formulas into A1:A5, each depending on the previous one.
+        abs_range_set_t dirty_cells;
+        for (row_t row = 0; row < 5; ++row)
+        {
+            std::ostringstream os;
+            if (row)
+                os << 'A' << row << "+1";
+            else
+                os << '1';
+
+            std::string exp = os.str();
+            insert_formula(cxt, abs_address_t(0,row,0), exp.c_str(), *resolver);
+            dirty_cells.insert(abs_address_t(0,row,0));
+        }
+
+        // Cancel the calculation after the second cell gets interpreted.
+        cancellation_token token;
+        cancelling_session_handler_factory factory(token, 2);
+        cxt.set_session_handler_factory(&factory);
+
+        auto sorted = query_and_sort_dirty_cells(cxt, abs_range_set_t(), &dirty_cells);
+        assert(sorted.size() == 5);
+        auto remaining = calculate_sorted_cells(cxt, sorted, thread_count, token);
+
+        // The calculated cells have their results, and the rest have none.
+        assert(remaining.size() == 3);
+        assert(cxt.get_numeric_value(abs_address_t(0,0,0)) == 1.0);
+        assert(cxt.get_numeric_value(abs_address_t(0,1,0)) == 2.0);
+
+        for (row_t row = 2; row < 5; ++row)
+        {
+            abs_address_t pos(0,row,0);
+            assert(remaining[row-2] == abs_range_t(pos));
+
+            try
+            {
+                cxt.get_numeric_value(pos);
+                assert(!"exception should have been thrown");
+            }
+            catch (const formula_error& e)
+            {
+                assert(e.get_error() == formula_error_t::ref_result_not_available);
+            }
+        }
+
+        // Resume the calculation.  Only the remaining cells get interpreted.
+        token.reset();
+        remaining = calculate_sorted_cells(cxt, remaining, thread_count, token);
+        assert(remaining.empty());
+        assert(factory.get_count() == 5);
+
+        for (row_t row = 0; row < 5; ++row)
+            assert(cxt.get_numeric_value(abs_address_t(0,row,0)) == row + 1.0);
+
+        // Calculate again without any session handler.
+        cxt.set_session_handler_factory(nullptr);
+        calculate_sorted_cells(cxt, sorted, thread_count);
+        assert(factory.get_count() == 5);
+        assert(cxt.get_numeric_value(abs_address_t(0,4,0)) == 5.0);
+
+    }
+}
+
+void test_cancel_iterative_calculation()
+{
+    IXION_TEST_FUNC_SCOPE;
+
+    for (size_t thread_count : {0, 1})
+    {
+        model_context cxt{{100, 10}};
+        auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, &cxt);
+        assert(resolver);
+        cxt.append_sheet("test");
+
+        config cfg = cxt.get_config();
+        cfg.max_iterations = 100;
+        cxt.set_config(cfg);
+
+        // B1 and B2 form a cycle that depends on A1 and converges after
+        // several sweeps, and C1 depends on the cycle.
+        abs_range_set_t dirty_cells;
+        const char* exps[] = { "1", "B2", "MIN(B1+A1,5)", "B1*2" };
+        const abs_address_t positions[] = {
+            abs_address_t(0,0,0), abs_address_t(0,0,1), abs_address_t(0,1,1), abs_address_t(0,0,2) };
+
+        for (size_t i = 0; i < std::size(exps); ++i)
+        {
+            insert_formula(cxt, positions[i], exps[i], *resolver);
+            dirty_cells.insert(positions[i]);
+        }
+
+        // Cancel the calculation after the first sweep over the cycle.
+        cancellation_token token;
+        cancelling_session_handler_factory factory(token, 3);
+        cxt.set_session_handler_factory(&factory);
+
+        auto sorted = query_and_sort_dirty_cells(cxt, abs_range_set_t(), &dirty_cells);
+        auto remaining = calculate_sorted_cells(cxt, sorted, thread_count, token);
+
+        // The cells in the cycle get left without results, not with their intermediate ones.
+        assert(remaining.size() == 3);
+        assert(cxt.get_numeric_value(positions[0]) == 1.0);
+
+        for (size_t i = 1; i < std::size(positions); ++i)
+        {
+            try
+            {
+                cxt.get_numeric_value(positions[i]);
+                assert(!"exception should have been thrown");
+            }
+            catch (const formula_error& e)
+            {
+                assert(e.get_error() == formula_error_t::ref_result_not_available);
+            }
+        }
+
+        token.reset();
+        remaining = calculate_sorted_cells(cxt, remaining, thread_count, token);
+        assert(remaining.empty());
+        assert(cxt.get_numeric_value(positions[1]) == 5.0);
+        assert(cxt.get_numeric_value(positions[2]) == 5.0);
+        assert(cxt.get_numeric_value(positions[3]) == 10.0);
+
+    }
+}
+
+void test_recalculate_after_cancel()
+{
+    IXION_TEST_FUNC_SCOPE;
+
+    for (size_t thread_count : {0, 1})
+    {
+        model_context cxt{{100, 10}};
+        auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, &cxt);
+        assert(resolver);
+        cxt.append_sheet("test");
+
+        config cfg = cxt.get_config();
+        cfg.max_iterations = 100;
+        cxt.set_config(cfg);
+
+        // A chain of formulas in A1:A5, and a cycle in B1:B2 that depends
+        // on the chain and converges after several sweeps.
+        abs_range_set_t dirty_cells;
+        const char* exps[] = { "1", "A1+1", "A2+1", "A3+1", "A4+1", "B2", "MIN(B1+A1,A5)" };
+        const abs_address_t positions[] = {
+            abs_address_t(0,0,0), abs_address_t(0,1,0), abs_address_t(0,2,0), abs_address_t(0,3,0),
+            abs_address_t(0,4,0), abs_address_t(0,0,1), abs_address_t(0,1,1) };
+
+        for (size_t i = 0; i < std::size(exps); ++i)
+        {
+            insert_formula(cxt, positions[i], exps[i], *resolver);
+            dirty_cells.insert(positions[i]);
+        }
+
+        // Cancel the calculation partway through the chain.
+        cancellation_token token;
+        cancelling_session_handler_factory factory(token, 2);
+        cxt.set_session_handler_factory(&factory);
+
+        auto sorted = query_and_sort_dirty_cells(cxt, abs_range_set_t(), &dirty_cells);
+        auto remaining = calculate_sorted_cells(cxt, sorted, thread_count, token);
+        assert(!remaining.empty());
+        cxt.set_session_handler_factory(nullptr);
+
+        // A full calculation of all the cells, including those left
+        // cancelled, gets the same results as an uninterrupted one.
+        calculate_sorted_cells(cxt, sorted, thread_count);
+
+        for (row_t row = 0; row < 5; ++row)
+            assert(cxt.get_numeric_value(abs_address_t(0,row,0)) == row + 1.0);
+
+        assert(cxt.get_numeric_value(abs_address_t(0,0,1)) == 5.0);
+        assert(cxt.get_numeric_value(abs_address_t(0,1,1)) == 5.0);
+
+        // Cancel again in the middle of the cycle, then calculate everything
+        // once more with a token that never gets cancelled.
+        token.reset();
+        cancelling_session_handler_factory factory2(token, 7);
+        cxt.set_session_handler_factory(&factory2);
+        remaining = calculate_sorted_cells(cxt, sorted, thread_count, token);
+        assert(!remaining.empty());
+        cxt.set_session_handler_factory(nullptr);
+
+        token.reset();
+        remaining = calculate_sorted_cells(cxt, sorted, thread_count, token);
+        assert(remaining.empty());
+
+        for (row_t row = 0; row < 5; ++row)
+            assert(cxt.get_numeric_value(abs_address_t(0,row,0)) == row + 1.0);
+
+        assert(cxt.get_numeric_value(abs_address_t(0,0,1)) == 5.0);
+        assert(cxt.get_numeric_value(abs_address_t(0,1,1)) == 5.0);
+    }
+}
+
 } // anonymous namespace
 
 int main()
@@ -1615,8 +2137,15 @@ int main()
     test_model_context_error_value();
     test_model_context_rename_sheets();
     test_volatile_function();
+    test_interpreter_reuse_across_contexts();
     test_invalid_formula_tokens();
     test_grouped_formula_string_results();
+    test_shared_formula_tokens_edit();
+    test_formula_group_evaluation();
+    test_named_definitions_change();
+    test_cancel_calculation();
+    test_cancel_iterative_calculation();
+    test_recalculate_after_cancel();
 
     return EXIT_SUCCESS;
 }
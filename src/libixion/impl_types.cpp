@@ -14,6 +14,7 @@ namespace ixion {
 resolved_stack_value::resolved_stack_value(matrix v) : m_value(std::move(v)) {}
 resolved_stack_value::resolved_stack_value(double v) : m_value(v) {}
 resolved_stack_value::resolved_stack_value(std::string v) : m_value(std::move(v)) {}
+resolved_stack_value::resolved_stack_value(formula_error_t v) : m_value(v) {}
 
 resolved_stack_value::value_type resolved_stack_value::type() const
 {
@@ -35,6 +36,11 @@ const std::string& resolved_stack_value::get_string() const
     return std::get<std::string>(m_value);
 }
 
+formula_error_t resolved_stack_value::get_error() const
+{
+    return std::get<formula_error_t>(m_value);
+}
+
 } // namespace ixion
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
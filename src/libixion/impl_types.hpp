@@ -24,21 +24,23 @@ class matrix;
 class resolved_stack_value
 {
     // Keep the type ordering in sync with value_type's.
-    using store_type = std::variant<matrix, double, std::string>;
+    using store_type = std::variant<matrix, double, std::string, formula_error_t>;
     store_type m_value;
 public:
 
-    enum class value_type { matrix, numeric, string };
+    enum class value_type { matrix, numeric, string, error };
 
     resolved_stack_value(matrix v);
     resolved_stack_value(double v);
     resolved_stack_value(std::string v);
+    resolved_stack_value(formula_error_t v);
 
     value_type type() const;
 
     const matrix& get_matrix() const;
     double get_numeric() const;
     const std::string& get_string() const;
+    formula_error_t get_error() const;
 };
 
 template<typename T>
@@ -0,0 +1,268 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "lookup_index.hpp"
+#include "model_context_impl.hpp"
+#include "utils.hpp"
+
+#include <ixion/formula_result.hpp>
+
+#include <algorithm>
+#include <cassert>
+
+namespace ixion { namespace detail {
+
+namespace {
+
+template<typename T>
+using sorted_entries_type = std::vector<std::pair<T, std::size_t>>;
+
+template<typename T>
+std::optional<std::size_t> find_sorted(const sorted_entries_type<T>& entries, const T& v, lookup_match_t match)
+{
+    using entry_type = typename sorted_entries_type<T>::value_type;
+
+    auto less_than_value = [](const entry_type& e, const T& value) { return e.first < value; };
+    auto value_less_than = [](const T& value, const entry_type& e) { return value < e.first; };
+
+    switch (match)
+    {
+        case lookup_match_t::exact:
+        {
+            auto it = std::lower_bound(entries.begin(), entries.end(), v, less_than_value);
+            if (it == entries.end() || it->first != v)
+                return {};
+
+            return it->second;
+        }
+        case lookup_match_t::less_or_equal:
+        {
+            auto it = std::upper_bound(entries.begin(), entries.end(), v, value_less_than);
+            if (it == entries.begin())
+                return {};
+
+            return std::prev(it)->second;
+        }
+        case lookup_match_t::greater_or_equal:
+        {
+            auto it = std::lower_bound(entries.begin(), entries.end(), v, less_than_value);
+            if (it == entries.end())
+                return {};
+
+            // Get the last of the entries with the same value.
+            auto it_end = std::upper_bound(it, entries.end(), it->first, value_less_than);
+            return std::prev(it_end)->second;
+        }
+    }
+
+    return {};
+}
+
+template<typename MapT, typename T>
+std::optional<std::size_t> find_exact(const MapT& positions, const T& v)
+{
+    auto it = positions.find(v);
+    if (it == positions.end())
+        return {};
+
+    return it->second;
+}
+
+bool has_upper_case(std::string_view s)
+{
+    return std::any_of(s.begin(), s.end(), [](char c) { return 'A' <= c && c <= 'Z'; });
+}
+
+/**
+ * Convert the ASCII letters in a string to lower case, to use the string
+ * as a key of the exact matches.
+ */
+std::string fold_case(std::string_view s)
+{
+    std::string ret{s};
+    for (char& c : ret)
+    {
+        if ('A' <= c && c <= 'Z')
+            c += 'a' - 'A';
+    }
+
+    return ret;
+}
+
+} // anonymous namespace
+
+lookup_index::lookup_index(const model_context_impl& cxt, const abs_range_t& range) :
+    m_has_formula(false)
+{
+    assert(range.valid());
+    assert(range.first.sheet == range.last.sheet);
+    assert(range.first.row == range.last.row || range.first.column == range.last.column);
+
+    const formula_result_wait_policy_t wait_policy = cxt.get_formula_result_wait_policy();
+    const bool vertical = range.first.column == range.last.column;
+
+    column_block_callback_t cb = [&](col_t col, row_t row1, row_t row2, const column_block_shape_t& node)
+    {
+        assert(row1 <= row2);
+        row_t length = row2 - row1 + 1;
+        std::size_t pos = vertical ? row1 - range.first.row : col - range.first.column;
+
+        switch (node.type)
+        {
+            case column_block_t::numeric:
+            {
+                for (double v : make_element_range<column_block_t::numeric>{}(node, length))
+                    push(pos++, v);
+                break;
+            }
+            case column_block_t::boolean:
+            {
+                for (bool b : make_element_range<column_block_t::boolean>{}(node, length))
+                    push_boolean(pos++, b);
+                break;
+            }
+            case column_block_t::string:
+            {
+                for (string_id_t sid : make_element_range<column_block_t::string>{}(node, length))
+                {
+                    const std::string* p = cxt.get_string(sid);
+                    if (p)
+                        push(pos, *p);
+                    ++pos;
+                }
+                break;
+            }
+            case column_block_t::formula:
+            {
+                m_has_formula = true;
+
+                for (const formula_cell* fc : make_element_range<column_block_t::formula>{}(node, length))
+                {
+                    formula_result res = fc->get_result_cache(wait_policy);
+
+                    switch (res.get_type())
+                    {
+                        case formula_result::result_type::value:
+                            push(pos, res.get_value());
+                            break;
+                        case formula_result::result_type::boolean:
+                            push_boolean(pos, res.get_boolean());
+                            break;
+                        case formula_result::result_type::string:
+                        {
+                            // The string results are not pooled, so the
+                            // index needs to keep its own copies.
+                            m_formula_strings.push_back(res.get_string());
+                            push(pos, m_formula_strings.back());
+                            break;
+                        }
+                        case formula_result::result_type::error:
+                        case formula_result::result_type::matrix:
+                            break;
+                    }
+
+                    ++pos;
+                }
+                break;
+            }
+            case column_block_t::empty:
+            case column_block_t::unknown:
+                break;
+        }
+
+        return true;
+    };
+
+    cxt.walk(range.first.sheet, range, cb);
+
+    std::sort(m_sorted_numerics.begin(), m_sorted_numerics.end());
+    std::sort(m_sorted_strings.begin(), m_sorted_strings.end());
+    std::sort(m_sorted_booleans.begin(), m_sorted_booleans.end());
+}
+
+lookup_index::~lookup_index() {}
+
+bool lookup_index::has_formula() const
+{
+    return m_has_formula;
+}
+
+std::size_t lookup_index::byte_size() const
+{
+    // Each hash entry costs its key and value, the node link and the bucket.
+    constexpr std::size_t node_overhead = 2 * sizeof(void*);
+
+    std::size_t n = m_numeric_positions.size() * (sizeof(double) + sizeof(std::size_t) + node_overhead);
+    n += m_string_positions.size() * (sizeof(std::string_view) + sizeof(std::size_t) + node_overhead);
+    n += m_sorted_numerics.capacity() * sizeof(m_sorted_numerics[0]);
+    n += m_sorted_strings.capacity() * sizeof(m_sorted_strings[0]);
+    n += m_sorted_booleans.capacity() * sizeof(m_sorted_booleans[0]);
+
+    for (const std::string& str : m_formula_strings)
+        n += sizeof(std::string) + str.capacity();
+
+    for (const std::string& str : m_folded_strings)
+        n += sizeof(std::string) + str.capacity();
+
+    return n;
+}
+
+std::optional<std::size_t> lookup_index::find(double v, lookup_match_t match) const
+{
+    if (match == lookup_match_t::exact)
+        return find_exact(m_numeric_positions, v);
+
+    return find_sorted(m_sorted_numerics, v, match);
+}
+
+std::optional<std::size_t> lookup_index::find(std::string_view s, lookup_match_t match) const
+{
+    if (match == lookup_match_t::exact)
+    {
+        if (!has_upper_case(s))
+            return find_exact(m_string_positions, s);
+
+        std::string folded = fold_case(s);
+        return find_exact(m_string_positions, std::string_view{folded});
+    }
+
+    return find_sorted(m_sorted_strings, s, match);
+}
+
+std::optional<std::size_t> lookup_index::find_boolean(bool b, lookup_match_t match) const
+{
+    return find_sorted(m_sorted_booleans, b, match);
+}
+
+void lookup_index::push(std::size_t pos, double v)
+{
+    // The positions come in ascending order, so the first one stays.
+    m_numeric_positions.emplace(v, pos);
+    m_sorted_numerics.emplace_back(v, pos);
+}
+
+void lookup_index::push(std::size_t pos, std::string_view s)
+{
+    if (has_upper_case(s))
+    {
+        m_folded_strings.push_back(fold_case(s));
+        m_string_positions.emplace(m_folded_strings.back(), pos);
+    }
+    else
+        m_string_positions.emplace(s, pos);
+
+    m_sorted_strings.emplace_back(s, pos);
+}
+
+void lookup_index::push_boolean(std::size_t pos, bool b)
+{
+    m_sorted_booleans.emplace_back(b, pos);
+}
+
+}}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
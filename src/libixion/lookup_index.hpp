@@ -0,0 +1,134 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_LOOKUP_INDEX_HPP
+#define INCLUDED_IXION_LOOKUP_INDEX_HPP
+
+#include <ixion/address.hpp>
+
+#include <cstdlib>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace ixion { namespace detail {
+
+class model_context_impl;
+
+/**
+ * Type of a match to look for, which corresponds with the match type
+ * argument of the MATCH function.
+ */
+enum class lookup_match_t
+{
+    /** the first value that is equal to the value to look up. */
+    exact,
+    /** the largest value that is less than or equal to the value to look up. */
+    less_or_equal,
+    /** the smallest value that is greater than or equal to the value to look up. */
+    greater_or_equal,
+};
+
+/**
+ * Index of the values in a single column or a single row of cells, to
+ * look values up in it without scanning the cells.  The numeric and string
+ * values have hash indexes for the exact matches, and all value types have
+ * sorted indexes for the approximate matches.  Numeric, string and
+ * boolean values never match one another, and the empty cells and the
+ * error values never match any value.  The exact matches of the strings
+ * ignore the case of the ASCII letters, as with VLOOKUP, HLOOKUP and
+ * MATCH.
+ *
+ * <p>An approximate match finds the largest or the smallest matching value
+ * regardless of the order of the cells, which is the same result as the
+ * binary search of the cells when they are sorted.  When more than one
+ * cell has the matching value, the exact match finds the first of them,
+ * and the approximate match finds the last of them.</p>
+ *
+ * <p>The index gets built once, and is read-only thereafter.</p>
+ */
+class lookup_index
+{
+public:
+    /**
+     * Constructor.  Build the index of the values in a range.
+     *
+     * @param cxt model context to get the values from.
+     * @param range range of cells to build the index of, which must be
+     *              within a single column or a single row of a single
+     *              sheet, and within the sheet size.
+     */
+    lookup_index(const model_context_impl& cxt, const abs_range_t& range);
+    ~lookup_index();
+
+    /**
+     * @return true if the range contains a formula cell, in which case the
+     *         index is only valid until the next calculation.
+     */
+    bool has_formula() const;
+
+    /**
+     * @return approximate number of bytes used by the index.
+     */
+    std::size_t byte_size() const;
+
+    /**
+     * Look up a numeric value.
+     *
+     * @return 0-based position of the matching cell in the range, or
+     *         nothing if no cell matches.
+     */
+    std::optional<std::size_t> find(double v, lookup_match_t match) const;
+
+    /**
+     * Look up a string value.
+     *
+     * @return 0-based position of the matching cell in the range, or
+     *         nothing if no cell matches.
+     */
+    std::optional<std::size_t> find(std::string_view s, lookup_match_t match) const;
+
+    /**
+     * Look up a boolean value.  False is less than true.
+     *
+     * @return 0-based position of the matching cell in the range, or
+     *         nothing if no cell matches.
+     */
+    std::optional<std::size_t> find_boolean(bool b, lookup_match_t match) const;
+
+private:
+    void push(std::size_t pos, double v);
+    void push(std::size_t pos, std::string_view s);
+    void push_boolean(std::size_t pos, bool b);
+
+private:
+    bool m_has_formula;
+
+    /** first positions of the values, for the exact matches. */
+    std::unordered_map<double, std::size_t> m_numeric_positions;
+    std::unordered_map<std::string_view, std::size_t> m_string_positions;
+
+    /** values and their positions sorted by value then by position. */
+    std::vector<std::pair<double, std::size_t>> m_sorted_numerics;
+    std::vector<std::pair<std::string_view, std::size_t>> m_sorted_strings;
+    std::vector<std::pair<bool, std::size_t>> m_sorted_booleans;
+
+    /** copies of the string results of the formula cells. */
+    std::deque<std::string> m_formula_strings;
+
+    /** lower-case copies of the strings that have upper-case letters. */
+    std::deque<std::string> m_folded_strings;
+};
+
+}}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
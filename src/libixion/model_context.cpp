@@ -15,6 +15,10 @@
 #include <ixion/exceptions.hpp>
 
 #include "model_context_impl.hpp"
+#include "range_view.hpp"
+
+#include <algorithm>
+#include <vector>
 
 namespace ixion {
 
@@ -241,36 +245,48 @@ matrix model_context::get_range_value(const abs_range_t& range) const
         throw std::invalid_argument(os.str());
     }
 
-    rc_size_t sheet_size = get_sheet_size();
-    abs_range_t range_clipped = range;
-    if (range_clipped.all_rows())
-    {
-        range_clipped.first.row = 0;
-        range_clipped.last.row = sheet_size.row - 1;
-    }
-    if (range_clipped.all_columns())
-    {
-        range_clipped.first.column = 0;
-        range_clipped.last.column = sheet_size.column - 1;
-    }
+    // Fill the values column by column straight from the column blocks.
+    // Whole rows or columns only extend to the last non-empty cells of the
+    // sheet, for the ranges combined element by element to match in size.
+    detail::range_view view(*mp_impl, mp_impl->clip_to_sheet_data_extent(range));
+    const abs_range_t& range_clipped = view.get_range();
+    const std::size_t rows = view.row_size();
+    const formula_result_wait_policy_t wait_policy = get_formula_result_wait_policy();
 
-    row_t rows = range_clipped.last.row - range_clipped.first.row + 1;
-    col_t cols = range_clipped.last.column - range_clipped.first.column + 1;
+    // TODO: we need to handle string types when that becomes available.
+    std::vector<double> array(rows * view.col_size(), 0.0);
 
-    matrix ret(rows, cols);
-    for (row_t i = 0; i < rows; ++i)
+    for (const detail::range_view::block& blk : view)
     {
-        for (col_t j = 0; j < cols; ++j)
-        {
-            row_t row = i + range_clipped.first.row;
-            col_t col = j + range_clipped.first.column;
-            double val = get_numeric_value(abs_address_t(range_clipped.first.sheet, row, col));
+        double* p = array.data() +
+            (blk.column() - range_clipped.first.column) * rows + (blk.row() - range_clipped.first.row);
 
-            // TODO: we need to handle string types when that becomes available.
-            ret.set(i, j, val);
+        switch (blk.type())
+        {
+            case column_block_t::numeric:
+            {
+                auto values = blk.values<column_block_t::numeric>();
+                std::copy(values.begin(), values.end(), p);
+                break;
+            }
+            case column_block_t::boolean:
+            {
+                auto values = blk.values<column_block_t::boolean>();
+                std::transform(values.begin(), values.end(), p, [](bool b) { return b ? 1.0 : 0.0; });
+                break;
+            }
+            case column_block_t::formula:
+            {
+                auto values = blk.values<column_block_t::formula>();
+                std::transform(values.begin(), values.end(), p,
+                    [wait_policy](const formula_cell* fc) { return fc->get_value(wait_policy); });
+                break;
+            }
+            default:;
         }
     }
-    return ret;
+
+    return numeric_matrix(std::move(array), rows, view.col_size());
 }
 
 std::unique_ptr<iface::session_handler> model_context::create_session_handler()
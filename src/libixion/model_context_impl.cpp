@@ -20,6 +20,12 @@
 #include "utils.hpp"
 #include "debug.hpp"
 
+#include "formula_interpreter.hpp"
+
+#if IXION_THREADS
+#include "thread_pool.hpp"
+#endif
+
 #include <sstream>
 #include <iostream>
 #include <cstring>
@@ -34,7 +40,8 @@ string_id_t safe_string_pool::append_string_unsafe(std::string_view s)
     string_id_t str_id = m_strings.size();
     m_strings.push_back(std::string{s});
     s = m_strings.back();
-    m_string_map.insert({s, str_id});
+    if (!m_string_map.insert({s, str_id}).second)
+        m_unique = false;
     return str_id;
 }
 
@@ -103,9 +110,12 @@ string_id_t safe_string_pool::get_identifier_from_string(std::string_view s) con
     return it == m_string_map.end() ? empty_string_id : it->second;
 }
 
-namespace {
+bool safe_string_pool::unique() const
+{
+    return m_unique;
+}
 
-model_context::session_handler_factory dummy_session_handler_factory;
+namespace {
 
 rc_size_t to_group_size(const abs_range_t& group_range)
 {
@@ -184,6 +194,20 @@ void clip_range(abs_range_t& range, const rc_size_t& sheet_size)
         range.last.row = sheet_size.row - 1;
 }
 
+/** maximum total size in bytes of the cached lookup indexes. */
+constexpr std::size_t max_lookup_indexes_size = 64 * 1024 * 1024;
+
+/** maximum total size in bytes of the cached results of matching criteria. */
+constexpr std::size_t max_criteria_matches_size = 64 * 1024 * 1024;
+
+/** maximum total size in bytes of the cached sorted values of the ranges. */
+constexpr std::size_t max_sorted_values_size = 64 * 1024 * 1024;
+
+std::size_t get_byte_size(const sorted_values& sv)
+{
+    return sv.values.size() * sizeof(double);
+}
+
 void throw_sheet_name_conflict(const std::string& name)
 {
     // This sheet name is already taken.
@@ -199,6 +223,17 @@ void throw_invalid_sheet_index(sheet_t sheet)
     throw std::invalid_argument(os.str());
 }
 
+/**
+ * Revisions are unique across all model context instances, so that a
+ * revision never identifies the definitions of another instance.
+ */
+std::atomic<std::size_t> definitions_revision_counter{0};
+
+std::size_t next_definitions_revision()
+{
+    return ++definitions_revision_counter;
+}
+
 } // anonymous namespace
 
 model_context_impl::model_context_impl(model_context& parent, const rc_size_t& sheet_size) :
@@ -206,8 +241,12 @@ model_context_impl::model_context_impl(model_context& parent, const rc_size_t& s
     m_sheet_size(sheet_size),
     m_tracker(),
     mp_table_handler(nullptr),
-    mp_session_factory(&dummy_session_handler_factory),
-    m_formula_res_wait_policy(formula_result_wait_policy_t::throw_exception)
+    mp_session_factory(nullptr),
+    m_formula_res_wait_policy(formula_result_wait_policy_t::throw_exception),
+    m_definitions_revision(next_definitions_revision()),
+    m_lookup_indexes(max_lookup_indexes_size),
+    m_criteria_matches(max_criteria_matches_size),
+    m_sorted_values(max_sorted_values_size)
 {
 }
 
@@ -218,12 +257,100 @@ void model_context_impl::notify(formula_event_t event)
     switch (event)
     {
         case formula_event_t::calculation_begins:
+        {
             m_formula_res_wait_policy = formula_result_wait_policy_t::block_until_done;
+
+            // The results of the formula cells may change in this
+            // calculation.
+            m_lookup_indexes.erase_if([](const lookup_index& index) { return index.has_formula(); });
+            m_criteria_matches.erase_if([](const criteria_match& res) { return res.has_formula; });
+            m_sorted_values.erase_if([](const sorted_values& sv) { return sv.has_formula; });
             break;
+        }
         case formula_event_t::calculation_ends:
             m_formula_res_wait_policy = formula_result_wait_policy_t::throw_exception;
             break;
+        case formula_event_t::table_definitions_changed:
+            m_definitions_revision = next_definitions_revision();
+            break;
+    }
+}
+
+void model_context_impl::set_table_handler(iface::table_handler* handler)
+{
+    mp_table_handler = handler;
+    m_definitions_revision = next_definitions_revision();
+}
+
+#if IXION_THREADS
+
+thread_pool& model_context_impl::get_thread_pool(size_t thread_count)
+{
+    if (!mp_thread_pool || mp_thread_pool->size() != thread_count)
+    {
+        // Destroy the old pool first so that its worker threads don't
+        // co-exist with the new ones.
+        mp_thread_pool.reset();
+        mp_thread_pool = std::make_unique<thread_pool>(thread_count);
+        m_worker_interpreters.resize(thread_count);
+    }
+
+    return *mp_thread_pool;
+}
+
+#endif
+
+model_context_impl::interpreters_type* model_context_impl::get_worker_interpreters()
+{
+#if IXION_THREADS
+    if (mp_thread_pool)
+    {
+        if (auto index = mp_thread_pool->get_current_worker_index(); index)
+            return &m_worker_interpreters[*index];
     }
+#endif
+
+    return nullptr;
+}
+
+std::unique_ptr<formula_interpreter> model_context_impl::acquire_interpreter(const formula_cell* cell)
+{
+    std::unique_ptr<formula_interpreter> ret;
+
+    auto take_back = [&ret](interpreters_type& interpreters)
+    {
+        if (interpreters.empty())
+            return;
+
+        ret = std::move(interpreters.back());
+        interpreters.pop_back();
+    };
+
+    if (interpreters_type* interpreters = get_worker_interpreters(); interpreters)
+        take_back(*interpreters);
+    else
+    {
+        std::lock_guard<std::mutex> lock(m_interpreters_mtx);
+        take_back(m_interpreters);
+    }
+
+    if (!ret)
+        return std::make_unique<formula_interpreter>(cell, m_parent);
+
+    ret->set_cell(cell);
+    return ret;
+}
+
+void model_context_impl::release_interpreter(std::unique_ptr<formula_interpreter> interpreter)
+{
+    if (interpreters_type* interpreters = get_worker_interpreters(); interpreters)
+    {
+        interpreters->push_back(std::move(interpreter));
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_interpreters_mtx);
+    m_interpreters.push_back(std::move(interpreter));
 }
 
 void model_context_impl::set_named_expression(
@@ -232,6 +359,7 @@ void model_context_impl::set_named_expression(
     check_named_exp_name_or_throw(name.data(), name.size());
 
     IXION_TRACE("named expression: name='" << name << "'");
+    m_definitions_revision = next_definitions_revision();
     m_named_expressions.insert(
         detail::named_expressions_t::value_type(
             std::move(name),
@@ -247,6 +375,7 @@ void model_context_impl::set_named_expression(
 
     detail::named_expressions_t& ns = m_sheets.at(sheet).get_named_expressions();
     IXION_TRACE("named expression: name='" << name << "'");
+    m_definitions_revision = next_definitions_revision();
     ns.insert(
         detail::named_expressions_t::value_type(
             std::move(name),
@@ -409,6 +538,11 @@ size_t model_context_impl::get_string_count() const
     return m_str_pool.size();
 }
 
+bool model_context_impl::has_unique_strings() const
+{
+    return m_str_pool.unique();
+}
+
 void model_context_impl::dump_strings() const
 {
     m_str_pool.dump_strings();
@@ -477,20 +611,6 @@ double count_formula_block(
     return ret;
 }
 
-column_block_t map_column_block_type(const mdds::mtv::element_t mtv_type)
-{
-    static const std::map<mdds::mtv::element_t, column_block_t> rules = {
-        { element_type_empty, column_block_t::empty }, // -1
-        { element_type_boolean, column_block_t::boolean }, // 0
-        { element_type_string, column_block_t::string }, // 6
-        { element_type_numeric, column_block_t::numeric }, // 10
-        { element_type_formula, column_block_t::formula }, // user-start (50)
-    };
-
-    auto it = rules.find(mtv_type);
-    return it == rules.end() ? column_block_t::unknown : it->second;
-}
-
 } // anonymous namespace
 
 double model_context_impl::count_range(abs_range_t range, values_t values_type) const
@@ -576,6 +696,109 @@ double model_context_impl::count_range(abs_range_t range, values_t values_type)
     return ret;
 }
 
+std::optional<column_aggregates> model_context_impl::get_range_aggregates(abs_range_t range) const
+{
+    if (!m_config.aggregate_index)
+        return {};
+
+    if (!range.valid() || range.all_columns())
+        return {};
+
+    if (range.first.sheet != range.last.sheet || range.first.column != range.last.column)
+        return {};
+
+    clip_range(range, m_sheet_size);
+
+    const column_store_t* store = get_column(range.first.sheet, range.first.column);
+    if (!store)
+        return {};
+
+    column_aggregate_index* index = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(m_aggregate_indexes_mtx);
+        auto& p = m_aggregate_indexes[{range.first.sheet, range.first.column}];
+        if (!p)
+            p = std::make_unique<column_aggregate_index>();
+
+        index = p.get();
+    }
+
+    return index->query(*store, range.first.row, range.last.row);
+}
+
+std::shared_ptr<const lookup_index> model_context_impl::get_lookup_index(abs_range_t range) const
+{
+    if (!range.valid() || range.first.sheet != range.last.sheet)
+        return nullptr;
+
+    clip_range(range, m_sheet_size);
+
+    if (range.first.column == column_unset)
+        range.first.column = 0;
+    if (range.last.column == column_unset)
+        range.last.column = m_sheet_size.column - 1;
+
+    if (range.first.row != range.last.row && range.first.column != range.last.column)
+        return nullptr;
+
+    if (range.first.sheet < 0 || std::size_t(range.first.sheet) >= m_sheets.size())
+        return nullptr;
+
+    range_cache_key key{range, std::string()};
+
+    if (auto index = m_lookup_indexes.find(key); index)
+        return index;
+
+    // Build the index without holding the lock, so that the lookups into
+    // the other ranges can proceed meanwhile.  When more than one thread
+    // builds the index of the same range, the first one to finish wins.
+    auto index = std::make_shared<const lookup_index>(*this, range);
+    std::size_t index_size = index->byte_size();
+    return m_lookup_indexes.insert(std::move(key), std::move(index), index_size);
+}
+
+std::shared_ptr<const criteria_match> model_context_impl::get_criteria_match(
+    const abs_range_t& range, const criterion& crit) const
+{
+    range_cache_key key{range, crit.get_key()};
+
+    if (auto res = m_criteria_matches.find(key); res)
+        return res;
+
+    auto res = std::make_shared<const criteria_match>(match_criterion(*this, range, crit));
+    std::size_t res_size = res->mask.size();
+    return m_criteria_matches.insert(std::move(key), std::move(res), res_size);
+}
+
+std::shared_ptr<const sorted_values> model_context_impl::get_sorted_values(abs_range_t range) const
+{
+    // The cached values must be dropped by any change within the whole
+    // range, including the rows past its current data extent.
+    clip_range(range, m_sheet_size);
+
+    if (range.first.column == column_unset)
+        range.first.column = 0;
+    if (range.last.column == column_unset)
+        range.last.column = m_sheet_size.column - 1;
+
+    range_cache_key key{range, std::string()};
+
+    if (auto res = m_sorted_values.find(key); res)
+        return res;
+
+    auto res = std::make_shared<const sorted_values>(sort_range_values(*this, range));
+    std::size_t res_size = get_byte_size(*res);
+    return m_sorted_values.insert(std::move(key), std::move(res), res_size);
+}
+
+void model_context_impl::invalidate_formula_results(const abs_range_t& range)
+{
+    m_lookup_indexes.erase_overlapping(range);
+    m_criteria_matches.erase_overlapping(range);
+    m_sorted_values.erase_overlapping(range);
+}
+
 void model_context_impl::walk(sheet_t sheet, const abs_rc_range_t& range, column_block_callback_t cb) const
 {
     const sheet_store& sh = m_sheets.at(sheet);
@@ -646,6 +869,17 @@ model_iterator model_context_impl::get_model_iterator(
     return model_iterator(*this, sheet, range, dir);
 }
 
+void model_context_impl::set_config(const config& cfg)
+{
+    m_config = cfg;
+
+    if (!m_config.aggregate_index)
+    {
+        std::lock_guard<std::mutex> lock(m_aggregate_indexes_mtx);
+        m_aggregate_indexes.clear();
+    }
+}
+
 void model_context_impl::set_sheet_size(const rc_size_t& sheet_size)
 {
     if (!m_sheets.empty())
@@ -658,6 +892,10 @@ void model_context_impl::set_sheet_size(const rc_size_t& sheet_size)
 
 std::unique_ptr<iface::session_handler> model_context_impl::create_session_handler()
 {
+    // Skip the virtual call altogether when no factory is installed.
+    if (!mp_session_factory)
+        return nullptr;
+
     return mp_session_factory->create();
 }
 
@@ -667,6 +905,7 @@ void model_context_impl::empty_cell(const abs_address_t& addr)
     column_store_t& col_store = sheet.at(addr.column);
     column_store_t::iterator& pos_hint = sheet.get_pos_hint(addr.column);
     pos_hint = col_store.set_empty(addr.row, addr.row);
+    invalidate_indexes(addr);
 }
 
 void model_context_impl::set_numeric_cell(const abs_address_t& addr, double val)
@@ -675,6 +914,7 @@ void model_context_impl::set_numeric_cell(const abs_address_t& addr, double val)
     column_store_t& col_store = sheet.at(addr.column);
     column_store_t::iterator& pos_hint = sheet.get_pos_hint(addr.column);
     pos_hint = col_store.set(pos_hint, addr.row, val);
+    invalidate_indexes(addr);
 }
 
 void model_context_impl::set_boolean_cell(const abs_address_t& addr, bool val)
@@ -683,6 +923,7 @@ void model_context_impl::set_boolean_cell(const abs_address_t& addr, bool val)
     column_store_t& col_store = sheet.at(addr.column);
     column_store_t::iterator& pos_hint = sheet.get_pos_hint(addr.column);
     pos_hint = col_store.set(pos_hint, addr.row, val);
+    invalidate_indexes(addr);
 }
 
 void model_context_impl::set_string_cell(const abs_address_t& addr, std::string_view s)
@@ -692,6 +933,7 @@ void model_context_impl::set_string_cell(const abs_address_t& addr, std::string_
     column_store_t& col_store = sheet.at(addr.column);
     column_store_t::iterator& pos_hint = sheet.get_pos_hint(addr.column);
     pos_hint = col_store.set(pos_hint, addr.row, str_id);
+    invalidate_indexes(addr);
 }
 
 void model_context_impl::fill_down_cells(const abs_address_t& src, size_t n_dst)
@@ -703,6 +945,7 @@ void model_context_impl::fill_down_cells(const abs_address_t& src, size_t n_dst)
     sheet_store& sheet = m_sheets.at(src.sheet);
     column_store_t& col_store = sheet.at(src.column);
     column_store_t::iterator& pos_hint = sheet.get_pos_hint(src.column);
+    invalidate_indexes(abs_range_t(src.sheet, src.row + 1, src.column, n_dst, 1));
 
     column_store_t::const_position_type pos = col_store.position(pos_hint, src.row);
     auto it = pos.first; // block iterator
@@ -755,6 +998,7 @@ void model_context_impl::set_string_cell(const abs_address_t& addr, string_id_t
     column_store_t& col_store = sheet.at(addr.column);
     column_store_t::iterator& pos_hint = sheet.get_pos_hint(addr.column);
     pos_hint = col_store.set(pos_hint, addr.row, identifier);
+    invalidate_indexes(addr);
 }
 
 formula_cell* model_context_impl::set_formula_cell(
@@ -767,6 +1011,7 @@ formula_cell* model_context_impl::set_formula_cell(
     column_store_t::iterator& pos_hint = sheet.get_pos_hint(addr.column);
     formula_cell* p = fcell.release();
     pos_hint = col_store.set(pos_hint, addr.row, p);
+    invalidate_indexes(addr);
     return p;
 }
 
@@ -781,6 +1026,7 @@ formula_cell* model_context_impl::set_formula_cell(
     formula_cell* p = fcell.release();
     p->set_result_cache(std::move(result));
     pos_hint = col_store.set(pos_hint, addr.row, p);
+    invalidate_indexes(addr);
     return p;
 }
 
@@ -793,6 +1039,7 @@ void model_context_impl::set_grouped_formula_cells(
     rc_size_t group_size = to_group_size(group_range);
     calc_status_ptr_t cs(new calc_status(group_size));
     set_grouped_formula_cells_to_workbook(m_sheets, group_range.first, group_size, cs, ts);
+    invalidate_indexes(group_range);
 }
 
 void model_context_impl::set_grouped_formula_cells(
@@ -810,8 +1057,9 @@ void model_context_impl::set_grouped_formula_cells(
         throw std::invalid_argument("dimension of the cached result differs from the size of the group.");
 
     calc_status_ptr_t cs(new calc_status(group_size));
-    cs->result = std::make_unique<formula_result>(std::move(result));
+    cs->set_result(std::make_unique<formula_result>(std::move(result)));
     set_grouped_formula_cells_to_workbook(m_sheets, group_range.first, group_size, cs, ts);
+    invalidate_indexes(group_range);
 }
 
 abs_range_t model_context_impl::get_data_range(sheet_t sheet) const
@@ -912,6 +1160,71 @@ abs_range_t model_context_impl::get_data_range(sheet_t sheet) const
     return range;
 }
 
+abs_range_t model_context_impl::clip_to_data_extent(abs_range_t range) const
+{
+    const bool all_rows = range.all_rows();
+    const bool all_columns = range.all_columns();
+
+    clip_range(range, m_sheet_size);
+    if (all_columns)
+    {
+        range.first.column = 0;
+        range.last.column = m_sheet_size.column - 1;
+    }
+
+    if (!all_rows && !all_columns)
+        return range;
+
+    row_t last_row = range.first.row;
+    col_t last_column = range.first.column;
+
+    sheet_t last_sheet = std::min<sheet_t>(range.last.sheet, m_sheets.size() - 1);
+    for (sheet_t sheet = range.first.sheet; sheet <= last_sheet; ++sheet)
+    {
+        const sheet_store& sh = m_sheets[sheet];
+        col_t col_end = std::min<col_t>(range.last.column + 1, sh.size());
+
+        for (col_t col = range.first.column; col < col_end; ++col)
+        {
+            std::size_t n = get_column_data_size(sh[col]);
+            if (n <= std::size_t(range.first.row))
+                continue;
+
+            last_row = std::max<row_t>(last_row, std::min<row_t>(n - 1, range.last.row));
+            last_column = std::max(last_column, col);
+        }
+    }
+
+    if (all_rows)
+        range.last.row = last_row;
+    if (all_columns)
+        range.last.column = last_column;
+
+    return range;
+}
+
+abs_range_t model_context_impl::clip_to_sheet_data_extent(abs_range_t range) const
+{
+    const bool all_rows = range.all_rows();
+    const bool all_columns = range.all_columns();
+
+    if (!all_rows && !all_columns)
+        return range;
+
+    abs_range_t extent = range;
+    extent.set_all_rows();
+    extent.set_all_columns();
+    extent = clip_to_data_extent(extent);
+
+    range = clip_to_data_extent(range);
+    if (all_rows)
+        range.last.row = extent.last.row;
+    if (all_columns)
+        range.last.column = extent.last.column;
+
+    return range;
+}
+
 bool model_context_impl::is_empty(const abs_address_t& addr) const
 {
     return m_sheets.at(addr.sheet).at(addr.column).is_empty(addr.row);
@@ -1086,6 +1399,22 @@ formula_result model_context_impl::get_formula_result(const abs_address_t& addr)
     return fc->get_result_cache(m_formula_res_wait_policy);
 }
 
+void model_context_impl::invalidate_indexes(const abs_range_t& range)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_aggregate_indexes_mtx);
+
+        auto it = m_aggregate_indexes.lower_bound({range.first.sheet, range.first.column});
+        auto it_end = m_aggregate_indexes.upper_bound({range.first.sheet, range.last.column});
+        for (; it != it_end; ++it)
+            it->second->invalidate(range.first.row);
+    }
+
+    m_lookup_indexes.erase_overlapping(range);
+    m_criteria_matches.erase_overlapping(range);
+    m_sorted_values.erase_overlapping(range);
+}
+
 abs_range_t model_context_impl::shrink_to_workbook(abs_range_t range) const
 {
     range.reorder();
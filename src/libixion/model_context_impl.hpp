@@ -15,14 +15,29 @@
 
 #include "sheet_store.hpp"
 #include "column_store_type.hpp"
+#include "column_aggregate_index.hpp"
+#include "lookup_index.hpp"
+#include "range_cache.hpp"
+#include "sorted_values.hpp"
+#include "criteria.hpp"
 
+#include <atomic>
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <deque>
+#include <optional>
 
-namespace ixion { namespace detail {
+namespace ixion {
+
+class formula_interpreter;
+
+namespace detail {
+
+class thread_pool;
 
 using sheet_stores_type = std::deque<sheet_store>;
 
@@ -35,6 +50,7 @@ class safe_string_pool
     string_pool_type m_strings;
     string_map_type m_string_map;
     std::string m_empty_string;
+    std::atomic<bool> m_unique{true};
 
     string_id_t append_string_unsafe(std::string_view s);
 
@@ -46,6 +62,13 @@ public:
     size_t size() const;
     void dump_strings() const;
     string_id_t get_identifier_from_string(std::string_view s) const;
+
+    /**
+     * @return true if no two strings in the pool have the same value, in
+     *         which case the identifiers of the strings can be compared in
+     *         place of their values.
+     */
+    bool unique() const;
 };
 
 class model_context_impl
@@ -72,10 +95,7 @@ public:
         return m_config;
     }
 
-    void set_config(const config& cfg)
-    {
-        m_config = cfg;
-    }
+    void set_config(const config& cfg);
 
     void set_sheet_size(const rc_size_t& sheet_size);
 
@@ -91,6 +111,11 @@ public:
 
     std::unique_ptr<iface::session_handler> create_session_handler();
 
+    bool has_session_handler_factory() const
+    {
+        return mp_session_factory != nullptr;
+    }
+
     void set_session_handler_factory(model_context::session_handler_factory* factory)
     {
         mp_session_factory = factory;
@@ -106,11 +131,48 @@ public:
         return mp_table_handler;
     }
 
-    void set_table_handler(iface::table_handler* handler)
+    void set_table_handler(iface::table_handler* handler);
+
+    /**
+     * Get the current revision of the definitions of the named expressions
+     * and tables.  The revision changes whenever any of them changes.
+     */
+    std::size_t get_definitions_revision() const
     {
-        mp_table_handler = handler;
+        return m_definitions_revision;
     }
 
+#if IXION_THREADS
+    /**
+     * Get the pool of worker threads used for threaded calculation.  The
+     * pool is created on first request, and is re-created only when the
+     * requested thread count differs from that of the current pool.
+     *
+     * @param thread_count number of worker threads requested.
+     *
+     * @return reference to the thread pool instance.
+     */
+    thread_pool& get_thread_pool(size_t thread_count);
+#endif
+
+    /**
+     * Take a formula interpreter instance out of the instances kept for
+     * reuse between the cells, or create a new one if none is available.
+     * Each instance is bound to this context, and gets destroyed with it.
+     *
+     * @param cell formula cell to interpret with the instance.
+     *
+     * @return interpreter instance, which should be given back via
+     *         release_interpreter() once the cell is interpreted.
+     */
+    std::unique_ptr<formula_interpreter> acquire_interpreter(const formula_cell* cell);
+
+    /**
+     * Give back an interpreter instance taken via acquire_interpreter(), for
+     * it to be reused for another cell.
+     */
+    void release_interpreter(std::unique_ptr<formula_interpreter> interpreter);
+
     void empty_cell(const abs_address_t& addr);
     void set_numeric_cell(const abs_address_t& addr, double val);
     void set_boolean_cell(const abs_address_t& addr, bool val);
@@ -124,6 +186,40 @@ public:
 
     abs_range_t get_data_range(sheet_t sheet) const;
 
+    /**
+     * Clip a range that spans all rows or all columns to the data extent of
+     * its columns.  All rows get clipped to the last non-empty row of the
+     * columns of the range, and all columns to the last non-empty column.
+     * The cells past the clipped range are all empty.  The range keeps at
+     * least one row and one column even when all of its cells are empty.
+     *
+     * <p>The clipped range depends on the current content of the sheets.
+     * The dependencies on the range must still be tracked on the whole
+     * rows or columns, for the growth of the data extent to mark the
+     * dependent formula cells dirty.</p>
+     *
+     * @param range range to clip.
+     *
+     * @return clipped range, or the range as-is if it spans neither all rows
+     *         nor all columns.
+     */
+    abs_range_t clip_to_data_extent(abs_range_t range) const;
+
+    /**
+     * Clip a range that spans all rows or all columns to the data extent of
+     * its whole sheet, rather than of its own columns.  All ranges of the
+     * same sheet that span all rows get clipped to the same rows, and those
+     * that span all columns to the same columns, so that they keep the
+     * same shape as one another when their values get combined element by
+     * element.
+     *
+     * @param range range to clip.
+     *
+     * @return clipped range, or the range as-is if it spans neither all rows
+     *         nor all columns.
+     */
+    abs_range_t clip_to_sheet_data_extent(abs_range_t range) const;
+
     bool is_empty(const abs_address_t& addr) const;
     bool is_empty(abs_range_t range) const;
     cell_t get_celltype(const abs_address_t& addr) const;
@@ -157,6 +253,7 @@ public:
     string_id_t add_string(std::string_view s);
     const std::string* get_string(string_id_t identifier) const;
     size_t get_string_count() const;
+    bool has_unique_strings() const;
     void dump_strings() const;
 
     const column_store_t* get_column(sheet_t sheet, col_t col) const;
@@ -164,6 +261,71 @@ public:
 
     double count_range(abs_range_t range, values_t values_type) const;
 
+    /**
+     * Get the aggregates of the numeric values in a range from the
+     * aggregate index of its column, building the index on first use.
+     *
+     * @param range range to get the aggregates of.
+     *
+     * @return aggregates of the values in the range, or nothing if the
+     *         aggregate index is not enabled, the range is not within a
+     *         single column of a single sheet, or it contains a formula
+     *         cell.
+     */
+    std::optional<column_aggregates> get_range_aggregates(abs_range_t range) const;
+
+    /**
+     * Get the lookup index of a range, building it on first use.  The index
+     * is shared by all lookups into the same range, and stays until any of
+     * the cells in the range changes.  The index of a range that contains a
+     * formula cell also gets dropped at the start of each calculation.
+     *
+     * @param range range to look values up in.
+     *
+     * @return lookup index of the range, or nullptr if the range is not
+     *         within a single column or a single row of a single sheet.
+     */
+    std::shared_ptr<const lookup_index> get_lookup_index(abs_range_t range) const;
+
+    /**
+     * Get the result of matching a criterion against the cells of a range.
+     * The results are cached by the range and the criterion, and shared by
+     * all formulas that use the same criterion on the same range, until
+     * any of the cells in the range changes.  The result for a range that
+     * contains a formula cell also gets dropped at the start of each
+     * calculation.
+     *
+     * @param range range within a single sheet and within the sheet size.
+     * @param crit criterion to match.
+     *
+     * @return result of matching the criterion.
+     */
+    std::shared_ptr<const criteria_match> get_criteria_match(const abs_range_t& range, const criterion& crit) const;
+
+    /**
+     * Get the numeric values of the cells of a range in ascending order.
+     * The sorted values are cached by the range, and shared by all formulas
+     * that take the order statistics of the same range, until any of the
+     * cells in the range changes.  The values of a range that contains a
+     * formula cell also get dropped at the start of each calculation.
+     *
+     * @param range range within a single sheet.
+     *
+     * @return sorted values of the range.
+     */
+    std::shared_ptr<const sorted_values> get_sorted_values(abs_range_t range) const;
+
+    /**
+     * Drop the cached results derived from the values of the cells in a
+     * range, for the results of the formula cells in the range that have
+     * changed in the middle of a calculation.  This gets called between the
+     * sweeps of an iterative calculation of circular references.  It is safe
+     * to call this method while other formula cells are being calculated.
+     *
+     * @param range range of the formula cells whose results have changed.
+     */
+    void invalidate_formula_results(const abs_range_t& range);
+
     void walk(sheet_t sheet, const abs_rc_range_t& range, column_block_callback_t cb) const;
 
     bool empty() const;
@@ -179,8 +341,25 @@ public:
         sheet_t sheet, rc_direction_t dir, const abs_rc_range_t& range) const;
 
 private:
+    using interpreters_type = std::vector<std::unique_ptr<formula_interpreter>>;
+
     abs_range_t shrink_to_workbook(abs_range_t range) const;
 
+    /**
+     * @return idle interpreter instances of the calling thread if it is a
+     *         worker of the thread pool, or nullptr otherwise.
+     */
+    interpreters_type* get_worker_interpreters();
+
+    /**
+     * Update the indexes of the cells for a change to a range of cells.  The
+     * rows of the aggregate indexes of the columns get marked as outdated
+     * from the first row of the range onward, and the lookup indexes, the
+     * cached results of matching the criteria and the sorted values of the
+     * ranges that overlap with it get dropped.
+     */
+    void invalidate_indexes(const abs_range_t& range);
+
 private:
     model_context& m_parent;
 
@@ -198,7 +377,47 @@ private:
 
     safe_string_pool m_str_pool;
 
-    formula_result_wait_policy_t m_formula_res_wait_policy;
+    /**
+     * Atomic since the results may be read from other threads while a
+     * calculation is starting or ending.
+     */
+    std::atomic<formula_result_wait_policy_t> m_formula_res_wait_policy;
+
+    std::size_t m_definitions_revision;
+
+    using aggregate_index_key_type = std::pair<sheet_t, col_t>;
+    using aggregate_indexes_type = std::map<aggregate_index_key_type, std::unique_ptr<column_aggregate_index>>;
+
+    /** aggregate indexes of the columns, created on first query. */
+    mutable aggregate_indexes_type m_aggregate_indexes;
+    mutable std::mutex m_aggregate_indexes_mtx;
+
+    /** lookup indexes of the ranges, created on first lookup. */
+    mutable range_cache<lookup_index> m_lookup_indexes;
+
+    /** cached results of matching the criteria, tagged by the criteria. */
+    mutable range_cache<criteria_match> m_criteria_matches;
+
+    /** cached sorted values of the ranges. */
+    mutable range_cache<sorted_values> m_sorted_values;
+
+    /**
+     * interpreter instances not in use, kept for reuse between the cells by
+     * the threads other than the workers of the thread pool.
+     */
+    interpreters_type m_interpreters;
+    std::mutex m_interpreters_mtx;
+
+#if IXION_THREADS
+    std::unique_ptr<thread_pool> mp_thread_pool;
+
+    /**
+     * interpreter instances not in use, kept by each worker of the thread
+     * pool at its index.  Only the worker itself accesses its instances, so
+     * they need no lock.
+     */
+    std::vector<interpreters_type> m_worker_interpreters;
+#endif
 };
 
 }}
@@ -0,0 +1,898 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "numeric_kernels.hpp"
+
+#include <cassert>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define IXION_KERNEL_X86 1
+#include <immintrin.h>
+#endif
+
+namespace ixion { namespace kernel {
+
+namespace {
+
+/**
+ * Number of partial sums to accumulate the values in.  The value at
+ * position i of an array gets added to the partial sum at i modulo this
+ * number, except for the values past the last full set of partial sums,
+ * which get added to the combined sum one at a time.
+ */
+constexpr std::size_t lane_count = 16;
+
+double combine_lanes(const double* lanes)
+{
+    double v[lane_count / 2];
+    for (std::size_t i = 0; i < lane_count / 2; ++i)
+        v[i] = lanes[i] + lanes[i + lane_count / 2];
+
+    return ((v[0] + v[1]) + (v[2] + v[3])) + ((v[4] + v[5]) + (v[6] + v[7]));
+}
+
+std::size_t count_if_generic(const double* p, std::size_t n, op_t op, double v)
+{
+    std::size_t ret = 0;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        if (evaluate(op, p[i], v) != 0.0)
+            ++ret;
+    }
+
+    return ret;
+}
+
+bool is_relational(op_t op)
+{
+    switch (op)
+    {
+        case op_t::equal:
+        case op_t::not_equal:
+        case op_t::less:
+        case op_t::less_equal:
+        case op_t::greater:
+        case op_t::greater_equal:
+            return true;
+        default:;
+    }
+
+    return false;
+}
+
+double sum_scalar(const double* p, std::size_t n)
+{
+    double lanes[lane_count] = {};
+    std::size_t i = 0;
+    for (; i + lane_count <= n; i += lane_count)
+    {
+        for (std::size_t j = 0; j < lane_count; ++j)
+            lanes[j] += p[i + j];
+    }
+
+    double ret = combine_lanes(lanes);
+    for (; i < n; ++i)
+        ret += p[i];
+
+    return ret;
+}
+
+double dot_scalar(const double* p1, const double* p2, std::size_t n)
+{
+    double lanes[lane_count] = {};
+    std::size_t i = 0;
+    for (; i + lane_count <= n; i += lane_count)
+    {
+        for (std::size_t j = 0; j < lane_count; ++j)
+            lanes[j] += p1[i + j] * p2[i + j];
+    }
+
+    double ret = combine_lanes(lanes);
+    for (; i < n; ++i)
+        ret += p1[i] * p2[i];
+
+    return ret;
+}
+
+double dot_deviations_scalar(const double* p1, double mean1, const double* p2, double mean2, std::size_t n)
+{
+    double lanes[lane_count] = {};
+    std::size_t i = 0;
+    for (; i + lane_count <= n; i += lane_count)
+    {
+        for (std::size_t j = 0; j < lane_count; ++j)
+            lanes[j] += (p1[i + j] - mean1) * (p2[i + j] - mean2);
+    }
+
+    double ret = combine_lanes(lanes);
+    for (; i < n; ++i)
+        ret += (p1[i] - mean1) * (p2[i] - mean2);
+
+    return ret;
+}
+
+double min_scalar(const double* p, std::size_t n)
+{
+    assert(n);
+    double ret = p[0];
+    for (std::size_t i = 1; i < n; ++i)
+    {
+        if (p[i] < ret)
+            ret = p[i];
+    }
+
+    return ret;
+}
+
+double max_scalar(const double* p, std::size_t n)
+{
+    assert(n);
+    double ret = p[0];
+    for (std::size_t i = 1; i < n; ++i)
+    {
+        if (ret < p[i])
+            ret = p[i];
+    }
+
+    return ret;
+}
+
+/**
+ * Apply an operator to each pair of values.  An operand flagged as scalar
+ * points to a single value to pair with every value of the other operand.
+ */
+void transform_scalar(
+    op_t op, const double* p1, bool scalar1, const double* p2, bool scalar2, double* out, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i)
+        out[i] = evaluate(op, scalar1 ? *p1 : p1[i], scalar2 ? *p2 : p2[i]);
+}
+
+#ifdef IXION_KERNEL_X86
+
+// SSE2 implementations.
+
+__attribute__((target("sse2")))
+double sum_sse2(const double* p, std::size_t n)
+{
+    constexpr std::size_t m = lane_count / 2;
+    __m128d acc[m];
+    for (std::size_t j = 0; j < m; ++j)
+        acc[j] = _mm_setzero_pd();
+
+    std::size_t i = 0;
+    for (; i + lane_count <= n; i += lane_count)
+    {
+        for (std::size_t j = 0; j < m; ++j)
+            acc[j] = _mm_add_pd(acc[j], _mm_loadu_pd(p + i + j * 2));
+    }
+
+    double lanes[lane_count];
+    for (std::size_t j = 0; j < m; ++j)
+        _mm_storeu_pd(lanes + j * 2, acc[j]);
+
+    double ret = combine_lanes(lanes);
+    for (; i < n; ++i)
+        ret += p[i];
+
+    return ret;
+}
+
+__attribute__((target("sse2")))
+double dot_sse2(const double* p1, const double* p2, std::size_t n)
+{
+    constexpr std::size_t m = lane_count / 2;
+    __m128d acc[m];
+    for (std::size_t j = 0; j < m; ++j)
+        acc[j] = _mm_setzero_pd();
+
+    std::size_t i = 0;
+    for (; i + lane_count <= n; i += lane_count)
+    {
+        for (std::size_t j = 0; j < m; ++j)
+        {
+            __m128d v = _mm_mul_pd(_mm_loadu_pd(p1 + i + j * 2), _mm_loadu_pd(p2 + i + j * 2));
+            acc[j] = _mm_add_pd(acc[j], v);
+        }
+    }
+
+    double lanes[lane_count];
+    for (std::size_t j = 0; j < m; ++j)
+        _mm_storeu_pd(lanes + j * 2, acc[j]);
+
+    double ret = combine_lanes(lanes);
+    for (; i < n; ++i)
+        ret += p1[i] * p2[i];
+
+    return ret;
+}
+
+__attribute__((target("sse2")))
+double dot_deviations_sse2(const double* p1, double mean1, const double* p2, double mean2, std::size_t n)
+{
+    constexpr std::size_t m = lane_count / 2;
+    __m128d acc[m];
+    for (std::size_t j = 0; j < m; ++j)
+        acc[j] = _mm_setzero_pd();
+
+    const __m128d m1 = _mm_set1_pd(mean1);
+    const __m128d m2 = _mm_set1_pd(mean2);
+
+    std::size_t i = 0;
+    for (; i + lane_count <= n; i += lane_count)
+    {
+        for (std::size_t j = 0; j < m; ++j)
+        {
+            __m128d d1 = _mm_sub_pd(_mm_loadu_pd(p1 + i + j * 2), m1);
+            __m128d d2 = _mm_sub_pd(_mm_loadu_pd(p2 + i + j * 2), m2);
+            acc[j] = _mm_add_pd(acc[j], _mm_mul_pd(d1, d2));
+        }
+    }
+
+    double lanes[lane_count];
+    for (std::size_t j = 0; j < m; ++j)
+        _mm_storeu_pd(lanes + j * 2, acc[j]);
+
+    double ret = combine_lanes(lanes);
+    for (; i < n; ++i)
+        ret += (p1[i] - mean1) * (p2[i] - mean2);
+
+    return ret;
+}
+
+__attribute__((target("sse2")))
+double min_sse2(const double* p, std::size_t n)
+{
+    if (n < 2)
+        return min_scalar(p, n);
+
+    __m128d acc = _mm_loadu_pd(p);
+    std::size_t i = 2;
+    for (; i + 2 <= n; i += 2)
+        acc = _mm_min_pd(acc, _mm_loadu_pd(p + i));
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    double ret = lanes[1] < lanes[0] ? lanes[1] : lanes[0];
+    for (; i < n; ++i)
+    {
+        if (p[i] < ret)
+            ret = p[i];
+    }
+
+    return ret;
+}
+
+__attribute__((target("sse2")))
+double max_sse2(const double* p, std::size_t n)
+{
+    if (n < 2)
+        return max_scalar(p, n);
+
+    __m128d acc = _mm_loadu_pd(p);
+    std::size_t i = 2;
+    for (; i + 2 <= n; i += 2)
+        acc = _mm_max_pd(acc, _mm_loadu_pd(p + i));
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    double ret = lanes[0] < lanes[1] ? lanes[1] : lanes[0];
+    for (; i < n; ++i)
+    {
+        if (ret < p[i])
+            ret = p[i];
+    }
+
+    return ret;
+}
+
+/**
+ * @return each lane set to all ones if the relation holds, or else all
+ *         zeros.
+ */
+__attribute__((target("sse2")))
+inline __m128d compare_sse2(op_t op, __m128d a, __m128d b)
+{
+    switch (op)
+    {
+        case op_t::equal:
+            return _mm_cmpeq_pd(a, b);
+        case op_t::not_equal:
+            return _mm_cmpneq_pd(a, b);
+        case op_t::less:
+            return _mm_cmplt_pd(a, b);
+        case op_t::less_equal:
+            return _mm_cmple_pd(a, b);
+        case op_t::greater:
+            return _mm_cmpgt_pd(a, b);
+        case op_t::greater_equal:
+            return _mm_cmpge_pd(a, b);
+        default:;
+    }
+
+    assert(!"not a relational operator");
+    return _mm_setzero_pd();
+}
+
+__attribute__((target("sse2")))
+inline __m128d apply_sse2(op_t op, __m128d a, __m128d b)
+{
+    switch (op)
+    {
+        case op_t::add:
+            return _mm_add_pd(a, b);
+        case op_t::subtract:
+            return _mm_sub_pd(a, b);
+        case op_t::multiply:
+            return _mm_mul_pd(a, b);
+        case op_t::divide:
+            return _mm_div_pd(a, b);
+        default:;
+    }
+
+    return _mm_and_pd(compare_sse2(op, a, b), _mm_set1_pd(1.0));
+}
+
+__attribute__((target("sse2")))
+std::size_t count_if_sse2(const double* p, std::size_t n, op_t op, double v)
+{
+    if (!is_relational(op))
+        return count_if_generic(p, n, op, v);
+
+    const __m128d b = _mm_set1_pd(v);
+    std::size_t ret = 0;
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        ret += __builtin_popcount(_mm_movemask_pd(compare_sse2(op, _mm_loadu_pd(p + i), b)));
+
+    return ret + count_if_generic(p + i, n - i, op, v);
+}
+
+__attribute__((target("sse2")))
+void transform_sse2(
+    op_t op, const double* p1, bool scalar1, const double* p2, bool scalar2, double* out, std::size_t n)
+{
+    const __m128d b1 = scalar1 ? _mm_set1_pd(*p1) : _mm_setzero_pd();
+    const __m128d b2 = scalar2 ? _mm_set1_pd(*p2) : _mm_setzero_pd();
+
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128d a = scalar1 ? b1 : _mm_loadu_pd(p1 + i);
+        __m128d b = scalar2 ? b2 : _mm_loadu_pd(p2 + i);
+        _mm_storeu_pd(out + i, apply_sse2(op, a, b));
+    }
+
+    for (; i < n; ++i)
+        out[i] = evaluate(op, scalar1 ? *p1 : p1[i], scalar2 ? *p2 : p2[i]);
+}
+
+// AVX2 implementations.
+
+__attribute__((target("avx2")))
+double sum_avx2(const double* p, std::size_t n)
+{
+    constexpr std::size_t m = lane_count / 4;
+    __m256d acc[m];
+    for (std::size_t j = 0; j < m; ++j)
+        acc[j] = _mm256_setzero_pd();
+
+    std::size_t i = 0;
+    for (; i + lane_count <= n; i += lane_count)
+    {
+        for (std::size_t j = 0; j < m; ++j)
+            acc[j] = _mm256_add_pd(acc[j], _mm256_loadu_pd(p + i + j * 4));
+    }
+
+    double lanes[lane_count];
+    for (std::size_t j = 0; j < m; ++j)
+        _mm256_storeu_pd(lanes + j * 4, acc[j]);
+
+    double ret = combine_lanes(lanes);
+    for (; i < n; ++i)
+        ret += p[i];
+
+    return ret;
+}
+
+__attribute__((target("avx2")))
+double dot_avx2(const double* p1, const double* p2, std::size_t n)
+{
+    constexpr std::size_t m = lane_count / 4;
+    __m256d acc[m];
+    for (std::size_t j = 0; j < m; ++j)
+        acc[j] = _mm256_setzero_pd();
+
+    std::size_t i = 0;
+    for (; i + lane_count <= n; i += lane_count)
+    {
+        for (std::size_t j = 0; j < m; ++j)
+        {
+            __m256d v = _mm256_mul_pd(_mm256_loadu_pd(p1 + i + j * 4), _mm256_loadu_pd(p2 + i + j * 4));
+            acc[j] = _mm256_add_pd(acc[j], v);
+        }
+    }
+
+    double lanes[lane_count];
+    for (std::size_t j = 0; j < m; ++j)
+        _mm256_storeu_pd(lanes + j * 4, acc[j]);
+
+    double ret = combine_lanes(lanes);
+    for (; i < n; ++i)
+        ret += p1[i] * p2[i];
+
+    return ret;
+}
+
+__attribute__((target("avx2")))
+double dot_deviations_avx2(const double* p1, double mean1, const double* p2, double mean2, std::size_t n)
+{
+    constexpr std::size_t m = lane_count / 4;
+    __m256d acc[m];
+    for (std::size_t j = 0; j < m; ++j)
+        acc[j] = _mm256_setzero_pd();
+
+    const __m256d m1 = _mm256_set1_pd(mean1);
+    const __m256d m2 = _mm256_set1_pd(mean2);
+
+    std::size_t i = 0;
+    for (; i + lane_count <= n; i += lane_count)
+    {
+        for (std::size_t j = 0; j < m; ++j)
+        {
+            __m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(p1 + i + j * 4), m1);
+            __m256d d2 = _mm256_sub_pd(_mm256_loadu_pd(p2 + i + j * 4), m2);
+            acc[j] = _mm256_add_pd(acc[j], _mm256_mul_pd(d1, d2));
+        }
+    }
+
+    double lanes[lane_count];
+    for (std::size_t j = 0; j < m; ++j)
+        _mm256_storeu_pd(lanes + j * 4, acc[j]);
+
+    double ret = combine_lanes(lanes);
+    for (; i < n; ++i)
+        ret += (p1[i] - mean1) * (p2[i] - mean2);
+
+    return ret;
+}
+
+__attribute__((target("avx2")))
+double min_avx2(const double* p, std::size_t n)
+{
+    if (n < 4)
+        return min_scalar(p, n);
+
+    __m256d acc = _mm256_loadu_pd(p);
+    std::size_t i = 4;
+    for (; i + 4 <= n; i += 4)
+        acc = _mm256_min_pd(acc, _mm256_loadu_pd(p + i));
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    double ret = min_scalar(lanes, 4);
+    for (; i < n; ++i)
+    {
+        if (p[i] < ret)
+            ret = p[i];
+    }
+
+    return ret;
+}
+
+__attribute__((target("avx2")))
+double max_avx2(const double* p, std::size_t n)
+{
+    if (n < 4)
+        return max_scalar(p, n);
+
+    __m256d acc = _mm256_loadu_pd(p);
+    std::size_t i = 4;
+    for (; i + 4 <= n; i += 4)
+        acc = _mm256_max_pd(acc, _mm256_loadu_pd(p + i));
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    double ret = max_scalar(lanes, 4);
+    for (; i < n; ++i)
+    {
+        if (ret < p[i])
+            ret = p[i];
+    }
+
+    return ret;
+}
+
+__attribute__((target("avx2")))
+inline __m256d compare_avx2(op_t op, __m256d a, __m256d b)
+{
+    switch (op)
+    {
+        case op_t::equal:
+            return _mm256_cmp_pd(a, b, _CMP_EQ_OQ);
+        case op_t::not_equal:
+            return _mm256_cmp_pd(a, b, _CMP_NEQ_UQ);
+        case op_t::less:
+            return _mm256_cmp_pd(a, b, _CMP_LT_OQ);
+        case op_t::less_equal:
+            return _mm256_cmp_pd(a, b, _CMP_LE_OQ);
+        case op_t::greater:
+            return _mm256_cmp_pd(a, b, _CMP_GT_OQ);
+        case op_t::greater_equal:
+            return _mm256_cmp_pd(a, b, _CMP_GE_OQ);
+        default:;
+    }
+
+    assert(!"not a relational operator");
+    return _mm256_setzero_pd();
+}
+
+__attribute__((target("avx2")))
+inline __m256d apply_avx2(op_t op, __m256d a, __m256d b)
+{
+    switch (op)
+    {
+        case op_t::add:
+            return _mm256_add_pd(a, b);
+        case op_t::subtract:
+            return _mm256_sub_pd(a, b);
+        case op_t::multiply:
+            return _mm256_mul_pd(a, b);
+        case op_t::divide:
+            return _mm256_div_pd(a, b);
+        default:;
+    }
+
+    return _mm256_and_pd(compare_avx2(op, a, b), _mm256_set1_pd(1.0));
+}
+
+__attribute__((target("avx2")))
+std::size_t count_if_avx2(const double* p, std::size_t n, op_t op, double v)
+{
+    if (!is_relational(op))
+        return count_if_generic(p, n, op, v);
+
+    const __m256d b = _mm256_set1_pd(v);
+    std::size_t ret = 0;
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        ret += __builtin_popcount(_mm256_movemask_pd(compare_avx2(op, _mm256_loadu_pd(p + i), b)));
+
+    return ret + count_if_generic(p + i, n - i, op, v);
+}
+
+__attribute__((target("avx2")))
+void transform_avx2(
+    op_t op, const double* p1, bool scalar1, const double* p2, bool scalar2, double* out, std::size_t n)
+{
+    const __m256d b1 = scalar1 ? _mm256_set1_pd(*p1) : _mm256_setzero_pd();
+    const __m256d b2 = scalar2 ? _mm256_set1_pd(*p2) : _mm256_setzero_pd();
+
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d a = scalar1 ? b1 : _mm256_loadu_pd(p1 + i);
+        __m256d b = scalar2 ? b2 : _mm256_loadu_pd(p2 + i);
+        _mm256_storeu_pd(out + i, apply_avx2(op, a, b));
+    }
+
+    for (; i < n; ++i)
+        out[i] = evaluate(op, scalar1 ? *p1 : p1[i], scalar2 ? *p2 : p2[i]);
+}
+
+// AVX-512 implementations.  The dot products are left to the AVX2
+// implementations, since AVX-512 implies FMA, which the compiler would
+// fuse the multiplications and additions into, and that would change the
+// results.
+
+__attribute__((target("avx512f")))
+double sum_avx512(const double* p, std::size_t n)
+{
+    constexpr std::size_t m = lane_count / 8;
+    __m512d acc[m];
+    for (std::size_t j = 0; j < m; ++j)
+        acc[j] = _mm512_setzero_pd();
+
+    std::size_t i = 0;
+    for (; i + lane_count <= n; i += lane_count)
+    {
+        for (std::size_t j = 0; j < m; ++j)
+            acc[j] = _mm512_add_pd(acc[j], _mm512_loadu_pd(p + i + j * 8));
+    }
+
+    double lanes[lane_count];
+    for (std::size_t j = 0; j < m; ++j)
+        _mm512_storeu_pd(lanes + j * 8, acc[j]);
+
+    double ret = combine_lanes(lanes);
+    for (; i < n; ++i)
+        ret += p[i];
+
+    return ret;
+}
+
+__attribute__((target("avx512f")))
+double min_avx512(const double* p, std::size_t n)
+{
+    if (n < 8)
+        return min_scalar(p, n);
+
+    __m512d acc = _mm512_loadu_pd(p);
+    std::size_t i = 8;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m512d v = _mm512_loadu_pd(p + i);
+        acc = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(v, acc, _CMP_LT_OQ), acc, v);
+    }
+
+    double lanes[8];
+    _mm512_storeu_pd(lanes, acc);
+    double ret = min_scalar(lanes, 8);
+    for (; i < n; ++i)
+    {
+        if (p[i] < ret)
+            ret = p[i];
+    }
+
+    return ret;
+}
+
+__attribute__((target("avx512f")))
+double max_avx512(const double* p, std::size_t n)
+{
+    if (n < 8)
+        return max_scalar(p, n);
+
+    __m512d acc = _mm512_loadu_pd(p);
+    std::size_t i = 8;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m512d v = _mm512_loadu_pd(p + i);
+        acc = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(acc, v, _CMP_LT_OQ), acc, v);
+    }
+
+    double lanes[8];
+    _mm512_storeu_pd(lanes, acc);
+    double ret = max_scalar(lanes, 8);
+    for (; i < n; ++i)
+    {
+        if (ret < p[i])
+            ret = p[i];
+    }
+
+    return ret;
+}
+
+__attribute__((target("avx512f")))
+inline __mmask8 compare_avx512(op_t op, __m512d a, __m512d b)
+{
+    switch (op)
+    {
+        case op_t::equal:
+            return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ);
+        case op_t::not_equal:
+            return _mm512_cmp_pd_mask(a, b, _CMP_NEQ_UQ);
+        case op_t::less:
+            return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ);
+        case op_t::less_equal:
+            return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ);
+        case op_t::greater:
+            return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ);
+        case op_t::greater_equal:
+            return _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ);
+        default:;
+    }
+
+    assert(!"not a relational operator");
+    return 0;
+}
+
+__attribute__((target("avx512f")))
+inline __m512d apply_avx512(op_t op, __m512d a, __m512d b)
+{
+    switch (op)
+    {
+        case op_t::add:
+            return _mm512_add_pd(a, b);
+        case op_t::subtract:
+            return _mm512_sub_pd(a, b);
+        case op_t::multiply:
+            return _mm512_mul_pd(a, b);
+        case op_t::divide:
+            return _mm512_div_pd(a, b);
+        default:;
+    }
+
+    return _mm512_maskz_mov_pd(compare_avx512(op, a, b), _mm512_set1_pd(1.0));
+}
+
+__attribute__((target("avx512f")))
+std::size_t count_if_avx512(const double* p, std::size_t n, op_t op, double v)
+{
+    if (!is_relational(op))
+        return count_if_generic(p, n, op, v);
+
+    const __m512d b = _mm512_set1_pd(v);
+    std::size_t ret = 0;
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        ret += __builtin_popcount(compare_avx512(op, _mm512_loadu_pd(p + i), b));
+
+    return ret + count_if_generic(p + i, n - i, op, v);
+}
+
+__attribute__((target("avx512f")))
+void transform_avx512(
+    op_t op, const double* p1, bool scalar1, const double* p2, bool scalar2, double* out, std::size_t n)
+{
+    const __m512d b1 = scalar1 ? _mm512_set1_pd(*p1) : _mm512_setzero_pd();
+    const __m512d b2 = scalar2 ? _mm512_set1_pd(*p2) : _mm512_setzero_pd();
+
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m512d a = scalar1 ? b1 : _mm512_loadu_pd(p1 + i);
+        __m512d b = scalar2 ? b2 : _mm512_loadu_pd(p2 + i);
+        _mm512_storeu_pd(out + i, apply_avx512(op, a, b));
+    }
+
+    for (; i < n; ++i)
+        out[i] = evaluate(op, scalar1 ? *p1 : p1[i], scalar2 ? *p2 : p2[i]);
+}
+
+#endif
+
+/**
+ * Kernel implementations for one instruction set.
+ */
+struct kernel_table
+{
+    isa_t isa;
+    double (*sum)(const double*, std::size_t);
+    double (*dot)(const double*, const double*, std::size_t);
+    double (*dot_deviations)(const double*, double, const double*, double, std::size_t);
+    double (*min)(const double*, std::size_t);
+    double (*max)(const double*, std::size_t);
+    std::size_t (*count_if)(const double*, std::size_t, op_t, double);
+    void (*transform)(op_t, const double*, bool, const double*, bool, double*, std::size_t);
+};
+
+kernel_table make_table()
+{
+#ifdef IXION_KERNEL_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f"))
+        return { isa_t::avx512, sum_avx512, dot_avx2, dot_deviations_avx2, min_avx512, max_avx512, count_if_avx512, transform_avx512 };
+
+    if (__builtin_cpu_supports("avx2"))
+        return { isa_t::avx2, sum_avx2, dot_avx2, dot_deviations_avx2, min_avx2, max_avx2, count_if_avx2, transform_avx2 };
+
+    if (__builtin_cpu_supports("sse2"))
+        return { isa_t::sse2, sum_sse2, dot_sse2, dot_deviations_sse2, min_sse2, max_sse2, count_if_sse2, transform_sse2 };
+#endif
+
+    return { isa_t::scalar, sum_scalar, dot_scalar, dot_deviations_scalar, min_scalar, max_scalar, count_if_generic, transform_scalar };
+}
+
+const kernel_table& get_table()
+{
+    static const kernel_table table = make_table();
+    return table;
+}
+
+} // anonymous namespace
+
+isa_t get_isa()
+{
+    return get_table().isa;
+}
+
+const char* get_isa_name(isa_t isa)
+{
+    switch (isa)
+    {
+        case isa_t::scalar:
+            return "scalar";
+        case isa_t::sse2:
+            return "sse2";
+        case isa_t::avx2:
+            return "avx2";
+        case isa_t::avx512:
+            return "avx512";
+    }
+
+    return "unknown";
+}
+
+double sum(const double* p, std::size_t n)
+{
+    return get_table().sum(p, n);
+}
+
+double sum_squares(const double* p, std::size_t n)
+{
+    return get_table().dot(p, p, n);
+}
+
+double dot(const double* p1, const double* p2, std::size_t n)
+{
+    return get_table().dot(p1, p2, n);
+}
+
+double sum_squared_deviations(const double* p, std::size_t n, double mean)
+{
+    return get_table().dot_deviations(p, mean, p, mean, n);
+}
+
+double dot_deviations(const double* p1, double mean1, const double* p2, double mean2, std::size_t n)
+{
+    return get_table().dot_deviations(p1, mean1, p2, mean2, n);
+}
+
+double min(const double* p, std::size_t n)
+{
+    return get_table().min(p, n);
+}
+
+double max(const double* p, std::size_t n)
+{
+    return get_table().max(p, n);
+}
+
+std::size_t count_if(const double* p, std::size_t n, op_t op, double v)
+{
+    return get_table().count_if(p, n, op, v);
+}
+
+double evaluate(op_t op, double v1, double v2)
+{
+    switch (op)
+    {
+        case op_t::add:
+            return v1 + v2;
+        case op_t::subtract:
+            return v1 - v2;
+        case op_t::multiply:
+            return v1 * v2;
+        case op_t::divide:
+            return v1 / v2;
+        case op_t::equal:
+            return v1 == v2;
+        case op_t::not_equal:
+            return v1 != v2;
+        case op_t::less:
+            return v1 < v2;
+        case op_t::less_equal:
+            return v1 <= v2;
+        case op_t::greater:
+            return v1 > v2;
+        case op_t::greater_equal:
+            return v1 >= v2;
+    }
+
+    return 0.0;
+}
+
+void transform(op_t op, const double* p1, const double* p2, double* out, std::size_t n)
+{
+    get_table().transform(op, p1, false, p2, false, out, n);
+}
+
+void transform(op_t op, const double* p1, double v2, double* out, std::size_t n)
+{
+    get_table().transform(op, p1, false, &v2, true, out, n);
+}
+
+void transform(op_t op, double v1, const double* p2, double* out, std::size_t n)
+{
+    get_table().transform(op, &v1, true, p2, false, out, n);
+}
+
+}}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,132 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_NUMERIC_KERNELS_HPP
+#define INCLUDED_IXION_NUMERIC_KERNELS_HPP
+
+#include <cstddef>
+
+/**
+ * Numeric kernels over contiguous arrays of double values.  Each kernel
+ * has a scalar implementation, and on x86 also SSE2, AVX2 and AVX-512
+ * implementations, one of which gets picked on first use based on what
+ * the CPU supports.
+ *
+ * <p>The kernels that add values up accumulate them in sixteen interleaved
+ * partial sums regardless of the implementation, and combine the partial
+ * sums in the same order.  This way, the results do not depend on the CPU
+ * the calculation runs on.</p>
+ */
+namespace ixion { namespace kernel {
+
+/**
+ * Instruction set of the kernel implementations in use.
+ */
+enum class isa_t
+{
+    scalar,
+    sse2,
+    avx2,
+    avx512
+};
+
+/**
+ * Element-wise operator.  Each relational operator results in either 1 or
+ * 0.
+ */
+enum class op_t
+{
+    add,
+    subtract,
+    multiply,
+    divide,
+    equal,
+    not_equal,
+    less,
+    less_equal,
+    greater,
+    greater_equal
+};
+
+/**
+ * @return instruction set of the kernel implementations in use.
+ */
+isa_t get_isa();
+
+/**
+ * @return name of the instruction set, for debugging purposes.
+ */
+const char* get_isa_name(isa_t isa);
+
+double sum(const double* p, std::size_t n);
+
+double sum_squares(const double* p, std::size_t n);
+
+/**
+ * @return sum of the products of the values at the same positions in two
+ *         arrays of the same length.
+ */
+double dot(const double* p1, const double* p2, std::size_t n);
+
+/**
+ * @return sum of the squared differences between the values in the array
+ *         and the passed mean value.
+ */
+double sum_squared_deviations(const double* p, std::size_t n, double mean);
+
+/**
+ * @return sum of the products of the differences between the values at the
+ *         same positions in two arrays and the mean value of each array.
+ */
+double dot_deviations(const double* p1, double mean1, const double* p2, double mean2, std::size_t n);
+
+/**
+ * @return smallest value in the array, which must not be empty.
+ */
+double min(const double* p, std::size_t n);
+
+/**
+ * @return largest value in the array, which must not be empty.
+ */
+double max(const double* p, std::size_t n);
+
+/**
+ * @return number of values in the array for which the relational operator
+ *         against the passed value is true.  An arithmetic operator counts
+ *         the values for which the result is not 0.
+ */
+std::size_t count_if(const double* p, std::size_t n, op_t op, double v);
+
+/**
+ * Apply an operator to a pair of values.
+ */
+double evaluate(op_t op, double v1, double v2);
+
+/**
+ * Apply an operator to each pair of values at the same positions in two
+ * arrays, and store the results in the output array, which may be the
+ * same as either of the input arrays.
+ */
+void transform(op_t op, const double* p1, const double* p2, double* out, std::size_t n);
+
+/**
+ * Apply an operator to each value in an array as its left-hand side
+ * operand, with the same right-hand side operand.
+ */
+void transform(op_t op, const double* p1, double v2, double* out, std::size_t n);
+
+/**
+ * Apply an operator to each value in an array as its right-hand side
+ * operand, with the same left-hand side operand.
+ */
+void transform(op_t op, double v1, const double* p2, double* out, std::size_t n);
+
+}}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,246 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_RANGE_CACHE_HPP
+#define INCLUDED_IXION_RANGE_CACHE_HPP
+
+#include <ixion/address.hpp>
+
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+namespace ixion { namespace detail {
+
+/**
+ * Key of a value cached for a range.  The tag tells apart the values
+ * derived from the same range in different ways, such as the results of
+ * matching different criteria against the range.
+ */
+struct range_cache_key
+{
+    abs_range_t range;
+    std::string tag;
+
+    bool operator== (const range_cache_key& other) const
+    {
+        return range == other.range && tag == other.tag;
+    }
+
+    struct hash
+    {
+        std::size_t operator() (const range_cache_key& key) const
+        {
+            return abs_range_t::hash{}(key.range) ^ (std::hash<std::string>{}(key.tag) << 1);
+        }
+    };
+};
+
+/**
+ * Cache of the values derived from the cells of ranges, which need to be
+ * dropped when any of the cells in their ranges changes.  The keys of the
+ * ranges within a single column are also filed under their column, so that
+ * dropping the values for a change to a cell only looks at the values of
+ * its column, and at the values of the ranges spanning multiple columns.
+ *
+ * <p>The total size of the cached values is capped.  Once it is reached,
+ * the new values are handed back without being cached.</p>
+ *
+ * <p>All methods are safe to call concurrently.</p>
+ */
+template<typename ValueT>
+class range_cache
+{
+public:
+    using value_ptr = std::shared_ptr<const ValueT>;
+
+    /**
+     * Constructor.
+     *
+     * @param max_size maximum total size in bytes of the cached values.
+     */
+    range_cache(std::size_t max_size) : m_max_size(max_size), m_size(0) {}
+
+    range_cache(const range_cache&) = delete;
+    range_cache& operator= (const range_cache&) = delete;
+
+    /**
+     * @return cached value for the key, or nullptr if none is cached.
+     */
+    value_ptr find(const range_cache_key& key) const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto it = m_entries.find(key);
+        return it == m_entries.end() ? nullptr : it->second.value;
+    }
+
+    /**
+     * Cache a value for a key, unless a value has already been cached for
+     * the same key meanwhile, or the cache is full.
+     *
+     * @param key key of the value.
+     * @param value value to cache.
+     * @param size size of the value in bytes.
+     *
+     * @return value cached for the key, or the value passed if it could not
+     *         be cached.
+     */
+    value_ptr insert(range_cache_key key, value_ptr value, std::size_t size)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+
+        if (auto it = m_entries.find(key); it != m_entries.end())
+            return it->second.value;
+
+        if (m_size + size > m_max_size)
+            return value;
+
+        if (is_single_column(key.range))
+            m_columns[{key.range.first.sheet, key.range.first.column}].insert(key);
+        else
+            m_wide_keys.insert(key);
+
+        m_size += size;
+        m_entries.emplace(std::move(key), entry{value, size});
+        return value;
+    }
+
+    /**
+     * Drop the values of the ranges that overlap with a range.
+     */
+    void erase_overlapping(const abs_range_t& range)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+
+        if (m_entries.empty())
+            return;
+
+        auto erase_keys = [this, &range](keys_type& keys)
+        {
+            for (auto it = keys.begin(); it != keys.end(); )
+            {
+                if (overlaps(it->range, range))
+                {
+                    erase_entry(*it);
+                    it = keys.erase(it);
+                }
+                else
+                    ++it;
+            }
+        };
+
+        for (sheet_t sheet = range.first.sheet; sheet <= range.last.sheet; ++sheet)
+        {
+            auto it = m_columns.lower_bound({sheet, range.first.column});
+            auto it_end = m_columns.upper_bound({sheet, range.last.column});
+
+            while (it != it_end)
+            {
+                erase_keys(it->second);
+                it = it->second.empty() ? m_columns.erase(it) : std::next(it);
+            }
+        }
+
+        erase_keys(m_wide_keys);
+    }
+
+    /**
+     * Drop the values that satisfy a predicate.
+     */
+    template<typename PredT>
+    void erase_if(PredT pred)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+
+        for (auto it = m_entries.begin(); it != m_entries.end(); )
+        {
+            if (!pred(*it->second.value))
+            {
+                ++it;
+                continue;
+            }
+
+            const range_cache_key& key = it->first;
+            if (is_single_column(key.range))
+            {
+                auto it_col = m_columns.find({key.range.first.sheet, key.range.first.column});
+                it_col->second.erase(key);
+                if (it_col->second.empty())
+                    m_columns.erase(it_col);
+            }
+            else
+                m_wide_keys.erase(key);
+
+            m_size -= it->second.size;
+            it = m_entries.erase(it);
+        }
+    }
+
+    /**
+     * Drop all values.
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_entries.clear();
+        m_columns.clear();
+        m_wide_keys.clear();
+        m_size = 0;
+    }
+
+private:
+    using keys_type = std::unordered_set<range_cache_key, range_cache_key::hash>;
+
+    struct entry
+    {
+        value_ptr value;
+        std::size_t size;
+    };
+
+    static bool is_single_column(const abs_range_t& range)
+    {
+        return range.first.sheet == range.last.sheet && range.first.column == range.last.column;
+    }
+
+    static bool overlaps(const abs_range_t& range1, const abs_range_t& range2)
+    {
+        return range1.first.sheet <= range2.last.sheet && range2.first.sheet <= range1.last.sheet
+            && range1.first.row <= range2.last.row && range2.first.row <= range1.last.row
+            && range1.first.column <= range2.last.column && range2.first.column <= range1.last.column;
+    }
+
+    void erase_entry(const range_cache_key& key)
+    {
+        auto it = m_entries.find(key);
+        m_size -= it->second.size;
+        m_entries.erase(it);
+    }
+
+    const std::size_t m_max_size;
+
+    mutable std::mutex m_mtx;
+    std::unordered_map<range_cache_key, entry, range_cache_key::hash> m_entries;
+
+    /** keys of the ranges within a single column of a single sheet, by the sheet and the column. */
+    std::map<std::pair<sheet_t, col_t>, keys_type> m_columns;
+
+    /** keys of the ranges spanning multiple columns or sheets. */
+    keys_type m_wide_keys;
+
+    std::size_t m_size;
+};
+
+}}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
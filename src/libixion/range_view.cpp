@@ -0,0 +1,115 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "range_view.hpp"
+#include "model_context_impl.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace ixion { namespace detail {
+
+range_view::block::block() : m_column(0), m_row(0), m_size(0) {}
+
+range_view::const_iterator::const_iterator() : mp_view(nullptr) {}
+
+range_view::const_iterator::const_iterator(const range_view* view, col_t col, row_t row) :
+    mp_view(view)
+{
+    seek(col, row);
+}
+
+void range_view::const_iterator::seek(col_t col, row_t row)
+{
+    const abs_range_t& range = mp_view->m_range;
+    const column_stores_t* columns = mp_view->mp_columns;
+
+    col_t col_end = columns ? std::min<col_t>(range.last.column + 1, columns->size()) : 0;
+
+    for (; col < col_end; ++col, row = range.first.row)
+    {
+        const column_store_t& store = (*columns)[col];
+
+        while (row <= range.last.row)
+        {
+            auto pos = store.position(row);
+            auto blk = pos.first;
+            assert(blk->size > pos.second);
+            std::size_t remaining = blk->size - pos.second;
+
+            if (blk->type == element_type_empty)
+            {
+                row += remaining;
+                continue;
+            }
+
+            m_block.m_column = col;
+            m_block.m_row = row;
+            m_block.m_size = std::min<std::size_t>(remaining, range.last.row - row + 1);
+            m_block.m_node = column_block_shape_t(
+                blk->position, blk->size, pos.second, map_column_block_type(blk->type), blk->data);
+            return;
+        }
+    }
+
+    // End position.
+    m_block = block();
+    m_block.m_column = range.last.column + 1;
+    m_block.m_row = range.first.row;
+}
+
+range_view::const_iterator& range_view::const_iterator::operator++()
+{
+    seek(m_block.m_column, m_block.m_row + m_block.m_size);
+    return *this;
+}
+
+bool range_view::const_iterator::operator==(const const_iterator& r) const
+{
+    return mp_view == r.mp_view && m_block.m_column == r.m_block.m_column && m_block.m_row == r.m_block.m_row;
+}
+
+bool range_view::const_iterator::operator!=(const const_iterator& r) const
+{
+    return !operator==(r);
+}
+
+range_view::range_view(const model_context_impl& cxt, const abs_range_t& range) :
+    mp_columns(cxt.get_columns(range.first.sheet)),
+    m_range(cxt.clip_to_data_extent(range))
+{
+    assert(range.first.sheet == range.last.sheet);
+}
+
+const abs_range_t& range_view::get_range() const
+{
+    return m_range;
+}
+
+std::size_t range_view::row_size() const
+{
+    return m_range.last.row - m_range.first.row + 1;
+}
+
+std::size_t range_view::col_size() const
+{
+    return m_range.last.column - m_range.first.column + 1;
+}
+
+range_view::const_iterator range_view::begin() const
+{
+    return const_iterator(this, m_range.first.column, m_range.first.row);
+}
+
+range_view::const_iterator range_view::end() const
+{
+    return const_iterator(this, m_range.last.column + 1, m_range.first.row);
+}
+
+}}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,137 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_RANGE_VIEW_HPP
+#define INCLUDED_IXION_RANGE_VIEW_HPP
+
+#include "utils.hpp"
+
+#include <ixion/address.hpp>
+
+#include <iterator>
+
+namespace ixion { namespace detail {
+
+class model_context_impl;
+
+/**
+ * Read-only view of the cells of a range within a single sheet.  It
+ * iterates over the segments of the column blocks that overlap with the
+ * range, one column at a time from top to bottom, and exposes the values
+ * of each segment as a typed span directly over the column store without
+ * copying them.  The empty blocks get skipped.
+ *
+ * <p>A range that spans all rows or all columns is clipped to the data
+ * extent of the sheet.  The view is only valid until any of the cells in
+ * the sheet changes.</p>
+ */
+class range_view
+{
+public:
+    /**
+     * Segment of a column block that overlaps with the range.
+     */
+    class block
+    {
+        friend class range_view;
+
+        col_t m_column;
+        row_t m_row;
+        std::size_t m_size;
+        column_block_shape_t m_node;
+
+    public:
+        block();
+
+        /** @return column of the segment. */
+        col_t column() const { return m_column; }
+
+        /** @return first row of the segment. */
+        row_t row() const { return m_row; }
+
+        /** @return number of the cells in the segment. */
+        std::size_t size() const { return m_size; }
+
+        column_block_t type() const { return m_node.type; }
+
+        /**
+         * Get the values of the segment as a typed span.  The numeric
+         * values, the string identifiers and the formula cells are
+         * contiguous arrays.
+         *
+         * @return range of the values, which is only valid when the
+         *         segment is of the specified block type.
+         */
+        template<column_block_t BlockT>
+        auto values() const
+        {
+            return make_element_range<BlockT>{}(m_node, m_size);
+        }
+    };
+
+    class const_iterator
+    {
+        friend class range_view;
+
+        const range_view* mp_view;
+        block m_block;
+
+        const_iterator(const range_view* view, col_t col, row_t row);
+
+        /**
+         * Move to the first non-empty block at or after the current
+         * position, or to the end position.
+         */
+        void seek(col_t col, row_t row);
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = block;
+        using pointer = const block*;
+        using reference = const block&;
+        using difference_type = std::ptrdiff_t;
+
+        const_iterator();
+
+        const block& operator*() const { return m_block; }
+        const block* operator->() const { return &m_block; }
+
+        const_iterator& operator++();
+
+        bool operator==(const const_iterator& r) const;
+        bool operator!=(const const_iterator& r) const;
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param cxt model context to get the columns from.
+     * @param range range to view, which must be within a single sheet.
+     */
+    range_view(const model_context_impl& cxt, const abs_range_t& range);
+
+    /**
+     * @return range of the view, clipped to the sheet or to its data extent.
+     */
+    const abs_range_t& get_range() const;
+
+    std::size_t row_size() const;
+    std::size_t col_size() const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+private:
+    const column_stores_t* mp_columns;
+    abs_range_t m_range;
+};
+
+}}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
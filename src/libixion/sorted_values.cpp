@@ -0,0 +1,71 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "sorted_values.hpp"
+#include "model_context_impl.hpp"
+#include "range_view.hpp"
+
+#include <ixion/formula_result.hpp>
+
+#include <algorithm>
+
+namespace ixion { namespace detail {
+
+sorted_values sort_range_values(const model_context_impl& cxt, const abs_range_t& range)
+{
+    const formula_result_wait_policy_t wait_policy = cxt.get_formula_result_wait_policy();
+
+    sorted_values ret;
+    std::vector<double>& values = ret.values;
+
+    for (const range_view::block& blk : range_view(cxt, range))
+    {
+        switch (blk.type())
+        {
+            case column_block_t::numeric:
+            {
+                auto blk_values = blk.values<column_block_t::numeric>();
+                values.insert(values.end(), blk_values.begin(), blk_values.end());
+                break;
+            }
+            case column_block_t::boolean:
+            {
+                for (bool b : blk.values<column_block_t::boolean>())
+                    values.push_back(b ? 1.0 : 0.0);
+                break;
+            }
+            case column_block_t::formula:
+            {
+                ret.has_formula = true;
+
+                for (const formula_cell* fc : blk.values<column_block_t::formula>())
+                {
+                    formula_result res = fc->get_result_cache(wait_policy);
+                    switch (res.get_type())
+                    {
+                        case formula_result::result_type::boolean:
+                            values.push_back(res.get_boolean() ? 1.0 : 0.0);
+                            break;
+                        case formula_result::result_type::value:
+                            values.push_back(res.get_value());
+                            break;
+                        default:;
+                    }
+                }
+                break;
+            }
+            default:;
+        }
+    }
+
+    std::sort(values.begin(), values.end());
+    return ret;
+}
+
+}}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
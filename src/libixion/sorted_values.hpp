@@ -0,0 +1,48 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_SORTED_VALUES_HPP
+#define INCLUDED_IXION_SORTED_VALUES_HPP
+
+#include <ixion/address.hpp>
+
+#include <vector>
+
+namespace ixion { namespace detail {
+
+class model_context_impl;
+
+/**
+ * Numeric values of the cells of a range sorted in ascending order, for
+ * the order statistics of the range such as its median, its k-th largest
+ * value, or the rank of a value in it.
+ *
+ * <p>The values are collected the same way as the statistical functions
+ * collect the values of a range argument.  Boolean values count as 1 or
+ * 0, while strings, empty cells and error values get skipped.</p>
+ */
+struct sorted_values
+{
+    std::vector<double> values;
+
+    /** whether the range contains a formula cell. */
+    bool has_formula = false;
+};
+
+/**
+ * Collect and sort the numeric values of the cells of a range.
+ *
+ * @param cxt model context to get the values of the cells from.
+ * @param range range within a single sheet.
+ */
+sorted_values sort_range_values(const model_context_impl& cxt, const abs_range_t& range);
+
+}}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
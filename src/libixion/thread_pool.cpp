@@ -0,0 +1,195 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "thread_pool.hpp"
+
+#include <cassert>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdexcept>
+
+#if !IXION_THREADS
+#error "This file is not to be compiled when the threads are disabled."
+#endif
+
+namespace ixion { namespace detail {
+
+namespace {
+
+/**
+ * Pool that the current thread works for, or nullptr if the current thread
+ * is not a worker thread.
+ */
+thread_local const void* tl_owner_pool = nullptr;
+
+/**
+ * Index of the current worker thread within its pool.
+ */
+thread_local size_t tl_worker_index = 0;
+
+struct worker_queue
+{
+    std::mutex mtx;
+    std::deque<thread_pool::task_type> tasks;
+};
+
+} // anonymous namespace
+
+struct thread_pool::impl
+{
+    std::vector<worker_queue> m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mtx;
+    std::condition_variable m_cond;
+
+    /** number of tasks that have been submitted but not yet picked up. */
+    std::atomic<size_t> m_pending;
+
+    /** position of the next queue to receive an externally submitted task. */
+    std::atomic<size_t> m_next_queue;
+
+    bool m_shutdown;
+
+    impl(size_t thread_count) :
+        m_queues(thread_count),
+        m_pending(0),
+        m_next_queue(0),
+        m_shutdown(false)
+    {
+        if (!thread_count)
+            throw std::invalid_argument("thread count must be greater than zero.");
+
+        m_threads.reserve(thread_count);
+        for (size_t i = 0; i < thread_count; ++i)
+            m_threads.emplace_back(&impl::run_worker, this, i);
+    }
+
+    ~impl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_shutdown = true;
+        }
+
+        m_cond.notify_all();
+
+        for (std::thread& t : m_threads)
+            t.join();
+    }
+
+    void submit(task_type task)
+    {
+        size_t pos = tl_owner_pool == this ?
+            tl_worker_index : m_next_queue.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+
+        {
+            // Increment the counter while holding the mutex so that no
+            // worker misses this task between its last check and its wait.
+            std::lock_guard<std::mutex> lock(m_mtx);
+            ++m_pending;
+        }
+
+        {
+            worker_queue& q = m_queues[pos];
+            std::lock_guard<std::mutex> lock(q.mtx);
+            q.tasks.push_back(std::move(task));
+        }
+
+        m_cond.notify_one();
+    }
+
+    /**
+     * Pop a task from the back of the worker's own queue.
+     */
+    bool pop_local(size_t index, task_type& task)
+    {
+        worker_queue& q = m_queues[index];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (q.tasks.empty())
+            return false;
+
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        return true;
+    }
+
+    /**
+     * Steal a task from the front of another worker's queue.
+     */
+    bool steal(size_t index, task_type& task)
+    {
+        for (size_t i = 1, n = m_queues.size(); i < n; ++i)
+        {
+            worker_queue& q = m_queues[(index + i) % n];
+            std::unique_lock<std::mutex> lock(q.mtx, std::try_to_lock);
+            if (!lock.owns_lock() || q.tasks.empty())
+                continue;
+
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            return true;
+        }
+
+        return false;
+    }
+
+    void run_worker(size_t index)
+    {
+        tl_owner_pool = this;
+        tl_worker_index = index;
+
+        while (true)
+        {
+            task_type task;
+
+            if (pop_local(index, task) || steal(index, task))
+            {
+                --m_pending;
+                task();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cond.wait(lock, [this] { return m_shutdown || m_pending.load() > 0; });
+
+            if (m_shutdown && !m_pending.load())
+                break;
+        }
+    }
+};
+
+thread_pool::thread_pool(size_t thread_count) :
+    mp_impl(std::make_unique<impl>(thread_count)) {}
+
+thread_pool::~thread_pool() = default;
+
+void thread_pool::submit(task_type task)
+{
+    mp_impl->submit(std::move(task));
+}
+
+size_t thread_pool::size() const
+{
+    return mp_impl->m_threads.size();
+}
+
+std::optional<size_t> thread_pool::get_current_worker_index() const
+{
+    if (tl_owner_pool != mp_impl.get())
+        return {};
+
+    return tl_worker_index;
+}
+
+}}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,77 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_THREAD_POOL_HPP
+#define INCLUDED_IXION_THREAD_POOL_HPP
+
+#include <functional>
+#include <memory>
+#include <optional>
+
+namespace ixion { namespace detail {
+
+/**
+ * Pool of long-lived worker threads.  Each worker owns its own task deque;
+ * a worker takes tasks from the back of its own deque, and steals from the
+ * front of the other workers' deques when its own deque runs empty.
+ *
+ * Tasks submitted from outside the pool are distributed to the workers in
+ * a round-robin fashion, while tasks submitted from within a worker thread
+ * go to that worker's own deque.
+ */
+class thread_pool
+{
+    struct impl;
+    std::unique_ptr<impl> mp_impl;
+
+public:
+    using task_type = std::function<void()>;
+
+    thread_pool() = delete;
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator= (const thread_pool&) = delete;
+
+    /**
+     * Constructor.
+     *
+     * @param thread_count number of worker threads to launch.  It must be
+     *                     greater than zero.
+     */
+    thread_pool(size_t thread_count);
+
+    /**
+     * The destructor waits for all submitted tasks to finish before
+     * joining the worker threads.
+     */
+    ~thread_pool();
+
+    /**
+     * Submit a task for execution.  The task must not throw; the caller is
+     * responsible for catching and transporting any exception that may be
+     * thrown from within the task.
+     *
+     * @param task task to execute on one of the worker threads.
+     */
+    void submit(task_type task);
+
+    /**
+     * @return number of worker threads in this pool.
+     */
+    size_t size() const;
+
+    /**
+     * @return index of the calling thread among the worker threads of this
+     *         pool, or nothing if the calling thread is not one of them.
+     */
+    std::optional<size_t> get_current_worker_index() const;
+};
+
+}}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -67,6 +67,12 @@ std::vector<std::size_t> calc_utf8_byte_positions(const std::string& s)
     return positions;
 }
 
+std::size_t calc_utf8_char_length(char c1)
+{
+    uint8_t n = calc_utf8_byte_length(c1);
+    return n == invalid_utf8_byte_length ? 1 : n;
+}
+
 }}
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
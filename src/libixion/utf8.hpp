@@ -22,6 +22,16 @@ namespace ixion { namespace detail {
  */
 std::vector<std::size_t> calc_utf8_byte_positions(const std::string& s);
 
+/**
+ * Obtains the byte length of a unicode character from its first byte.
+ *
+ * @param c1 first byte of the character encoded in utf-8.
+ *
+ * @return byte length of the character, or 1 if the byte is not a valid
+ *         first byte.
+ */
+std::size_t calc_utf8_char_length(char c1);
+
 }}
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -9,6 +9,7 @@
 #include <ixion/exceptions.hpp>
 #include <ixion/formula_result.hpp>
 
+#include <map>
 #include <sstream>
 
 namespace ixion { namespace detail {
@@ -65,6 +66,31 @@ cell_value_t to_cell_value_type(
     return cell_value_t::unknown;
 }
 
+column_block_t map_column_block_type(const mdds::mtv::element_t mtv_type)
+{
+    static const std::map<mdds::mtv::element_t, column_block_t> rules = {
+        { element_type_empty, column_block_t::empty }, // -1
+        { element_type_boolean, column_block_t::boolean }, // 0
+        { element_type_string, column_block_t::string }, // 6
+        { element_type_numeric, column_block_t::numeric }, // 10
+        { element_type_formula, column_block_t::formula }, // user-start (50)
+    };
+
+    auto it = rules.find(mtv_type);
+    return it == rules.end() ? column_block_t::unknown : it->second;
+}
+
+std::size_t get_column_data_size(const column_store_t& store)
+{
+    if (!store.block_size())
+        return 0;
+
+    auto it = store.end();
+    --it;
+
+    return it->type == element_type_empty ? it->position : store.size();
+}
+
 }}
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -17,9 +17,16 @@ namespace ixion { namespace detail {
 
 cell_t to_celltype(mdds::mtv::element_t mtv_type);
 
+column_block_t map_column_block_type(const mdds::mtv::element_t mtv_type);
+
 cell_value_t to_cell_value_type(
     const column_store_t::const_position_type& pos, formula_result_wait_policy_t policy);
 
+/**
+ * @return number of rows of a column up to its last non-empty row.
+ */
+std::size_t get_column_data_size(const column_store_t& store);
+
 template<std::size_t S, typename T>
 void ensure_max_size(const T& v)
 {
@@ -102,6 +109,20 @@ struct make_element_range<column_block_t::formula>
     }
 };
 
+template<>
+struct make_element_range<column_block_t::string>
+{
+    const_element_block_range<string_id_t> operator()(const column_block_shape_t& node, std::size_t length) const
+    {
+        const auto* blk = reinterpret_cast<const string_element_block*>(node.data);
+        const string_id_t* p = &string_element_block::at(*blk, node.offset);
+        length = std::min(node.size - node.offset, length);
+        const string_id_t* p_end = p + length;
+
+        return {p, p_end};
+    }
+};
+
 // TODO : add specialization for the other block types as needed.
 
 }}
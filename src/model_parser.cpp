@@ -448,6 +448,27 @@ void model_parser::parse_session()
 
         std::cout << "current sheet: " << value << std::endl;
     }
+    else if (cmd == "max-iterations")
+    {
+        config cfg = m_context.get_config();
+        cfg.max_iterations = to_long(value);
+        m_context.set_config(cfg);
+        std::cout << "max iterations: " << cfg.max_iterations << std::endl;
+    }
+    else if (cmd == "iteration-epsilon")
+    {
+        config cfg = m_context.get_config();
+        cfg.iteration_epsilon = to_double(value);
+        m_context.set_config(cfg);
+        std::cout << "iteration epsilon: " << cfg.iteration_epsilon << std::endl;
+    }
+    else if (cmd == "aggregate-index")
+    {
+        config cfg = m_context.get_config();
+        cfg.aggregate_index = to_bool(value);
+        m_context.set_config(cfg);
+        std::cout << "aggregate index: " << cfg.aggregate_index << std::endl;
+    }
     else if (cmd == "display-sheet-name")
     {
         std::cout << "display sheet name: " << value << std::endl;
@@ -717,6 +738,7 @@ void model_parser::push_table()
 
     std::cout << "totals row count: " << mp_table_entry->totals_row_count << std::endl;
     m_table_handler.insert(mp_table_entry);
+    m_context.notify(formula_event_t::table_definitions_changed);
     assert(!mp_table_entry);
 }
 
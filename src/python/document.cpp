@@ -17,6 +17,7 @@
 #include <vector>
 #include <algorithm>
 #include <sstream>
+#include <exception>
 
 using namespace std;
 
@@ -85,6 +86,9 @@ PyObject* document_append_sheet(pyobj_document* self, PyObject* args)
 
     assert(sheet_name);
 
+    if (!check_document_modifiable(self->m_data->m_global))
+        return nullptr;
+
     PyTypeObject* sheet_type = get_sheet_type();
     if (!sheet_type)
         return nullptr;
@@ -147,6 +151,11 @@ const char* doc_document_calculate =
 "\n"
 "threads -- number of threads to use besides the main thread, or 0 if all\n"
 "           calculations are to be performed on the main thread. (default 0)\n"
+"\n"
+"The calculation does not hold the global interpreter lock, which allows it\n"
+"to run on a separate Python thread without blocking the other threads.\n"
+"Any attempt to modify or calculate the document until the calculation\n"
+"finishes raises a DocumentError.\n"
 ;
 
 PyObject* document_calculate(pyobj_document* self, PyObject* args, PyObject* kwargs)
@@ -163,10 +172,34 @@ PyObject* document_calculate(pyobj_document* self, PyObject* args, PyObject* kwa
 
     document_global& dg = self->m_data->m_global;
 
+    if (!check_document_modifiable(dg))
+        return nullptr;
+
     // Query additional dirty formula cells and add them to the current set.
     std::vector<abs_range_t> sorted = ixion::query_and_sort_dirty_cells(
         dg.m_cxt, dg.m_modified_cells, &dg.m_dirty_formula_cells);
-    ixion::calculate_sorted_cells(dg.m_cxt, sorted, threads);
+
+    // Release the GIL during the calculation so that the other Python
+    // threads can keep running.  Any exception must not leave this block
+    // before the GIL gets re-acquired.
+    std::exception_ptr calc_error;
+    dg.m_calculating = true;
+
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        ixion::calculate_sorted_cells(dg.m_cxt, sorted, threads);
+    }
+    catch (...)
+    {
+        calc_error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+
+    dg.m_calculating = false;
+
+    if (calc_error)
+        std::rethrow_exception(calc_error);
 
     dg.m_modified_cells.clear();
     dg.m_dirty_formula_cells.clear();
@@ -175,6 +208,23 @@ PyObject* document_calculate(pyobj_document* self, PyObject* args, PyObject* kwa
     return Py_None;
 }
 
+/**
+ * Test hook to mark the document as being calculated, so that the tests can
+ * check the rejection of the changes during a calculation without racing
+ * against a real one.
+ */
+PyObject* document_set_calculating(pyobj_document* self, PyObject* arg)
+{
+    int calculating = PyObject_IsTrue(arg);
+    if (calculating < 0)
+        return nullptr;
+
+    self->m_data->m_global.m_calculating = calculating != 0;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
 PyObject* document_get_sheet(pyobj_document* self, PyObject* arg)
 {
     const vector<PyObject*>& sheets = self->m_data->m_sheets;
@@ -250,6 +300,7 @@ PyMethodDef document_methods[] =
     { "append_sheet", (PyCFunction)document_append_sheet, METH_VARARGS, "append new sheet to the document" },
     { "calculate", (PyCFunction)document_calculate, METH_VARARGS | METH_KEYWORDS, doc_document_calculate },
     { "get_sheet", (PyCFunction)document_get_sheet, METH_O, "get a sheet object either by index or name" },
+    { "_set_calculating", (PyCFunction)document_set_calculating, METH_O, "for testing only" },
     { nullptr }
 };
 
@@ -12,10 +12,23 @@ namespace ixion { namespace python {
 
 document_global::document_global() :
     m_cxt(),
-    m_resolver(ixion::formula_name_resolver::get(formula_name_resolver_t::excel_a1, &m_cxt))
+    m_resolver(ixion::formula_name_resolver::get(formula_name_resolver_t::excel_a1, &m_cxt)),
+    m_calculating(false)
 {
 }
 
+bool check_document_modifiable(const document_global& dg)
+{
+    if (dg.m_calculating)
+    {
+        PyErr_SetString(get_python_document_error(),
+            "The document cannot be modified while it is being calculated.");
+        return false;
+    }
+
+    return true;
+}
+
 PyObject* get_python_document_error()
 {
     static PyObject* p = PyErr_NewException(const_cast<char*>("ixion.DocumentError"), NULL, NULL);
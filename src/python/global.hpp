@@ -31,9 +31,25 @@ struct document_global
 
     std::unique_ptr<formula_name_resolver> m_resolver;
 
+    /**
+     * whether or not a calculation is currently running on this document.
+     * This flag is only accessed while holding the global interpreter lock.
+     */
+    bool m_calculating;
+
     document_global();
 };
 
+/**
+ * Check whether or not the document can be modified.  When a calculation is
+ * in progress, it sets a DocumentError and returns false.
+ *
+ * @param dg document to check.
+ *
+ * @return true if the document can be modified, false otherwise.
+ */
+bool check_document_modifiable(const document_global& dg);
+
 PyObject* get_python_document_error();
 PyObject* get_python_sheet_error();
 PyObject* get_python_formula_error();
@@ -95,6 +95,9 @@ PyObject* sheet_set_numeric_cell(sheet* self, PyObject* args, PyObject* kwargs)
         return nullptr;
     }
 
+    if (!check_document_modifiable(*sd->m_global))
+        return nullptr;
+
     ixion::model_context& cxt = sd->m_global->m_cxt;
     ixion::abs_address_t pos(sd->m_sheet_index, row, col);
     sd->m_global->m_modified_cells.insert(pos);
@@ -122,6 +125,9 @@ PyObject* sheet_set_string_cell(sheet* self, PyObject* args, PyObject* kwargs)
         return nullptr;
     }
 
+    if (!check_document_modifiable(*sd->m_global))
+        return nullptr;
+
     ixion::model_context& cxt = sd->m_global->m_cxt;
     ixion::abs_address_t pos(sd->m_sheet_index, row, col);
     sd->m_global->m_modified_cells.insert(pos);
@@ -149,6 +155,9 @@ PyObject* sheet_set_formula_cell(sheet* self, PyObject* args, PyObject* kwargs)
         return nullptr;
     }
 
+    if (!check_document_modifiable(*sd->m_global))
+        return nullptr;
+
     ixion::model_context& cxt = sd->m_global->m_cxt;
 
     ixion::abs_address_t pos(sd->m_sheet_index, row, col);
@@ -284,6 +293,9 @@ PyObject* sheet_empty_cell(sheet* self, PyObject* args, PyObject* kwargs)
         return nullptr;
     }
 
+    if (!check_document_modifiable(*sd->m_global))
+        return nullptr;
+
     ixion::model_context& cxt = sd->m_global->m_cxt;
     abs_address_t pos(sd->m_sheet_index, row, col);
     sd->m_global->m_modified_cells.insert(pos);
@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 
 import unittest
+import threading
 import ixion
 
 
@@ -237,6 +238,64 @@ class DocumentTest(unittest.TestCase):
         except ixion.SheetError:
             pass # expected
 
+    def test_modify_during_calculation(self):
+        # Modifying or re-calculating the document while it is being
+        # calculated on another thread must raise an error.  Mark the
+        # document as being calculated via the test hook, rather than racing
+        # against a real calculation running in the background.
+        sh1 = self.doc.append_sheet("Data")
+        sh1.set_numeric_cell(0, 0, 1)
+        sh1.set_formula_cell(1, 0, "A1+1")
+
+        self.doc._set_calculating(True)
+
+        with self.assertRaises(ixion.DocumentError):
+            sh1.set_numeric_cell(0, 1, 1)
+        with self.assertRaises(ixion.DocumentError):
+            sh1.set_string_cell(0, 1, "text")
+        with self.assertRaises(ixion.DocumentError):
+            sh1.set_formula_cell(0, 1, "A1")
+        with self.assertRaises(ixion.DocumentError):
+            sh1.empty_cell(0, 1)
+        with self.assertRaises(ixion.DocumentError):
+            self.doc.append_sheet("Other")
+        with self.assertRaises(ixion.DocumentError):
+            self.doc.calculate()
+
+        self.doc._set_calculating(False)
+
+        # Nothing has been changed by the rejected calls.
+        self.assertEqual(("Data",), self.doc.sheet_names)
+        self.assertEqual(0.0, sh1.get_numeric_value(0, 1))
+
+        # The document can be modified and calculated again once the
+        # calculation is done.
+        sh1.set_numeric_cell(0, 0, 2)
+        self.doc.calculate()
+        self.assertEqual(3.0, sh1.get_numeric_value(1, 0))
+
+    def test_calculate_on_other_thread(self):
+        # The calculation releases the GIL, so it can run on another thread.
+        sh1 = self.doc.append_sheet("Data")
+        n = 3000
+        sh1.set_numeric_cell(0, 0, 1)
+        for row in range(1, n):
+            sh1.set_formula_cell(row, 0, "A{}+1".format(row))
+
+        errors = []
+
+        def calculate():
+            try:
+                self.doc.calculate()
+            except Exception as e:
+                errors.append(e)
+
+        t = threading.Thread(target=calculate)
+        t.start()
+        t.join()
+
+        self.assertEqual([], errors)
+        self.assertEqual(float(n), sh1.get_numeric_value(n-1, 0))
 
 if __name__ == '__main__':
     unittest.main()